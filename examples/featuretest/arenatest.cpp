@@ -0,0 +1,74 @@
+/*
+ *  arenatest.cpp
+ *  BEAGLE
+ *
+ *  Checks that moving buffers out of and back into the memory arena leaves
+ *  log likelihoods unchanged, also with a restore point and with scale
+ *  buffers widened for mixed precision, and when the arena is reserved again
+ *  from the hugetlbfs pool.
+ *
+ */
+
+#include "featuretest.h"
+
+static void checkArena(int stateCount,
+                       long requirementFlags) {
+    int instance = createTestInstance(stateCount, 301, 0, NODE_COUNT - 1, 0, requirementFlags, true);
+    updateMatrices(instance, edgeLengths);
+    double logL = calculateRootLogLikelihood(instance, true);
+
+    checkCode("separate buffers", beagleSetCPUBufferArena(instance, 0), BEAGLE_SUCCESS);
+    check("separate buffers logL", rootLogLikelihood(instance, true), logL, 0.0);
+    check("recomputed logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+    checkCode("arena buffers", beagleSetCPUBufferArena(instance, 1), BEAGLE_SUCCESS);
+    check("arena buffers logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+
+    // Buffers saved at a restore point stay where they are
+    beagleStoreSnapshot(instance);
+    beagleSetCPUBufferArena(instance, 0);
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = 2.0 * edgeLengths[i];
+    updateMatrices(instance, lengths);
+    calculateRootLogLikelihood(instance, true);
+    beagleRestoreSnapshot(instance);
+    check("restored logL", rootLogLikelihood(instance, true), logL, 0.0);
+    beagleSetCPUBufferArena(instance, 1);
+    check("restored arena logL", rootLogLikelihood(instance, true), logL, 0.0);
+    beagleReleaseSnapshot(instance);
+
+    // The block is reserved again from the hugetlbfs pool, or stays in normal pages
+    // where too few huge pages are reserved
+    checkCode("unknown arena mode", beagleSetCPUBufferArena(instance, 3), BEAGLE_ERROR_OUT_OF_RANGE);
+    beagleStoreSnapshot(instance);
+    updateMatrices(instance, lengths);
+    calculateRootLogLikelihood(instance, true);
+    int code = beagleSetCPUBufferArena(instance, 2);
+    checkCount("hugetlbfs arena", code == BEAGLE_SUCCESS || code == BEAGLE_ERROR_OUT_OF_MEMORY ||
+               code == BEAGLE_ERROR_NO_IMPLEMENTATION, 1);
+    beagleRestoreSnapshot(instance);
+    check("restored hugetlbfs arena logL", rootLogLikelihood(instance, true), logL, 0.0);
+    beagleReleaseSnapshot(instance);
+    check("hugetlbfs arena logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+    checkCode("normal pages again", beagleSetCPUBufferArena(instance, 1), BEAGLE_SUCCESS);
+    check("normal pages logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+
+    if (stateCount != 4 && (requirementFlags & BEAGLE_FLAG_PRECISION_SINGLE)) {
+        checkCode("mixed precision", beagleSetCPUMixedPrecision(instance, 1), BEAGLE_SUCCESS);
+        double mixedLogL = calculateRootLogLikelihood(instance, true);
+        beagleSetCPUBufferArena(instance, 0);
+        check("mixed separate buffers logL", calculateRootLogLikelihood(instance, true), mixedLogL, 0.0);
+        beagleSetCPUBufferArena(instance, 1);
+        check("mixed arena buffers logL", calculateRootLogLikelihood(instance, true), mixedLogL, 0.0);
+    }
+
+    beagleFinalizeInstance(instance);
+}
+
+int main(int argc, const char* argv[]) {
+    checkArena(4, BEAGLE_FLAG_PRECISION_DOUBLE);
+    checkArena(20, BEAGLE_FLAG_PRECISION_DOUBLE);
+    checkArena(20, BEAGLE_FLAG_PRECISION_SINGLE);
+
+    return failureCount;
+}
@@ -0,0 +1,98 @@
+/*
+ *  edgederivstest.cpp
+ *  BEAGLE
+ *
+ *  Checks that log likelihoods and derivatives of several edges computed in
+ *  one call match those of one edge at a time.
+ *
+ */
+
+#include "featuretest.h"
+
+#define EDGE_COUNT 5
+
+// First and second derivatives of matrix i are matrices FIRST_DERIVATIVE + i
+// and SECOND_DERIVATIVE + i
+#define FIRST_DERIVATIVE (NODE_COUNT - 1)
+#define SECOND_DERIVATIVE (2 * (NODE_COUNT - 1))
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, 500, 0, 3 * (NODE_COUNT - 1), 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    int matrixIndices[NODE_COUNT - 1];
+    int firstDerivativeIndices[NODE_COUNT - 1];
+    int secondDerivativeIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++) {
+        matrixIndices[i] = i;
+        firstDerivativeIndices[i] = FIRST_DERIVATIVE + i;
+        secondDerivativeIndices[i] = SECOND_DERIVATIVE + i;
+    }
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, firstDerivativeIndices,
+                                   secondDerivativeIndices, edgeLengths, NODE_COUNT - 1);
+    calculateRootLogLikelihood(instance, false);
+
+    // Edges between the partials of two subtrees, some with a tip as child
+    int parents[EDGE_COUNT] = {12, 8, 10, 9, 11};
+    int children[EDGE_COUNT] = {13, 9, 11, 3, 6};
+    int matrices[EDGE_COUNT] = {13, 9, 11, 3, 6};
+    int firstDerivatives[EDGE_COUNT];
+    int secondDerivatives[EDGE_COUNT];
+    int weightsIndices[EDGE_COUNT];
+    int freqsIndices[EDGE_COUNT];
+    int cumulativeScaleIndices[EDGE_COUNT];
+    for (int e = 0; e < EDGE_COUNT; e++) {
+        firstDerivatives[e] = FIRST_DERIVATIVE + matrices[e];
+        secondDerivatives[e] = SECOND_DERIVATIVE + matrices[e];
+        weightsIndices[e] = 0;
+        freqsIndices[e] = 0;
+        cumulativeScaleIndices[e] = BEAGLE_OP_NONE;
+    }
+
+    double logL[EDGE_COUNT], firstDerivative[EDGE_COUNT], secondDerivative[EDGE_COUNT];
+    checkCode("edges in one call",
+              beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                                       firstDerivatives, secondDerivatives,
+                                                       weightsIndices, freqsIndices,
+                                                       cumulativeScaleIndices, EDGE_COUNT, logL,
+                                                       firstDerivative, secondDerivative),
+              BEAGLE_SUCCESS);
+
+    for (int e = 0; e < EDGE_COUNT; e++) {
+        double edgeLogL, edgeFirstDerivative, edgeSecondDerivative;
+        beagleCalculateEdgeLogLikelihoods(instance, &parents[e], &children[e], &matrices[e],
+                                          &firstDerivatives[e], &secondDerivatives[e],
+                                          &weightsIndices[e], &freqsIndices[e],
+                                          &cumulativeScaleIndices[e], 1, &edgeLogL,
+                                          &edgeFirstDerivative, &edgeSecondDerivative);
+        check("edge logL", logL[e], edgeLogL, 1E-12);
+        check("edge first derivative", firstDerivative[e], edgeFirstDerivative, 1E-10);
+        check("edge second derivative", secondDerivative[e], edgeSecondDerivative, 1E-10);
+    }
+
+    // Second derivatives are optional
+    double firstOnly[EDGE_COUNT];
+    beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                             firstDerivatives, NULL, weightsIndices, freqsIndices,
+                                             cumulativeScaleIndices, EDGE_COUNT, logL, firstOnly,
+                                             NULL);
+    for (int e = 0; e < EDGE_COUNT; e++)
+        check("first derivative only", firstOnly[e], firstDerivative[e], 0.0);
+
+    checkCode("no first derivatives",
+              beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                                       NULL, NULL, weightsIndices, freqsIndices,
+                                                       cumulativeScaleIndices, EDGE_COUNT, logL,
+                                                       NULL, NULL),
+              BEAGLE_ERROR_NO_IMPLEMENTATION);
+    parents[EDGE_COUNT - 1] = 2 * NODE_COUNT;
+    checkCode("bad buffer index",
+              beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                                       firstDerivatives, NULL, weightsIndices,
+                                                       freqsIndices, cumulativeScaleIndices,
+                                                       EDGE_COUNT, logL, firstOnly, NULL),
+              BEAGLE_ERROR_OUT_OF_RANGE);
+
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
@@ -0,0 +1,281 @@
+/*
+ *  featuretest.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Setup shared by the CPU feature tests: a fixed rooted tree of eight tips with
+ * random sequences under an equal-input model and four rate categories. Node i
+ * uses partials buffer i and matrix i for the edge above it; internal node i
+ * writes scale buffer i - TIP_COUNT and scale buffer CUMULATIVE_SCALE holds
+ * the cumulative factors. Each test exits with the number of failed checks.
+ */
+
+#ifndef __featuretest__
+#define __featuretest__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+
+#define TIP_COUNT 8
+#define NODE_COUNT (2 * TIP_COUNT - 1)
+#define ROOT_NODE (NODE_COUNT - 1)
+#define CATEGORY_COUNT 4
+#define CUMULATIVE_SCALE (TIP_COUNT - 1)
+
+// ((((0,1),(2,3)),((4,5),(6,7)))), children always before their parent
+static const int parentIndices[NODE_COUNT] = {8, 8, 9, 9, 10, 10, 11, 11,
+                                              12, 12, 13, 13, 14, 14, -1};
+static const double edgeLengths[NODE_COUNT] = {0.05, 0.12, 0.21, 0.08, 0.15, 0.03, 0.30, 0.11,
+                                               0.07, 0.18, 0.09, 0.14, 0.06, 0.10, 0.0};
+static const double categoryRates[CATEGORY_COUNT] = {0.03338775, 0.25191592, 0.82026848, 2.89442785};
+
+static int failureCount = 0;
+
+static unsigned int randomState = 1;
+
+static int nextRandom(int n) {
+    randomState = randomState * 1103515245 + 12345;
+    return (int) ((randomState >> 16) % n);
+}
+
+/*
+ * Tip sequences evolve from a random root sequence down the tree, each edge
+ * replacing the state with probability about its length; about one tip state
+ * in twenty is missing.
+ */
+static std::vector<int> makeTipStates(int stateCount,
+                                      int patternCount) {
+    std::vector<int> states(TIP_COUNT * patternCount);
+    int nodeStates[NODE_COUNT];
+    randomState = 1;
+    for (int k = 0; k < patternCount; k++) {
+        nodeStates[ROOT_NODE] = nextRandom(stateCount);
+        for (int node = ROOT_NODE - 1; node >= 0; node--) {
+            nodeStates[node] = nodeStates[parentIndices[node]];
+            if (nextRandom(1000) < 1000 * edgeLengths[node])
+                nodeStates[node] = nextRandom(stateCount);
+        }
+        for (int tip = 0; tip < TIP_COUNT; tip++)
+            states[tip * patternCount + k] = (nextRandom(20) == 0 ? stateCount : nodeStates[tip]);
+    }
+    return states;
+}
+
+/*
+ * Fills in the equal-input model with rate one: eigenvectors 1 and e_0 - e_i,
+ * eigenvalue -stateCount/(stateCount - 1) for all but the first.
+ */
+static void makeEigenDecomposition(int stateCount,
+                                   std::vector<double>& evec,
+                                   std::vector<double>& ivec,
+                                   std::vector<double>& eval) {
+    evec.assign(stateCount * stateCount, 0.0);
+    ivec.assign(stateCount * stateCount, 0.0);
+    eval.assign(stateCount, -stateCount / (stateCount - 1.0));
+    eval[0] = 0.0;
+    for (int i = 0; i < stateCount; i++) {
+        evec[i * stateCount] = 1.0;
+        ivec[i] = 1.0 / stateCount;
+        if (i > 0) {
+            evec[i] = 1.0;
+            evec[i * stateCount + i] = -1.0;
+            for (int j = 0; j < stateCount; j++)
+                ivec[i * stateCount + j] = 1.0 / stateCount - (i == j ? 1.0 : 0.0);
+        }
+    }
+}
+
+static void setEigenDecomposition(int instance,
+                                  int stateCount) {
+    std::vector<double> evec, ivec, eval;
+    makeEigenDecomposition(stateCount, evec, ivec, eval);
+    beagleSetEigenDecomposition(instance, 0, &evec[0], &ivec[0], &eval[0]);
+}
+
+/*
+ * Creates a CPU instance with a partials buffer per node plus extraBufferCount,
+ * matrixCount matrices and a scale buffer per internal node plus the cumulative
+ * one, and sets the model, weights and tip data (as compact states or as
+ * partials). Returns the instance or exits on failure.
+ */
+static int createTestInstance(int stateCount,
+                              int patternCount,
+                              int extraBufferCount,
+                              int matrixCount,
+                              long preferenceFlags,
+                              long requirementFlags,
+                              bool compactTips) {
+    BeagleInstanceDetails instDetails;
+    int instance = beagleCreateInstance(TIP_COUNT,
+                                        NODE_COUNT + extraBufferCount - (compactTips ? TIP_COUNT : 0),
+                                        (compactTips ? TIP_COUNT : 0),
+                                        stateCount,
+                                        patternCount,
+                                        1,
+                                        matrixCount,
+                                        CATEGORY_COUNT,
+                                        TIP_COUNT,
+                                        NULL,
+                                        0,
+                                        preferenceFlags,
+                                        requirementFlags | BEAGLE_FLAG_PROCESSOR_CPU |
+                                        BEAGLE_FLAG_SCALING_MANUAL,
+                                        &instDetails);
+    if (instance < 0) {
+        fprintf(stderr, "Failed to obtain BEAGLE instance\n\n");
+        exit(1);
+    }
+    fprintf(stdout, "Impl Name : %s\n", instDetails.implName);
+
+    std::vector<int> states = makeTipStates(stateCount, patternCount);
+    for (int tip = 0; tip < TIP_COUNT; tip++) {
+        const int* tipStates = &states[tip * patternCount];
+        if (compactTips) {
+            beagleSetTipStates(instance, tip, tipStates);
+        } else {
+            std::vector<double> partials(patternCount * stateCount, 0.0);
+            for (int k = 0; k < patternCount; k++) {
+                for (int i = 0; i < stateCount; i++) {
+                    if (tipStates[k] == stateCount || tipStates[k] == i)
+                        partials[k * stateCount + i] = 1.0;
+                }
+            }
+            beagleSetTipPartials(instance, tip, &partials[0]);
+        }
+    }
+
+    setEigenDecomposition(instance, stateCount);
+
+    std::vector<double> freqs(stateCount, 1.0 / stateCount);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+
+    double weights[CATEGORY_COUNT];
+    for (int c = 0; c < CATEGORY_COUNT; c++)
+        weights[c] = 1.0 / CATEGORY_COUNT;
+    beagleSetCategoryWeights(instance, 0, weights);
+    beagleSetCategoryRates(instance, categoryRates);
+
+    std::vector<double> patternWeights(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        patternWeights[k] = 1.0 + (k % 3);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    return instance;
+}
+
+/*
+ * Fills operations with the post-order operations of the tree and returns
+ * their number.
+ */
+static int makeOperations(BeagleOperation* operations,
+                          bool scaling) {
+    int count = 0;
+    for (int node = TIP_COUNT; node < NODE_COUNT; node++) {
+        int children[2];
+        int childCount = 0;
+        for (int child = 0; child < node; child++) {
+            if (parentIndices[child] == node)
+                children[childCount++] = child;
+        }
+        BeagleOperation operation = {node, (scaling ? node - TIP_COUNT : BEAGLE_OP_NONE),
+                                     BEAGLE_OP_NONE, children[0], children[0],
+                                     children[1], children[1]};
+        operations[count++] = operation;
+    }
+    return count;
+}
+
+static void updateMatrices(int instance,
+                           const double* lengths) {
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, lengths, NODE_COUNT - 1);
+}
+
+/*
+ * Returns the log likelihood at the root from the current root partials.
+ */
+static double rootLogLikelihood(int instance,
+                                bool scaling) {
+    int rootIndex = ROOT_NODE;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int cumulativeScaleIndex = (scaling ? CUMULATIVE_SCALE : BEAGLE_OP_NONE);
+    double logL = 0.0;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &freqsIndex,
+                                      &cumulativeScaleIndex, 1, &logL);
+    return logL;
+}
+
+/*
+ * Computes all partials of the tree, rescaling them if scaling is set, and
+ * returns the log likelihood at the root.
+ */
+static double calculateRootLogLikelihood(int instance,
+                                         bool scaling) {
+    BeagleOperation operations[NODE_COUNT];
+    int operationCount = makeOperations(operations, scaling);
+    int cumulativeScaleIndex = (scaling ? CUMULATIVE_SCALE : BEAGLE_OP_NONE);
+    if (scaling)
+        beagleResetScaleFactors(instance, cumulativeScaleIndex);
+    beagleUpdatePartials(instance, operations, operationCount, cumulativeScaleIndex);
+
+    return rootLogLikelihood(instance, scaling);
+}
+
+static void check(const char* what,
+                  double value,
+                  double expected,
+                  double tolerance) {
+    bool passed = (fabs(value - expected) <= tolerance * (1.0 + fabs(expected)));
+    fprintf(stdout, "%s %s: %.10f (expected %.10f)\n", (passed ? "ok  " : "FAIL"), what,
+            value, expected);
+    if (!passed)
+        failureCount++;
+}
+
+static void checkCount(const char* what,
+                       int value,
+                       int expected) {
+    bool passed = (value == expected);
+    fprintf(stdout, "%s %s: %d (expected %d)\n", (passed ? "ok  " : "FAIL"), what, value, expected);
+    if (!passed)
+        failureCount++;
+}
+
+static void checkCode(const char* what,
+                      int returnCode,
+                      int expected) {
+    bool passed = (returnCode == expected);
+    fprintf(stdout, "%s %s: returned %d (expected %d)\n", (passed ? "ok  " : "FAIL"), what,
+            returnCode, expected);
+    if (!passed)
+        failureCount++;
+}
+
+#endif // __featuretest__
@@ -0,0 +1,137 @@
+/*
+ *  gradienttest.cpp
+ *  BEAGLE
+ *
+ *  Checks that pre-order partials integrate to the root log likelihood on
+ *  every edge, and that the edge derivatives computed from them match finite
+ *  differences of the log likelihood, as does the rate derivative from cross
+ *  products.
+ *
+ */
+
+#include "featuretest.h"
+
+static const int patternCount = 500;
+
+// Pre-order partials of node i are in buffer PRE_BUFFER + i, the first
+// derivative of matrix i is matrix DERIVATIVE_MATRIX + i
+#define PRE_BUFFER NODE_COUNT
+#define DERIVATIVE_MATRIX (NODE_COUNT - 1)
+
+static void updatePrePartials(int instance) {
+    int rootBuffer = PRE_BUFFER + ROOT_NODE;
+    int freqsIndex = 0;
+    beagleSetRootPrePartials(instance, &rootBuffer, &freqsIndex, 1);
+
+    // Parents have higher indices than their children
+    BeagleOperation operations[NODE_COUNT - 1];
+    int operationCount = 0;
+    for (int node = NODE_COUNT - 2; node >= 0; node--) {
+        int parent = parentIndices[node];
+        int sibling = 0;
+        while (sibling == node || parentIndices[sibling] != parent)
+            sibling++;
+        BeagleOperation operation = {PRE_BUFFER + node, BEAGLE_OP_NONE, BEAGLE_OP_NONE,
+                                     PRE_BUFFER + parent,
+                                     (parent == ROOT_NODE ? BEAGLE_OP_NONE : parent),
+                                     sibling, sibling};
+        operations[operationCount++] = operation;
+    }
+    beagleUpdatePrePartials(instance, operations, operationCount);
+}
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, patternCount, NODE_COUNT, 2 * (NODE_COUNT - 1), 0,
+                                      BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = edgeLengths[i];
+
+    int matrixIndices[NODE_COUNT - 1];
+    int derivativeIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++) {
+        matrixIndices[i] = i;
+        derivativeIndices[i] = DERIVATIVE_MATRIX + i;
+    }
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, derivativeIndices, NULL,
+                                   lengths, NODE_COUNT - 1);
+    double logL = calculateRootLogLikelihood(instance, false);
+    updatePrePartials(instance);
+
+    // Frequencies are in the pre-order partials as well as applied on the edge
+    double weightSum = 0.0;
+    for (int k = 0; k < patternCount; k++)
+        weightSum += 1.0 + (k % 3);
+    for (int node = 0; node < NODE_COUNT - 1; node += 3) {
+        int preBuffer = PRE_BUFFER + node;
+        int weightsIndex = 0;
+        int freqsIndex = 0;
+        int cumulativeScaleIndex = BEAGLE_OP_NONE;
+        double edgeLogL = 0.0;
+        beagleCalculateEdgeLogLikelihoods(instance, &preBuffer, &node, &node, NULL, NULL,
+                                          &weightsIndex, &freqsIndex, &cumulativeScaleIndex, 1,
+                                          &edgeLogL, NULL, NULL);
+        check("pre-order edge logL", edgeLogL - weightSum * log(0.25), logL, 1E-10);
+    }
+
+    // Scale factors cancel out of the derivatives
+    calculateRootLogLikelihood(instance, true);
+    updatePrePartials(instance);
+
+    int preBuffers[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        preBuffers[i] = PRE_BUFFER + i;
+    double derivatives[NODE_COUNT - 1];
+    checkCode("edge derivatives",
+              beagleCalculateEdgeDerivatives(instance, matrixIndices, preBuffers, matrixIndices,
+                                             derivativeIndices, 0, NODE_COUNT - 1, derivatives),
+              BEAGLE_SUCCESS);
+
+    const double h = 1E-6;
+    for (int node = 0; node < NODE_COUNT - 1; node++) {
+        double length = lengths[node];
+        lengths[node] = length + h;
+        updateMatrices(instance, lengths);
+        double logLPlus = calculateRootLogLikelihood(instance, true);
+        lengths[node] = length - h;
+        updateMatrices(instance, lengths);
+        double logLMinus = calculateRootLogLikelihood(instance, true);
+        lengths[node] = length;
+
+        check("edge derivative", derivatives[node], (logLPlus - logLMinus) / (2.0 * h), 1E-6);
+    }
+
+    // The derivative with respect to the overall rate, for which dQ/dtheta = Q
+    updateMatrices(instance, lengths);
+    calculateRootLogLikelihood(instance, true);
+    updatePrePartials(instance);
+    std::vector<double> crossProducts(CATEGORY_COUNT * 4 * 4);
+    checkCode("cross products",
+              beagleCalculateCrossProducts(instance, matrixIndices, preBuffers, matrixIndices,
+                                           lengths, 0, NODE_COUNT - 1, &crossProducts[0]),
+              BEAGLE_SUCCESS);
+    double rateDerivative = 0.0;
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++)
+                rateDerivative += categoryRates[c] * crossProducts[(c * 4 + i) * 4 + j] *
+                                  (i == j ? -1.0 : 1.0 / 3.0);
+        }
+    }
+
+    double rates[CATEGORY_COUNT];
+    double rateLogL[2];
+    for (int sign = 0; sign < 2; sign++) {
+        for (int c = 0; c < CATEGORY_COUNT; c++)
+            rates[c] = categoryRates[c] * (sign == 0 ? 1.0 + h : 1.0 - h);
+        beagleSetCategoryRates(instance, rates);
+        updateMatrices(instance, lengths);
+        rateLogL[sign] = calculateRootLogLikelihood(instance, true);
+    }
+    check("rate derivative", rateDerivative, (rateLogL[0] - rateLogL[1]) / (2.0 * h), 1E-6);
+
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
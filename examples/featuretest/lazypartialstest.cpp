@@ -0,0 +1,115 @@
+/*
+ *  lazypartialstest.cpp
+ *  BEAGLE
+ *
+ *  Checks that partials buffers can be released and are allocated again when
+ *  next written, also with skipped operations and restore points, that
+ *  buffers allocated ahead of time start out as zeros, and that patterns can
+ *  be reordered by partition before every tip is set.
+ *
+ */
+
+#include "featuretest.h"
+
+static const int patternCount = 500;
+
+static int rootLogLikelihoodCode(int instance) {
+    int rootIndex = ROOT_NODE;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int cumulativeScaleIndex = CUMULATIVE_SCALE;
+    double logL;
+    return beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &freqsIndex,
+                                             &cumulativeScaleIndex, 1, &logL);
+}
+
+/*
+ * Splits patterns into two interleaved partitions while the partials of the
+ * last tip are not set, then sets them in the new pattern order.
+ */
+static void checkUnsetTipReordered() {
+    int reference = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, false);
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, false);
+    const int unsetTip = TIP_COUNT - 1;
+    beagleReleasePartials(instance, &unsetTip, 1);
+
+    std::vector<int> partitions(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        partitions[k] = k % 2;
+    checkCode("reorder with a tip unset", beagleSetPatternPartitions(instance, 2, &partitions[0]),
+              BEAGLE_SUCCESS);
+
+    // Patterns of the first partition come first, each in its original order
+    std::vector<int> states = makeTipStates(4, patternCount);
+    std::vector<double> partials(patternCount * 4, 0.0);
+    for (int k = 0; k < patternCount; k++) {
+        const int state = states[unsetTip * patternCount + k];
+        const int sorted = (k % 2 == 0 ? k / 2 : (patternCount + 1) / 2 + k / 2);
+        for (int i = 0; i < 4; i++)
+            partials[sorted * 4 + i] = (state == 4 || state == i ? 1.0 : 0.0);
+    }
+    beagleSetTipPartials(instance, unsetTip, &partials[0]);
+
+    updateMatrices(reference, edgeLengths);
+    updateMatrices(instance, edgeLengths);
+    check("reordered logL", calculateRootLogLikelihood(instance, true),
+          calculateRootLogLikelihood(reference, true), 1E-12);
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+    updateMatrices(instance, edgeLengths);
+    double logL = calculateRootLogLikelihood(instance, true);
+
+    int internalBuffers[NODE_COUNT - TIP_COUNT];
+    for (int i = 0; i < NODE_COUNT - TIP_COUNT; i++)
+        internalBuffers[i] = TIP_COUNT + i;
+
+    checkCode("release partials", beagleReleasePartials(instance, internalBuffers, NODE_COUNT - TIP_COUNT),
+              BEAGLE_SUCCESS);
+    checkCode("read released root", rootLogLikelihoodCode(instance), BEAGLE_ERROR_GENERAL);
+    check("reallocated logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+
+    // Released buffers are computed even if their inputs did not change
+    beagleSetCPUSkipUnchangedOperations(instance, 1);
+    calculateRootLogLikelihood(instance, true);
+    beagleReleasePartials(instance, &internalBuffers[2], 1);
+    check("reallocated logL when skipping", calculateRootLogLikelihood(instance, true), logL, 0.0);
+    beagleSetCPUSkipUnchangedOperations(instance, 0);
+
+    // A restore point keeps the contents of released buffers
+    beagleStoreSnapshot(instance);
+    beagleReleasePartials(instance, internalBuffers, NODE_COUNT - TIP_COUNT);
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = 2.0 * edgeLengths[i];
+    updateMatrices(instance, lengths);
+    calculateRootLogLikelihood(instance, true);
+    beagleRestoreSnapshot(instance);
+    check("restored released logL", rootLogLikelihood(instance, true), logL, 0.0);
+    beagleReleaseSnapshot(instance);
+
+    // Allocation ahead of time zeroes new buffers and keeps existing ones
+    std::vector<double> partials(patternCount * 4 * CATEGORY_COUNT);
+    std::vector<double> expected(partials.size());
+    beagleGetPartials(instance, ROOT_NODE - 1, BEAGLE_OP_NONE, &expected[0]);
+    beagleReleasePartials(instance, &internalBuffers[0], 1);
+    int buffers[2] = {internalBuffers[0], ROOT_NODE - 1};
+    checkCode("allocate partials", beagleAllocatePartials(instance, buffers, 2), BEAGLE_SUCCESS);
+    beagleGetPartials(instance, internalBuffers[0], BEAGLE_OP_NONE, &partials[0]);
+    checkCount("allocated partials are zeros", partials == std::vector<double>(partials.size(), 0.0), 1);
+    beagleGetPartials(instance, ROOT_NODE - 1, BEAGLE_OP_NONE, &partials[0]);
+    checkCount("allocated partials are kept", partials == expected, 1);
+
+    checkCode("release out of range", beagleReleasePartials(instance, &patternCount, 1),
+              BEAGLE_ERROR_OUT_OF_RANGE);
+
+    beagleFinalizeInstance(instance);
+
+    checkUnsetTipReordered();
+
+    return failureCount;
+}
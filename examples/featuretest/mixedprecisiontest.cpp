@@ -0,0 +1,159 @@
+/*
+ *  mixedprecisiontest.cpp
+ *  BEAGLE
+ *
+ *  Checks that single precision instances accumulating in double precision
+ *  come closer to double precision log likelihoods than plain single
+ *  precision, also when enabled with a restore point active and for sums over
+ *  several subsets or with derivatives, and that the instances without
+ *  double-accumulating kernels refuse it.
+ *
+ */
+
+#include "featuretest.h"
+
+static const int patternCount = 2000;
+
+// Matrix of the edge between the two children of the root, and its derivative
+#define EDGE_MATRIX (NODE_COUNT - 1)
+#define DERIVATIVE_MATRIX NODE_COUNT
+
+static double edgeLogLikelihood(int instance,
+                                double length) {
+    int matrix = EDGE_MATRIX;
+    beagleUpdateTransitionMatrices(instance, 0, &matrix, NULL, NULL, &length, 1);
+
+    int parent = ROOT_NODE - 2;
+    int child = ROOT_NODE - 1;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int cumulativeScaleIndex = CUMULATIVE_SCALE;
+    double logL = 0.0;
+    beagleCalculateEdgeLogLikelihoods(instance, &parent, &child, &matrix, NULL, NULL,
+                                      &weightsIndex, &freqsIndex, &cumulativeScaleIndex, 1,
+                                      &logL, NULL, NULL);
+    return logL;
+}
+
+/*
+ * Optimizes the edge through the root with the scale factors of both subtrees
+ * and checks the optimum against the edge log likelihood there, which comes
+ * from transition matrices rounded to the precision of the instance.
+ */
+static double optimizedLogLikelihood(int instance,
+                                     double tolerance) {
+    calculateRootLogLikelihood(instance, true);
+    int scaleIndices[NODE_COUNT - TIP_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - TIP_COUNT - 1; i++)
+        scaleIndices[i] = i;
+    beagleResetScaleFactors(instance, CUMULATIVE_SCALE);
+    beagleAccumulateScaleFactors(instance, scaleIndices, NODE_COUNT - TIP_COUNT - 1, CUMULATIVE_SCALE);
+
+    double length = edgeLengths[ROOT_NODE - 2] + edgeLengths[ROOT_NODE - 1];
+    double logL = 0.0;
+    beagleOptimizeEdgeLength(instance, ROOT_NODE - 2, ROOT_NODE - 1, 0, 0, 0, CUMULATIVE_SCALE,
+                             0.0, 10.0, 1E-10, 100, &length, &logL, NULL, NULL);
+    check("optimum logL", logL, edgeLogLikelihood(instance, length), tolerance);
+    return logL;
+}
+
+/*
+ * Checks the log likelihoods summed over two equal subsets at the root and on
+ * the edge through the root, and on that edge with its derivatives, against
+ * those of one subset without derivatives.
+ */
+static void checkSubsetsAndDerivatives(int instance,
+                                       double tolerance) {
+    double length = edgeLengths[ROOT_NODE - 2] + edgeLengths[ROOT_NODE - 1];
+    int matrix = EDGE_MATRIX;
+    int derivativeMatrix = DERIVATIVE_MATRIX;
+    beagleUpdateTransitionMatrices(instance, 0, &matrix, &derivativeMatrix, NULL, &length, 1);
+
+    int rootIndices[2] = {ROOT_NODE, ROOT_NODE};
+    int parents[2] = {ROOT_NODE - 2, ROOT_NODE - 2};
+    int children[2] = {ROOT_NODE - 1, ROOT_NODE - 1};
+    int matrices[2] = {EDGE_MATRIX, EDGE_MATRIX};
+    int indices[2] = {0, 0};
+    int scaleIndices[2] = {CUMULATIVE_SCALE, CUMULATIVE_SCALE};
+    double rootLogL, edgeLogL, subsetsLogL, derivativesLogL, firstDerivative, secondDerivative;
+    beagleCalculateRootLogLikelihoods(instance, rootIndices, indices, indices, scaleIndices, 1, &rootLogL);
+    beagleCalculateEdgeLogLikelihoods(instance, parents, children, matrices, NULL, NULL, indices,
+                                      indices, scaleIndices, 1, &edgeLogL, NULL, NULL);
+
+    // Each pattern is twice as likely over two equal subsets
+    double weightSum = 0.0;
+    for (int k = 0; k < patternCount; k++)
+        weightSum += 1.0 + (k % 3);
+    beagleCalculateRootLogLikelihoods(instance, rootIndices, indices, indices, scaleIndices, 2,
+                                      &subsetsLogL);
+    check("two subsets at the root", subsetsLogL, rootLogL + weightSum * log(2.0), tolerance);
+    beagleCalculateEdgeLogLikelihoods(instance, parents, children, matrices, NULL, NULL, indices,
+                                      indices, scaleIndices, 2, &subsetsLogL, NULL, NULL);
+    check("two subsets on the edge", subsetsLogL, edgeLogL + weightSum * log(2.0), tolerance);
+    beagleCalculateEdgeLogLikelihoods(instance, parents, children, matrices, &derivativeMatrix,
+                                      &derivativeMatrix, indices, indices, scaleIndices, 1,
+                                      &derivativesLogL, &firstDerivative, &secondDerivative);
+    check("edge with derivatives", derivativesLogL, edgeLogL, tolerance);
+}
+
+static void checkMixedPrecision(int stateCount) {
+    int reference = createTestInstance(stateCount, patternCount, 0, NODE_COUNT + 1, 0,
+                                       BEAGLE_FLAG_PRECISION_DOUBLE, true);
+    int single = createTestInstance(stateCount, patternCount, 0, NODE_COUNT + 1, 0,
+                                    BEAGLE_FLAG_PRECISION_SINGLE, true);
+    int mixed = createTestInstance(stateCount, patternCount, 0, NODE_COUNT + 1, 0,
+                                   BEAGLE_FLAG_PRECISION_SINGLE, true);
+    checkCode("double precision instance", beagleSetCPUMixedPrecision(reference, 1),
+              BEAGLE_ERROR_NO_IMPLEMENTATION);
+
+    updateMatrices(reference, edgeLengths);
+    updateMatrices(single, edgeLengths);
+    double logL = calculateRootLogLikelihood(reference, true);
+    double singleError = fabs(calculateRootLogLikelihood(single, true) - logL);
+
+    // Scale buffers already written, also those saved at the restore point,
+    // are widened when mixed precision is enabled
+    updateMatrices(mixed, edgeLengths);
+    calculateRootLogLikelihood(mixed, true);
+    beagleStoreSnapshot(mixed);
+    checkCode("enable mixed precision", beagleSetCPUMixedPrecision(mixed, 1), BEAGLE_SUCCESS);
+    setEigenDecomposition(mixed, stateCount);
+    updateMatrices(mixed, edgeLengths);
+    double mixedError = fabs(calculateRootLogLikelihood(mixed, true) - logL);
+    fprintf(stdout, "single precision error %g, mixed precision error %g\n", singleError, mixedError);
+    checkCount("mixed precision closer to double", mixedError < singleError, 1);
+    checkSubsetsAndDerivatives(reference, 1E-12);
+    checkSubsetsAndDerivatives(mixed, 1E-12);
+
+    beagleRestoreSnapshot(mixed);
+    check("restored logL", rootLogLikelihood(mixed, true), logL, 1E-7);
+    beagleReleaseSnapshot(mixed);
+    updateMatrices(mixed, edgeLengths);
+    double mixedLogL = calculateRootLogLikelihood(mixed, true);
+    beagleSetCPUBufferArena(mixed, 0);
+    check("separate buffers logL", calculateRootLogLikelihood(mixed, true), mixedLogL, 0.0);
+    beagleSetCPUBufferArena(mixed, 1);
+
+    double optimizedLogL = optimizedLogLikelihood(reference, 1E-10);
+    check("mixed precision optimized logL", optimizedLogLikelihood(mixed, 1E-8), optimizedLogL, 1E-7);
+
+    checkCode("disable mixed precision", beagleSetCPUMixedPrecision(mixed, 0), BEAGLE_SUCCESS);
+    updateMatrices(mixed, edgeLengths);
+    check("single precision logL", calculateRootLogLikelihood(mixed, true), logL, 1E-6);
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(single);
+    beagleFinalizeInstance(mixed);
+}
+
+int main(int argc, const char* argv[]) {
+    checkMixedPrecision(20);
+    checkMixedPrecision(61);
+
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_SINGLE, true);
+    checkCode("4-state instance", beagleSetCPUMixedPrecision(instance, 1), BEAGLE_ERROR_NO_IMPLEMENTATION);
+    checkCode("4-state single precision", beagleSetCPUMixedPrecision(instance, 0), BEAGLE_SUCCESS);
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
@@ -0,0 +1,74 @@
+/*
+ *  optimizeedgetest.cpp
+ *  BEAGLE
+ *
+ *  Checks the edge length optimizer on the edge through the root: the optimum
+ *  must be a maximum of the log likelihood computed from transition matrices.
+ *
+ */
+
+#include "featuretest.h"
+
+// Matrix of the edge between the two children of the root
+#define EDGE_MATRIX (NODE_COUNT - 1)
+
+static double edgeLogLikelihood(int instance,
+                                double length) {
+    int matrix = EDGE_MATRIX;
+    beagleUpdateTransitionMatrices(instance, 0, &matrix, NULL, NULL, &length, 1);
+
+    int parent = ROOT_NODE - 2;
+    int child = ROOT_NODE - 1;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int cumulativeScaleIndex = CUMULATIVE_SCALE;
+    double logL = 0.0;
+    beagleCalculateEdgeLogLikelihoods(instance, &parent, &child, &matrix, NULL, NULL,
+                                      &weightsIndex, &freqsIndex, &cumulativeScaleIndex, 1,
+                                      &logL, NULL, NULL);
+    return logL;
+}
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, 500, 0, NODE_COUNT, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    updateMatrices(instance, edgeLengths);
+    calculateRootLogLikelihood(instance, true);
+
+    // Scale factors of both subtrees, without those of the root
+    int scaleIndices[NODE_COUNT - TIP_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - TIP_COUNT - 1; i++)
+        scaleIndices[i] = i;
+    beagleResetScaleFactors(instance, CUMULATIVE_SCALE);
+    beagleAccumulateScaleFactors(instance, scaleIndices, NODE_COUNT - TIP_COUNT - 1, CUMULATIVE_SCALE);
+
+    double startLength = edgeLengths[ROOT_NODE - 2] + edgeLengths[ROOT_NODE - 1];
+    double startLogL = edgeLogLikelihood(instance, startLength);
+
+    double length = startLength;
+    double logL, firstDerivative, secondDerivative;
+    checkCode("optimize edge",
+              beagleOptimizeEdgeLength(instance, ROOT_NODE - 2, ROOT_NODE - 1, 0, 0, 0,
+                                       CUMULATIVE_SCALE, 0.0, 10.0, 1E-10, 100, &length, &logL,
+                                       &firstDerivative, &secondDerivative),
+              BEAGLE_SUCCESS);
+
+    check("optimum logL", logL, edgeLogLikelihood(instance, length), 1E-10);
+    checkCount("optimum not worse than start", logL >= startLogL, 1);
+    checkCount("optimum above neighbours",
+               logL >= edgeLogLikelihood(instance, length - 1E-3) &&
+               logL >= edgeLogLikelihood(instance, length + 1E-3), 1);
+    check("first derivative at optimum", firstDerivative, 0.0, 1E-6);
+    checkCount("negative second derivative", secondDerivative < 0.0, 1);
+
+    // The bracket is respected
+    length = startLength;
+    beagleOptimizeEdgeLength(instance, ROOT_NODE - 2, ROOT_NODE - 1, 0, 0, 0, CUMULATIVE_SCALE,
+                             0.0, 0.01, 1E-10, 100, &length, &logL, NULL, NULL);
+    check("optimum at upper bound", length, 0.01, 1E-12);
+    check("logL at upper bound", logL, edgeLogLikelihood(instance, 0.01), 1E-10);
+
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
@@ -0,0 +1,55 @@
+/*
+ *  plantest.cpp
+ *  BEAGLE
+ *
+ *  Checks that running an operation plan gives the log likelihood of the
+ *  equivalent matrix, partials and root calls, also after edge lengths change.
+ *
+ */
+
+#include "featuretest.h"
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, 500, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    BeagleOperation operations[NODE_COUNT];
+    int operationCount = makeOperations(operations, true);
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+
+    int plan = beagleCreateOperationPlan(instance, 0, matrixIndices, NODE_COUNT - 1,
+                                         operations, operationCount, CUMULATIVE_SCALE,
+                                         ROOT_NODE, 0, 0);
+    checkCode("create plan", plan >= 0 ? BEAGLE_SUCCESS : plan, BEAGLE_SUCCESS);
+
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = edgeLengths[i];
+
+    for (int rep = 0; rep < 3; rep++) {
+        updateMatrices(instance, lengths);
+        double expected = calculateRootLogLikelihood(instance, true);
+
+        // Perturb the matrices so that the plan has to update them
+        lengths[rep] *= 2.0;
+        updateMatrices(instance, lengths);
+        lengths[rep] /= 2.0;
+
+        double logL = 0.0;
+        beagleResetScaleFactors(instance, CUMULATIVE_SCALE);
+        checkCode("run plan", beagleUpdateWithOperationPlan(instance, plan, lengths, &logL),
+                  BEAGLE_SUCCESS);
+        check("plan logL", logL, expected, 1E-12);
+
+        lengths[2 * rep + 1] += 0.05;
+    }
+
+    checkCode("finalize plan", beagleFinalizeOperationPlan(instance, plan), BEAGLE_SUCCESS);
+    checkCode("run finalized plan", beagleUpdateWithOperationPlan(instance, plan, NULL, NULL),
+              BEAGLE_ERROR_OUT_OF_RANGE);
+
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
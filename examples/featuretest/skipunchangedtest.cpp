@@ -0,0 +1,56 @@
+/*
+ *  skipunchangedtest.cpp
+ *  BEAGLE
+ *
+ *  Checks that skipping unchanged partials operations gives the log likelihood
+ *  of computing them all, after changes to matrices, tips and partials.
+ *
+ */
+
+#include "featuretest.h"
+
+int main(int argc, const char* argv[]) {
+    const int patternCount = 500;
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+    int reference = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+    checkCode("enable skipping", beagleSetCPUSkipUnchangedOperations(instance, 1), BEAGLE_SUCCESS);
+
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = edgeLengths[i];
+
+    for (int rep = 0; rep < 6; rep++) {
+        bool scaling = (rep % 2 == 0);
+        if (rep == 0) {
+            updateMatrices(instance, lengths);
+        } else if (rep < 4) {
+            // One edge changed
+            int node = 3 * rep;
+            lengths[node] += 0.04;
+            beagleUpdateTransitionMatrices(instance, 0, &node, NULL, NULL, &lengths[node], 1);
+        } else if (rep == 4) {
+            // A tip changed
+            std::vector<int> states = makeTipStates(4, patternCount);
+            for (int k = 0; k < patternCount; k += 7)
+                states[k] = (states[k] + 1) % 4;
+            beagleSetTipStates(instance, 0, &states[0]);
+            beagleSetTipStates(reference, 0, &states[0]);
+        } else {
+            // Internal partials overwritten, then recomputed from unchanged inputs
+            std::vector<double> partials(patternCount * 4 * CATEGORY_COUNT, 0.5);
+            beagleSetPartials(instance, 9, &partials[0]);
+        }
+        updateMatrices(reference, lengths);
+        check("skipping logL", calculateRootLogLikelihood(instance, scaling),
+              calculateRootLogLikelihood(reference, scaling), 1E-12);
+    }
+
+    checkCode("disable skipping", beagleSetCPUSkipUnchangedOperations(instance, 0), BEAGLE_SUCCESS);
+    check("logL after skipping", calculateRootLogLikelihood(instance, true),
+          calculateRootLogLikelihood(reference, true), 1E-12);
+
+    beagleFinalizeInstance(instance);
+    beagleFinalizeInstance(reference);
+
+    return failureCount;
+}
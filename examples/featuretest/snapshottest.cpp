@@ -0,0 +1,81 @@
+/*
+ *  snapshottest.cpp
+ *  BEAGLE
+ *
+ *  Checks that restoring a snapshot after a rejected proposal brings back the
+ *  partials, matrices and scale factors at the restore point, and that storing
+ *  a new one accepts the proposal.
+ *
+ */
+
+#include "featuretest.h"
+
+static const int patternCount = 500;
+
+static double propose(int instance,
+                      double* lengths,
+                      int node) {
+    lengths[node] *= 1.5;
+    lengths[TIP_COUNT + node % (TIP_COUNT - 1)] += 0.05;
+    updateMatrices(instance, lengths);
+    return calculateRootLogLikelihood(instance, true);
+}
+
+static bool samePartials(int instance,
+                         const std::vector<double>& expected) {
+    std::vector<double> partials(expected.size());
+    beagleGetPartials(instance, TIP_COUNT + 1, BEAGLE_OP_NONE, &partials[0]);
+    return partials == expected;
+}
+
+int main(int argc, const char* argv[]) {
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = edgeLengths[i];
+    updateMatrices(instance, lengths);
+    double logL = calculateRootLogLikelihood(instance, true);
+
+    std::vector<double> partials(patternCount * 4 * CATEGORY_COUNT);
+    beagleGetPartials(instance, TIP_COUNT + 1, BEAGLE_OP_NONE, &partials[0]);
+
+    checkCode("store snapshot", beagleStoreSnapshot(instance), BEAGLE_SUCCESS);
+
+    // Rejected proposals, restoring the same point twice
+    double proposedLengths[NODE_COUNT];
+    for (int rep = 0; rep < 2; rep++) {
+        for (int i = 0; i < NODE_COUNT; i++)
+            proposedLengths[i] = lengths[i];
+        double proposedLogL = propose(instance, proposedLengths, 2 + rep);
+        checkCount("proposal changes logL", proposedLogL != logL, 1);
+
+        checkCode("restore snapshot", beagleRestoreSnapshot(instance), BEAGLE_SUCCESS);
+        check("restored root logL", rootLogLikelihood(instance, true), logL, 0.0);
+        checkCount("restored partials", samePartials(instance, partials), 1);
+
+        // Restored matrices give the same partials again
+        check("recomputed logL", calculateRootLogLikelihood(instance, true), logL, 0.0);
+    }
+
+    // Accepted proposal
+    double acceptedLogL = propose(instance, lengths, 5);
+    beagleGetPartials(instance, TIP_COUNT + 1, BEAGLE_OP_NONE, &partials[0]);
+    checkCode("store snapshot on accept", beagleStoreSnapshot(instance), BEAGLE_SUCCESS);
+    for (int i = 0; i < NODE_COUNT; i++)
+        proposedLengths[i] = lengths[i];
+    propose(instance, proposedLengths, 6);
+    beagleRestoreSnapshot(instance);
+    check("accepted root logL", rootLogLikelihood(instance, true), acceptedLogL, 0.0);
+    checkCount("accepted partials", samePartials(instance, partials), 1);
+
+    // Releasing keeps the current state
+    double releasedLogL = propose(instance, proposedLengths, 1);
+    checkCode("release snapshot", beagleReleaseSnapshot(instance), BEAGLE_SUCCESS);
+    check("released root logL", rootLogLikelihood(instance, true), releasedLogL, 0.0);
+    check("released recomputed logL", calculateRootLogLikelihood(instance, true), releasedLogL, 0.0);
+
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
@@ -0,0 +1,234 @@
+/*
+ *  threadingtest.cpp
+ *  BEAGLE
+ *
+ *  Checks that threaded instances compute the log likelihoods of a serial
+ *  instance, with automatic pattern partitions and with fewer or more client
+ *  partitions than threads, for an operation list that reuses partials and
+ *  scale buffers once they have been read, and after the thread count,
+ *  minimum patterns per thread or thread affinity change. Checks that setting
+ *  the affinity pins the workers of every pool still in use.
+ *
+ */
+
+#include "featuretest.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#endif
+
+static const int patternCount = 1000;
+static const int threadCount = 4;
+
+// Matrix of the edge between the two children of the root
+#define EDGE_MATRIX (NODE_COUNT - 1)
+
+static double edgeLogLikelihood(int instance) {
+    int parent = ROOT_NODE - 2;
+    int child = ROOT_NODE - 1;
+    int matrix = EDGE_MATRIX;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int cumulativeScaleIndex = CUMULATIVE_SCALE;
+    double logL = 0.0;
+    beagleCalculateEdgeLogLikelihoods(instance, &parent, &child, &matrix, NULL, NULL,
+                                      &weightsIndex, &freqsIndex, &cumulativeScaleIndex, 1,
+                                      &logL, NULL, NULL);
+    return logL;
+}
+
+static int createInstance(long threadingFlag) {
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT, 0,
+                                      BEAGLE_FLAG_PRECISION_DOUBLE | threadingFlag, true);
+    updateMatrices(instance, edgeLengths);
+    int matrix = EDGE_MATRIX;
+    double length = edgeLengths[ROOT_NODE - 2] + edgeLengths[ROOT_NODE - 1];
+    beagleUpdateTransitionMatrices(instance, 0, &matrix, NULL, NULL, &length, 1);
+    return instance;
+}
+
+/*
+ * Splits the patterns into partitionCount contiguous partitions and computes
+ * all partials of each. The buffers and scale buffers of the first two
+ * cherries are written again for the other two once the parent of the first
+ * two has read them, so these operations depend on a later level than their
+ * children alone. Checks the log likelihoods at the root and on the edge
+ * through the root, summed over partitions, against the expected values.
+ */
+static void checkPartitions(int instance,
+                            int partitionCount,
+                            double rootLogL,
+                            double edgeLogL) {
+    std::vector<int> partitions(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        partitions[k] = k * partitionCount / patternCount;
+    beagleSetPatternPartitions(instance, partitionCount, &partitions[0]);
+
+    // {buffer, scale buffer, child 1, child 2, matrix 1, matrix 2}
+    const int nodes[NODE_COUNT - TIP_COUNT][6] = {{8, 0, 0, 1, 0, 1},
+                                                  {9, 1, 2, 3, 2, 3},
+                                                  {12, 4, 8, 9, 8, 9},
+                                                  {8, 0, 4, 5, 4, 5},
+                                                  {9, 1, 6, 7, 6, 7},
+                                                  {13, 5, 8, 9, 10, 11},
+                                                  {14, 6, 12, 13, 12, 13}};
+    std::vector<BeagleOperationByPartition> operations;
+    for (int i = 0; i < NODE_COUNT - TIP_COUNT; i++) {
+        for (int p = 0; p < partitionCount; p++) {
+            BeagleOperationByPartition operation = {nodes[i][0], nodes[i][1], BEAGLE_OP_NONE,
+                                                    nodes[i][2], nodes[i][4], nodes[i][3],
+                                                    nodes[i][5], p, CUMULATIVE_SCALE};
+            operations.push_back(operation);
+        }
+    }
+
+    for (int p = 0; p < partitionCount; p++)
+        beagleResetScaleFactorsByPartition(instance, CUMULATIVE_SCALE, p);
+    beagleUpdatePartialsByPartition(instance, &operations[0], (int) operations.size());
+
+    std::vector<int> partitionIndices(partitionCount);
+    for (int p = 0; p < partitionCount; p++)
+        partitionIndices[p] = p;
+    std::vector<int> roots(partitionCount, ROOT_NODE);
+    std::vector<int> parents(partitionCount, ROOT_NODE - 2);
+    std::vector<int> children(partitionCount, ROOT_NODE - 1);
+    std::vector<int> matrices(partitionCount, EDGE_MATRIX);
+    std::vector<int> indices(partitionCount, 0);
+    std::vector<int> scaleIndices(partitionCount, CUMULATIVE_SCALE);
+    std::vector<double> logLByPartition(partitionCount);
+    double logL = 0.0;
+    beagleCalculateRootLogLikelihoodsByPartition(instance, &roots[0], &indices[0], &indices[0],
+                                                 &scaleIndices[0], &partitionIndices[0],
+                                                 partitionCount, 1, &logLByPartition[0], &logL);
+    check("root logL by partition", logL, rootLogL, 1E-10);
+    beagleCalculateEdgeLogLikelihoodsByPartition(instance, &parents[0], &children[0], &matrices[0],
+                                                 NULL, NULL, &indices[0], &indices[0],
+                                                 &scaleIndices[0], &partitionIndices[0],
+                                                 partitionCount, 1, &logLByPartition[0], &logL,
+                                                 NULL, NULL, NULL, NULL);
+    check("edge logL by partition", logL, edgeLogL, 1E-10);
+}
+
+/*
+ * Changes how many threads work on a threaded instance and where they run,
+ * and checks the log likelihoods after each change.
+ */
+static void checkThreadControls(int instance,
+                                int serialInstance,
+                                double rootLogL,
+                                double edgeLogL) {
+    checkCode("no threads", beagleSetCPUThreadCount(instance, 0), BEAGLE_ERROR_OUT_OF_RANGE);
+    checkCode("thread count without threading", beagleSetCPUThreadCount(serialInstance, 2),
+              BEAGLE_ERROR_NO_IMPLEMENTATION);
+    checkCode("no patterns per thread", beagleSetCPUMinPatternsPerThread(instance, 0),
+              BEAGLE_ERROR_OUT_OF_RANGE);
+
+    beagleSetCPUThreadCount(instance, 3);
+    check("root logL on 3 threads", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+
+    // More threads than the pool has are limited to the pool
+    beagleSetCPUThreadCount(instance, 2 * threadCount);
+    check("root logL on all threads", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+
+    // Too few patterns for two threads turn threading off
+    beagleSetCPUMinPatternsPerThread(instance, patternCount);
+    check("root logL on one thread", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+    beagleSetCPUMinPatternsPerThread(instance, 100);
+    check("root logL on threads again", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+
+    int cpu = 0;
+    checkCode("negative CPU count", beagleSetCPUThreadAffinity(&cpu, -1), BEAGLE_ERROR_OUT_OF_RANGE);
+    if (beagleSetCPUThreadAffinity(&cpu, 1) == BEAGLE_SUCCESS)
+        check("root logL pinned", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+    checkCode("missing NUMA node", beagleSetCPUThreadNUMANode(1 << 20), BEAGLE_ERROR_OUT_OF_RANGE);
+    if (beagleSetCPUThreadNUMANode(0) == BEAGLE_SUCCESS)
+        check("root logL on NUMA node", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+
+    // Partition slices of the buffers are touched again by the threads of the pinned pool
+    checkPartitions(instance, 2, rootLogL, edgeLogL);
+    beagleSetCPUThreadAffinity(NULL, 0);
+}
+
+/*
+ * Counts the threads of the process, other than the main thread, that may run
+ * on a CPU other than cpu; 0 where this cannot be read.
+ */
+static int countUnpinnedThreads(int cpu) {
+    int count = 0;
+#if defined(__linux__)
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == NULL)
+        return 0;
+    const std::string pinned = std::to_string(cpu);
+    while (struct dirent* task = readdir(tasks)) {
+        if (task->d_name[0] == '.' || atoi(task->d_name) == getpid())
+            continue;
+        std::ifstream status(("/proc/self/task/" + std::string(task->d_name) + "/status").c_str());
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 19, "Cpus_allowed_list:\t") == 0 && line.substr(19) != pinned)
+                count++;
+        }
+    }
+    closedir(tasks);
+#endif
+    return count;
+}
+
+/*
+ * Changes the thread count while an instance uses the pool, so that a later
+ * instance gets a new pool, and pins the workers of both.
+ */
+static void checkReplacedPool(double rootLogL) {
+    int instance = createInstance(BEAGLE_FLAG_THREADING_CPP);
+    beagleSetCPUThreadPoolSize(threadCount - 1);
+    int laterInstance = createInstance(BEAGLE_FLAG_THREADING_CPP);
+
+    int cpu = 0;
+    if (beagleSetCPUThreadAffinity(&cpu, 1) == BEAGLE_SUCCESS)
+        checkCount("workers of both pools pinned", countUnpinnedThreads(cpu), 0);
+    check("root logL on the replaced pool", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+    check("root logL on the new pool", calculateRootLogLikelihood(laterInstance, true), rootLogL, 1E-10);
+
+    beagleFinalizeInstance(instance);
+    beagleFinalizeInstance(laterInstance);
+    beagleSetCPUThreadAffinity(NULL, 0);
+    beagleSetCPUThreadPoolSize(threadCount);
+}
+
+int main(int argc, const char* argv[]) {
+    beagleSetCPUThreadPoolSize(threadCount);
+
+    int reference = createInstance(BEAGLE_FLAG_THREADING_NONE);
+    double rootLogL = calculateRootLogLikelihood(reference, true);
+    double edgeLogL = edgeLogLikelihood(reference);
+
+    // Patterns are split across the threads automatically
+    int instance = createInstance(BEAGLE_FLAG_THREADING_CPP);
+    check("root logL", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+    check("edge logL", edgeLogLikelihood(instance), edgeLogL, 1E-10);
+    check("root logL with buffers reused", calculateRootLogLikelihood(instance, true), rootLogL, 1E-10);
+
+    // Fewer partitions than threads run independent operations concurrently by level
+    checkPartitions(instance, 2, rootLogL, edgeLogL);
+    beagleFinalizeInstance(instance);
+
+    // More partitions than threads
+    instance = createInstance(BEAGLE_FLAG_THREADING_CPP);
+    checkCode("set thread count", beagleSetCPUThreadCount(instance, 2), BEAGLE_SUCCESS);
+    checkPartitions(instance, 5, rootLogL, edgeLogL);
+    beagleFinalizeInstance(instance);
+
+    instance = createInstance(BEAGLE_FLAG_THREADING_CPP);
+    checkThreadControls(instance, reference, rootLogL, edgeLogL);
+    beagleFinalizeInstance(instance);
+
+    checkReplacedPool(rootLogL);
+
+    beagleFinalizeInstance(reference);
+
+    return failureCount;
+}
@@ -0,0 +1,107 @@
+/*
+ *  tilingtest.cpp
+ *  BEAGLE
+ *
+ *  Checks that partials rescaled in blocks of patterns give the log
+ *  likelihoods of unscaled partials, and that running operation lists tile
+ *  by tile gives the same log likelihoods as running them operation by
+ *  operation, also by partition, on threads and with reused buffers.
+ *
+ */
+
+#include "featuretest.h"
+
+static const int patternCount = 1000;
+
+/*
+ * Computes the partials of each of two contiguous partitions with the
+ * operations of makeOperations and returns the log likelihood at the root
+ * summed over partitions.
+ */
+static double partitionsLogLikelihood(int instance) {
+    BeagleOperation operations[NODE_COUNT];
+    int operationCount = makeOperations(operations, true);
+    std::vector<BeagleOperationByPartition> partitionOperations;
+    for (int i = 0; i < operationCount; i++) {
+        for (int p = 0; p < 2; p++) {
+            BeagleOperationByPartition operation = {operations[i].destinationPartials,
+                                                    operations[i].destinationScaleWrite,
+                                                    operations[i].destinationScaleRead,
+                                                    operations[i].child1Partials,
+                                                    operations[i].child1TransitionMatrix,
+                                                    operations[i].child2Partials,
+                                                    operations[i].child2TransitionMatrix,
+                                                    p, CUMULATIVE_SCALE};
+            partitionOperations.push_back(operation);
+        }
+    }
+
+    for (int p = 0; p < 2; p++)
+        beagleResetScaleFactorsByPartition(instance, CUMULATIVE_SCALE, p);
+    beagleUpdatePartialsByPartition(instance, &partitionOperations[0], (int) partitionOperations.size());
+
+    int roots[2] = {ROOT_NODE, ROOT_NODE};
+    int indices[2] = {0, 0};
+    int scaleIndices[2] = {CUMULATIVE_SCALE, CUMULATIVE_SCALE};
+    int partitionIndices[2] = {0, 1};
+    double logLByPartition[2];
+    double logL = 0.0;
+    beagleCalculateRootLogLikelihoodsByPartition(instance, roots, indices, indices, scaleIndices,
+                                                 partitionIndices, 2, 1, logLByPartition, &logL);
+    return logL;
+}
+
+static void checkTiles(int stateCount,
+                       long requirementFlags,
+                       double tolerance) {
+    int instance = createTestInstance(stateCount, patternCount, 0, NODE_COUNT - 1, 0,
+                                      requirementFlags, true);
+    updateMatrices(instance, edgeLengths);
+
+    // No partials underflow on this tree, so scaling only changes rounding
+    double unscaledLogL = calculateRootLogLikelihood(instance, false);
+    double logL = calculateRootLogLikelihood(instance, true);
+    check("rescaled in blocks", logL, unscaledLogL, tolerance);
+
+    // Tiles shorter than, equal to and not dividing the patterns of a rescaling block
+    const int tileSizes[4] = {1, 37, 256, patternCount};
+    for (int i = 0; i < 4; i++) {
+        checkCode("set tile patterns", beagleSetCPUTilePatternCount(instance, tileSizes[i]), BEAGLE_SUCCESS);
+        check("tiled", calculateRootLogLikelihood(instance, true), logL, 0.0);
+        check("tiled with buffers reused", calculateRootLogLikelihood(instance, true), logL, 0.0);
+    }
+    beagleSetCPUTilePatternCount(instance, 0);
+
+    // Tiles start at each partition's first pattern
+    std::vector<int> partitions(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        partitions[k] = (3 * k < patternCount ? 0 : 1);
+    beagleSetPatternPartitions(instance, 2, &partitions[0]);
+    double partitionsLogL = partitionsLogLikelihood(instance);
+    check("by partition", partitionsLogL, logL, tolerance);
+    beagleSetCPUTilePatternCount(instance, 37);
+    check("tiled by partition", partitionsLogLikelihood(instance), partitionsLogL, 0.0);
+
+    beagleFinalizeInstance(instance);
+}
+
+int main(int argc, const char* argv[]) {
+    beagleSetCPUThreadPoolSize(4);
+
+    checkTiles(4, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_NONE, 1E-10);
+    checkTiles(4, BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_THREADING_NONE, 1E-5);
+    checkTiles(20, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_NONE, 1E-10);
+    checkTiles(20, BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_THREADING_NONE, 1E-5);
+    checkTiles(4, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_CPP, 1E-10);
+    checkTiles(20, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_CPP, 1E-10);
+
+    int instance = createTestInstance(4, patternCount, 0, NODE_COUNT - 1, 0,
+                                      BEAGLE_FLAG_SCALING_ALWAYS, true);
+    checkCode("tiles with scaling always", beagleSetCPUTilePatternCount(instance, 37),
+              BEAGLE_ERROR_NO_IMPLEMENTATION);
+    checkCode("negative tile patterns", beagleSetCPUTilePatternCount(instance, -1),
+              BEAGLE_ERROR_OUT_OF_RANGE);
+    beagleFinalizeInstance(instance);
+
+    return failureCount;
+}
@@ -0,0 +1,68 @@
+/*
+ *  tipstatestest.cpp
+ *  BEAGLE
+ *
+ *  Checks that tips set as compact states give the log likelihood of the same
+ *  tips set as partials, for several state counts, precisions and vector
+ *  implementations, and that 4-state tips packed two bits per pattern give
+ *  the same again.
+ *
+ */
+
+#include "featuretest.h"
+
+static void checkTipStates(int stateCount,
+                           long preferenceFlags,
+                           long requirementFlags) {
+    // An odd pattern count leaves a partial vector at the end
+    const int patternCount = 301;
+    const double tolerance = (requirementFlags & BEAGLE_FLAG_PRECISION_DOUBLE ? 1E-12 : 1E-6);
+    int compact = createTestInstance(stateCount, patternCount, 0, NODE_COUNT - 1, preferenceFlags,
+                                     requirementFlags, true);
+    int partials = createTestInstance(stateCount, patternCount, 0, NODE_COUNT - 1, preferenceFlags,
+                                      requirementFlags, false);
+    updateMatrices(compact, edgeLengths);
+    updateMatrices(partials, edgeLengths);
+
+    double logL = calculateRootLogLikelihood(compact, true);
+    check("compact tips logL", logL, calculateRootLogLikelihood(partials, true), tolerance);
+
+    if (stateCount == 4) {
+        // Tips already set are converted
+        checkCode("pack tips", beagleSetCPUPackedTipStates(compact, 1), BEAGLE_SUCCESS);
+        check("packed tips logL", calculateRootLogLikelihood(compact, true), logL, 1E-12);
+
+        // Tips set afterwards are packed as they are set
+        std::vector<int> states = makeTipStates(4, patternCount);
+        for (int tip = 0; tip < TIP_COUNT; tip++)
+            beagleSetTipStates(compact, tip, &states[tip * patternCount]);
+        check("tips set packed logL", calculateRootLogLikelihood(compact, true), logL, 1E-12);
+
+        checkCode("unpack tips", beagleSetCPUPackedTipStates(compact, 0), BEAGLE_SUCCESS);
+        check("unpacked tips logL", calculateRootLogLikelihood(compact, true), logL, 1E-12);
+    } else {
+        checkCode("pack tips", beagleSetCPUPackedTipStates(compact, 1), BEAGLE_ERROR_NO_IMPLEMENTATION);
+    }
+
+    beagleFinalizeInstance(compact);
+    beagleFinalizeInstance(partials);
+}
+
+int main(int argc, const char* argv[]) {
+    const int stateCounts[3] = {4, 20, 61};
+    const long precisions[2] = {BEAGLE_FLAG_PRECISION_DOUBLE, BEAGLE_FLAG_PRECISION_SINGLE};
+    const long vectors[3] = {BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_VECTOR_SSE, BEAGLE_FLAG_VECTOR_AVX};
+    const char* vectorNames[3] = {"no vectors", "SSE", "AVX"};
+
+    for (int v = 0; v < 3; v++) {
+        for (int s = 0; s < 3; s++) {
+            for (int p = 0; p < 2; p++) {
+                fprintf(stdout, "%d states, %s precision, %s preferred\n", stateCounts[s],
+                        (p == 0 ? "double" : "single"), vectorNames[v]);
+                checkTipStates(stateCounts[s], vectors[v], precisions[p]);
+            }
+        }
+    }
+
+    return failureCount;
+}
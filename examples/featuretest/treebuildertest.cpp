@@ -0,0 +1,85 @@
+/*
+ *  treebuildertest.cpp
+ *  BEAGLE
+ *
+ *  Checks the operations built from a parent array, and that updating only
+ *  the dirty part of a tree gives the log likelihood of a full update.
+ *
+ */
+
+#include "featuretest.h"
+
+int main(int argc, const char* argv[]) {
+    BeagleOperation operations[NODE_COUNT];
+    int operationCount;
+    int levelOffsets[NODE_COUNT + 1];
+    int levelCount;
+    int matrixIndices[NODE_COUNT];
+    int matrixCount;
+
+    checkCode("build full tree",
+              beagleGetTreeOperations(parentIndices, NODE_COUNT, TIP_COUNT, NULL, 0, 1,
+                                      operations, &operationCount, levelOffsets, &levelCount,
+                                      matrixIndices, &matrixCount),
+              BEAGLE_SUCCESS);
+    checkCount("operations", operationCount, NODE_COUNT - TIP_COUNT);
+    checkCount("matrices", matrixCount, NODE_COUNT - 1);
+    checkCount("levels", levelCount, 3);
+    checkCount("last level offset", levelOffsets[levelCount], operationCount);
+
+    // Operations of a level only read tips and partials of lower levels
+    std::vector<int> level(NODE_COUNT, -1);
+    int misplaced = 0;
+    for (int l = 0; l < levelCount; l++) {
+        for (int i = levelOffsets[l]; i < levelOffsets[l + 1]; i++) {
+            const BeagleOperation& op = operations[i];
+            if (op.destinationScaleWrite != op.destinationPartials - TIP_COUNT ||
+                parentIndices[op.child1Partials] != op.destinationPartials ||
+                parentIndices[op.child2Partials] != op.destinationPartials ||
+                (op.child1Partials >= TIP_COUNT && !(level[op.child1Partials] >= 0 && level[op.child1Partials] < l)) ||
+                (op.child2Partials >= TIP_COUNT && !(level[op.child2Partials] >= 0 && level[op.child2Partials] < l)))
+                misplaced++;
+        }
+        for (int i = levelOffsets[l]; i < levelOffsets[l + 1]; i++)
+            level[operations[i].destinationPartials] = l;
+    }
+    checkCount("misplaced operations", misplaced, 0);
+
+    int dirtyNode = 2;
+    beagleGetTreeOperations(parentIndices, NODE_COUNT, TIP_COUNT, &dirtyNode, 1, 0,
+                            operations, &operationCount, NULL, NULL, matrixIndices, &matrixCount);
+    checkCount("operations above a dirty tip", operationCount, 3);
+    checkCount("matrices of a dirty tip", matrixCount, 1);
+    checkCount("matrix of a dirty tip", matrixIndices[0], dirtyNode);
+
+    int instance = createTestInstance(4, 500, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+    int reference = createTestInstance(4, 500, 0, NODE_COUNT - 1, 0, BEAGLE_FLAG_PRECISION_DOUBLE, true);
+
+    double lengths[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++)
+        lengths[i] = edgeLengths[i];
+
+    checkCode("update full tree",
+              beagleUpdateTree(instance, 0, parentIndices, lengths, NODE_COUNT, TIP_COUNT,
+                               NULL, 0, CUMULATIVE_SCALE),
+              BEAGLE_SUCCESS);
+    updateMatrices(reference, lengths);
+    check("full tree logL", rootLogLikelihood(instance, true), calculateRootLogLikelihood(reference, true),
+          1E-12);
+
+    int dirtyNodes[2][2] = {{5, 0}, {9, 3}};
+    for (int rep = 0; rep < 2; rep++) {
+        lengths[dirtyNodes[rep][0]] += 0.1;
+        lengths[dirtyNodes[rep][1]] *= 0.5;
+        beagleUpdateTree(instance, 0, parentIndices, lengths, NODE_COUNT, TIP_COUNT,
+                         dirtyNodes[rep], 2, CUMULATIVE_SCALE);
+        updateMatrices(reference, lengths);
+        check("dirty tree logL", rootLogLikelihood(instance, true), calculateRootLogLikelihood(reference, true),
+              1E-12);
+    }
+
+    beagleFinalizeInstance(instance);
+    beagleFinalizeInstance(reference);
+
+    return failureCount;
+}
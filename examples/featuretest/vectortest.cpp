@@ -0,0 +1,183 @@
+/*
+ *  vectortest.cpp
+ *  BEAGLE
+ *
+ *  Checks every CPU implementation of every CPU plugin that loads on this
+ *  processor (generic, SSE, AVX, AVX2/FMA and AVX-512, in single and double
+ *  precision, for 4 states and general state counts) against the generic
+ *  double precision implementation: log likelihoods at the root and on two
+ *  edges, and the derivatives on those edges. Implementations are created
+ *  from their plugin's factories, since the library only offers the widest
+ *  AVX variant the processor supports.
+ *
+ */
+
+#include "featuretest.h"
+
+#include <string.h>
+
+#include "libhmsbeagle/BeagleImpl.h"
+#include "libhmsbeagle/plugin/Plugin.h"
+
+static const int patternCount = 1000;
+
+// Matrix of the edge between the two children of the root, and its derivatives
+#define EDGE_MATRIX (NODE_COUNT - 1)
+#define FIRST_DERIVATIVE_MATRIX NODE_COUNT
+#define SECOND_DERIVATIVE_MATRIX (NODE_COUNT + 1)
+
+#define RESULT_COUNT 7
+
+static const char* resultNames[RESULT_COUNT] = {"root logL",
+                                                "edge logL", "edge first derivative",
+                                                "edge second derivative",
+                                                "tip edge logL", "tip edge first derivative",
+                                                "tip edge second derivative"};
+
+static beagle::BeagleImpl* createImpl(beagle::BeagleImplFactory* factory,
+                                      int stateCount) {
+    const long precision = factory->getFlags() & (BEAGLE_FLAG_PRECISION_SINGLE |
+                                                  BEAGLE_FLAG_PRECISION_DOUBLE);
+    int errorCode = BEAGLE_SUCCESS;
+    return factory->createImpl(TIP_COUNT, NODE_COUNT - TIP_COUNT, TIP_COUNT, stateCount,
+                               patternCount, 1, NODE_COUNT + 2, CATEGORY_COUNT, TIP_COUNT, 0, 0, 0,
+                               precision | BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_SCALING_MANUAL |
+                               BEAGLE_FLAG_THREADING_NONE,
+                               &errorCode);
+}
+
+/*
+ * Sets the data and model as createTestInstance does, computes all partials
+ * with rescaling and fills results with the values named in resultNames. The
+ * tip edge joins tip 0 to the partials of its parent.
+ */
+static void computeResults(beagle::BeagleImpl* impl,
+                           int stateCount,
+                           double* results) {
+    std::vector<int> states = makeTipStates(stateCount, patternCount);
+    for (int tip = 0; tip < TIP_COUNT; tip++)
+        impl->setTipStates(tip, &states[tip * patternCount]);
+
+    std::vector<double> evec, ivec, eval;
+    makeEigenDecomposition(stateCount, evec, ivec, eval);
+    impl->setEigenDecomposition(0, &evec[0], &ivec[0], &eval[0]);
+
+    std::vector<double> freqs(stateCount, 1.0 / stateCount);
+    impl->setStateFrequencies(0, &freqs[0]);
+    double weights[CATEGORY_COUNT];
+    for (int c = 0; c < CATEGORY_COUNT; c++)
+        weights[c] = 1.0 / CATEGORY_COUNT;
+    impl->setCategoryWeights(0, weights);
+    impl->setCategoryRates(categoryRates);
+    std::vector<double> patternWeights(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        patternWeights[k] = 1.0 + (k % 3);
+    impl->setPatternWeights(&patternWeights[0]);
+
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    impl->updateTransitionMatrices(0, matrixIndices, NULL, NULL, edgeLengths, NODE_COUNT - 1);
+    int matrix = EDGE_MATRIX;
+    int firstDerivativeMatrix = FIRST_DERIVATIVE_MATRIX;
+    int secondDerivativeMatrix = SECOND_DERIVATIVE_MATRIX;
+    double length = edgeLengths[ROOT_NODE - 2] + edgeLengths[ROOT_NODE - 1];
+    impl->updateTransitionMatrices(0, &matrix, &firstDerivativeMatrix, &secondDerivativeMatrix,
+                                   &length, 1);
+
+    BeagleOperation operations[NODE_COUNT];
+    int operationCount = makeOperations(operations, true);
+    impl->resetScaleFactors(CUMULATIVE_SCALE);
+    impl->updatePartials((const int*) operations, operationCount, CUMULATIVE_SCALE);
+
+    int rootIndex = ROOT_NODE;
+    int zero = 0;
+    int cumulativeScaleIndex = CUMULATIVE_SCALE;
+    impl->calculateRootLogLikelihoods(&rootIndex, &zero, &zero, &cumulativeScaleIndex, 1, &results[0]);
+
+    int parent = ROOT_NODE - 2;
+    int child = ROOT_NODE - 1;
+    impl->calculateEdgeLogLikelihoods(&parent, &child, &matrix, &firstDerivativeMatrix,
+                                      &secondDerivativeMatrix, &zero, &zero, &cumulativeScaleIndex,
+                                      1, &results[1], &results[2], &results[3]);
+
+    parent = parentIndices[0];
+    child = 0;
+    impl->calculateEdgeLogLikelihoods(&parent, &child, &matrix, &firstDerivativeMatrix,
+                                      &secondDerivativeMatrix, &zero, &zero, &cumulativeScaleIndex,
+                                      1, &results[4], &results[5], &results[6]);
+}
+
+/*
+ * Returns the factory named name of the given plugin, or NULL.
+ */
+static beagle::BeagleImplFactory* findFactory(beagle::plugin::Plugin* plugin,
+                                              const char* name) {
+    const std::list<beagle::BeagleImplFactory*>& factories = plugin->getBeagleFactories();
+    for (std::list<beagle::BeagleImplFactory*>::const_iterator it = factories.begin();
+         it != factories.end(); ++it) {
+        if (strcmp((*it)->getName(), name) == 0)
+            return *it;
+    }
+    return NULL;
+}
+
+static void checkImplementations(beagle::plugin::Plugin* plugin,
+                                 int stateCount,
+                                 const double* expected) {
+    const std::list<beagle::BeagleImplFactory*>& factories = plugin->getBeagleFactories();
+    for (std::list<beagle::BeagleImplFactory*>::const_iterator it = factories.begin();
+         it != factories.end(); ++it) {
+        beagle::BeagleImpl* impl = createImpl(*it, stateCount);
+        if (impl == NULL)
+            continue; // not for this state count
+
+        BeagleInstanceDetails details;
+        impl->getInstanceDetails(&details);
+        fprintf(stdout, "Impl Name : %s, %d states\n", details.implName, stateCount);
+        const double tolerance = ((*it)->getFlags() & BEAGLE_FLAG_PRECISION_SINGLE ? 1E-4 : 1E-10);
+
+        double results[RESULT_COUNT];
+        computeResults(impl, stateCount, results);
+        for (int i = 0; i < RESULT_COUNT; i++)
+            check(resultNames[i], results[i], expected[i], tolerance);
+
+        delete impl;
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const char* pluginNames[] = {"hmsbeagle-cpu", "hmsbeagle-cpu-sse", "hmsbeagle-cpu-avx",
+                                 "hmsbeagle-cpu-avx2", "hmsbeagle-cpu-avx512"};
+    const int pluginCount = sizeof(pluginNames) / sizeof(pluginNames[0]);
+    std::vector<beagle::plugin::Plugin*> plugins;
+    for (int i = 0; i < pluginCount; i++) {
+        try {
+            plugins.push_back(beagle::plugin::PluginManager::instance().findPlugin(pluginNames[i]));
+        } catch (beagle::plugin::SharedLibraryException& e) {
+            // Not built, or the processor lacks its instructions
+            fprintf(stdout, "skipping %s: %s\n", pluginNames[i], e.getError());
+        }
+    }
+    beagle::BeagleImplFactory* referenceFactory = NULL;
+    if (!plugins.empty() && plugins[0]->pluginName() == "CPU")
+        referenceFactory = findFactory(plugins[0], "CPU-Double");
+    if (referenceFactory == NULL) {
+        fprintf(stderr, "Failed to load the CPU plugin\n\n");
+        return 1;
+    }
+
+    // Row padding differs for state counts of 4, 4n + 3 and 4n
+    const int stateCounts[3] = {4, 7, 20};
+    for (int s = 0; s < 3; s++) {
+        beagle::BeagleImpl* reference = createImpl(referenceFactory, stateCounts[s]);
+        double expected[RESULT_COUNT];
+        computeResults(reference, stateCounts[s], expected);
+        delete reference;
+
+        for (size_t p = 0; p < plugins.size(); p++)
+            checkImplementations(plugins[p], stateCounts[s], expected);
+    }
+
+    return failureCount;
+}
@@ -16,6 +16,10 @@
 #include <cmath>
 #include <stack>
 #include <queue>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <cerrno>
 
 #ifdef _WIN32
     #include <winsock.h>
@@ -24,6 +28,13 @@
     #include <sys/time.h>
 #endif
 
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
 #include "libhmsbeagle/beagle.h"
 #include "linalg.h"
 
@@ -54,6 +65,74 @@ double cpuTimeSetPartitions, cpuTimeUpdateTransitionMatrices, cpuTimeUpdateParti
 
 bool useStdlibRand;
 
+// heap allocations are counted while enabled, to check that evaluation loops do not allocate
+static std::atomic<bool> gCountAllocations(false);
+static std::atomic<long> gAllocationCount(0);
+
+#if defined(__GLIBC__)
+// replacing the C allocators also counts operator new, which allocates through them
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size) __THROW {
+    if (gCountAllocations)
+        gAllocationCount++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) __THROW {
+    if (gCountAllocations)
+        gAllocationCount++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) __THROW {
+    if (gCountAllocations)
+        gAllocationCount++;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) __THROW {
+    if (gCountAllocations)
+        gAllocationCount++;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) __THROW {
+    if (gCountAllocations)
+        gAllocationCount++;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size) __THROW {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if (gCountAllocations)
+        gAllocationCount++;
+    void* p = __libc_memalign(alignment, size);
+    if (p == NULL && size > 0)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+#else
+// only operator new can be replaced portably; C allocations are not counted here
+void* operator new(size_t size) {
+    if (gCountAllocations)
+        gAllocationCount++;
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+#endif
+
 static unsigned int rand_state = 1;
 
 int gt_rand_r(unsigned int *seed)
@@ -85,6 +164,38 @@ void abort(std::string msg) {
     std::exit(1);
 }
 
+// counts data TLB load misses of the calling thread; returns -1 where this is not possible
+int openTLBMissCounter() {
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+long long readTLBMissCounter(int counter) {
+    long long count = 0;
+#if defined(__linux__)
+    if (read(counter, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+#endif
+    return count;
+}
+
+void closeTLBMissCounter(int counter) {
+#if defined(__linux__)
+    close(counter);
+#endif
+}
+
 double* getRandomTipPartials( int nsites, int stateCount )
 {
     double *partials = (double*) calloc(sizeof(double), nsites * stateCount); // 'malloc' was a bug
@@ -394,7 +505,20 @@ void runBeagle(int resource,
                bool newDataPerRep,
                bool randomTree,
                bool rerootTrees,
-               bool pectinate)
+               bool pectinate,
+               int tilePatternCount,
+               bool usePlan,
+               bool treeUpdate,
+               bool skipUnchanged,
+               bool useSnapshot,
+               bool gradient,
+               bool optimizeEdge,
+               bool countAllocs,
+               bool packedTips,
+               bool releasePartials,
+               bool noArena,
+               bool tlbMisses,
+               bool mixedPrecision)
 {
     
     int edgeCount = ntaxa*2-2;
@@ -402,6 +526,16 @@ void runBeagle(int resource,
     int partialCount = ((ntaxa+internalCount)-compactTipCount)*eigenCount;
     int scaleCount = ((manualScaling || dynamicScaling) ? ntaxa : 0);
 
+    // pre-order partials for every node follow the post-order buffers and, with
+    // manual scaling, write scale buffers after the post-order ones
+    int preOffset = ntaxa + internalCount;
+    int preScaleCount = 0;
+    if (gradient) {
+        partialCount += ntaxa + internalCount;
+        if (manualScaling)
+            preScaleCount = edgeCount;
+    }
+
     int modelCount = eigenCount * partitionCount;
     
     BeagleInstanceDetails instDetails;
@@ -414,9 +548,9 @@ void runBeagle(int resource,
                 stateCount,       /**< Number of states in the continuous-time Markov chain (input) */
                 nsites,           /**< Number of site patterns to be handled by the instance (input) */
                 modelCount,               /**< Number of rate matrix eigen-decomposition buffers to allocate (input) */
-                (calcderivs ? (3*edgeCount*modelCount) : edgeCount*modelCount),/**< Number of rate matrix buffers (input) */
+                ((calcderivs || gradient) ? (3*edgeCount*modelCount) : edgeCount*modelCount),/**< Number of rate matrix buffers (input) */
                 rateCategoryCount,/**< Number of rate categories */
-                scaleCount*eigenCount,          /**< scaling buffers */
+                scaleCount*eigenCount + preScaleCount,          /**< scaling buffers */
                 &resource,        /**< List of potential resource on which this instance is allowed (input, NULL implies no restriction */
                 1,                /**< Length of resourceList list (input) */
                 0,         /**< Bit-flags indicating preferred implementation charactertistics, see BeagleFlags (input) */
@@ -447,6 +581,26 @@ void runBeagle(int resource,
 
     if (!(instDetails.flags & BEAGLE_FLAG_SCALING_AUTO))
         autoScaling = false;
+
+    if (tilePatternCount > 0 &&
+        beagleSetCPUTilePatternCount(instance, tilePatternCount) != BEAGLE_SUCCESS)
+        fprintf(stdout, "Tiled partials updates are not supported by this implementation\n\n");
+
+    if (skipUnchanged &&
+        beagleSetCPUSkipUnchangedOperations(instance, 1) != BEAGLE_SUCCESS)
+        fprintf(stdout, "Skipping unchanged operations is not supported by this implementation\n\n");
+
+    if (packedTips &&
+        beagleSetCPUPackedTipStates(instance, 1) != BEAGLE_SUCCESS)
+        fprintf(stdout, "Packed tip states are not supported by this implementation\n\n");
+
+    if (noArena &&
+        beagleSetCPUBufferArena(instance, 0) != BEAGLE_SUCCESS)
+        fprintf(stdout, "Buffer arenas are not supported by this implementation\n\n");
+
+    if (mixedPrecision &&
+        beagleSetCPUMixedPrecision(instance, 1) != BEAGLE_SUCCESS)
+        fprintf(stdout, "Mixed precision is not supported by this implementation\n\n");
     
     // set the sequences for each tip using partial likelihood arrays
     gt_srand(randomSeed);   // fix the random seed...
@@ -542,6 +696,7 @@ void runBeagle(int resource,
         eval = (double*)malloc(sizeof(double)*stateCount*2);
     double* evec = (double*)malloc(sizeof(double)*stateCount*stateCount);
     double* ivec = (double*)malloc(sizeof(double)*stateCount*stateCount);
+    double* rateMatrix = new double[stateCount*stateCount];
     
     for (int eigenIndex=0; eigenIndex < modelCount; eigenIndex++) {
         if (!eigencomplex && ((stateCount & (stateCount-1)) == 0)) {
@@ -688,6 +843,19 @@ void runBeagle(int resource,
             // set the Eigen decomposition
             beagleSetEigenDecomposition(instance, eigenIndex, &evec[0], &ivec[0], &eval[0]);
         }
+
+        if (gradient) {
+            // the rate matrix, to check the cross products against the edge derivatives
+            for (int x=0; x<stateCount; x++) {
+                for (int y=0; y<stateCount; y++) {
+                    double sum = 0.0;
+                    for (int k=0; k<stateCount; k++)
+                        sum += evec[x*stateCount + k] * eval[k] *
+                               (ievectrans ? ivec[y*stateCount + k] : ivec[k*stateCount + y]);
+                    rateMatrix[x*stateCount + y] = sum;
+                }
+            }
+        }
     }
     
     free(eval);
@@ -790,6 +958,9 @@ void runBeagle(int resource,
     double deriv1 = 0.0;
     double deriv2 = 0.0;
     
+    int tlbMissCounter = (tlbMisses ? openTLBMissCounter() : -1);
+    long long tlbMissCount = 0;
+
     double previousLogL = 0.0;
     double previousDeriv1 = 0.0;
     double previousDeriv2 = 0.0;
@@ -937,8 +1108,84 @@ void runBeagle(int resource,
     }
 
 
+    // tree as a parent array for library-built operations; the first rep updates
+    // every node, later reps only the edge above tip 0 and its ancestors
+    int nodeCount = ntaxa + internalCount;
+    int* parentIndices = new int[nodeCount];
+    double* nodeEdgeLengths = new double[nodeCount];
+    int dirtyTip = 0;
+    if (treeUpdate) {
+        for (int j=0; j<nodeCount; j++) {
+            parentIndices[j] = -1;
+            nodeEdgeLengths[j] = (j < edgeCount ? edgeLengths[j] : 0.0);
+        }
+        for (int op=0; op<internalCount; op++) {
+            parentIndices[operations[op*beagleOpCount+3]] = operations[op*beagleOpCount+0];
+            parentIndices[operations[op*beagleOpCount+5]] = operations[op*beagleOpCount+0];
+        }
+    }
+
+    // pre-order operations from the root down; edges are indexed by the node below them
+    int* preOperations = NULL;
+    int* preIndices = NULL;
+    double* edgeDerivatives = NULL;
+    int preRootIndex = preOffset + rootIndices[0];
+    if (gradient) {
+        int* nodeMatrices = new int[nodeCount];
+        for (int op=0; op<internalCount; op++) {
+            nodeMatrices[operations[op*beagleOpCount+3]] = operations[op*beagleOpCount+4];
+            nodeMatrices[operations[op*beagleOpCount+5]] = operations[op*beagleOpCount+6];
+        }
+        nodeMatrices[rootIndices[0]] = BEAGLE_OP_NONE;
+
+        preOperations = new int[BEAGLE_OP_COUNT*edgeCount];
+        int preOp = 0;
+        for (int op=internalCount-1; op>=0; op--) {
+            int parentIndex = operations[op*beagleOpCount+0];
+            for (int c=0; c<2; c++) {
+                int childIndex = operations[op*beagleOpCount+(c == 0 ? 3 : 5)];
+                int siblingIndex = operations[op*beagleOpCount+(c == 0 ? 5 : 3)];
+                int* preOperation = &preOperations[preOp*BEAGLE_OP_COUNT];
+                preOperation[0] = preOffset + childIndex;
+                preOperation[1] = (manualScaling ? scaleCount + childIndex : BEAGLE_OP_NONE);
+                preOperation[2] = BEAGLE_OP_NONE;
+                preOperation[3] = preOffset + parentIndex;
+                preOperation[4] = nodeMatrices[parentIndex];
+                preOperation[5] = siblingIndex;
+                preOperation[6] = nodeMatrices[siblingIndex];
+                preOp++;
+            }
+        }
+        delete[] nodeMatrices;
+
+        preIndices = new int[edgeCount];
+        for (int j=0; j<edgeCount; j++)
+            preIndices[j] = preOffset + j;
+        edgeDerivatives = new double[edgeCount];
+    }
+    double* crossProducts = new double[rateCategoryCount*stateCount*stateCount];
+    double* repSiteLogLs = (double*) malloc(sizeof(double) * nsites);
+
+    // operation plans for rescaling and for reusing scale factors
+    int plans[2] = {-1, -1};
+    bool rootInPlan = (usePlan && !unrooted && !manualScaling);
+
     for (int i=0; i<nreps; i++){
 
+        if (releasePartials && i > 0) {
+            // every rep recomputes all internal partials, which then need no memory in between
+            int internalBufferCount = partialCount + compactTipCount - ntaxa;
+            int* internalBuffers = new int[internalBufferCount];
+            for (int j=0; j<internalBufferCount; j++)
+                internalBuffers[j] = ntaxa + j;
+            if (beagleReleasePartials(instance, internalBuffers, internalBufferCount) != BEAGLE_SUCCESS ||
+                beagleAllocatePartials(instance, internalBuffers, internalBufferCount) != BEAGLE_SUCCESS) {
+                printf("ERROR: No BEAGLE implementation for beagleReleasePartials\n");
+                exit(-1);
+            }
+            delete[] internalBuffers;
+        }
+
         if (newDataPerRep) {
             for(int ii=0; ii<ntaxa; ii++)
             {
@@ -962,8 +1209,15 @@ void runBeagle(int resource,
             }
         }
         
+        if (tlbMissCounter >= 0)
+            tlbMissCount -= readTLBMissCounter(tlbMissCounter);
+
         gettimeofday(&time0,NULL);
 
+        // every rep after the first must run without touching the heap
+        gAllocationCount = 0;
+        gCountAllocations = (countAllocs && i > 0);
+
         if (partitionCount > 1 && i==0) { //!(i % rescaleFrequency)) {
             if (beagleSetPatternPartitions(instance, partitionCount, patternPartitions) != BEAGLE_SUCCESS) {
                 printf("ERROR: No BEAGLE implementation for beagleSetPatternPartitions\n");
@@ -973,7 +1227,9 @@ void runBeagle(int resource,
 
         gettimeofday(&time1,NULL);
 
-        if (partitionCount > 1) {
+        if (usePlan || treeUpdate) {
+            // transition matrices are updated with the partials
+        } else if (partitionCount > 1) {
             int totalEdgeCount = edgeCount * modelCount;
             beagleUpdateTransitionMatricesWithMultipleModels(
                                            instance,     // instance
@@ -985,16 +1241,19 @@ void runBeagle(int resource,
                                            edgeLengths,   // edgeLengths
                                            totalEdgeCount);            // count
         } else {
+            // with skip-unchanged, later reps only change the edge above tip 0 and
+            // leave BEAGLE to skip the operations that do not depend on it
+            int updateEdgeCount = ((skipUnchanged && i > 0) ? 1 : edgeCount);
             for (int eigenIndex=0; eigenIndex < modelCount; eigenIndex++) {
                 if (!setmatrix) {
                     // tell BEAGLE to populate the transition matrices for the above edge lengths
                     beagleUpdateTransitionMatrices(instance,     // instance
                                                    eigenIndex,             // eigenIndex
                                                    &edgeIndices[eigenIndex*edgeCount],   // probabilityIndices
-                                                   (calcderivs ? &edgeIndicesD1[eigenIndex*edgeCount] : NULL), // firstDerivativeIndices
+                                                   ((calcderivs || gradient) ? &edgeIndicesD1[eigenIndex*edgeCount] : NULL), // firstDerivativeIndices
                                                    (calcderivs ? &edgeIndicesD2[eigenIndex*edgeCount] : NULL), // secondDerivativeIndices
                                                    edgeLengths,   // edgeLengths
-                                                   edgeCount);            // count
+                                                   updateEdgeCount);            // count
                 } else {
                     double* inMatrix = new double[stateCount*stateCount*rateCategoryCount];
                     for (int matrixIndex=0; matrixIndex < edgeCount; matrixIndex++) {
@@ -1031,7 +1290,45 @@ void runBeagle(int resource,
             gettimeofday(&time2, NULL);
 
             // update the partials
-            if (partitionCount > 1) {
+            if (usePlan) {
+                int planIndex = ((manualScaling && (i % rescaleFrequency)) ? 1 : 0);
+                if (plans[planIndex] < 0) {
+                    // plans are set up once, outside the steady state
+                    bool counting = gCountAllocations;
+                    gCountAllocations = false;
+                    plans[planIndex] = beagleCreateOperationPlan(instance,
+                                                                 0,
+                                                                 edgeIndices,
+                                                                 edgeCount,
+                                                                 (BeagleOperation*)operations,
+                                                                 internalCount,
+                                                                 BEAGLE_OP_NONE,
+                                                                 (rootInPlan ? rootIndices[0] : BEAGLE_OP_NONE),
+                                                                 categoryWeightsIndices[0],
+                                                                 stateFrequencyIndices[0]);
+                    gCountAllocations = counting;
+                    if (plans[planIndex] < 0) {
+                        printf("ERROR: No BEAGLE implementation for beagleCreateOperationPlan\n");
+                        exit(-1);
+                    }
+                }
+                beagleUpdateWithOperationPlan(instance, plans[planIndex], edgeLengths,
+                                              (rootInPlan ? &logL : NULL));
+            } else if (treeUpdate) {
+                int treeReturnCode = beagleUpdateTree(instance,
+                                                      0,
+                                                      parentIndices,
+                                                      nodeEdgeLengths,
+                                                      nodeCount,
+                                                      ntaxa,
+                                                      (i == 0 ? NULL : &dirtyTip),
+                                                      (i == 0 ? 0 : 1),
+                                                      cumulativeScalingFactorIndices[0]);
+                if (treeReturnCode != BEAGLE_SUCCESS) {
+                    printf("ERROR: beagleUpdateTree failed (%d)\n", treeReturnCode);
+                    exit(-1);
+                }
+            } else if (partitionCount > 1) {
                 beagleUpdatePartialsByPartition( instance,                   // instance
                                 (BeagleOperationByPartition*)operations,     // operations
                                 internalCount*eigenCount*partitionCount);    // operationCount
@@ -1059,7 +1356,9 @@ void runBeagle(int resource,
         int scalingFactorsCount = internalCount;
                 
         for (int eigenIndex=0; eigenIndex < eigenCount; eigenIndex++) {
-            if (manualScaling && !(i % rescaleFrequency)) {
+            if (manualScaling && treeUpdate) {
+                // cumulative scale factors are kept up to date by beagleUpdateTree
+            } else if (manualScaling && !(i % rescaleFrequency)) {
                 beagleResetScaleFactors(instance,
                                         cumulativeScalingFactorIndices[eigenIndex]);
                 
@@ -1076,7 +1375,9 @@ void runBeagle(int resource,
 
         // calculate the site likelihoods at the root node
         if (!unrooted) {
-            if (partitionCount > 1) {
+            if (rootInPlan) {
+                // integrated by the plan
+            } else if (partitionCount > 1) {
                 beagleCalculateRootLogLikelihoodsByPartition(
                                             instance,               // instance
                                             rootIndices,// bufferIndices
@@ -1135,8 +1436,38 @@ void runBeagle(int resource,
             }
 
         }
+
+        if (gradient) {
+            // one pre-order pass gives the derivatives for all edges
+            if (beagleSetRootPrePartials(instance, &preRootIndex, stateFrequencyIndices, 1) != BEAGLE_SUCCESS ||
+                beagleUpdatePrePartials(instance, (BeagleOperation*)preOperations, edgeCount) != BEAGLE_SUCCESS ||
+                beagleCalculateEdgeDerivatives(instance, edgeIndices, preIndices, edgeIndices, edgeIndicesD1,
+                                               categoryWeightsIndices[0], edgeCount,
+                                               edgeDerivatives) != BEAGLE_SUCCESS ||
+                beagleCalculateCrossProducts(instance, edgeIndices, preIndices, edgeIndices, edgeLengths,
+                                             categoryWeightsIndices[0], edgeCount,
+                                             crossProducts) != BEAGLE_SUCCESS) {
+                printf("ERROR: No BEAGLE implementation for pre-order edge derivatives\n");
+                exit(-1);
+            }
+        }
+        if (countAllocs)
+            beagleGetSiteLogLikelihoods(instance, repSiteLogLs);
+
         // end timing!
         gettimeofday(&time5,NULL);
+
+        if (tlbMissCounter >= 0)
+            tlbMissCount += readTLBMissCounter(tlbMissCounter);
+
+        if (countAllocs) {
+            gCountAllocations = false;
+            if (gAllocationCount > 0) {
+                printf("ERROR: %ld heap allocations in steady-state evaluation loop\n",
+                       (long) gAllocationCount);
+                exit(-1);
+            }
+        }
         
         // std::cout.setf(std::ios::showpoint);
         // std::cout.setf(std::ios::floatfield, std::ios::fixed);
@@ -1162,7 +1493,120 @@ void runBeagle(int resource,
             bestTimeAccumulateScaleFactors = getTimeDiff(time3, time4);
             bestTimeCalculateRootLogLikelihoods = getTimeDiff(time4, time5);
         }
+
+        if (useSnapshot) {
+            // reject a proposal that doubles every edge length: after restoring,
+            // the root must integrate to the same lnL without recomputing partials
+            if (beagleStoreSnapshot(instance) != BEAGLE_SUCCESS) {
+                printf("ERROR: No BEAGLE implementation for beagleStoreSnapshot\n");
+                exit(-1);
+            }
+            double* proposedEdgeLengths = new double[edgeCount];
+            for (int j=0; j<edgeCount; j++)
+                proposedEdgeLengths[j] = 2.0 * edgeLengths[j];
+            beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL,
+                                           proposedEdgeLengths, edgeCount);
+            beagleUpdatePartials(instance, (BeagleOperation*)operations, internalCount, BEAGLE_OP_NONE);
+            if (manualScaling && !(i % rescaleFrequency)) {
+                beagleResetScaleFactors(instance, cumulativeScalingFactorIndices[0]);
+                beagleAccumulateScaleFactors(instance, scalingFactorsIndices, internalCount,
+                                             cumulativeScalingFactorIndices[0]);
+            }
+            delete[] proposedEdgeLengths;
+
+            beagleRestoreSnapshot(instance);
+
+            double restoredLogL = 0.0;
+            if (!unrooted) {
+                beagleCalculateRootLogLikelihoods(instance, rootIndices, categoryWeightsIndices,
+                                                  stateFrequencyIndices, cumulativeScalingFactorIndices,
+                                                  1, &restoredLogL);
+            } else {
+                beagleCalculateEdgeLogLikelihoods(instance, rootIndices, lastTipIndices, lastTipIndices,
+                                                  NULL, NULL, categoryWeightsIndices, stateFrequencyIndices,
+                                                  cumulativeScalingFactorIndices, 1, &restoredLogL,
+                                                  NULL, NULL);
+            }
+            if (std::abs(restoredLogL - logL) > MAX_DIFF)
+                fprintf(stdout, "error: lnL changed after restoring snapshot\n");
+        }
         
+        if (gradient) {
+            // scaling all edges equals scaling the rate matrix, for which the cross
+            // products give the exact derivative
+            double treeScaleDerivative = 0.0;
+            for (int j=0; j<edgeCount; j++)
+                treeScaleDerivative += edgeLengths[j] * edgeDerivatives[j];
+            double rateScaleDerivative = 0.0;
+            for (int c=0; c<rateCategoryCount; c++) {
+                for (int x=0; x<stateCount*stateCount; x++)
+                    rateScaleDerivative += rates[c] * crossProducts[c*stateCount*stateCount + x] * rateMatrix[x];
+            }
+            if (std::abs(rateScaleDerivative - treeScaleDerivative) > 1e-3 * std::max(1.0, std::abs(treeScaleDerivative)))
+                fprintf(stdout, "error: cross products disagree with edge derivatives\n");
+        }
+
+        if (optimizeEdge) {
+            // optimize the edge of the last tip; the optimum must not be worse than the
+            // current length and must agree with the likelihood from transition matrices
+            double optimumLength = edgeLengths[ntaxa-1];
+            double optimumLogL, optimumDeriv1, optimumDeriv2;
+            if (beagleOptimizeEdgeLength(instance, rootIndices[0], lastTipIndices[0], 0,
+                                         categoryWeightsIndices[0], stateFrequencyIndices[0],
+                                         cumulativeScalingFactorIndices[0], 0.0, 10.0, 1e-8, 100,
+                                         &optimumLength, &optimumLogL, &optimumDeriv1,
+                                         &optimumDeriv2) != BEAGLE_SUCCESS) {
+                printf("ERROR: No BEAGLE implementation for edge length optimization\n");
+                exit(-1);
+            }
+            if (optimumLogL < logL - MAX_DIFF)
+                fprintf(stdout, "error: optimized edge length lowers lnL\n");
+
+            double matrixLogL = 0.0;
+            beagleUpdateTransitionMatrices(instance, 0, &lastTipIndices[0], NULL, NULL,
+                                           &optimumLength, 1);
+            beagleCalculateEdgeLogLikelihoods(instance, rootIndices, lastTipIndices, lastTipIndices,
+                                              NULL, NULL, categoryWeightsIndices, stateFrequencyIndices,
+                                              cumulativeScalingFactorIndices, 1, &matrixLogL,
+                                              NULL, NULL);
+            beagleUpdateTransitionMatrices(instance, 0, &lastTipIndices[0], NULL, NULL,
+                                           &edgeLengths[ntaxa-1], 1);
+            if (std::abs(matrixLogL - optimumLogL) > MAX_DIFF)
+                fprintf(stdout, "error: optimized edge lnL differs from transition matrices\n");
+
+            if (i == 0)
+                fprintf(stdout, "optimized edge length = %.5f (lnL = %.5f, d1 = %.5f, d2 = %.5f)\n",
+                        optimumLength, optimumLogL, optimumDeriv1, optimumDeriv2);
+        }
+
+        if (gradient && i == 0 && requireDoublePrecision) {
+            // compare a tip edge and an internal edge with central differences; the
+            // last pass puts the original edge length back
+            int checkEdges[2] = {0, ntaxa};
+            for (int c=0; c<2 && checkEdges[c]<edgeCount; c++) {
+                int edge = checkEdges[c];
+                double h = 1e-5;
+                double lengths[3] = {edgeLengths[edge] - h, edgeLengths[edge] + h, edgeLengths[edge]};
+                double edgeLogLs[3];
+                for (int j=0; j<3; j++) {
+                    beagleUpdateTransitionMatrices(instance, 0, &edgeIndices[edge], NULL, NULL,
+                                                   &lengths[j], 1);
+                    beagleUpdatePartials(instance, (BeagleOperation*)operations, internalCount, BEAGLE_OP_NONE);
+                    if (manualScaling) {
+                        beagleResetScaleFactors(instance, cumulativeScalingFactorIndices[0]);
+                        beagleAccumulateScaleFactors(instance, scalingFactorsIndices, internalCount,
+                                                     cumulativeScalingFactorIndices[0]);
+                    }
+                    beagleCalculateRootLogLikelihoods(instance, rootIndices, categoryWeightsIndices,
+                                                      stateFrequencyIndices, cumulativeScalingFactorIndices,
+                                                      1, &edgeLogLs[j]);
+                }
+                double difference = (edgeLogLs[1] - edgeLogLs[0]) / (2.0 * h);
+                if (std::abs(difference - edgeDerivatives[edge]) > 1e-4 * std::max(1.0, std::abs(difference)))
+                    fprintf(stdout, "error: edge derivative differs from finite differences\n");
+            }
+        }
+
         if (!(logL - logL == 0.0))
             fprintf(stdout, "error: invalid lnL\n");
 
@@ -1177,6 +1621,37 @@ void runBeagle(int resource,
             
             if (i > 0 && ((std::abs(deriv1 - previousDeriv1) > MAX_DIFF) || (std::abs(deriv2 - previousDeriv2) > MAX_DIFF)) )
                 fprintf(stdout, "error: large deriv difference between reps\n");
+
+            if (partitionCount == 1 && eigenCount == 1 && !autoScaling) {
+                // integrate every edge below the root buffer in one call and compare with one
+                // call per edge
+                std::vector<int> parentIndices(edgeCount, rootIndices[0]);
+                std::vector<int> weightsIndices(edgeCount, categoryWeightsIndices[0]);
+                std::vector<int> frequencyIndices(edgeCount, stateFrequencyIndices[0]);
+                std::vector<int> scaleIndices(edgeCount, cumulativeScalingFactorIndices[0]);
+                std::vector<double> edgeLogLs(edgeCount), edgeDerivs1(edgeCount), edgeDerivs2(edgeCount);
+                if (beagleCalculateEdgeLogLikelihoodsPerEdge(instance, &parentIndices[0], edgeIndices, edgeIndices,
+                                                             edgeIndicesD1, edgeIndicesD2, &weightsIndices[0],
+                                                             &frequencyIndices[0], &scaleIndices[0], edgeCount,
+                                                             &edgeLogLs[0], &edgeDerivs1[0],
+                                                             &edgeDerivs2[0]) != BEAGLE_SUCCESS) {
+                    printf("ERROR: No BEAGLE implementation for multi-edge derivatives\n");
+                    exit(-1);
+                }
+                for (int j=0; j<edgeCount; j++) {
+                    double edgeLogL, edgeDeriv1, edgeDeriv2;
+                    beagleCalculateEdgeLogLikelihoods(instance, &parentIndices[j], &edgeIndices[j], &edgeIndices[j],
+                                                      &edgeIndicesD1[j], &edgeIndicesD2[j], &weightsIndices[j],
+                                                      &frequencyIndices[j], &scaleIndices[j], 1,
+                                                      &edgeLogL, &edgeDeriv1, &edgeDeriv2);
+                    if (std::abs(edgeLogL - edgeLogLs[j]) > 1e-4 * std::max(1.0, std::abs(edgeLogL)) ||
+                        std::abs(edgeDeriv1 - edgeDerivs1[j]) > 1e-4 * std::max(1.0, std::abs(edgeDeriv1)) ||
+                        std::abs(edgeDeriv2 - edgeDerivs2[j]) > 1e-4 * std::max(1.0, std::abs(edgeDeriv2))) {
+                        fprintf(stdout, "error: multi-edge derivatives differ from single edges\n");
+                        break;
+                    }
+                }
+            }
         }
 
         previousLogL = logL;
@@ -1198,6 +1673,13 @@ void runBeagle(int resource,
     else
         fprintf(stdout, "logL = %.5f d1 = %.5f d2 = %.5f\n", logL, deriv1, deriv2);
 
+    if (gradient) {
+        double sumDerivatives = 0.0;
+        for (int j=0; j<edgeCount; j++)
+            sumDerivatives += edgeDerivatives[j];
+        fprintf(stdout, "sum of edge derivatives = %.5f\n", sumDerivatives);
+    }
+
     if (partitionCount > 1) {
         fprintf(stdout, " (");
         for (int p=0; p < partitionCount; p++) {
@@ -1221,6 +1703,7 @@ void runBeagle(int resource,
         free(siteLogLs);
     }
 
+    free(repSiteLogLs);
     free(patternWeights);
     if (partitionCount > 1) {
         free(patternPartitions);
@@ -1264,6 +1747,14 @@ void runBeagle(int resource,
         std::cout << " tree throughput total:   " << (partialsTotal/bestTimeTotal)/1000000.0 << " M partials/second " << std::endl;
 
     }
+    if (tlbMisses) {
+        if (tlbMissCounter >= 0) {
+            std::cout << "dTLB load misses per rep: " << tlbMissCount / nreps << std::endl;
+            closeTLBMissCounter(tlbMissCounter);
+        } else {
+            std::cout << "dTLB load misses per rep: unavailable" << std::endl;
+        }
+    }
     std::cout << "\n";
     
     beagleFinalizeInstance(instance);
@@ -1291,10 +1782,18 @@ void printResourceList() {
 
 void helpMessage() {
     std::cerr << "Usage:\n\n";
-    std::cerr << "synthetictest [--help] [--resourcelist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--SSE] [--AVX] [--compact-tips <integer>] [--seed <integer>] [--rescale-frequency <integer>] [--full-timing] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl] [--partitions <integer>] [--sitelikes] [--newdata] [--randomtree] [--reroot] [--stdrand] [--pectinate]\n\n";
+    std::cerr << "synthetictest [--help] [--resourcelist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--SSE] [--AVX] [--compact-tips <integer>] [--seed <integer>] [--rescale-frequency <integer>] [--full-timing] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl] [--partitions <integer>] [--sitelikes] [--newdata] [--randomtree] [--reroot] [--stdrand] [--pectinate] [--threads <integer>] [--pin-threads] [--tile-patterns <integer>] [--plan] [--tree-update] [--skip-unchanged] [--snapshot] [--gradient] [--optimize-edge] [--count-allocs] [--packed-tips] [--release-partials] [--no-arena] [--tlb-misses] [--mixed-precision]\n\n";
     std::cerr << "If --help is specified, this usage message is shown\n\n";
     std::cerr << "If --manualscale, --autoscale, or --dynamicscale is specified, BEAGLE will rescale the partials during computation\n\n";
     std::cerr << "If --full-timing is specified, you will see more detailed timing results (requires BEAGLE_DEBUG_SYNCH defined to report accurate values)\n\n";
+    std::cerr << "If --threads is specified, threaded CPU instances use that many threads; with --pin-threads, CPU worker threads are pinned to one logical CPU each\n\n";
+    std::cerr << "If --tile-patterns is specified, CPU instances update all partials over blocks of that many patterns at a time\n\n";
+    std::cerr << "If --plan is specified, matrices, partials and root likelihoods are computed with operation plans created once\n\n";
+    std::cerr << "If --packed-tips is specified, 4-state CPU instances store compact tip states in two bits per pattern\n\n";
+    std::cerr << "If --release-partials is specified, internal partials buffers are released and allocated again before every rep after the first\n\n";
+    std::cerr << "If --no-arena is specified, CPU instances allocate each buffer separately instead of from one (huge page backed) block\n\n";
+    std::cerr << "If --tlb-misses is specified, data TLB load misses of the calling thread are counted during the timed reps\n\n";
+    std::cerr << "If --mixed-precision is specified, single precision CPU instances sum products, scale factors and log likelihoods in double precision\n\n";
     std::exit(0);
 }
 
@@ -1328,7 +1827,22 @@ void interpretCommandLineParameters(int argc, const char* argv[],
                                     bool* newDataPerRep,
                                     bool* randomTree,
                                     bool* rerootTrees,
-                                    bool* pectinate)    {
+                                    bool* pectinate,
+                                    int* threadCount,
+                                    bool* pinThreads,
+                                    int* tilePatternCount,
+                                    bool* usePlan,
+                                    bool* treeUpdate,
+                                    bool* skipUnchanged,
+                                    bool* useSnapshot,
+                                    bool* gradient,
+                                    bool* optimizeEdge,
+                                    bool* countAllocs,
+                                    bool* packedTips,
+                                    bool* releasePartials,
+                                    bool* noArena,
+                                    bool* tlbMisses,
+                                    bool* mixedPrecision)    {
     bool expecting_stateCount = false;
     bool expecting_ntaxa = false;
     bool expecting_nsites = false;
@@ -1340,6 +1854,8 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     bool expecting_rescaleFrequency = false;
     bool expecting_eigenCount = false;
     bool expecting_partitions = false;
+    bool expecting_threadCount = false;
+    bool expecting_tilePatternCount = false;
     
     for (unsigned i = 1; i < argc; ++i) {
         std::string option = argv[i];
@@ -1383,6 +1899,12 @@ void interpretCommandLineParameters(int argc, const char* argv[],
         } else if (expecting_partitions) {
             *partitions = (unsigned)atoi(option.c_str());
             expecting_partitions = false;
+        } else if (expecting_threadCount) {
+            *threadCount = (unsigned)atoi(option.c_str());
+            expecting_threadCount = false;
+        } else if (expecting_tilePatternCount) {
+            *tilePatternCount = (unsigned)atoi(option.c_str());
+            expecting_tilePatternCount = false;
         } else if (option == "--help") {
             helpMessage();
         } else if (option == "--resourcelist") {
@@ -1449,6 +1971,36 @@ void interpretCommandLineParameters(int argc, const char* argv[],
             *rerootTrees = true;
         } else if (option == "--pectinate") {
             *pectinate = true;
+        } else if (option == "--threads") {
+            expecting_threadCount = true;
+        } else if (option == "--pin-threads") {
+            *pinThreads = true;
+        } else if (option == "--tile-patterns") {
+            expecting_tilePatternCount = true;
+        } else if (option == "--plan") {
+            *usePlan = true;
+        } else if (option == "--tree-update") {
+            *treeUpdate = true;
+        } else if (option == "--skip-unchanged") {
+            *skipUnchanged = true;
+        } else if (option == "--snapshot") {
+            *useSnapshot = true;
+        } else if (option == "--gradient") {
+            *gradient = true;
+        } else if (option == "--optimize-edge") {
+            *optimizeEdge = true;
+        } else if (option == "--count-allocs") {
+            *countAllocs = true;
+        } else if (option == "--packed-tips") {
+            *packedTips = true;
+        } else if (option == "--release-partials") {
+            *releasePartials = true;
+        } else if (option == "--no-arena") {
+            *noArena = true;
+        } else if (option == "--tlb-misses") {
+            *tlbMisses = true;
+        } else if (option == "--mixed-precision") {
+            *mixedPrecision = true;
         } else {
             std::string msg("Unknown command line parameter \"");
             msg.append(option);         
@@ -1489,6 +2041,12 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     if (expecting_partitions)
         abort("read last command line option without finding value associated with --partitions");
 
+    if (expecting_threadCount)
+        abort("read last command line option without finding value associated with --threads");
+
+    if (expecting_tilePatternCount)
+        abort("read last command line option without finding value associated with --tile-patterns");
+
     if (*stateCount < 2)
         abort("invalid number of states supplied on the command line");
         
@@ -1525,6 +2083,45 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     if (*partitions < 1 || *partitions > *nsites)
         abort("invalid number for partitions supplied on the command line");
 
+    if (*threadCount < 0)
+        abort("invalid number for threads supplied on the command line");
+
+    if (*tilePatternCount < 0)
+        abort("invalid number for tile-patterns supplied on the command line");
+
+    if (*usePlan && (*partitions > 1 || *eigenCount > 1 || *setmatrix || *calcderivs || *autoScaling || *dynamicScaling))
+        abort("plan option does not work with partitions, eigencount > 1, setmatrix, calcderivs, autoscale or dynamicscale");
+
+    if (*treeUpdate && (*partitions > 1 || *eigenCount > 1 || *setmatrix || *calcderivs || *dynamicScaling || *newDataPerRep || *usePlan))
+        abort("tree-update option does not work with partitions, eigencount > 1, setmatrix, calcderivs, dynamicscale, newdata or plan");
+
+    if (*skipUnchanged && (*partitions > 1 || *autoScaling || *dynamicScaling || *usePlan || *treeUpdate))
+        abort("skip-unchanged option does not work with partitions, autoscale, dynamicscale, plan or tree-update");
+
+    if (*useSnapshot && (*partitions > 1 || *eigenCount > 1 || *autoScaling || *dynamicScaling))
+        abort("snapshot option does not work with partitions, eigencount > 1, autoscale or dynamicscale");
+
+    if (*gradient && (*partitions > 1 || *eigenCount > 1 || *unrooted || *setmatrix || *eigencomplex || *autoScaling || *dynamicScaling || *usePlan || *treeUpdate || *skipUnchanged || *useSnapshot))
+        abort("gradient option does not work with partitions, eigencount > 1, unrooted, setmatrix, eigencomplex, autoscale, dynamicscale, plan, tree-update, skip-unchanged or snapshot");
+
+    if (*mixedPrecision && *requireDoublePrecision)
+        abort("mixed-precision option does not work with doubleprecision");
+
+    if (*optimizeEdge && !(*unrooted))
+        abort("optimize-edge option requires unrooted tree option");
+
+    if (*optimizeEdge && (*partitions > 1 || *eigenCount > 1 || *setmatrix || *eigencomplex || *autoScaling || *dynamicScaling))
+        abort("optimize-edge option does not work with partitions, eigencount > 1, setmatrix, eigencomplex, autoscale or dynamicscale");
+
+    if (*countAllocs && (*setmatrix || *newDataPerRep))
+        abort("count-allocs option does not work with setmatrix or newdata");
+
+    if (*packedTips && *stateCount != 4)
+        abort("packed-tips option requires 4 states");
+
+    if (*releasePartials && (*treeUpdate || *countAllocs))
+        abort("release-partials option does not work with tree-update or count-allocs");
+
     if (*randomTree && (*eigenCount!=1 || *unrooted))
         abort("random tree topology can only be used with eigencount=1 and unrooted trees");
 }
@@ -1558,6 +2155,21 @@ int main( int argc, const char* argv[] )
     bool randomTree = false;
     bool rerootTrees = false;
     bool pectinate = false;
+    int threadCount = 0;
+    bool pinThreads = false;
+    int tilePatternCount = 0;
+    bool usePlan = false;
+    bool treeUpdate = false;
+    bool skipUnchanged = false;
+    bool useSnapshot = false;
+    bool gradient = false;
+    bool optimizeEdge = false;
+    bool countAllocs = false;
+    bool packedTips = false;
+    bool releasePartials = false;
+    bool noArena = false;
+    bool tlbMisses = false;
+    bool mixedPrecision = false;
     useStdlibRand = false;
 
     std::vector<int> rsrc;
@@ -1573,7 +2185,10 @@ int main( int argc, const char* argv[] )
                                    &requireDoublePrecision, &requireSSE, &requireAVX, &compactTipCount, &randomSeed,
                                    &rescaleFrequency, &unrooted, &calcderivs, &logscalers,
                                    &eigenCount, &eigencomplex, &ievectrans, &setmatrix, &opencl,
-                                   &partitions, &sitelikes, &newDataPerRep, &randomTree, &rerootTrees, &pectinate);
+                                   &partitions, &sitelikes, &newDataPerRep, &randomTree, &rerootTrees, &pectinate,
+                                   &threadCount, &pinThreads, &tilePatternCount, &usePlan, &treeUpdate, &skipUnchanged, &useSnapshot, &gradient,
+                                   &optimizeEdge, &countAllocs, &packedTips, &releasePartials,
+                                   &noArena, &tlbMisses, &mixedPrecision);
     
     std::cout << "\nSimulating genomic ";
     if (stateCount == 4)
@@ -1588,6 +2203,20 @@ int main( int argc, const char* argv[] )
     std::cout << (manualScaling ? ", manual scaling":(autoScaling ? ", auto scaling":(dynamicScaling ? ", dynamic scaling":""))) << ", random seed " << randomSeed << ")\n\n";
 
 
+    if (threadCount > 0)
+        beagleSetCPUThreadPoolSize(threadCount);
+
+    if (pinThreads) {
+        // one logical CPU per worker (CPU 0 is left to the main thread), so that
+        // workers keep the pattern slices they first touched on their NUMA node
+        int cpuCount = (threadCount > 0 ? threadCount : (int) std::thread::hardware_concurrency());
+        std::vector<int> cpuIndices(cpuCount);
+        for (int i = 0; i < cpuCount; i++)
+            cpuIndices[i] = (i + 1) % cpuCount;
+        if (beagleSetCPUThreadAffinity(&cpuIndices[0], cpuCount) != BEAGLE_SUCCESS)
+            std::cerr << "Pinning threads is not supported on this platform\n";
+    }
+
     BeagleResourceList* rl = beagleGetResourceList();
     if(rl != NULL){
         for(int i=0; i<rl->length; i++){
@@ -1621,7 +2250,20 @@ int main( int argc, const char* argv[] )
                           newDataPerRep,
                           randomTree,
                           rerootTrees,
-                          pectinate);
+                          pectinate,
+                          tilePatternCount,
+                          usePlan,
+                          treeUpdate,
+                          skipUnchanged,
+                          useSnapshot,
+                          gradient,
+                          optimizeEdge,
+                          countAllocs,
+                          packedTips,
+                          releasePartials,
+                          noArena,
+                          tlbMisses,
+                          mixedPrecision);
             }
         }
     } else {
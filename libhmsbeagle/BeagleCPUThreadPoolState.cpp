@@ -0,0 +1,90 @@
+/*
+ *  BeagleCPUThreadPoolState.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define BEAGLE_CORE_EXPORTING
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "libhmsbeagle/BeagleCPUThreadPoolState.h"
+
+namespace beagle {
+
+CPUThreadPoolState& getCPUThreadPoolState() {
+    static CPUThreadPoolState state;
+    return state;
+}
+
+void setCPUThreadPoolThreadCount(int threadCount) {
+    CPUThreadPoolState& state = getCPUThreadPoolState();
+    std::unique_lock<std::mutex> l(state.m);
+
+    state.threadCount = threadCount;
+    // Instances already using the current pool keep it; later instances get a new one
+    if (state.pool != NULL && state.poolThreadCount != threadCount)
+        state.pool = NULL;
+}
+
+bool setCPUThreadPoolAffinity(const int* cpuIndices,
+                              int cpuCount) {
+#if defined(__linux__) || defined(_WIN32)
+    CPUThreadPoolState& state = getCPUThreadPoolState();
+    std::unique_lock<std::mutex> l(state.m);
+
+    state.cpuIndices.assign(cpuIndices, cpuIndices + (cpuIndices != NULL ? cpuCount : 0));
+
+    // Workers of the current pool, and of pools instances still use after a thread
+    // count change, are re-pinned right away
+    if (!state.cpuIndices.empty()) {
+        for (size_t i = 0; i < state.livePools.size(); i++)
+            state.livePools[i].repin(state.livePools[i].pool);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Reads the node's CPU list (e.g. "0-15,32-47") from sysfs.
+ */
+bool getNUMANodeCPUs(int node,
+                     std::vector<int>& cpuIndices) {
+    cpuIndices.clear();
+#if defined(__linux__)
+    std::ifstream cpuList(("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").c_str());
+    std::string range;
+    while (std::getline(cpuList, range, ',')) {
+        size_t dash = range.find('-');
+        int first = atoi(range.substr(0, dash).c_str());
+        int last = (dash == std::string::npos ? first : atoi(range.substr(dash + 1).c_str()));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpuIndices.push_back(cpu);
+    }
+#endif
+    return !cpuIndices.empty();
+}
+
+}	// namespace beagle
@@ -0,0 +1,88 @@
+/*
+ *  BeagleCPUThreadPoolState.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUThreadPoolState__
+#define __BeagleCPUThreadPoolState__
+
+#include <mutex>
+#include <vector>
+
+// Defined once in libhmsbeagle; the CPU plugins link against it
+#ifdef _WIN32
+#ifdef BEAGLE_CORE_EXPORTING
+#define BEAGLE_CORE_DLLEXPORT __declspec(dllexport)
+#else
+#define BEAGLE_CORE_DLLEXPORT __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define BEAGLE_CORE_DLLEXPORT __attribute__((visibility("default")))
+#else
+#define BEAGLE_CORE_DLLEXPORT
+#endif
+
+namespace beagle {
+
+/*
+ * Thread settings and the current thread pool shared by all CPU instances in a
+ * process.
+ *
+ * There is one copy, in libhmsbeagle, whichever plugins are loaded and however
+ * they are loaded. The core only stores the settings: the pools themselves are
+ * opaque here and are created, re-pinned and destroyed by the CPU plugin that
+ * owns them. A pool replaced after a thread count change stays live until the
+ * last instance using it is finalized.
+ */
+struct CPUThreadPoolState {
+    struct LivePool {
+        void* pool;
+        void (*repin)(void* pool);   // pins the workers of pool to cpuIndices
+    };
+
+    std::mutex m;
+    void* pool;                      // current pool, NULL if none
+    int poolThreadCount;             // threads of the current pool, including the caller
+    std::vector<LivePool> livePools; // the current pool and pools still in use
+    int threadCount;                 // threads of pools created from now on, 0 for the default
+    std::vector<int> cpuIndices;     // logical CPUs to pin workers to, empty for none
+
+    CPUThreadPoolState() : pool(NULL), poolThreadCount(0), threadCount(0) {}
+};
+
+BEAGLE_CORE_DLLEXPORT CPUThreadPoolState& getCPUThreadPoolState();
+
+// Sets the thread count of pools created from now on
+void setCPUThreadPoolThreadCount(int threadCount);
+
+// Sets the logical CPUs to pin workers to and re-pins every live pool; returns
+// false if pinning is not supported on this platform
+bool setCPUThreadPoolAffinity(const int* cpuIndices,
+                              int cpuCount);
+
+// Logical CPUs of a NUMA node; returns false if they cannot be determined
+bool getNUMANodeCPUs(int node,
+                     std::vector<int>& cpuIndices);
+
+}	// namespace beagle
+
+#endif // __BeagleCPUThreadPoolState__
@@ -71,6 +71,12 @@ public:
     virtual int getPartials(int bufferIndex,
 							int scaleIndex,
                             double* outPartials) = 0;
+
+    virtual int allocatePartials(const int* bufferIndices,
+                                 int count) = 0;
+
+    virtual int releasePartials(const int* bufferIndices,
+                                int count) = 0;
     
     virtual int setEigenDecomposition(int eigenIndex,
                                       const double* inEigenVectors,
@@ -87,6 +93,20 @@ public:
 
     virtual int setPatternPartitions(int partitionCount,
                                      const int* inPatternPartitions) = 0;
+
+    virtual int setCPUThreadCount(int threadCount) = 0;
+
+    virtual int setCPUMinPatternsPerThread(int minPatternCount) = 0;
+
+    virtual int setCPUTilePatternCount(int patternCount) = 0;
+
+    virtual int setCPUSkipUnchangedOperations(int enabled) = 0;
+
+    virtual int setCPUPackedTipStates(int enabled) = 0;
+
+    virtual int setCPUBufferArena(int mode) = 0;
+
+    virtual int setCPUMixedPrecision(int enabled) = 0;
     
     virtual int setCategoryRates(const double* inCategoryRates) = 0;
 
@@ -135,6 +155,35 @@ public:
 
     virtual int updatePartialsByPartition(const int* operations,
                                           int operationCount) = 0;
+
+    virtual int createOperationPlan(int eigenIndex,
+                                    const int* probabilityIndices,
+                                    int matrixCount,
+                                    const int* operations,
+                                    int operationCount,
+                                    int cumulativeScalingIndex,
+                                    int rootBufferIndex,
+                                    int categoryWeightsIndex,
+                                    int stateFrequenciesIndex) = 0;
+
+    virtual int updateWithOperationPlan(int planIndex,
+                                        const double* edgeLengths,
+                                        double* outSumLogLikelihood) = 0;
+
+    virtual int finalizeOperationPlan(int planIndex) = 0;
+
+    virtual int storeSnapshot() = 0;
+
+    virtual int restoreSnapshot() = 0;
+
+    virtual int releaseSnapshot() = 0;
+
+    virtual int setRootPrePartials(const int* bufferIndices,
+                                   const int* stateFrequenciesIndices,
+                                   int count) = 0;
+
+    virtual int updatePrePartials(const int* operations,
+                                  int operationCount) = 0;
     
     virtual int waitForPartials(const int* destinationPartials,
                                 int destinationPartialsCount) = 0;
@@ -215,6 +264,50 @@ public:
                                                        double* outSumFirstDerivative,
                                                        double* outSumSecondDerivativeByPartition,
                                                        double* outSumSecondDerivative) = 0;
+
+    virtual int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                   const int* childBufferIndices,
+                                                   const int* probabilityIndices,
+                                                   const int* firstDerivativeIndices,
+                                                   const int* secondDerivativeIndices,
+                                                   const int* categoryWeightsIndices,
+                                                   const int* stateFrequenciesIndices,
+                                                   const int* cumulativeScaleIndices,
+                                                   int count,
+                                                   double* outLogLikelihoods,
+                                                   double* outFirstDerivatives,
+                                                   double* outSecondDerivatives) = 0;
+
+    virtual int calculateEdgeDerivatives(const int* postBufferIndices,
+                                         const int* preBufferIndices,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         int categoryWeightsIndex,
+                                         int count,
+                                         double* outDerivatives) = 0;
+
+    virtual int calculateCrossProducts(const int* postBufferIndices,
+                                       const int* preBufferIndices,
+                                       const int* probabilityIndices,
+                                       const double* edgeLengths,
+                                       int categoryWeightsIndex,
+                                       int count,
+                                       double* outCrossProducts) = 0;
+
+    virtual int optimizeEdgeLength(int parentBufferIndex,
+                                   int childBufferIndex,
+                                   int eigenIndex,
+                                   int categoryWeightsIndex,
+                                   int stateFrequenciesIndex,
+                                   int cumulativeScaleIndex,
+                                   double minEdgeLength,
+                                   double maxEdgeLength,
+                                   double tolerance,
+                                   int maxIterations,
+                                   double* inOutEdgeLength,
+                                   double* outLogLikelihood,
+                                   double* outFirstDerivative,
+                                   double* outSecondDerivative) = 0;
     
     virtual int getSiteLogLikelihoods(double* outLogLikelihoods) = 0;
     
@@ -51,16 +51,25 @@ typedef double VecEl_t;
 #	define VEC_LOAD(a)			_mm256_load_pd(a)
 //#	define VEC_LOAD_SCALAR(a)	_mm_load1_pd(a)
 #	define VEC_STORE(a, b)		_mm256_store_pd((a), (b))
+#	define VEC_LOADU(a)			_mm256_loadu_pd(a)
+#	define VEC_STOREU(a, b)		_mm256_storeu_pd((a), (b))
 //#   define VEC_STORE _SCALAR(a, b) _mm_store_sd((a), (b))
 #	define VEC_MULT(a, b)		_mm256_mul_pd((a), (b))
+#	define VEC_MAX(a, b)		_mm256_max_pd((a), (b))
 #	define VEC_DIV(a, b)		_mm256_div_pd((a), (b))
+#if defined(__FMA__)
+#	define VEC_MADD(a, b, c)	_mm256_fmadd_pd((a), (b), (c))
+#else
 #	define VEC_MADD(a, b, c)	_mm256_add_pd(_mm256_mul_pd((a), (b)), (c))
+#endif
 #	define VEC_SPLAT(a)			_mm256_set1_pd(a)
 #	define VEC_ADD(a, b)		_mm256_add_pd(a, b)
 #   define VEC_SWAP(a)			_mm256_shuffle_pd(a, a, _MM_SHUFFLE2(0,1))
 # 	define VEC_SETZERO()		_mm256_setzero_pd()
 #	define VEC_SET1(a)			_mm256_set_sd((a))
 #	define VEC_SET(a, b)		_mm256_set_pd((a), (b))
+#	define VEC_SET4(a, b, c, d)	_mm256_set_pd((a), (b), (c), (d))
+#	define VEC_BROADCAST(a)		_mm256_broadcast_sd(a)
 #   define VEC_MOVE(a, b)		_mm256_move_sd((a), (b))
 #else
 	typedef float RealType;
@@ -78,21 +87,76 @@ typedef union 			/* for copying individual elements to and from vector floats */
 	}
 	VecUnion;
 
-#ifdef __GNUC__
-    #define cpuid(func,ax,bx,cx,dx)\
-            __asm__ __volatile__ ("cpuid":\
-            "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func));
+/* Single-precision vectors, used by the float specializations */
+typedef __m256	V_Float8;
+typedef __m128	V_Float;
+#	define FLOATS_PER_VEC8			8	/* number of elements per 256-bit vector */
+#	define FLOATS_PER_VEC			4	/* number of elements per 128-bit vector */
+#	define VEC_F8_LOADU(a)		_mm256_loadu_ps(a)
+#if defined(__FMA__)
+#	define VEC_F8_MADD(a, b, c)	_mm256_fmadd_ps((a), (b), (c))
+#else
+#	define VEC_F8_MADD(a, b, c)	_mm256_add_ps(_mm256_mul_ps((a), (b)), (c))
 #endif
+#	define VEC_F8_SETZERO()		_mm256_setzero_ps()
+#	define VEC_F8_STOREU(a, b)	_mm256_storeu_ps((a), (b))
+#	define VEC_F8_MULT(a, b)		_mm256_mul_ps((a), (b))
+#	define VEC_F8_PERMUTE(a, i)	_mm256_permute_ps((a), (i))
+#	define VEC_F8_PAIR(lo, hi)	_mm256_insertf128_ps(_mm256_castps128_ps256(lo), (hi), 1)
+#	define VEC_F8_REDUCE(a)		_mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps((a), 1))
+#	define VEC_F_LOAD(a)			_mm_load_ps(a)
+#	define VEC_F_STORE(a, b)		_mm_store_ps((a), (b))
+#	define VEC_F_MULT(a, b)		_mm_mul_ps((a), (b))
+#	define VEC_F_MAX(a, b)		_mm_max_ps((a), (b))
+#if defined(__FMA__)
+#	define VEC_F_MADD(a, b, c)	_mm_fmadd_ps((a), (b), (c))
+#else
+#	define VEC_F_MADD(a, b, c)	_mm_add_ps(_mm_mul_ps((a), (b)), (c))
+#endif
+#	define VEC_F_ADD(a, b)		_mm_add_ps(a, b)
+#	define VEC_F_AND(a, b)		_mm_and_ps(a, b)
+#	define VEC_F_SPLAT(a)			_mm_set1_ps(a)
+#	define VEC_F_SETZERO()		_mm_setzero_ps()
+#	define VEC_F_SET(a, b, c, d)	_mm_set_ps((a), (b), (c), (d))
+#	define VEC_F_TAIL_MASK(n)		_mm_castsi128_ps(_mm_set_epi32(0, (n) > 2 ? -1 : 0, (n) > 1 ? -1 : 0, (n) > 0 ? -1 : 0))
+#	define VEC_F_TO_D(a)			_mm256_cvtps_pd(a)
+#	define VEC_D_TO_F(a)			_mm256_cvtpd_ps(a)
 
-#ifdef _WIN32
-
+#if defined(__AVX512F__)
+/* 512-bit vectors, used when compiled for AVX-512 */
+typedef __m512d	V_Real8;
+typedef __m512	V_Float16;
+#	define REALS_PER_VEC8			8	/* number of elements per 512-bit vector */
+#	define FLOATS_PER_VEC16			16	/* number of elements per 512-bit vector */
+#	define VEC_D8_LOADU(a)		_mm512_loadu_pd(a)
+#	define VEC_D8_STOREU(a, b)	_mm512_storeu_pd((a), (b))
+#	define VEC_D8_MULT(a, b)		_mm512_mul_pd((a), (b))
+#	define VEC_D8_MADD(a, b, c)	_mm512_fmadd_pd((a), (b), (c))
+#	define VEC_D8_SETZERO()		_mm512_setzero_pd()
+#	define VEC_D8_PERMUTE(a, i)	_mm512_permutex_pd((a), (i))	/* within each 256-bit half */
+#	define VEC_D8_SPLAT4(a)		_mm512_broadcast_f64x4(a)
+#	define VEC_D8_PAIR(lo, hi)	_mm512_insertf64x4(_mm512_castpd256_pd512(lo), (hi), 1)
+#	define VEC_D8_REDUCE(a)		_mm256_add_pd(_mm512_castpd512_pd256(a), _mm512_extractf64x4_pd((a), 1))
+#	define VEC_F16_LOADU(a)		_mm512_loadu_ps(a)
+#	define VEC_F16_STOREU(a, b)	_mm512_storeu_ps((a), (b))
+#	define VEC_F16_MULT(a, b)		_mm512_mul_ps((a), (b))
+#	define VEC_F16_MADD(a, b, c)	_mm512_fmadd_ps((a), (b), (c))
+#	define VEC_F16_SETZERO()		_mm512_setzero_ps()
+#	define VEC_F16_PERMUTE(a, i)	_mm512_permute_ps((a), (i))	/* within each 128-bit quarter */
+#	define VEC_F16_SPLAT4(a)		_mm512_broadcast_f32x4(a)
+#	define VEC_F16_QUAD(a, b, c, d)	_mm512_insertf32x4(_mm512_insertf32x4(_mm512_insertf32x4( \
+										_mm512_castps128_ps512(a), (b), 1), (c), 2), (d), 3)
+#	define VEC_F16_REDUCE(a)		_mm256_add_ps(_mm512_castps512_ps256(a), _mm256_castpd_ps( \
+										_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)))
 #endif
 
-int CPUSupportsAVX() {
-    //int a,b,c,d;
-    //cpuid(0,a,b,c,d);
-    //fprintf(stderr,"a = %d\nb = %d\nc = %d\nd = %d\n",a,b,c,d);
-    return 1;
-}
+/* Instruction set the AVX code is compiled for, reported in implementation names */
+#if defined(__AVX512F__)
+#	define BEAGLE_AVX_VARIANT		"AVX512"
+#elif defined(__AVX2__) && defined(__FMA__)
+#	define BEAGLE_AVX_VARIANT		"AVX2"
+#else
+#	define BEAGLE_AVX_VARIANT		"AVX"
+#endif
 
 #endif // __AVXDefinitions__
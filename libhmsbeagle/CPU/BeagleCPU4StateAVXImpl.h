@@ -63,6 +63,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gCategoryWeights;
@@ -70,6 +72,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gPatternWeights;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gPatternPartitionsStartPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::setPatternScaleFactor;
     
 public:    
     virtual const char* getName();
@@ -81,37 +85,47 @@ protected:
     
 private:
     
-	virtual void calcStatesStates(float* destP,
-                                  const int* states1,
+    virtual void calcStatesStates(float* destP,
+                                  const TipState* states1,
                                   const float* matrices1,
-                                  const int* states2,
-                                  const float* matrices2);
+                                  const TipState* states2,
+                                  const float* matrices2,
+                                  int startPattern,
+                                  int endPattern);
     
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* __restrict matrices1,
                                     const float* __restrict partials2,
-                                    const float* __restrict matrices2);
+                                    const float* __restrict matrices2,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(float* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const float* __restrict matrices1,
                                                 const float* __restrict partials2,
                                                 const float* __restrict matrices2,
-                                                const float* __restrict scaleFactors);
+                                                const float* __restrict scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
     
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                                   const float* __restrict child0Partials,
                                                   const float* __restrict child0TransMat,
                                                   const float* __restrict child1Partials,
                                                   const float* __restrict child1TransMat,
-                                                  const float* __restrict scaleFactors);
+                                                  const float* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
@@ -119,6 +133,12 @@ private:
                                                  const float* __restrict partials2,
                                                  const float* __restrict matrices2,
                                                  int* activateScaling);
+
+    virtual void rescalePartials(float* destP,
+                                 float* scaleFactors,
+                                 float* cumulativeScaleFactors,
+                                 int startPattern,
+                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -127,7 +147,24 @@ private:
                                        const int stateFrequenciesIndex,
                                        const int scalingFactorsIndex,
                                        double* outSumLogLikelihood);
-    
+
+    virtual void calcEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition);
+
+    void integrateEdgeLikelihoods(const int parIndex,
+                                  const int childIndex,
+                                  const int probIndex,
+                                  const int categoryWeightsIndex,
+                                  int startPattern,
+                                  int endPattern);
+
 };
     
 
@@ -144,6 +181,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gCategoryWeights;
@@ -151,6 +190,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gPatternWeights;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gPatternPartitionsStartPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::setPatternScaleFactor;
     
 public:
     virtual const char* getName();
@@ -163,36 +204,46 @@ protected:
 private:
     
     virtual void calcStatesStates(double* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const double* matrices1,
-                                  const int* states2,
-                                  const double* matrices2);
+                                  const TipState* states2,
+                                  const double* matrices2,
+                                  int startPattern,
+                                  int endPattern);
     
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* __restrict matrices1,
                                     const double* __restrict partials2,
-                                    const double* __restrict matrices2);
+                                    const double* __restrict matrices2,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(double* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const double* __restrict matrices1,
                                                 const double* __restrict partials2,
                                                 const double* __restrict matrices2,
-                                                const double* __restrict scaleFactors);
+                                                const double* __restrict scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
     
     virtual void calcPartialsPartials(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
-                                      const double* __restrict matrices2);
+                                      const double* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
                                                   const double* __restrict child0Partials,
                                                   const double* __restrict child0TransMat,
                                                   const double* __restrict child1Partials,
                                                   const double* __restrict child1TransMat,
-                                                  const double* __restrict scaleFactors);
+                                                  const double* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
                                                  const double* __restrict partials1,
@@ -200,6 +251,12 @@ private:
                                                  const double* __restrict partials2,
                                                  const double* __restrict matrices2,
                                                  int* activateScaling);
+
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 double* cumulativeScaleFactors,
+                                 int startPattern,
+                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -208,7 +265,24 @@ private:
                                        const int stateFrequenciesIndex,
                                        const int scalingFactorsIndex,
                                        double* outSumLogLikelihood);
-    
+
+    virtual void calcEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition);
+
+    void integrateEdgeLikelihoods(const int parIndex,
+                                  const int childIndex,
+                                  const int probIndex,
+                                  const int categoryWeightsIndex,
+                                  int startPattern,
+                                  int endPattern);
+
 };
     
     
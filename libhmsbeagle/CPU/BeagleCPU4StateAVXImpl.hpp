@@ -42,61 +42,6 @@
 #include "libhmsbeagle/CPU/BeagleCPU4StateAVXImpl.h"
 #include "libhmsbeagle/CPU/AVXDefinitions.h"
 
-template<int K>
-inline V_Real pick_single(V_Real x) {
-	V_Real t = _mm256_permute2f128_pd(x,x, K&2?49:32);
-	return _mm256_permute_pd(t,K&1?15:0);
-}
-
-
-/* Loads partials into AVX vectors */
-#if 0
-#define AVX_PREFETCH_PARTIALS(dest, src, v) \
-		dest##0 = _mm256_broadcast_sd(&src[v + 0]); \
-		dest##1 = _mm256_broadcast_sd(&src[v + 1]); \
-		dest##2 = _mm256_broadcast_sd(&src[v + 2]); \
-		dest##3 = _mm256_broadcast_sd(&src[v + 3]);
-#else // Load four partials in one 256-bit memory transactions
-#define AVX_PREFETCH_PARTIALS(dest, src, v) \
-		V_Real tmp_##dest##0123, permute_##dest##_01, permute_##dest##_23; \
-		tmp_##dest##0123 = _mm256_load_pd(&src[v + 0]); \
-		permute_##dest##_01 = _mm256_permute2f128_pd(tmp_##dest##0123, tmp_##dest##0123, 32); \
-		permute_##dest##_23 = _mm256_permute2f128_pd(tmp_##dest##0123, tmp_##dest##0123, 49); \
-		dest##0 = _mm256_permute_pd(permute_##dest##_01, 0); \
-		dest##1 = _mm256_permute_pd(permute_##dest##_01, 15); \
-		dest##2 = _mm256_permute_pd(permute_##dest##_23, 0); \
-		dest##3 = _mm256_permute_pd(permute_##dest##_23, 15);
-//		dest##0 = pick_single<0>(tmp_##dest##0123); \
-//		dest##1 = pick_single<1>(tmp_##dest##0123); \
-//		dest##2 = pick_single<2>(tmp_##dest##0123); \
-//		dest##3 = pick_single<3>(tmp_##dest##0123);
-#endif
-
-// TODO Rearrange for optimal performance
-/* Loads (transposed) finite-time transition matrices into AVX vectors */
-#define AVX_PREFETCH_MATRICES(src_m1, src_m2, dest_vu_m1, dest_vu_m2) \
-	const double *m1 = (src_m1); \
-	const double *m2 = (src_m2); \
-	for (int i = 0; i < OFFSET; i++, m1++, m2++) { \
-		dest_vu_m1[i].x[0] = m1[0*OFFSET]; \
-		dest_vu_m1[i].x[1] = m1[1*OFFSET]; \
-		dest_vu_m1[i].x[2] = m1[2*OFFSET]; \
-		dest_vu_m1[i].x[3] = m1[3*OFFSET]; \
-		dest_vu_m2[i].x[0] = m2[0*OFFSET]; \
-		dest_vu_m2[i].x[1] = m2[1*OFFSET]; \
-		dest_vu_m2[i].x[2] = m2[2*OFFSET]; \
-		dest_vu_m2[i].x[3] = m2[3*OFFSET]; \
-	}
-
-#define AVX_PREFETCH_MATRIX(src_m1, dest_vu_m1) \
-	const double *m1 = (src_m1); \
-	for (int i = 0; i < OFFSET; i++, m1++) { \
-		dest_vu_m1[i][0].x[0] = m1[0*OFFSET]; \
-		dest_vu_m1[i][0].x[1] = m1[1*OFFSET]; \
-		dest_vu_m1[i][1].x[0] = m1[2*OFFSET]; \
-		dest_vu_m1[i][1].x[1] = m1[3*OFFSET]; \
-	}
-
 namespace beagle {
 namespace cpu {
 
@@ -105,424 +50,254 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 inline const char* getBeagleCPU4StateAVXName(){ return "CPU-4State-AVX-Unknown"; };
 
 template<>
-inline const char* getBeagleCPU4StateAVXName<double>(){ return "CPU-4State-AVX-Double"; };
+inline const char* getBeagleCPU4StateAVXName<double>(){ return "CPU-4State-" BEAGLE_AVX_VARIANT "-Double"; };
 
 template<>
-inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-AVX-Single"; };
+inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-" BEAGLE_AVX_VARIANT "-Single"; };
     
-/*
- * Calculates partial likelihoods at a node when both children have states.
- */
-
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(float* destP,
-                                     const int* states_q,
-                                     const float* matrices_q,
-                                     const int* states_r,
-                                     const float* matrices_r) {
-
-									 BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(destP,
-                                     states_q,
-                                     matrices_q,
-                                     states_r,
-                                     matrices_r);
+///////////////////////////////////////////////////////////////////////////////
+// Double-precision specialization
+//
+// The four partials of a pattern fill one AVX register; when compiled for AVX-512,
+// the partials kernels compute two patterns per 512-bit register.
+
+/* Loads (transposed) finite-time transition matrix columns into AVX vectors */
+#define AVX_PREFETCH_MATRIX_DOUBLE(src_m, dest_vm) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm[i] = VEC_SET4((src_m)[3*OFFSET + i], (src_m)[2*OFFSET + i], \
+		                      (src_m)[1*OFFSET + i], (src_m)[0*OFFSET + i]); \
+	}
 
-									 }
+/* Multiplies the four partials at p by a transposed transition matrix */
+#define AVX_TRANSFORM_PARTIALS_DOUBLE(vm, p) \
+	VEC_MADD(VEC_BROADCAST((p) + 3), vm[3], \
+	VEC_MADD(VEC_BROADCAST((p) + 2), vm[2], \
+	VEC_MADD(VEC_BROADCAST((p) + 1), vm[1], \
+	VEC_MULT(VEC_BROADCAST((p) + 0), vm[0]))))
+
+#if defined(__AVX512F__)
+/* Repeats transposed transition matrix columns in both halves of 512-bit vectors */
+#define AVX_WIDEN_MATRIX_DOUBLE(vm, dest_vm8) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm8[i] = VEC_D8_SPLAT4(vm[i]); \
+	}
 
+/* Multiplies the partials of two consecutive patterns by a transposed transition matrix */
+#define AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8, p) \
+	VEC_D8_MADD(VEC_D8_PERMUTE(p, _MM_SHUFFLE(3,3,3,3)), vm8[3], \
+	VEC_D8_MADD(VEC_D8_PERMUTE(p, _MM_SHUFFLE(2,2,2,2)), vm8[2], \
+	VEC_D8_MADD(VEC_D8_PERMUTE(p, _MM_SHUFFLE(1,1,1,1)), vm8[1], \
+	VEC_D8_MULT(VEC_D8_PERMUTE(p, _MM_SHUFFLE(0,0,0,0)), vm8[0]))))
+#endif
 
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
-                                     const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
-
-	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-
-    int w = 0;
-	V_Real *destPvec = (V_Real *)destP;
+                                                                       const TipState* states_q,
+                                                                       const double* matrices_q,
+                                                                       const TipState* states_r,
+                                                                       const double* matrices_r,
+                                                                       int startPattern,
+                                                                       int endPattern) {
 
     for (int l = 0; l < kCategoryCount; l++) {
-
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
-
-        for (int k = 0; k < kPatternCount; k++) {
-
-            const int state_q = states_q[k];
-            const int state_r = states_r[k];
-
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
-
+        V_Real vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_r + l*4*OFFSET, vm_r)
+
+        double* destPu = destP + (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+            VEC_STOREU(destPu, VEC_MULT(vm_q[states_q[k]], vm_r[states_r[k]]));
+            destPu += 4;
         }
-
-        w += OFFSET*4;
-        if (kExtraPatterns)
-        	destPvec += kExtraPatterns * 2;
     }
 }
 
 /*
  * Calculates partial likelihoods at a node when one child has states and one has partials.
-   AVX version
  */
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(float* destP,
-                                       const int* states_q,
-                                       const float* matrices_q,
-                                       const float* partials_r,
-                                       const float* matrices_r) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(
-									   destP,
-									   states_q,
-									   matrices_q,
-									   partials_r,
-									   matrices_r);
-}
-
-
-
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
-                                       const double* matrices_q,
-                                       const double* partials_r,
-                                       const double* matrices_r) {
-
-    int v = 0;
-    int w = 0;
-
-    fprintf(stderr, "Not yet implemented!\n");
-    exit(-1);
-
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
-	V_Real destr_01, destr_23;
+                                                                         const TipState* states_q,
+                                                                         const double* __restrict matrices_q,
+                                                                         const double* __restrict partials_r,
+                                                                         const double* __restrict matrices_r,
+                                                                         int startPattern,
+                                                                         int endPattern) {
 
     for (int l = 0; l < kCategoryCount; l++) {
-
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
-
-        for (int k = 0; k < kPatternCount; k++) {
-
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            AVX_PREFETCH_PARTIALS(vp,partials_r,v);
-
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
-
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
-
-            v += 4;
+        V_Real vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Real8 vm8_r[OFFSET];
+        AVX_WIDEN_MATRIX_DOUBLE(vm_r, vm8_r)
+        for (; k + 1 < endPattern; k += 2) {
+            const V_Real8 vp_r = VEC_D8_LOADU(partials_r + v);
+            const V_Real8 vs_q = VEC_D8_PAIR(vm_q[states_q[k]], vm_q[states_q[k + 1]]);
+            VEC_D8_STOREU(destP + v, VEC_D8_MULT(vs_q, AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_r, vp_r)));
+            v += 8;
         }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
+#endif
+        for (; k < endPattern; k++) {
+            VEC_STOREU(destP + v, VEC_MULT(vm_q[states_q[k]],
+                                           AVX_TRANSFORM_PARTIALS_DOUBLE(vm_r, partials_r + v)));
+            v += 4;
         }
     }
 }
 
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
-                                const int* states1,
-                                const float* __restrict matrices1,
-                                const float* __restrict partials2,
-                                const float* __restrict matrices2,
-                                const float* __restrict scaleFactors) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(
-									   destP,
-									   states1,
-									   matrices1,
-									   partials2,
-									   matrices2,
-									   scaleFactors);
-}
-
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                const int* states_q,
-                                const double* __restrict matrices_q,
-                                const double* __restrict partials_r,
-                                const double* __restrict matrices_r,
-                                const double* __restrict scaleFactors) {
-
-
-    int v = 0;
-    int w = 0;
-
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
-	V_Real destr_01, destr_23;
+                                                                                     const TipState* states_q,
+                                                                                     const double* __restrict matrices_q,
+                                                                                     const double* __restrict partials_r,
+                                                                                     const double* __restrict matrices_r,
+                                                                                     const double* __restrict scaleFactors,
+                                                                                     int startPattern,
+                                                                                     int endPattern) {
 
     for (int l = 0; l < kCategoryCount; l++) {
-
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
-
-        for (int k = 0; k < kPatternCount; k++) {
-
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
-
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            AVX_PREFETCH_PARTIALS(vp,partials_r,v);
-
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
-
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
-
-            v += 4;
+        V_Real vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Real8 vm8_r[OFFSET];
+        AVX_WIDEN_MATRIX_DOUBLE(vm_r, vm8_r)
+        for (; k + 1 < endPattern; k += 2) {
+            const V_Real8 scaleFactor = VEC_D8_PAIR(VEC_SPLAT(1.0/scaleFactors[k]),
+                                                    VEC_SPLAT(1.0/scaleFactors[k + 1]));
+            const V_Real8 vp_r = VEC_D8_LOADU(partials_r + v);
+            const V_Real8 vs_q = VEC_D8_PAIR(vm_q[states_q[k]], vm_q[states_q[k + 1]]);
+            VEC_D8_STOREU(destP + v, VEC_D8_MULT(VEC_D8_MULT(vs_q,
+                                                             AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_r, vp_r)),
+                                                 scaleFactor));
+            v += 8;
         }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
+#endif
+        for (; k < endPattern; k++) {
+            const V_Real scaleFactor = VEC_SPLAT(1.0/scaleFactors[k]);
+            VEC_STOREU(destP + v, VEC_MULT(VEC_MULT(vm_q[states_q[k]],
+                                                    AVX_TRANSFORM_PARTIALS_DOUBLE(vm_r, partials_r + v)),
+                                           scaleFactor));
+            v += 4;
         }
     }
 }
 
+/*
+ * Calculates partial likelihoods at a node when both children have partials.
+ */
 BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartials(float* destP,
-                                                  const float*  partials_q,
-                                                  const float*  matrices_q,
-                                                  const float*  partials_r,
-                                                  const float*  matrices_r) {
-
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartials(destP,
-                                                  partials_q,
-                                                  matrices_q,
-                                                  partials_r,
-                                                  matrices_r);
-}
-
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(double* destP,
-                                                  const double*  partials_q,
-                                                  const double*  matrices_q,
-                                                  const double*  partials_r,
-                                                  const double*  matrices_r) {
-
-    int v = 0;
-    int w = 0;
-
-    V_Real	destq_0123, destr_0123;
- 	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
-	V_Real *destPvec = (V_Real *)destP;
-
-//	for (int i = 0; i < 4; ++i) {
-//		int t1 = i & 1;
-//		int t2 = i & 2;
-//		fprintf(stderr, "%d ->  %d %d\n", i, t1, t2);
-//	}
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(double* __restrict destP,
+                                                                           const double* __restrict partials_q,
+                                                                           const double* __restrict matrices_q,
+                                                                           const double* __restrict partials_r,
+                                                                           const double* __restrict matrices_r,
+                                                                           int startPattern,
+                                                                           int endPattern) {
 
     for (int l = 0; l < kCategoryCount; l++) {
+        V_Real vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Real8 vm8_q[OFFSET], vm8_r[OFFSET];
+        AVX_WIDEN_MATRIX_DOUBLE(vm_q, vm8_q)
+        AVX_WIDEN_MATRIX_DOUBLE(vm_r, vm8_r)
+        for (; k + 1 < endPattern; k += 2) {
 
-		/* Load transition-probability matrices into vectors */
-    	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
-
-//    	for (int j = 0; j < 4; ++j) {
-//    		fprintf(stderr, "mq[%d]:", j);
-//    		VecUnion tmp;
-//    		tmp.vx = vu_mq[j].vx;
-//    		for (int i = 0; i < 4; ++i) {
-//    			fprintf(stderr, " %5.3e", tmp.x[i]);
-//    		}
-//    		fprintf(stderr, "\n");
-//    	}
-//
-//    	fprintf(stderr,"APM\n");
-
-        for (int k = 0; k < kPatternCount; k++) {
-            
 #           if 1 && !defined(_WIN32)
             __builtin_prefetch (&partials_q[v+64]);
             __builtin_prefetch (&partials_r[v+64]);
 #           endif
 
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
-
-//        	fprintf(stderr, "t:");
-//        	for (int i = 0; i < 4; ++i) {
-//        		fprintf(stderr, " %5.3e", partials_q[v + i]);
-//        	}
-//        	fprintf(stderr, "\n");
-//        	VecUnion tmp;
-//        	fprintf(stderr, "g:");
-//        	tmp.vx = vpq_0;
-//        	for (int j = 0; j < 4; ++j) {
-//        		fprintf(stderr, " %5.3f", tmp.x[j]);
-//        	}
-//        	tmp.vx = vpq_1;
-//        	for (int j = 0; j < 4; ++j) {
-//        		fprintf(stderr, " %5.3f", tmp.x[j]);
-//        	}
-//        	tmp.vx = vpq_2;
-//        	for (int j = 0; j < 4; ++j) {
-//        		fprintf(stderr, " %5.3f", tmp.x[j]);
-//        	}
-//        	tmp.vx = vpq_3;
-//        	for (int j = 0; j < 4; ++j) {
-//        		fprintf(stderr, " %5.3f", tmp.x[j]);
-//        	}
-//        	fprintf(stderr, "\n");
-
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
-
-        	destq_0123 = VEC_MULT(vpq_0, vu_mq[0].vx);
-        	destq_0123 = VEC_MADD(vpq_1, vu_mq[1].vx, destq_0123);
-        	destq_0123 = VEC_MADD(vpq_2, vu_mq[2].vx, destq_0123);
-        	destq_0123 = VEC_MADD(vpq_3, vu_mq[3].vx, destq_0123);
-
-        	destr_0123 = VEC_MULT(vpr_0, vu_mr[0].vx);
-        	destr_0123 = VEC_MADD(vpr_1, vu_mr[1].vx, destr_0123);
-        	destr_0123 = VEC_MADD(vpr_2, vu_mr[2].vx, destr_0123);
-        	destr_0123 = VEC_MADD(vpr_3, vu_mr[3].vx, destr_0123);
-
-//        	*destPvec = VEC_MULT(destq_0123, destr_0123); // Single store
-//        	destPvec += 1;
-
-        	VEC_STORE(destP, VEC_MULT(destq_0123, destr_0123));
-        	destP += 4;
-
-//        	for (int i = 0; i < 4; ++i) {
-//        		fprintf(stderr, " %5.3e", ((double*)destPvec)[i]);
-//        	}
-//        	fprintf(stderr, "\n");
+            const V_Real8 vp_q = VEC_D8_LOADU(partials_q + v);
+            const V_Real8 vp_r = VEC_D8_LOADU(partials_r + v);
+            VEC_D8_STOREU(destP + v, VEC_D8_MULT(AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_q, vp_q),
+                                                 AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_r, vp_r)));
+            v += 8;
+        }
+#endif
+        for (; k < endPattern; k++) {
 
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
 
+            VEC_STOREU(destP + v, VEC_MULT(AVX_TRANSFORM_PARTIALS_DOUBLE(vm_q, partials_q + v),
+                                           AVX_TRANSFORM_PARTIALS_DOUBLE(vm_r, partials_r + v)));
             v += 4;
         }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsFixedScaling(float* destP,
-                                        const float*  child0Partials,
-                                        const float*  child0TransMat,
-                                        const float*  child1Partials,
-                                        const float*  child1TransMat,
-                                        const float*  scaleFactors) {
-
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsFixedScaling(
-			destP,
-			child0Partials,
-			child0TransMat,
-			child1Partials,
-			child1TransMat,
-			scaleFactors);
-}
-
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsFixedScaling(double* destP,
-		                                                        const double* partials_q,
-		                                                        const double* matrices_q,
-		                                                        const double* partials_r,
-		                                                        const double* matrices_r,
-		                                                        const double* scaleFactors) {
-
-    int v = 0;
-    int w = 0;
-
-    V_Real	destq_01, destq_23, destr_01, destr_23;
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsFixedScaling(double* __restrict destP,
+                                                                                       const double* __restrict partials_q,
+                                                                                       const double* __restrict matrices_q,
+                                                                                       const double* __restrict partials_r,
+                                                                                       const double* __restrict matrices_r,
+                                                                                       const double* __restrict scaleFactors,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
 
-	for (int l = 0; l < kCategoryCount; l++) {
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Real vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_DOUBLE(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Real8 vm8_q[OFFSET], vm8_r[OFFSET];
+        AVX_WIDEN_MATRIX_DOUBLE(vm_q, vm8_q)
+        AVX_WIDEN_MATRIX_DOUBLE(vm_r, vm8_r)
+        for (; k + 1 < endPattern; k += 2) {
 
-		/* Load transition-probability matrices into vectors */
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
 
-        for (int k = 0; k < kPatternCount; k++) {
+            const V_Real8 scaleFactor = VEC_D8_PAIR(VEC_SPLAT(1.0/scaleFactors[k]),
+                                                    VEC_SPLAT(1.0/scaleFactors[k + 1]));
+            const V_Real8 vp_q = VEC_D8_LOADU(partials_q + v);
+            const V_Real8 vp_r = VEC_D8_LOADU(partials_r + v);
+            VEC_D8_STOREU(destP + v, VEC_D8_MULT(VEC_D8_MULT(AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_q, vp_q),
+                                                             AVX_TRANSFORM_PARTIALS_DOUBLE8(vm8_r, vp_r)),
+                                                 scaleFactor));
+            v += 8;
+        }
+#endif
+        for (; k < endPattern; k++) {
 
 #           if 1 && !defined(_WIN32)
             __builtin_prefetch (&partials_q[v+64]);
             __builtin_prefetch (&partials_r[v+64]);
-            //            __builtin_prefetch (destPvec+32,1,0);
 #           endif
-            
-            // Prefetch scale factor
-//            const V_Real scaleFactor = VEC_LOAD_SCALAR(scaleFactors + k);
-        	// Option below appears faster, why?
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
-
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
-
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
-
-        	// TODO Make below into macro since this repeats from other calcPPs
-			destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
-			destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
-			destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
-			destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
-
-			destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
-
-            destPvec[0] = VEC_DIV(VEC_MULT(destq_01, destr_01), scaleFactor);
-            destPvec[1] = VEC_DIV(VEC_MULT(destq_23, destr_23), scaleFactor);
-
-            destPvec += 2;
+
+            const V_Real scaleFactor = VEC_SPLAT(1.0/scaleFactors[k]);
+            VEC_STOREU(destP + v, VEC_MULT(VEC_MULT(AVX_TRANSFORM_PARTIALS_DOUBLE(vm_q, partials_q + v),
+                                                    AVX_TRANSFORM_PARTIALS_DOUBLE(vm_r, partials_r + v)),
+                                           scaleFactor));
             v += 4;
         }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
-    
-BEAGLE_CPU_4_AVX_TEMPLATE
-void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
-                                                         const float*  partials_q,
-                                                         const float*  matrices_q,
-                                                         const float*  partials_r,
-                                                         const float*  matrices_r,
-                                                                 int* activateScaling) {
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(destP,
-                                                     partials_q,
-                                                     matrices_q,
-                                                     partials_r,
-                                                     matrices_r,
-                                                     activateScaling);
-}
-
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoScaling(double* destP,
                                                                     const double*  partials_q,
@@ -538,119 +313,556 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoSc
                                                                 matrices_r,
                                                                 activateScaling);
 }
-    
+
+/*
+ * Rescales one pattern at a time: its partials for all rate categories are loaded,
+ * their maximum is taken in-register and they are scaled and stored back.
+ */
 BEAGLE_CPU_4_AVX_TEMPLATE
-int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
-                                                          const int childIndex,
-                                                          const int probIndex,
-                                                          const int categoryWeightsIndex,
-                                                          const int stateFrequenciesIndex,
-                                                          const int scalingFactorsIndex,
-                                                          double* outSumLogLikelihood) {
-    return BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(
-                                                              parIndex,
-                                                              childIndex,
-                                                              probIndex,
-                                                              categoryWeightsIndex,
-                                                              stateFrequenciesIndex,
-                                                              scalingFactorsIndex,
-                                                              outSumLogLikelihood);
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::rescalePartials(double* destP,
+                                                                      double* scaleFactors,
+                                                                      double* cumulativeScaleFactors,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double* patternP = destP + k * 4;
+
+        V_Real vmax = VEC_LOADU(patternP);
+        for (int l = 1; l < kCategoryCount; l++)
+            vmax = VEC_MAX(vmax, VEC_LOADU(patternP + l * categoryStride));
+        __m128d vmax2 = _mm_max_pd(_mm256_castpd256_pd128(vmax), _mm256_extractf128_pd(vmax, 1));
+        vmax2 = _mm_max_sd(vmax2, _mm_unpackhi_pd(vmax2, vmax2));
+
+        double max = _mm_cvtsd_f64(vmax2);
+        if (max == 0)
+            max = 1.0;
+
+        const V_Real oneOverMax = VEC_SPLAT(1.0 / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            double* catP = patternP + l * categoryStride;
+            VEC_STOREU(catP, VEC_MULT(VEC_LOADU(catP), oneOverMax));
+        }
+
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
+    }
 }
 
+/*
+ * Accumulates the category-weighted product of parent partials and transformed child
+ * partials (or child states) into integrationTmp for patterns [startPattern, endPattern).
+ */
 BEAGLE_CPU_4_AVX_TEMPLATE
-int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
-                                                            const int childIndex,
-                                                            const int probIndex,
-                                                            const int categoryWeightsIndex,
-                                                            const int stateFrequenciesIndex,
-                                                            const int scalingFactorsIndex,
-                                                            double* outSumLogLikelihood) {
-    // TODO: implement derivatives for calculateEdgeLnL
-
-    int returnCode = BEAGLE_SUCCESS;
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::integrateEdgeLikelihoods(const int parIndex,
+                                                                               const int childIndex,
+                                                                               const int probIndex,
+                                                                               const int categoryWeightsIndex,
+                                                                               int startPattern,
+                                                                               int endPattern) {
 
     assert(parIndex >= kTipCount);
 
-    const double* cl_r = gPartials[parIndex];
     double* cl_p = integrationTmp;
+    const double* cl_r = gPartials[parIndex];
     const double* transMatrix = gTransitionMatrices[probIndex];
     const double* wt = gCategoryWeights[categoryWeightsIndex];
-    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
 
-    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
+    memset(&cl_p[startPattern*4], 0, ((endPattern - startPattern) * 4)*sizeof(double));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    const TipState* statesChild = (childIndex < kTipCount ? getTipStates(childIndex, startPattern, endPattern, 0) : NULL);
+    const double* cl_q = gPartials[childIndex];
 
-        const int* statesChild = gTipStates[childIndex];
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Real vm[OFFSET];
+        AVX_PREFETCH_MATRIX_DOUBLE(transMatrix + l*4*OFFSET, vm)
+
+        const V_Real vwt = VEC_SPLAT(wt[l]);
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int u = startPattern*4;
+        if (statesChild) { // Integrate against a state at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Real vcl_r = VEC_MULT(VEC_LOADU(cl_r + v), vwt);
+                VEC_STOREU(cl_p + u, VEC_MADD(vm[statesChild[k]], vcl_r, VEC_LOADU(cl_p + u)));
+                v += 4;
+                u += 4;
+            }
+        } else { // Integrate against a partial at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Real vcl_r = VEC_MULT(VEC_LOADU(cl_r + v), vwt);
+                VEC_STOREU(cl_p + u, VEC_MADD(AVX_TRANSFORM_PARTIALS_DOUBLE(vm, cl_q + v), vcl_r,
+                                              VEC_LOADU(cl_p + u)));
+                v += 4;
+                u += 4;
+            }
+        }
+    }
+}
 
-        int w = 0;
-        V_Real *vcl_r = (V_Real *)cl_r;
-        for(int l = 0; l < kCategoryCount; l++) {
+BEAGLE_CPU_4_AVX_TEMPLATE
+int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                           const int childIndex,
+                                                                           const int probIndex,
+                                                                           const int categoryWeightsIndex,
+                                                                           const int stateFrequenciesIndex,
+                                                                           const int scalingFactorsIndex,
+                                                                           double* outSumLogLikelihood) {
 
-            VecUnion vu_m[OFFSET][2];
-            AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
+    int returnCode = BEAGLE_SUCCESS;
+
+    integrateEdgeLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                             0, kPatternCount);
 
-           V_Real *vcl_p = (V_Real *)cl_p;
+    const double* cl_p = integrationTmp;
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        double sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
 
-           for(int k = 0; k < kPatternCount; k++) {
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
 
-                const int stateChild = statesChild[k];
-                V_Real vwt = VEC_SPLAT(wt[l]);
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
 
-                V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
-                *vcl_p++ = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
+    return returnCode;
+}
 
-                wtdPartials = VEC_MULT(*vcl_r++, vwt);
-                *vcl_p++ = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+
+    const double* cl_p = integrationTmp;
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        integrateEdgeLikelihoods(parentBufferIndices[p], childBufferIndices[p],
+                                 probabilityIndices[p], categoryWeightsIndices[p],
+                                 startPattern, endPattern);
+
+        const double* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+
+        int u = startPattern * 4;
+        for(int k = startPattern; k < endPattern; k++) {
+            double sumOverI = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * cl_p[u];
+                u++;
             }
-           w += OFFSET*4;
-           vcl_r += 2 * kExtraPatterns;
+
+            outLogLikelihoodsTmp[k] = log(sumOverI);
+        }
+
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=startPattern; k < endPattern; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
+
+        outSumLogLikelihoodByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
         }
-    } else { // Integrate against a partial at the child
+    }
+}
+
 
-        const double* cl_q = gPartials[childIndex];
-        V_Real * vcl_r = (V_Real *)cl_r;
-        int v = 0;
-        int w = 0;
 
-        for(int l = 0; l < kCategoryCount; l++) {
+///////////////////////////////////////////////////////////////////////////////
+// Single-precision specialization
+//
+// One pattern of four float partials fills half an AVX register, so the partials
+// kernels compute two patterns per step (four per 512-bit register when compiled for
+// AVX-512); an odd final pattern uses 128-bit vectors.
+
+/* Loads (transposed) finite-time transition matrix columns into single-precision vectors */
+#define AVX_PREFETCH_MATRIX_FLOAT(src_m, dest_vm) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm[i] = VEC_F_SET((src_m)[3*OFFSET + i], (src_m)[2*OFFSET + i], \
+		                       (src_m)[1*OFFSET + i], (src_m)[0*OFFSET + i]); \
+	}
+
+/* Repeats transposed transition matrix columns in both halves of 256-bit vectors */
+#define AVX_PAIR_MATRIX_FLOAT(vm, dest_vm8) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm8[i] = VEC_F8_PAIR(vm[i], vm[i]); \
+	}
 
-            V_Real * vcl_p = (V_Real *)cl_p;
+/* Multiplies four partials by a transposed transition matrix */
+#define AVX_TRANSFORM_PARTIALS_FLOAT(vm, p) \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3,3,3,3)), vm[3], \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2)), vm[2], \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1)), vm[1], \
+	VEC_F_MULT(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0,0,0,0)), vm[0]))))
+
+/* Multiplies the partials of two consecutive patterns by a transposed transition matrix */
+#define AVX_TRANSFORM_PARTIALS_FLOAT8(vm8, p) \
+	VEC_F8_MADD(VEC_F8_PERMUTE(p, _MM_SHUFFLE(3,3,3,3)), vm8[3], \
+	VEC_F8_MADD(VEC_F8_PERMUTE(p, _MM_SHUFFLE(2,2,2,2)), vm8[2], \
+	VEC_F8_MADD(VEC_F8_PERMUTE(p, _MM_SHUFFLE(1,1,1,1)), vm8[1], \
+	VEC_F8_MULT(VEC_F8_PERMUTE(p, _MM_SHUFFLE(0,0,0,0)), vm8[0]))))
+
+#if defined(__AVX512F__)
+/* Repeats transposed transition matrix columns in each quarter of 512-bit vectors */
+#define AVX_WIDEN_MATRIX_FLOAT(vm, dest_vm16) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm16[i] = VEC_F16_SPLAT4(vm[i]); \
+	}
 
-            VecUnion vu_m[OFFSET][2];
-            AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
+/* Multiplies the partials of four consecutive patterns by a transposed transition matrix */
+#define AVX_TRANSFORM_PARTIALS_FLOAT16(vm16, p) \
+	VEC_F16_MADD(VEC_F16_PERMUTE(p, _MM_SHUFFLE(3,3,3,3)), vm16[3], \
+	VEC_F16_MADD(VEC_F16_PERMUTE(p, _MM_SHUFFLE(2,2,2,2)), vm16[2], \
+	VEC_F16_MADD(VEC_F16_PERMUTE(p, _MM_SHUFFLE(1,1,1,1)), vm16[1], \
+	VEC_F16_MULT(VEC_F16_PERMUTE(p, _MM_SHUFFLE(0,0,0,0)), vm16[0]))))
+#endif
 
-            for(int k = 0; k < kPatternCount; k++) {
-                V_Real vclp_01, vclp_23;
-                V_Real vwt = VEC_SPLAT(wt[l]);
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(float* destP,
+                                                                      const TipState* states_q,
+                                                                      const float* matrices_q,
+                                                                      const TipState* states_r,
+                                                                      const float* matrices_r,
+                                                                      int startPattern,
+                                                                      int endPattern) {
 
-                V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
-                AVX_PREFETCH_PARTIALS(vcl_q,cl_q,v);
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        float* destPu = destP + (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+            VEC_F_STORE(destPu, VEC_F_MULT(vm_q[states_q[k]], vm_r[states_r[k]]));
+            destPu += 4;
+        }
+    }
+}
 
-                vclp_01 = VEC_MULT(vcl_q0, vu_m[0][0].vx);
-                vclp_01 = VEC_MADD(vcl_q1, vu_m[1][0].vx, vclp_01);
-                vclp_01 = VEC_MADD(vcl_q2, vu_m[2][0].vx, vclp_01);
-                vclp_01 = VEC_MADD(vcl_q3, vu_m[3][0].vx, vclp_01);
-                vclp_23 = VEC_MULT(vcl_q0, vu_m[0][1].vx);
-                vclp_23 = VEC_MADD(vcl_q1, vu_m[1][1].vx, vclp_23);
-                vclp_23 = VEC_MADD(vcl_q2, vu_m[2][1].vx, vclp_23);
-                vclp_23 = VEC_MADD(vcl_q3, vu_m[3][1].vx, vclp_23);
-                vclp_01 = VEC_MULT(vclp_01, vwt);
-                vclp_23 = VEC_MULT(vclp_23, vwt);
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(float* destP,
+                                                                        const TipState* states_q,
+                                                                        const float* matrices_q,
+                                                                        const float* partials_r,
+                                                                        const float* matrices_r,
+                                                                        int startPattern,
+                                                                        int endPattern) {
 
-                *vcl_p++ = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
-                *vcl_p++ = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+        V_Float8 vm8_r[OFFSET];
+        AVX_PAIR_MATRIX_FLOAT(vm_r, vm8_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Float16 vm16_r[OFFSET];
+        AVX_WIDEN_MATRIX_FLOAT(vm_r, vm16_r)
+        for (; k + 3 < endPattern; k += 4) {
+            const V_Float16 vp_r = VEC_F16_LOADU(partials_r + v);
+            const V_Float16 vs_q = VEC_F16_QUAD(vm_q[states_q[k]], vm_q[states_q[k + 1]],
+                                                vm_q[states_q[k + 2]], vm_q[states_q[k + 3]]);
+            VEC_F16_STOREU(destP + v, VEC_F16_MULT(vs_q, AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_r, vp_r)));
+            v += 16;
+        }
+#endif
+        for (; k + 1 < endPattern; k += 2) {
+            const V_Float8 vp_r = VEC_F8_LOADU(partials_r + v);
+            const V_Float8 vs_q = VEC_F8_PAIR(vm_q[states_q[k]], vm_q[states_q[k + 1]]);
+            VEC_F8_STOREU(destP + v, VEC_F8_MULT(vs_q, AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_r, vp_r)));
+            v += 8;
+        }
+        if (k < endPattern) {
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(vm_q[states_q[k]],
+                                              AVX_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)));
+        }
+    }
+}
 
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
+                                                                                    const TipState* states_q,
+                                                                                    const float* __restrict matrices_q,
+                                                                                    const float* __restrict partials_r,
+                                                                                    const float* __restrict matrices_r,
+                                                                                    const float* __restrict scaleFactors,
+                                                                                    int startPattern,
+                                                                                    int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+        V_Float8 vm8_r[OFFSET];
+        AVX_PAIR_MATRIX_FLOAT(vm_r, vm8_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Float16 vm16_r[OFFSET];
+        AVX_WIDEN_MATRIX_FLOAT(vm_r, vm16_r)
+        for (; k + 3 < endPattern; k += 4) {
+            const V_Float16 scaleFactor = VEC_F16_QUAD(VEC_F_SPLAT(1.0f/scaleFactors[k]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 1]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 2]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 3]));
+            const V_Float16 vp_r = VEC_F16_LOADU(partials_r + v);
+            const V_Float16 vs_q = VEC_F16_QUAD(vm_q[states_q[k]], vm_q[states_q[k + 1]],
+                                                vm_q[states_q[k + 2]], vm_q[states_q[k + 3]]);
+            VEC_F16_STOREU(destP + v, VEC_F16_MULT(VEC_F16_MULT(vs_q,
+                                                                AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_r, vp_r)),
+                                                   scaleFactor));
+            v += 16;
+        }
+#endif
+        for (; k + 1 < endPattern; k += 2) {
+            const V_Float8 scaleFactor = VEC_F8_PAIR(VEC_F_SPLAT(1.0f/scaleFactors[k]),
+                                                     VEC_F_SPLAT(1.0f/scaleFactors[k + 1]));
+            const V_Float8 vp_r = VEC_F8_LOADU(partials_r + v);
+            const V_Float8 vs_q = VEC_F8_PAIR(vm_q[states_q[k]], vm_q[states_q[k + 1]]);
+            VEC_F8_STOREU(destP + v, VEC_F8_MULT(VEC_F8_MULT(vs_q,
+                                                             AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_r, vp_r)),
+                                                 scaleFactor));
+            v += 8;
+        }
+        if (k < endPattern) {
+            const V_Float scaleFactor = VEC_F_SPLAT(1.0f/scaleFactors[k]);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(VEC_F_MULT(vm_q[states_q[k]],
+                                                         AVX_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)),
+                                              scaleFactor));
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                                                          const float* __restrict partials_q,
+                                                                          const float* __restrict matrices_q,
+                                                                          const float* __restrict partials_r,
+                                                                          const float* __restrict matrices_r,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+        V_Float8 vm8_q[OFFSET], vm8_r[OFFSET];
+        AVX_PAIR_MATRIX_FLOAT(vm_q, vm8_q)
+        AVX_PAIR_MATRIX_FLOAT(vm_r, vm8_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Float16 vm16_q[OFFSET], vm16_r[OFFSET];
+        AVX_WIDEN_MATRIX_FLOAT(vm_q, vm16_q)
+        AVX_WIDEN_MATRIX_FLOAT(vm_r, vm16_r)
+        for (; k + 3 < endPattern; k += 4) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float16 vp_q = VEC_F16_LOADU(partials_q + v);
+            const V_Float16 vp_r = VEC_F16_LOADU(partials_r + v);
+            VEC_F16_STOREU(destP + v, VEC_F16_MULT(AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_q, vp_q),
+                                                   AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_r, vp_r)));
+            v += 16;
+        }
+#endif
+        for (; k + 1 < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float8 vp_q = VEC_F8_LOADU(partials_q + v);
+            const V_Float8 vp_r = VEC_F8_LOADU(partials_r + v);
+            VEC_F8_STOREU(destP + v, VEC_F8_MULT(AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_q, vp_q),
+                                                 AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_r, vp_r)));
+            v += 8;
+        }
+        if (k < endPattern) {
+            const V_Float vp_q = VEC_F_LOAD(partials_q + v);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(AVX_TRANSFORM_PARTIALS_FLOAT(vm_q, vp_q),
+                                              AVX_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)));
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                                                      const float* __restrict partials_q,
+                                                                                      const float* __restrict matrices_q,
+                                                                                      const float* __restrict partials_r,
+                                                                                      const float* __restrict matrices_r,
+                                                                                      const float* __restrict scaleFactors,
+                                                                                      int startPattern,
+                                                                                      int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        AVX_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+        V_Float8 vm8_q[OFFSET], vm8_r[OFFSET];
+        AVX_PAIR_MATRIX_FLOAT(vm_q, vm8_q)
+        AVX_PAIR_MATRIX_FLOAT(vm_r, vm8_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int k = startPattern;
+#if defined(__AVX512F__)
+        V_Float16 vm16_q[OFFSET], vm16_r[OFFSET];
+        AVX_WIDEN_MATRIX_FLOAT(vm_q, vm16_q)
+        AVX_WIDEN_MATRIX_FLOAT(vm_r, vm16_r)
+        for (; k + 3 < endPattern; k += 4) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float16 scaleFactor = VEC_F16_QUAD(VEC_F_SPLAT(1.0f/scaleFactors[k]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 1]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 2]),
+                                                       VEC_F_SPLAT(1.0f/scaleFactors[k + 3]));
+            const V_Float16 vp_q = VEC_F16_LOADU(partials_q + v);
+            const V_Float16 vp_r = VEC_F16_LOADU(partials_r + v);
+            VEC_F16_STOREU(destP + v, VEC_F16_MULT(VEC_F16_MULT(AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_q, vp_q),
+                                                                AVX_TRANSFORM_PARTIALS_FLOAT16(vm16_r, vp_r)),
+                                                   scaleFactor));
+            v += 16;
+        }
+#endif
+        for (; k + 1 < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float8 scaleFactor = VEC_F8_PAIR(VEC_F_SPLAT(1.0f/scaleFactors[k]),
+                                                     VEC_F_SPLAT(1.0f/scaleFactors[k + 1]));
+            const V_Float8 vp_q = VEC_F8_LOADU(partials_q + v);
+            const V_Float8 vp_r = VEC_F8_LOADU(partials_r + v);
+            VEC_F8_STOREU(destP + v, VEC_F8_MULT(VEC_F8_MULT(AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_q, vp_q),
+                                                             AVX_TRANSFORM_PARTIALS_FLOAT8(vm8_r, vp_r)),
+                                                 scaleFactor));
+            v += 8;
+        }
+        if (k < endPattern) {
+            const V_Float scaleFactor = VEC_F_SPLAT(1.0f/scaleFactors[k]);
+            const V_Float vp_q = VEC_F_LOAD(partials_q + v);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(VEC_F_MULT(AVX_TRANSFORM_PARTIALS_FLOAT(vm_q, vp_q),
+                                                         AVX_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)),
+                                              scaleFactor));
+        }
+    }
+}
+
+/*
+ * Accumulates the category-weighted product of parent partials and transformed child
+ * partials (or child states) into integrationTmp for patterns [startPattern, endPattern).
+ */
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::integrateEdgeLikelihoods(const int parIndex,
+                                                                              const int childIndex,
+                                                                              const int probIndex,
+                                                                              const int categoryWeightsIndex,
+                                                                              int startPattern,
+                                                                              int endPattern) {
+
+    assert(parIndex >= kTipCount);
+
+    float* cl_p = integrationTmp;
+    const float* cl_r = gPartials[parIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+
+    memset(&cl_p[startPattern*4], 0, ((endPattern - startPattern) * 4)*sizeof(float));
+
+    const TipState* statesChild = (childIndex < kTipCount ? getTipStates(childIndex, startPattern, endPattern, 0) : NULL);
+    const float* cl_q = gPartials[childIndex];
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm[OFFSET];
+        AVX_PREFETCH_MATRIX_FLOAT(transMatrix + l*4*OFFSET, vm)
+
+        const V_Float vwt = VEC_F_SPLAT(wt[l]);
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int u = startPattern*4;
+        if (statesChild) { // Integrate against a state at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Float vcl_r = VEC_F_MULT(VEC_F_LOAD(cl_r + v), vwt);
+                VEC_F_STORE(cl_p + u, VEC_F_MADD(vm[statesChild[k]], vcl_r, VEC_F_LOAD(cl_p + u)));
                 v += 4;
+                u += 4;
             }
-            w += 4*OFFSET;
-            if (kExtraPatterns) {
-                vcl_r += 2 * kExtraPatterns;
-                v += 4 * kExtraPatterns;
+        } else { // Integrate against a partial at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Float vcl_q = VEC_F_LOAD(cl_q + v);
+                const V_Float vcl_r = VEC_F_MULT(VEC_F_LOAD(cl_r + v), vwt);
+                VEC_F_STORE(cl_p + u, VEC_F_MADD(AVX_TRANSFORM_PARTIALS_FLOAT(vm, vcl_q), vcl_r,
+                                                 VEC_F_LOAD(cl_p + u)));
+                v += 4;
+                u += 4;
             }
-
         }
     }
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                           const int childIndex,
+                                                                           const int probIndex,
+                                                                           const int categoryWeightsIndex,
+                                                                           const int stateFrequenciesIndex,
+                                                                           const int scalingFactorsIndex,
+                                                                           double* outSumLogLikelihood) {
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    integrateEdgeLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                             0, kPatternCount);
+
+    const float* cl_p = integrationTmp;
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
 
     int u = 0;
     for(int k = 0; k < kPatternCount; k++) {
@@ -663,9 +875,8 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
         outLogLikelihoodsTmp[k] = log(sumOverI);
     }
 
-
     if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
         for(int k=0; k < kPatternCount; k++)
             outLogLikelihoodsTmp[k] += scalingFactors[k];
     }
@@ -677,11 +888,113 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
-        
+
     return returnCode;
 }
 
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+
+    const float* cl_p = integrationTmp;
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        integrateEdgeLikelihoods(parentBufferIndices[p], childBufferIndices[p],
+                                 probabilityIndices[p], categoryWeightsIndices[p],
+                                 startPattern, endPattern);
+
+        const float* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+
+        int u = startPattern * 4;
+        for(int k = startPattern; k < endPattern; k++) {
+            double sumOverI = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * cl_p[u];
+                u++;
+            }
+
+            outLogLikelihoodsTmp[k] = log(sumOverI);
+        }
+
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=startPattern; k < endPattern; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
+
+        outSumLogLikelihoodByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
+}
+
 
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
+                                                         const float*  partials_q,
+                                                         const float*  matrices_q,
+                                                         const float*  partials_r,
+                                                         const float*  matrices_r,
+                                                                 int* activateScaling) {
+    BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(destP,
+                                                     partials_q,
+                                                     matrices_q,
+                                                     partials_r,
+                                                     matrices_r,
+                                                     activateScaling);
+}
+
+/*
+ * Rescales one pattern at a time: its partials for all rate categories are loaded,
+ * their maximum is taken in-register and they are scaled and stored back.
+ */
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::rescalePartials(float* destP,
+                                                                     float* scaleFactors,
+                                                                     float* cumulativeScaleFactors,
+                                                                     int startPattern,
+                                                                     int endPattern) {
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        float* patternP = destP + k * 4;
+
+        V_Float vmax = VEC_F_LOAD(patternP);
+        for (int l = 1; l < kCategoryCount; l++)
+            vmax = VEC_F_MAX(vmax, VEC_F_LOAD(patternP + l * categoryStride));
+        vmax = VEC_F_MAX(vmax, _mm_movehl_ps(vmax, vmax));
+        vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1,1,1,1)));
+
+        float max = _mm_cvtss_f32(vmax);
+        if (max == 0)
+            max = 1.0f;
+
+        const V_Float oneOverMax = VEC_F_SPLAT(1.0f / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            float* catP = patternP + l * categoryStride;
+            VEC_F_STORE(catP, VEC_F_MULT(VEC_F_LOAD(catP), oneOverMax));
+        }
+
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
+    }
+}
+
+    
 BEAGLE_CPU_4_AVX_TEMPLATE
 int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -752,11 +1065,6 @@ BeagleImpl* BeagleCPU4StateAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImp
     BeagleCPU4StateAVXImpl<REALTYPE, T_PAD_4_AVX_DEFAULT, P_PAD_4_AVX_DEFAULT>* impl =
     		new BeagleCPU4StateAVXImpl<REALTYPE, T_PAD_4_AVX_DEFAULT, P_PAD_4_AVX_DEFAULT>();
 
-    if (!CPUSupportsAVX()) {
-        delete impl;
-        return NULL;
-    }
-
     try {
         if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
                                  patternCount, eigenBufferCount, matrixBufferCount,
@@ -784,7 +1092,7 @@ template <>
 const long BeagleCPU4StateAVXImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -798,7 +1106,7 @@ template <>
 const long BeagleCPU4StateAVXImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_SINGLE |
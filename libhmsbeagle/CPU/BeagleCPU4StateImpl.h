@@ -56,31 +56,39 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gStateFrequencies;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gCategoryWeights;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternWeights;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::indexMaxScaleTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::maxScaleFactorTmp;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::realtypeMin;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshhold;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternPartitionsStartPatterns;
+  using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternScaleFactor;
 
 public:
     virtual ~BeagleCPU4StateImpl();
     virtual const char* getName();
 
+    // The 4-state kernels have no double-accumulating variants
+    virtual int setCPUMixedPrecision(int enabled);
+
 
     virtual void calcStatesStates(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
-                                    const int* states2,
+                                    const TipState* states2,
                                     const REALTYPE* matrices2,
                                     int startPattern,
                                     int endPattern);
     
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
@@ -133,18 +141,31 @@ public:
                                                   const int* partitionIndices,
                                                   int partitionCount,
                                                   double* outSumLogLikelihoodByPartition);
+
+    virtual void calcEdgeLogLikelihoodDerivSums(const int parentBufferIndex,
+                                                const int childBufferIndex,
+                                                const int probabilityIndex,
+                                                const int firstDerivativeIndex,
+                                                const int secondDerivativeIndex,
+                                                const int categoryWeightsIndex,
+                                                const int stateFrequenciesIndex,
+                                                const int scalingFactorsIndex,
+                                                int startPattern,
+                                                int endPattern,
+                                                int scratchLane,
+                                                double* outSums);
     
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                              const int *child0States,
+                                              const TipState *child0States,
                                               const REALTYPE *child0TransMat,
-                                              const int *child1States,
+                                              const TipState *child1States,
                                               const REALTYPE *child1TransMat,
                                               const REALTYPE *scaleFactors,
                                               int startPattern,
                                               int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                                const int *child0States,
+                                                const TipState *child0States,
                                                 const REALTYPE *child0TransMat,
                                                 const REALTYPE *child1Partials,
                                                 const REALTYPE *child1TransMat,
@@ -184,14 +205,8 @@ public:
     virtual void rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
                                  REALTYPE *cumulativeScaleFactors,
-                                 const int  fillWithOnes);
-
-    virtual void rescalePartialsByPartition(REALTYPE *destP,
-                                            REALTYPE *scaleFactors,
-                                            REALTYPE *cumulativeScaleFactors,
-                                            const int fillWithOnes,
-                                            const int partitionIndex);
-
+                                 int startPattern,
+                                 int endPattern);
 
 };
 
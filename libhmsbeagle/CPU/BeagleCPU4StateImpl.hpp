@@ -144,6 +144,13 @@ BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::~BeagleCPU4StateImpl() {
     // which is TEMP_SCRATCH_PARTIAL twice.
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::setCPUMixedPrecision(int enabled) {
+    if (enabled == 0)
+        return BEAGLE_SUCCESS;
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // private methods
 
@@ -152,9 +159,9 @@ BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::~BeagleCPU4StateImpl() {
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                                               const int* states1,
+                                                               const TipState* states1,
                                                                const REALTYPE* matrices1,
-                                                               const int* states2,
+                                                               const TipState* states2,
                                                                const REALTYPE* matrices2,
                                                                int startPattern,
                                                                int endPattern) {
@@ -184,9 +191,9 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                                                           const int* states1,
+                                                                           const TipState* states1,
                                                                            const REALTYPE* matrices1,
-                                                                           const int* states2,
+                                                                           const TipState* states2,
                                                                            const REALTYPE* matrices2,
                                                                            const REALTYPE* scaleFactors,
                                                                            int startPattern,
@@ -221,7 +228,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                                                 const int* states1,
+                                                                 const TipState* states1,
                                                                  const REALTYPE* matrices1,
                                                                  const REALTYPE* partials2,
                                                                  const REALTYPE* matrices2,
@@ -255,7 +262,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                                             const int* states1,
+                                                                             const TipState* states1,
                                                                              const REALTYPE* matrices1,
                                                                              const REALTYPE* partials2,
                                                                              const REALTYPE* matrices2,
@@ -518,122 +525,48 @@ void inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScaleB
 }
 
 #define FAST_MAX(x,y)	(x > y ? x : y)
-//#define BEAGLE_TEST_OPTIMIZATION
 /*
- * Re-scales the partial likelihoods such that the largest is one.
+ * Re-scales the partial likelihoods of patterns [startPattern, endPattern) such
+ * that the largest is one.  The maximum is kept per state across categories and
+ * only reduced at the end, so the four lanes stay independent.
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
 		REALTYPE* scaleFactors,
 		REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
-
-	bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
-
-    for (int k = 0; k < kPatternCount; k++) {
-    	REALTYPE max = 0;    	
-        const int patternOffset = k * 4;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-
-#ifdef BEAGLE_TEST_OPTIMIZATION
-            REALTYPE max01 = FAST_MAX(destP[offset + 0], destP[offset + 1]);
-            REALTYPE max23 = FAST_MAX(destP[offset + 2], destP[offset + 3]);
-            max = FAST_MAX(max, max01);
-            max = FAST_MAX(max, max23);
-#else
-			#pragma unroll
-            for (int i = 0; i < 4; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-#endif
-        }
-
-        if (max == 0)
-            max = REALTYPE(1.0);
-
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-			#pragma unroll
-            for (int i = 0; i < 4; i++)
-                destP[offset++] *= oneOverMax;
-        }
-
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
-    }
-}
-
-BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(
-                                                                    REALTYPE* destP,
-                                                                    REALTYPE* scaleFactors,
-                                                                    REALTYPE* cumulativeScaleFactors,
-                                                                    const int fillWithOnes,
-                                                                    const int partitionIndex) {
-
-    bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
-
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+        int startPattern,
+        int endPattern) {
 
     for (int k = startPattern; k < endPattern; k++) {
-      REALTYPE max = 0;     
         const int patternOffset = k * 4;
+        REALTYPE max0 = 0, max1 = 0, max2 = 0, max3 = 0;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-
-#ifdef BEAGLE_TEST_OPTIMIZATION
-            REALTYPE max01 = FAST_MAX(destP[offset + 0], destP[offset + 1]);
-            REALTYPE max23 = FAST_MAX(destP[offset + 2], destP[offset + 3]);
-            max = FAST_MAX(max, max01);
-            max = FAST_MAX(max, max23);
-#else
-      #pragma unroll
-            for (int i = 0; i < 4; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-#endif
+            const int offset = l * kPaddedPatternCount * 4 + patternOffset;
+            max0 = FAST_MAX(destP[offset + 0], max0);
+            max1 = FAST_MAX(destP[offset + 1], max1);
+            max2 = FAST_MAX(destP[offset + 2], max2);
+            max3 = FAST_MAX(destP[offset + 3], max3);
         }
+        REALTYPE max01 = FAST_MAX(max0, max1);
+        REALTYPE max23 = FAST_MAX(max2, max3);
+        REALTYPE max = FAST_MAX(max01, max23);
 
         if (max == 0)
             max = REALTYPE(1.0);
 
         REALTYPE oneOverMax = REALTYPE(1.0) / max;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-      #pragma unroll
-            for (int i = 0; i < 4; i++)
-                destP[offset++] *= oneOverMax;
+            const int offset = l * kPaddedPatternCount * 4 + patternOffset;
+            destP[offset + 0] *= oneOverMax;
+            destP[offset + 1] *= oneOverMax;
+            destP[offset + 2] *= oneOverMax;
+            destP[offset + 3] *= oneOverMax;
         }
 
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
     }
 }
 
-
 BEAGLE_CPU_TEMPLATE
 int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex,
                                                            const int childIndex,
@@ -653,9 +586,9 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
     
     memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
     
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
       
-        const int* statesChild = gTipStates[childIndex];    
+        const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);    
         int v = 0; // Index for parent partials
         int w = 0;
         for(int l = 0; l < kCategoryCount; l++) {
@@ -752,9 +685,9 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
         const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
         
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
           
-            const int* statesChild = gTipStates[childIndex];    
+            const TipState* statesChild = getTipStates(childIndex, startPattern, endPattern, 0);    
             int v = startPattern * 4; // Index for parent partials
             int w = 0;
             for(int l = 0; l < kCategoryCount; l++) {
@@ -821,6 +754,131 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
     integrateOutStatesAndScaleByPartition(integrationTmp, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodDerivSums(const int parIndex,
+                                                                            const int childIndex,
+                                                                            const int probIndex,
+                                                                            const int firstDerivativeIndex,
+                                                                            const int secondDerivativeIndex,
+                                                                            const int categoryWeightsIndex,
+                                                                            const int stateFrequenciesIndex,
+                                                                            const int scalingFactorsIndex,
+                                                                            int startPattern,
+                                                                            int endPattern,
+                                                                            int scratchLane,
+                                                                            double* outSums) {
+    assert(parIndex >= kTipCount);
+
+    const bool secondDerivative = (secondDerivativeIndex != BEAGLE_OP_NONE);
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const TipState* statesChild = (childIndex < kTipCount ?
+                                   getTipStates(childIndex, startPattern, endPattern, 2 * scratchLane) : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
+    const REALTYPE* secondDerivMatrix = (secondDerivative ? gTransitionMatrices[secondDerivativeIndex] : firstDerivMatrix);
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const REALTYPE* scalingFactors = (scalingFactorsIndex != BEAGLE_OP_NONE ? gScaleBuffers[scalingFactorsIndex] : NULL);
+
+    // site sums for a block of patterns, so that the matrices are loaded once per category
+    // and block rather than once per pattern
+    const int blockPatterns = 64;
+    double siteLikelihoods[blockPatterns];
+    double siteFirst[blockPatterns];
+    double siteSecond[blockPatterns];
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+        const int blockEnd = std::min(blockStart + blockPatterns, endPattern);
+
+        for (int k = 0; k < blockEnd - blockStart; k++) {
+            siteLikelihoods[k] = 0.0;
+            siteFirst[k] = 0.0;
+            siteSecond[k] = 0.0;
+        }
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int w = l * 4 * OFFSET;
+            const REALTYPE weight = wt[l];
+            const REALTYPE q0 = freqs[0] * weight;
+            const REALTYPE q1 = freqs[1] * weight;
+            const REALTYPE q2 = freqs[2] * weight;
+            const REALTYPE q3 = freqs[3] * weight;
+            int v = l * 4 * kPaddedPatternCount + 4 * blockStart;
+
+            if (statesChild != NULL) {
+                for (int k = blockStart; k < blockEnd; k++) {
+                    const int stateChild = statesChild[k];
+                    const REALTYPE r0 = partialsParent[v    ] * q0;
+                    const REALTYPE r1 = partialsParent[v + 1] * q1;
+                    const REALTYPE r2 = partialsParent[v + 2] * q2;
+                    const REALTYPE r3 = partialsParent[v + 3] * q3;
+
+                    siteLikelihoods[k - blockStart] += transMatrix[w            + stateChild] * r0 +
+                                                       transMatrix[w + OFFSET*1 + stateChild] * r1 +
+                                                       transMatrix[w + OFFSET*2 + stateChild] * r2 +
+                                                       transMatrix[w + OFFSET*3 + stateChild] * r3;
+                    siteFirst[k - blockStart] += firstDerivMatrix[w            + stateChild] * r0 +
+                                                 firstDerivMatrix[w + OFFSET*1 + stateChild] * r1 +
+                                                 firstDerivMatrix[w + OFFSET*2 + stateChild] * r2 +
+                                                 firstDerivMatrix[w + OFFSET*3 + stateChild] * r3;
+                    if (secondDerivative)
+                        siteSecond[k - blockStart] += secondDerivMatrix[w            + stateChild] * r0 +
+                                                      secondDerivMatrix[w + OFFSET*1 + stateChild] * r1 +
+                                                      secondDerivMatrix[w + OFFSET*2 + stateChild] * r2 +
+                                                      secondDerivMatrix[w + OFFSET*3 + stateChild] * r3;
+                    v += 4;
+                }
+            } else {
+                PREFETCH_MATRIX(1,transMatrix,w);
+                PREFETCH_MATRIX(2,firstDerivMatrix,w);
+                PREFETCH_MATRIX(3,secondDerivMatrix,w);
+
+                for (int k = blockStart; k < blockEnd; k++) {
+                    PREFETCH_PARTIALS(1,partialsChild,v);
+                    PREFETCH_PARTIALS(2,partialsChild,v);
+
+                    const REALTYPE r0 = partialsParent[v    ] * q0;
+                    const REALTYPE r1 = partialsParent[v + 1] * q1;
+                    const REALTYPE r2 = partialsParent[v + 2] * q2;
+                    const REALTYPE r3 = partialsParent[v + 3] * q3;
+
+                    DO_INTEGRATION(1);
+                    DO_INTEGRATION(2);
+
+                    siteLikelihoods[k - blockStart] += sum10 * r0 + sum11 * r1 + sum12 * r2 + sum13 * r3;
+                    siteFirst[k - blockStart] += sum20 * r0 + sum21 * r1 + sum22 * r2 + sum23 * r3;
+
+                    if (secondDerivative) {
+                        PREFETCH_PARTIALS(3,partialsChild,v);
+                        DO_INTEGRATION(3);
+                        siteSecond[k - blockStart] += sum30 * r0 + sum31 * r1 + sum32 * r2 + sum33 * r3;
+                    }
+                    v += 4;
+                }
+            }
+        }
+
+        for (int k = blockStart; k < blockEnd; k++) {
+            const double ratio = siteFirst[k - blockStart] / siteLikelihoods[k - blockStart];
+            sumLogLikelihood += gPatternWeights[k] * (log(siteLikelihoods[k - blockStart]) +
+                                                       (scalingFactors != NULL ? scalingFactors[k] : 0.0));
+            sumFirstDerivative += gPatternWeights[k] * ratio;
+            sumSecondDerivative += gPatternWeights[k] * (siteSecond[k - blockStart] / siteLikelihoods[k - blockStart] -
+                                                         ratio * ratio);
+        }
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
                                                            const int categoryWeightsIndex,
@@ -919,8 +977,8 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
     
     int returnCode = BEAGLE_SUCCESS;
     
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
+    int* indexMaxScale = indexMaxScaleTmp;
+    REALTYPE* maxScaleFactor = maxScaleFactorTmp;
     
     for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
         const int rootPartialIndex = bufferIndices[subsetIndex];
@@ -63,6 +63,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gCategoryWeights;
@@ -71,6 +73,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gPatternWeights;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gPatternPartitionsStartPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::setPatternScaleFactor;
     
 public:    
     virtual const char* getName();
@@ -82,37 +85,47 @@ protected:
     
 private:
     
-	virtual void calcStatesStates(float* destP,
-                                  const int* states1,
+    virtual void calcStatesStates(float* destP,
+                                  const TipState* states1,
                                   const float* matrices1,
-                                  const int* states2,
-                                  const float* matrices2);
+                                  const TipState* states2,
+                                  const float* matrices2,
+                                  int startPattern,
+                                  int endPattern);
     
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* __restrict matrices1,
                                     const float* __restrict partials2,
-                                    const float* __restrict matrices2);
+                                    const float* __restrict matrices2,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(float* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const float* __restrict matrices1,
                                                 const float* __restrict partials2,
                                                 const float* __restrict matrices2,
-                                                const float* __restrict scaleFactors);
+                                                const float* __restrict scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
     
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                                   const float* __restrict child0Partials,
                                                   const float* __restrict child0TransMat,
                                                   const float* __restrict child1Partials,
                                                   const float* __restrict child1TransMat,
-                                                  const float* __restrict scaleFactors);
+                                                  const float* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
@@ -120,6 +133,12 @@ private:
                                                  const float* __restrict partials2,
                                                  const float* __restrict matrices2,
                                                  int* activateScaling);
+
+    virtual void rescalePartials(float* destP,
+                                 float* scaleFactors,
+                                 float* cumulativeScaleFactors,
+                                 int startPattern,
+                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -138,7 +157,14 @@ private:
                                                   const int* partitionIndices,
                                                   int partitionCount,
                                                   double* outSumLogLikelihoodByPartition);
-    
+
+    void integrateEdgeLikelihoods(const int parIndex,
+                                  const int childIndex,
+                                  const int probIndex,
+                                  const int categoryWeightsIndex,
+                                  int startPattern,
+                                  int endPattern);
+
 };
     
 
@@ -155,6 +181,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gCategoryWeights;
@@ -163,6 +191,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gPatternWeights;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gPatternPartitionsStartPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::setPatternScaleFactor;
     
 public:
     virtual const char* getName();
@@ -175,15 +204,15 @@ protected:
 private:
     
     virtual void calcStatesStates(double* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const double* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const double* matrices2,
                                   int startPattern,
                                   int endPattern);
     
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* __restrict matrices1,
                                     const double* __restrict partials2,
                                     const double* __restrict matrices2,
@@ -191,7 +220,7 @@ private:
                                     int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(double* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const double* __restrict matrices1,
                                                 const double* __restrict partials2,
                                                 const double* __restrict matrices2,
@@ -222,6 +251,12 @@ private:
                                                  const double* __restrict partials2,
                                                  const double* __restrict matrices2,
                                                  int* activateScaling);
+
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 double* cumulativeScaleFactors,
+                                 int startPattern,
+                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -104,9 +104,9 @@ inline const char* getBeagleCPU4StateSSEName<float>(){ return "CPU-4State-SSE-Si
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                                                       const int* states_q,
+                                                                       const TipState* states_q,
                                                                        const double* matrices_q,
-                                                                       const int* states_r,
+                                                                       const TipState* states_r,
                                                                        const double* matrices_r,
                                                                        int startPattern,
                                                                        int endPattern) {
@@ -147,7 +147,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* d
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                                                         const int* states_q,
+                                                                         const TipState* states_q,
                                                                          const double* matrices_q,
                                                                          const double* partials_r,
                                                                          const double* matrices_r,
@@ -200,7 +200,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double*
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                                                                     const int* states_q,
+                                                                                     const TipState* states_q,
                                                                                      const double* __restrict matrices_q,
                                                                                      const double* __restrict partials_r,
                                                                                      const double* __restrict matrices_r,
@@ -449,6 +449,164 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsFixedS
 }
 
     
+///////////////////////////////////////////////////////////////////////////////
+// Single-precision specialization
+//
+// One pattern of four float partials fills a whole SSE vector, so each kernel
+// computes all four states of a pattern at once from the transposed matrix columns.
+
+/* Loads (transposed) finite-time transition matrix columns into single-precision vectors */
+#define SSE_PREFETCH_MATRIX_FLOAT(src_m, dest_vm) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_vm[i] = VEC_F_SET((src_m)[3*OFFSET + i], (src_m)[2*OFFSET + i], \
+		                       (src_m)[1*OFFSET + i], (src_m)[0*OFFSET + i]); \
+	}
+
+/* Multiplies four partials by a transposed transition matrix */
+#define SSE_TRANSFORM_PARTIALS_FLOAT(vm, p) \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3,3,3,3)), vm[3], \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2)), vm[2], \
+	VEC_F_MADD(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1)), vm[1], \
+	VEC_F_MULT(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0,0,0,0)), vm[0]))))
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesStates(float* destP,
+                                                                      const TipState* states_q,
+                                                                      const float* matrices_q,
+                                                                      const TipState* states_r,
+                                                                      const float* matrices_r,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        float* destPu = destP + (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+            VEC_F_STORE(destPu, VEC_F_MULT(vm_q[states_q[k]], vm_r[states_r[k]]));
+            destPu += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartials(float* destP,
+                                                                        const TipState* states_q,
+                                                                        const float* matrices_q,
+                                                                        const float* partials_r,
+                                                                        const float* matrices_r,
+                                                                        int startPattern,
+                                                                        int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(vm_q[states_q[k]],
+                                              SSE_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)));
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
+                                                                                    const TipState* states_q,
+                                                                                    const float* __restrict matrices_q,
+                                                                                    const float* __restrict partials_r,
+                                                                                    const float* __restrict matrices_r,
+                                                                                    const float* __restrict scaleFactors,
+                                                                                    int startPattern,
+                                                                                    int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+            const V_Float scaleFactor = VEC_F_SPLAT(1.0f/scaleFactors[k]);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(VEC_F_MULT(vm_q[states_q[k]],
+                                                         SSE_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)),
+                                              scaleFactor));
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                                                          const float* __restrict partials_q,
+                                                                          const float* __restrict matrices_q,
+                                                                          const float* __restrict partials_r,
+                                                                          const float* __restrict matrices_r,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float vp_q = VEC_F_LOAD(partials_q + v);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(SSE_TRANSFORM_PARTIALS_FLOAT(vm_q, vp_q),
+                                              SSE_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)));
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                                                      const float* __restrict partials_q,
+                                                                                      const float* __restrict matrices_q,
+                                                                                      const float* __restrict partials_r,
+                                                                                      const float* __restrict matrices_r,
+                                                                                      const float* __restrict scaleFactors,
+                                                                                      int startPattern,
+                                                                                      int endPattern) {
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm_q[OFFSET], vm_r[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_q + l*4*OFFSET, vm_q)
+        SSE_PREFETCH_MATRIX_FLOAT(matrices_r + l*4*OFFSET, vm_r)
+
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Float scaleFactor = VEC_F_SPLAT(1.0f/scaleFactors[k]);
+            const V_Float vp_q = VEC_F_LOAD(partials_q + v);
+            const V_Float vp_r = VEC_F_LOAD(partials_r + v);
+            VEC_F_STORE(destP + v, VEC_F_MULT(VEC_F_MULT(SSE_TRANSFORM_PARTIALS_FLOAT(vm_q, vp_q),
+                                                         SSE_TRANSFORM_PARTIALS_FLOAT(vm_r, vp_r)),
+                                              scaleFactor));
+            v += 4;
+        }
+    }
+}
+
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
                                                          const float*  partials_q,
@@ -464,6 +622,41 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsAutoSca
                                                      activateScaling);
 }
 
+/*
+ * Rescales one pattern at a time: its partials for all rate categories are loaded,
+ * their maximum is taken in-register and they are scaled and stored back.
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::rescalePartials(float* destP,
+                                                                     float* scaleFactors,
+                                                                     float* cumulativeScaleFactors,
+                                                                     int startPattern,
+                                                                     int endPattern) {
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        float* patternP = destP + k * 4;
+
+        V_Float vmax = VEC_F_LOAD(patternP);
+        for (int l = 1; l < kCategoryCount; l++)
+            vmax = VEC_F_MAX(vmax, VEC_F_LOAD(patternP + l * categoryStride));
+        vmax = VEC_F_MAX(vmax, _mm_movehl_ps(vmax, vmax));
+        vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1,1,1,1)));
+
+        float max = _mm_cvtss_f32(vmax);
+        if (max == 0)
+            max = 1.0f;
+
+        const V_Float oneOverMax = VEC_F_SPLAT(1.0f / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            float* catP = patternP + l * categoryStride;
+            VEC_F_STORE(catP, VEC_F_MULT(VEC_F_LOAD(catP), oneOverMax));
+        }
+
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
+    }
+}
+
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoScaling(double* destP,
                                                                     const double*  partials_q,
@@ -479,23 +672,191 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoSc
                                                                 matrices_r,
                                                                 activateScaling);
 }
+
+/*
+ * Rescales one pattern at a time: its partials for all rate categories are loaded,
+ * their maximum is taken in-register and they are scaled and stored back.
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::rescalePartials(double* destP,
+                                                                      double* scaleFactors,
+                                                                      double* cumulativeScaleFactors,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double* patternP = destP + k * 4;
+
+        V_Real vmax01 = VEC_LOAD(patternP + 0);
+        V_Real vmax23 = VEC_LOAD(patternP + 2);
+        for (int l = 1; l < kCategoryCount; l++) {
+            vmax01 = VEC_MAX(vmax01, VEC_LOAD(patternP + l * categoryStride + 0));
+            vmax23 = VEC_MAX(vmax23, VEC_LOAD(patternP + l * categoryStride + 2));
+        }
+        vmax01 = VEC_MAX(vmax01, vmax23);
+        vmax01 = _mm_max_sd(vmax01, _mm_unpackhi_pd(vmax01, vmax01));
+
+        double max = _mm_cvtsd_f64(vmax01);
+        if (max == 0)
+            max = 1.0;
+
+        const V_Real oneOverMax = VEC_SPLAT(1.0 / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            double* catP = patternP + l * categoryStride;
+            VEC_STORE(catP + 0, VEC_MULT(VEC_LOAD(catP + 0), oneOverMax));
+            VEC_STORE(catP + 2, VEC_MULT(VEC_LOAD(catP + 2), oneOverMax));
+        }
+
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
+    }
+}
     
+/*
+ * Accumulates the category-weighted product of parent partials and transformed child
+ * partials (or child states) into integrationTmp for patterns [startPattern, endPattern).
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::integrateEdgeLikelihoods(const int parIndex,
+                                                                              const int childIndex,
+                                                                              const int probIndex,
+                                                                              const int categoryWeightsIndex,
+                                                                              int startPattern,
+                                                                              int endPattern) {
+
+    assert(parIndex >= kTipCount);
+
+    float* cl_p = integrationTmp;
+    const float* cl_r = gPartials[parIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+
+    memset(&cl_p[startPattern*4], 0, ((endPattern - startPattern) * 4)*sizeof(float));
+
+    const TipState* statesChild = (childIndex < kTipCount ? getTipStates(childIndex, startPattern, endPattern, 0) : NULL);
+    const float* cl_q = gPartials[childIndex];
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        V_Float vm[OFFSET];
+        SSE_PREFETCH_MATRIX_FLOAT(transMatrix + l*4*OFFSET, vm)
+
+        const V_Float vwt = VEC_F_SPLAT(wt[l]);
+        int v = (l*kPaddedPatternCount + startPattern)*4;
+        int u = startPattern*4;
+        if (statesChild) { // Integrate against a state at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Float vcl_r = VEC_F_MULT(VEC_F_LOAD(cl_r + v), vwt);
+                VEC_F_STORE(cl_p + u, VEC_F_MADD(vm[statesChild[k]], vcl_r, VEC_F_LOAD(cl_p + u)));
+                v += 4;
+                u += 4;
+            }
+        } else { // Integrate against a partial at the child
+            for (int k = startPattern; k < endPattern; k++) {
+                const V_Float vcl_q = VEC_F_LOAD(cl_q + v);
+                const V_Float vcl_r = VEC_F_MULT(VEC_F_LOAD(cl_r + v), vwt);
+                VEC_F_STORE(cl_p + u, VEC_F_MADD(SSE_TRANSFORM_PARTIALS_FLOAT(vm, vcl_q), vcl_r,
+                                                 VEC_F_LOAD(cl_p + u)));
+                v += 4;
+                u += 4;
+            }
+        }
+    }
+}
+
 BEAGLE_CPU_4_SSE_TEMPLATE
 int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
-                                                          const int childIndex,
-                                                          const int probIndex,
-                                                          const int categoryWeightsIndex,
-                                                          const int stateFrequenciesIndex,
-                                                          const int scalingFactorsIndex,
-                                                          double* outSumLogLikelihood) {
-    return BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoods(
-                                                              parIndex,
-                                                              childIndex,
-                                                              probIndex,
-                                                              categoryWeightsIndex,
-                                                              stateFrequenciesIndex,
-                                                              scalingFactorsIndex,
-                                                              outSumLogLikelihood);
+                                                                           const int childIndex,
+                                                                           const int probIndex,
+                                                                           const int categoryWeightsIndex,
+                                                                           const int stateFrequenciesIndex,
+                                                                           const int scalingFactorsIndex,
+                                                                           double* outSumLogLikelihood) {
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    integrateEdgeLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                             0, kPatternCount);
+
+    const float* cl_p = integrationTmp;
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        double sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+
+    const float* cl_p = integrationTmp;
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        integrateEdgeLikelihoods(parentBufferIndices[p], childBufferIndices[p],
+                                 probabilityIndices[p], categoryWeightsIndices[p],
+                                 startPattern, endPattern);
+
+        const float* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+
+        int u = startPattern * 4;
+        for(int k = startPattern; k < endPattern; k++) {
+            double sumOverI = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * cl_p[u];
+                u++;
+            }
+
+            outLogLikelihoodsTmp[k] = log(sumOverI);
+        }
+
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=startPattern; k < endPattern; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
+
+        outSumLogLikelihoodByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -520,9 +881,9 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -626,30 +987,6 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
     return returnCode;
 }
 
-BEAGLE_CPU_4_SSE_TEMPLATE
-void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoodsByPartition(
-                                                  const int* parentBufferIndices,
-                                                  const int* childBufferIndices,
-                                                  const int* probabilityIndices,
-                                                  const int* categoryWeightsIndices,
-                                                  const int* stateFrequenciesIndices,
-                                                  const int* cumulativeScaleIndices,
-                                                  const int* partitionIndices,
-                                                  int partitionCount,
-                                                  double* outSumLogLikelihoodByPartition) {
-
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoodsByPartition(
-                                                  parentBufferIndices,
-                                                  childBufferIndices,
-                                                  probabilityIndices,
-                                                  categoryWeightsIndices,
-                                                  stateFrequenciesIndices,
-                                                  cumulativeScaleIndices,
-                                                  partitionIndices,
-                                                  partitionCount,
-                                                  outSumLogLikelihoodByPartition);
-}
-
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPartition(
                                                   const int* parentBufferIndices,
@@ -689,9 +1026,9 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
         const double* freqs = gStateFrequencies[stateFrequenciesIndex];
 
 
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = getTipStates(childIndex, startPattern, endPattern, 0);
 
             int w = 0;
             V_Real *vcl_r = (V_Real *) (cl_r + startPattern * 4);
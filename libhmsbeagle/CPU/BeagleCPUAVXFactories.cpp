@@ -0,0 +1,33 @@
+/*
+ *  BeagleCPUAVXFactories.cpp
+ *  BEAGLE
+ *
+ *  The AVX implementations and their factories, compiled for the instruction set
+ *  of the plugin. Nothing here may run before plugin_init() has checked that the
+ *  processor supports it, so this file must not add static initializers; the
+ *  only one is that of <iostream>, which uses no vector registers.
+ *
+ */
+
+#include "libhmsbeagle/CPU/BeagleCPUAVXPlugin.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVXImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUAVXImpl.h"
+
+#if (BEAGLE_CPU_AVX_LEVEL == 3) != defined(__AVX512F__) || \
+    (BEAGLE_CPU_AVX_LEVEL == 2) != (defined(__AVX2__) && defined(__FMA__) && !defined(__AVX512F__))
+#error "BEAGLE_CPU_AVX_LEVEL does not match the instruction set flags"
+#endif
+
+namespace beagle {
+namespace cpu {
+
+void addAVXFactories(std::list<beagle::BeagleImplFactory*>& factories) {
+    factories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<double>());
+    factories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<float>());
+
+    factories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<double>());
+    factories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<float>());
+}
+
+}	// namespace cpu
+}	// namespace beagle
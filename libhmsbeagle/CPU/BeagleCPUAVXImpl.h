@@ -45,6 +45,16 @@
 #define P_PAD_AVX_EVEN  0   // for even state counts
 #define P_PAD_AVX_ODD   1   // for odd state counts
 
+// Single precision: transition matrix rows and partials padded to a multiple of four
+#define T_PAD_AVX_FLOAT_0   4   // for state counts = 0 (mod 4)
+#define T_PAD_AVX_FLOAT_1   3   // for state counts = 1 (mod 4)
+#define T_PAD_AVX_FLOAT_2   2   // for state counts = 2 (mod 4)
+#define T_PAD_AVX_FLOAT_3   1   // for state counts = 3 (mod 4)
+#define P_PAD_AVX_FLOAT_0   0
+#define P_PAD_AVX_FLOAT_1   3
+#define P_PAD_AVX_FLOAT_2   2
+#define P_PAD_AVX_FLOAT_3   1
+
 
 #define BEAGLE_CPU_AVX_FLOAT	float, T_PAD, P_PAD
 #define BEAGLE_CPU_AVX_DOUBLE	double, T_PAD, P_PAD
@@ -69,6 +79,8 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::getTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gCategoryWeights;
@@ -76,6 +88,11 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::realtypeMin;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kMixedPrecision;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gSiteLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::sumSiteLogLikelihoods;
 
 public:
     virtual const char* getName();
@@ -87,29 +104,46 @@ protected:
 
 private:
 	virtual void calcStatesStates(float* destP,
-                                     const int* states1,
-                                     const float* matrices1,
-                                     const int* states2,
-                                     const float* matrices2);
+                                  const TipState* states1,
+                                  const float* matrices1,
+                                  const TipState* states2,
+                                  const float* matrices2,
+                                  int startPattern,
+                                  int endPattern);
 
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* matrices1,
                                     const float* partials2,
-                                    const float* matrices2);
+                                    const float* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(float* destP,
+                                                const TipState* states1,
+                                                const float* matrices1,
+                                                const float* partials2,
+                                                const float* matrices2,
+                                                const float* scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
 
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
-                                      const float* __restrict partials1,
-                                      const float* __restrict matrices1,
-                                      const float* __restrict partials2,
-                                      const float* __restrict matrices2,
-                                      const float* __restrict scaleFactors);
+                                                  const float* __restrict partials1,
+                                                  const float* __restrict matrices1,
+                                                  const float* __restrict partials2,
+                                                  const float* __restrict matrices2,
+                                                  const float* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
@@ -126,6 +160,23 @@ private:
                                         const int scalingFactorsIndex,
                                         double* outSumLogLikelihood);
 
+    void sumStatesPartials(float* destP,
+                           const TipState* states1,
+                           const float* matrices1,
+                           const float* partials2,
+                           const float* matrices2,
+                           const float* scaleFactors,
+                           int startPattern,
+                           int endPattern);
+
+    void sumPartialsPartials(float* __restrict destP,
+                             const float* __restrict partials1,
+                             const float* __restrict matrices1,
+                             const float* __restrict partials2,
+                             const float* __restrict matrices2,
+                             const float* __restrict scaleFactors,
+                             int startPattern,
+                             int endPattern);
 
 };
 
@@ -143,6 +194,8 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::getTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gCategoryWeights;
@@ -161,29 +214,37 @@ protected:
 
 private:
 	virtual void calcStatesStates(double* destP,
-                                     const int* states1,
-                                     const double* matrices1,
-                                     const int* states2,
-                                     const double* matrices2);
+                                const TipState* states1,
+                                const double* matrices1,
+                                const TipState* states2,
+                                const double* matrices2,
+                                int startPattern,
+                                int endPattern);
 
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* matrices1,
                                     const double* partials2,
-                                    const double* matrices2);
+                                    const double* matrices2,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
-                                      const double* __restrict matrices2);
+                                      const double* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
-                                      const double* __restrict partials1,
-                                      const double* __restrict matrices1,
-                                      const double* __restrict partials2,
-                                      const double* __restrict matrices2,
-                                      const double* __restrict scaleFactors);
+                                                  const double* __restrict partials1,
+                                                  const double* __restrict matrices1,
+                                                  const double* __restrict partials2,
+                                                  const double* __restrict matrices2,
+                                                  const double* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
                                                  const double* __restrict partials1,
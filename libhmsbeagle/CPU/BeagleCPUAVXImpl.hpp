@@ -50,10 +50,10 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 inline const char* getBeagleCPUAVXName(){ return "CPU-AVX-Unknown"; };
 
 template<>
-inline const char* getBeagleCPUAVXName<double>(){ return "CPU-AVX-Double"; };
+inline const char* getBeagleCPUAVXName<double>(){ return "CPU-" BEAGLE_AVX_VARIANT "-Double"; };
 
 template<>
-inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX-Single"; };
+inline const char* getBeagleCPUAVXName<float>(){ return "CPU-" BEAGLE_AVX_VARIANT "-Single"; };
 
 /*
  * Calculates partial likelihoods at a node when both children have states.
@@ -61,24 +61,28 @@ inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX-Single"; };
 
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const TipState* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
+                                     const TipState* states_r,
+                                     const double* matrices_r,
+                                     int startPattern,
+                                     int endPattern) {
 
 	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(destP,
                                      states_q,
                                      matrices_q,
                                      states_r,
-                                     matrices_r);
+                                     matrices_r,
+                                     startPattern,
+                                     endPattern);
 }
 
 
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const TipState* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const TipState* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -112,23 +116,27 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const TipState* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
-                                       const double* matrices_r) {
+                                       const double* matrices_r,
+                                       int startPattern,
+                                       int endPattern) {
 	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(
 									   destP,
 									   states_q,
 									   matrices_q,
 									   partials_r,
-									   matrices_r);
+									   matrices_r,
+									   startPattern,
+									   endPattern);
 }
 
 //
 //
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const TipState* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -212,8 +220,10 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __res
                                               const double* __restrict partials1,
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
-                                              const double* __restrict matrices2) {
-    int stateCountMinusOne = kPartialsPaddedStateCount - 1;
+                                              const double* __restrict matrices2,
+                                              int startPattern,
+                                              int endPattern) {
+    int stateCountModFour = (kStateCount / 4) * 4;
 
     struct IO {
     	void operator()(V_Real v) {
@@ -235,28 +245,50 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __res
 
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
+    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
+    	int v = l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
+        for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount; ++i) {
-            	register V_Real sum1_vecA = VEC_SETZERO();
-            	register V_Real sum2_vecA = VEC_SETZERO();
-            	for (int j = 0; j < stateCountMinusOne; j += 4) {
+            	V_Real sum1_vecA = VEC_SETZERO();
+            	V_Real sum2_vecA = VEC_SETZERO();
+            	int j = 0;
+#if defined(__AVX512F__)
+            	V_Real8 sum1_wide = VEC_D8_SETZERO();
+            	V_Real8 sum2_wide = VEC_D8_SETZERO();
+            	for (; j + REALS_PER_VEC8 <= stateCountModFour; j += REALS_PER_VEC8) {
+            		sum1_wide = VEC_D8_MADD(VEC_D8_LOADU(matrices1 + w + j),
+            		                        VEC_D8_LOADU(partials1 + v + j),
+            		                        sum1_wide);
+            		sum2_wide = VEC_D8_MADD(VEC_D8_LOADU(matrices2 + w + j),
+            		                        VEC_D8_LOADU(partials2 + v + j),
+            		                        sum2_wide);
+            	}
+            	sum1_vecA = VEC_D8_REDUCE(sum1_wide);
+            	sum2_vecA = VEC_D8_REDUCE(sum2_wide);
+#endif
+            	for (; j < stateCountModFour; j += 4) {
 //            		IO()(VEC_LOAD(matrices1 + w + j));
 //            		IO()(VEC_LOAD(partials1 + v + j));
 
+            		// rows and patterns are not 32-byte aligned for all state counts
             		sum1_vecA = VEC_MADD(
-								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
+								 _mm256_loadu_pd(matrices1 + w + j),
+								 _mm256_loadu_pd(partials1 + v + j),
 								 sum1_vecA);
 //            		IO()(sum1_vecA);
             		sum2_vecA = VEC_MADD(
-								 VEC_LOAD(matrices2 + w + j),
-								 VEC_LOAD(partials2 + v + j),
+								 _mm256_loadu_pd(matrices2 + w + j),
+								 _mm256_loadu_pd(partials2 + v + j),
 								 sum2_vecA);
 //            		fprintf(stderr,"\n");
             	}
+            	double sum1_end = 0.0;
+            	double sum2_end = 0.0;
+            	for (; j < kStateCount; j++) {
+            		sum1_end += matrices1[w + j] * partials1[v + j];
+            		sum2_end += matrices2[w + j] * partials2[v + j];
+            	}
 
 
 //            	sum1_vecA = VEC_MULT(
@@ -274,7 +306,8 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __res
 //                double x[4];
 //                _mm256_storeu_pd(x, VEC_MULT(sum1_vecA,sum2_vecA));
 //                *destPu = x[0];
-                *destPu = math::horizontal_add(sum1_vecA) * math::horizontal_add(sum2_vecA);
+                *destPu = (math::horizontal_add(sum1_vecA) + sum1_end) *
+                          (math::horizontal_add(sum2_vecA) + sum2_end);
 
 //                *destPu = 1.0; //sum1_vecA[0];
                 destPu++;
@@ -293,10 +326,18 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartialsFixedScaling(
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
                                               const double* __restrict matrices2,
-                                              const double* __restrict scaleFactors) {
+                                              const double* __restrict scaleFactors,
+                                              int startPattern,
+                                              int endPattern) {
 
-	fprintf(stderr, "Not yet implemented: BeagleCPUAVXImpl::calcPartialsPartialsFixedScaling\n");
-	exit(-1);
+	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartialsFixedScaling(destP,
+                                              partials1,
+                                              matrices1,
+                                              partials2,
+                                              matrices2,
+                                              scaleFactors,
+                                              startPattern,
+                                              endPattern);
 
 //    int stateCountMinusOne = kPartialsPaddedStateCount - 1;
 //#pragma omp parallel for num_threads(kCategoryCount)
@@ -418,7 +459,7 @@ return BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(
 //
 //    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 //
-//        const int* statesChild = gTipStates[childIndex];
+//        const TipState* statesChild = gTipStates[childIndex];
 //
 //		int w = 0;
 //		V_Real *vcl_r = (V_Real *)cl_r;
@@ -518,6 +559,414 @@ return BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(
 //    return returnCode;
 //}
 
+///////////////////////////////////////////////////////////////////////////////
+// Single-precision specialization
+//
+// Same layout as the SSE single-precision specialization: rows and partials are
+// padded to a multiple of four states and four rows are integrated at once.
+
+/*
+ * Returns the dot products of rows [row, row + 3] of a transition matrix with a
+ * vector of partials.  Rows past lastRow repeat lastRow, and lanes of the final
+ * block that lie beyond the state count are masked out of the sums.  Eight states
+ * are accumulated per step (sixteen with AVX-512); rows are only 16-byte aligned, so
+ * wide loads are unaligned.
+ */
+inline V_Float avxFloatDotRows(const float* __restrict matrix,
+                               int rowStride,
+                               int row,
+                               int lastRow,
+                               const float* __restrict partials,
+                               int stateCountModFour,
+                               bool hasTail,
+                               V_Float tailMask) {
+    const float* m0 = matrix + row * rowStride;
+    const float* m1 = matrix + (row + 1 < lastRow ? row + 1 : lastRow) * rowStride;
+    const float* m2 = matrix + (row + 2 < lastRow ? row + 2 : lastRow) * rowStride;
+    const float* m3 = matrix + (row + 3 < lastRow ? row + 3 : lastRow) * rowStride;
+
+    V_Float8 wide0 = VEC_F8_SETZERO();
+    V_Float8 wide1 = VEC_F8_SETZERO();
+    V_Float8 wide2 = VEC_F8_SETZERO();
+    V_Float8 wide3 = VEC_F8_SETZERO();
+
+    int j = 0;
+#if defined(__AVX512F__)
+    V_Float16 widest0 = VEC_F16_SETZERO();
+    V_Float16 widest1 = VEC_F16_SETZERO();
+    V_Float16 widest2 = VEC_F16_SETZERO();
+    V_Float16 widest3 = VEC_F16_SETZERO();
+    for (; j + FLOATS_PER_VEC16 <= stateCountModFour; j += FLOATS_PER_VEC16) {
+        const V_Float16 p = VEC_F16_LOADU(partials + j);
+        widest0 = VEC_F16_MADD(VEC_F16_LOADU(m0 + j), p, widest0);
+        widest1 = VEC_F16_MADD(VEC_F16_LOADU(m1 + j), p, widest1);
+        widest2 = VEC_F16_MADD(VEC_F16_LOADU(m2 + j), p, widest2);
+        widest3 = VEC_F16_MADD(VEC_F16_LOADU(m3 + j), p, widest3);
+    }
+    wide0 = VEC_F16_REDUCE(widest0);
+    wide1 = VEC_F16_REDUCE(widest1);
+    wide2 = VEC_F16_REDUCE(widest2);
+    wide3 = VEC_F16_REDUCE(widest3);
+#endif
+    for (; j + FLOATS_PER_VEC8 <= stateCountModFour; j += FLOATS_PER_VEC8) {
+        const V_Float8 p = VEC_F8_LOADU(partials + j);
+        wide0 = VEC_F8_MADD(VEC_F8_LOADU(m0 + j), p, wide0);
+        wide1 = VEC_F8_MADD(VEC_F8_LOADU(m1 + j), p, wide1);
+        wide2 = VEC_F8_MADD(VEC_F8_LOADU(m2 + j), p, wide2);
+        wide3 = VEC_F8_MADD(VEC_F8_LOADU(m3 + j), p, wide3);
+    }
+
+    V_Float sum0 = VEC_F8_REDUCE(wide0);
+    V_Float sum1 = VEC_F8_REDUCE(wide1);
+    V_Float sum2 = VEC_F8_REDUCE(wide2);
+    V_Float sum3 = VEC_F8_REDUCE(wide3);
+
+    if (j < stateCountModFour) {
+        const V_Float p = VEC_F_LOAD(partials + j);
+        sum0 = VEC_F_MADD(VEC_F_LOAD(m0 + j), p, sum0);
+        sum1 = VEC_F_MADD(VEC_F_LOAD(m1 + j), p, sum1);
+        sum2 = VEC_F_MADD(VEC_F_LOAD(m2 + j), p, sum2);
+        sum3 = VEC_F_MADD(VEC_F_LOAD(m3 + j), p, sum3);
+        j += FLOATS_PER_VEC;
+    }
+    if (hasTail) { // padding entries are not initialized, so mask the products
+        const V_Float p = VEC_F_LOAD(partials + j);
+        sum0 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m0 + j), p), tailMask), sum0);
+        sum1 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m1 + j), p), tailMask), sum1);
+        sum2 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m2 + j), p), tailMask), sum2);
+        sum3 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m3 + j), p), tailMask), sum3);
+    }
+
+    _MM_TRANSPOSE4_PS(sum0, sum1, sum2, sum3);
+    return VEC_F_ADD(VEC_F_ADD(sum0, sum1), VEC_F_ADD(sum2, sum3));
+}
+
+/*
+ * As avxFloatDotRows, but the products are summed in double precision, for mixed
+ * precision.  Four states are converted and accumulated per step.
+ */
+inline V_Real avxFloatDotRowsDouble(const float* __restrict matrix,
+                                    int rowStride,
+                                    int row,
+                                    int lastRow,
+                                    const float* __restrict partials,
+                                    int stateCountModFour,
+                                    bool hasTail,
+                                    V_Float tailMask) {
+    const float* m0 = matrix + row * rowStride;
+    const float* m1 = matrix + (row + 1 < lastRow ? row + 1 : lastRow) * rowStride;
+    const float* m2 = matrix + (row + 2 < lastRow ? row + 2 : lastRow) * rowStride;
+    const float* m3 = matrix + (row + 3 < lastRow ? row + 3 : lastRow) * rowStride;
+
+    V_Real sum0 = VEC_SETZERO();
+    V_Real sum1 = VEC_SETZERO();
+    V_Real sum2 = VEC_SETZERO();
+    V_Real sum3 = VEC_SETZERO();
+
+    int j = 0;
+    for (; j < stateCountModFour; j += FLOATS_PER_VEC) {
+        const V_Real p = VEC_F_TO_D(VEC_F_LOAD(partials + j));
+        sum0 = VEC_MADD(VEC_F_TO_D(VEC_F_LOAD(m0 + j)), p, sum0);
+        sum1 = VEC_MADD(VEC_F_TO_D(VEC_F_LOAD(m1 + j)), p, sum1);
+        sum2 = VEC_MADD(VEC_F_TO_D(VEC_F_LOAD(m2 + j)), p, sum2);
+        sum3 = VEC_MADD(VEC_F_TO_D(VEC_F_LOAD(m3 + j)), p, sum3);
+    }
+    if (hasTail) { // padding entries are not initialized, so mask both factors
+        const V_Real p = VEC_F_TO_D(VEC_F_AND(VEC_F_LOAD(partials + j), tailMask));
+        sum0 = VEC_MADD(VEC_F_TO_D(VEC_F_AND(VEC_F_LOAD(m0 + j), tailMask)), p, sum0);
+        sum1 = VEC_MADD(VEC_F_TO_D(VEC_F_AND(VEC_F_LOAD(m1 + j), tailMask)), p, sum1);
+        sum2 = VEC_MADD(VEC_F_TO_D(VEC_F_AND(VEC_F_LOAD(m2 + j), tailMask)), p, sum2);
+        sum3 = VEC_MADD(VEC_F_TO_D(VEC_F_AND(VEC_F_LOAD(m3 + j), tailMask)), p, sum3);
+    }
+
+    const V_Real sum01 = _mm256_hadd_pd(sum0, sum1);
+    const V_Real sum23 = _mm256_hadd_pd(sum2, sum3);
+    return VEC_ADD(_mm256_permute2f128_pd(sum01, sum23, 0x20),
+                   _mm256_permute2f128_pd(sum01, sum23, 0x31));
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesStates(float* destP,
+                                                              const TipState* states_q,
+                                                              const float* matrices_q,
+                                                              const TipState* states_r,
+                                                              const float* matrices_r,
+                                                              int startPattern,
+                                                              int endPattern) {
+
+	BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesStates(destP,
+                                                          states_q,
+                                                          matrices_q,
+                                                          states_r,
+                                                          matrices_r,
+                                                          startPattern,
+                                                          endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesPartials(float* destP,
+                                                                const TipState* states_q,
+                                                                const float* matrices_q,
+                                                                const float* partials_r,
+                                                                const float* matrices_r,
+                                                                int startPattern,
+                                                                int endPattern) {
+    sumStatesPartials(destP, states_q, matrices_q, partials_r, matrices_r, NULL,
+                      startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
+                                                                            const TipState* states_q,
+                                                                            const float* matrices_q,
+                                                                            const float* partials_r,
+                                                                            const float* matrices_r,
+                                                                            const float* scaleFactors,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    sumStatesPartials(destP, states_q, matrices_q, partials_r, matrices_r, scaleFactors,
+                      startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::sumStatesPartials(float* destP,
+                                                               const TipState* states_q,
+                                                               const float* matrices_q,
+                                                               const float* partials_r,
+                                                               const float* matrices_r,
+                                                               const float* scaleFactors,
+                                                               int startPattern,
+                                                               int endPattern) {
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* mq = matrices_q + l*kMatrixSize;
+        const float* mr = matrices_r + l*kMatrixSize;
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state_q = states_q[k];
+            if (kMixedPrecision) {
+                const V_Real scale = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+                for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                    const V_Real sum_r = avxFloatDotRowsDouble(mr, rowStride, i, lastRow, partials_r + v,
+                                                               stateCountModFour, hasTail, tailMask);
+                    const V_Real m_q = VEC_SET4(
+                            mq[(i + 3 < lastRow ? i + 3 : lastRow) * rowStride + state_q],
+                            mq[(i + 2 < lastRow ? i + 2 : lastRow) * rowStride + state_q],
+                            mq[(i + 1 < lastRow ? i + 1 : lastRow) * rowStride + state_q],
+                            mq[i * rowStride + state_q]);
+                    VEC_F_STORE(destP + v + i, VEC_D_TO_F(VEC_MULT(VEC_MULT(m_q, sum_r), scale)));
+                }
+                v += kPartialsPaddedStateCount;
+                continue;
+            }
+            const V_Float scale = VEC_F_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum_r = avxFloatDotRows(mr, rowStride, i, lastRow, partials_r + v,
+                                                      stateCountModFour, hasTail, tailMask);
+                const V_Float m_q = VEC_F_SET(
+                        mq[(i + 3 < lastRow ? i + 3 : lastRow) * rowStride + state_q],
+                        mq[(i + 2 < lastRow ? i + 2 : lastRow) * rowStride + state_q],
+                        mq[(i + 1 < lastRow ? i + 1 : lastRow) * rowStride + state_q],
+                        mq[i * rowStride + state_q]);
+                VEC_F_STORE(destP + v + i, VEC_F_MULT(VEC_F_MULT(m_q, sum_r), scale));
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                                                  const float* __restrict partials1,
+                                                                  const float* __restrict matrices1,
+                                                                  const float* __restrict partials2,
+                                                                  const float* __restrict matrices2,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    sumPartialsPartials(destP, partials1, matrices1, partials2, matrices2, NULL,
+                        startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                                              const float* __restrict partials1,
+                                                                              const float* __restrict matrices1,
+                                                                              const float* __restrict partials2,
+                                                                              const float* __restrict matrices2,
+                                                                              const float* __restrict scaleFactors,
+                                                                              int startPattern,
+                                                                              int endPattern) {
+    sumPartialsPartials(destP, partials1, matrices1, partials2, matrices2, scaleFactors,
+                        startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::sumPartialsPartials(float* __restrict destP,
+                                                                 const float* __restrict partials1,
+                                                                 const float* __restrict matrices1,
+                                                                 const float* __restrict partials2,
+                                                                 const float* __restrict matrices2,
+                                                                 const float* __restrict scaleFactors,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* m1 = matrices1 + l*kMatrixSize;
+        const float* m2 = matrices2 + l*kMatrixSize;
+        for (int k = startPattern; k < endPattern; k++) {
+            if (kMixedPrecision) {
+                const V_Real scale = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+                for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                    const V_Real sum1 = avxFloatDotRowsDouble(m1, rowStride, i, lastRow, partials1 + v,
+                                                              stateCountModFour, hasTail, tailMask);
+                    const V_Real sum2 = avxFloatDotRowsDouble(m2, rowStride, i, lastRow, partials2 + v,
+                                                              stateCountModFour, hasTail, tailMask);
+                    VEC_F_STORE(destP + v + i, VEC_D_TO_F(VEC_MULT(VEC_MULT(sum1, sum2), scale)));
+                }
+                v += kPartialsPaddedStateCount;
+                continue;
+            }
+            const V_Float scale = VEC_F_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum1 = avxFloatDotRows(m1, rowStride, i, lastRow, partials1 + v,
+                                                     stateCountModFour, hasTail, tailMask);
+                const V_Float sum2 = avxFloatDotRows(m2, rowStride, i, lastRow, partials2 + v,
+                                                     stateCountModFour, hasTail, tailMask);
+                // lanes past the state count land in the partials padding
+                VEC_F_STORE(destP + v + i, VEC_F_MULT(VEC_F_MULT(sum1, sum2), scale));
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
+                                                                             const float* partials_q,
+                                                                             const float* matrices_q,
+                                                                             const float* partials_r,
+                                                                             const float* matrices_r,
+                                                                             int* activateScaling) {
+    BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartialsAutoScaling(destP,
+                                                                         partials_q,
+                                                                         matrices_q,
+                                                                         partials_r,
+                                                                         matrices_r,
+                                                                         activateScaling);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                   const int childIndex,
+                                                                   const int probIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) // Integrate against a state at the child
+        return BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcEdgeLogLikelihoods(parIndex,
+                                                                           childIndex,
+                                                                           probIndex,
+                                                                           categoryWeightsIndex,
+                                                                           stateFrequenciesIndex,
+                                                                           scalingFactorsIndex,
+                                                                           outSumLogLikelihood);
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const float* partialsParent = gPartials[parIndex];
+    const float* partialsChild = gPartials[childIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+    ALIGN16 float sums[FLOATS_PER_VEC];
+
+    int v = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = 0;
+        const float* m = transMatrix + l*kMatrixSize;
+        const V_Float weight = VEC_F_SPLAT(wt[l]);
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum = avxFloatDotRows(m, rowStride, i, lastRow, partialsChild + v,
+                                                    stateCountModFour, hasTail, tailMask);
+                VEC_F_STORE(sums, VEC_F_MULT(VEC_F_MULT(sum, VEC_F_LOAD(partialsParent + v + i)),
+                                             weight));
+                const int laneCount = (kStateCount - i < FLOATS_PER_VEC ?
+                                       kStateCount - i : FLOATS_PER_VEC);
+                for (int j = 0; j < laneCount; j++)
+                    integrationTmp[u + j] += sums[j];
+                u += laneCount;
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        float sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            u++;
+        }
+
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sumOverI;
+        else
+            outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=0; k < kPatternCount; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
+
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
 BEAGLE_CPU_AVX_TEMPLATE
 int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -555,6 +1004,42 @@ const long BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::getFlags() {
 ///////////////////////////////////////////////////////////////////////////////
 // BeagleImplFactory public methods
 
+BEAGLE_CPU_TEMPLATE
+BeagleImpl* createBeagleCPUAVXImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags) {
+    BeagleCPUAVXImpl<BEAGLE_CPU_GENERIC>* impl = new BeagleCPUAVXImpl<BEAGLE_CPU_GENERIC>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 BeagleImpl* BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
                                              int partialsBufferCount,
@@ -566,55 +1051,54 @@ BeagleImpl* BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int
                                              int categoryCount,
                                              int scaleBufferCount,
                                              int resourceNumber,
-                                             int pluginResourceNumber,                                             
+                                             int pluginResourceNumber,
                                              long preferenceFlags,
                                              long requirementFlags,
                                              int* errorCode) {
 
-    if (!CPUSupportsAVX())
-        return NULL;
-    
 	if (stateCount & 1) { // is odd
-        BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_ODD, P_PAD_AVX_ODD>* impl =
-        new BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_ODD, P_PAD_AVX_ODD>();
-        
-        
-        try {
-            if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
-                                     patternCount, eigenBufferCount, matrixBufferCount,
-                                     categoryCount,scaleBufferCount, resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags) == 0)
-                return impl;
-        }
-        catch(...) {
-            if (DEBUGGING_OUTPUT)
-                std::cerr << "exception in initialize\n";
-            delete impl;
-            throw;
-        }
-        
-        delete impl;        
+        return createBeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_ODD, P_PAD_AVX_ODD>(
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount,
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags);
 	} else {
-        BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_EVEN, P_PAD_AVX_EVEN>* impl =
-                new BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_EVEN, P_PAD_AVX_EVEN>();
+        return createBeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_EVEN, P_PAD_AVX_EVEN>(
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount,
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags);
+    }
+}
 
+template <>
+BeagleImpl* BeagleCPUAVXImplFactory<float>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
 
-        try {
-            if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
-                                     patternCount, eigenBufferCount, matrixBufferCount,
-                                     categoryCount,scaleBufferCount, resourceNumber,  pluginResourceNumber, preferenceFlags, requirementFlags) == 0)
-                return impl;
-        }
-        catch(...) {
-            if (DEBUGGING_OUTPUT)
-                std::cerr << "exception in initialize\n";
-            delete impl;
-            throw;
-        }
+#define CREATE_AVX_FLOAT_IMPL(MOD) \
+        createBeagleCPUAVXImpl<float, T_PAD_AVX_FLOAT_##MOD, P_PAD_AVX_FLOAT_##MOD>( \
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount, \
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount, \
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags)
 
-        delete impl;
+    switch (stateCount & 3) { // pad rows to a multiple of four states
+        case 0:  return CREATE_AVX_FLOAT_IMPL(0);
+        case 1:  return CREATE_AVX_FLOAT_IMPL(1);
+        case 2:  return CREATE_AVX_FLOAT_IMPL(2);
+        default: return CREATE_AVX_FLOAT_IMPL(3);
     }
-    
-    return NULL;
+
+#undef CREATE_AVX_FLOAT_IMPL
 }
 
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -626,7 +1110,7 @@ template <>
 const long BeagleCPUAVXImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -640,7 +1124,7 @@ template <>
 const long BeagleCPUAVXImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_SINGLE |
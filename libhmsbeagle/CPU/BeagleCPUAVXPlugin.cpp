@@ -6,8 +6,6 @@
  */
 
 #include "libhmsbeagle/CPU/BeagleCPUAVXPlugin.h"
-#include "libhmsbeagle/CPU/BeagleCPU4StateAVXImpl.h"
-#include "libhmsbeagle/CPU/BeagleCPUAVXImpl.h"
 #include <iostream>
 
 #ifdef HAVE_CPUID_H
@@ -16,12 +14,16 @@
 	#endif
 #endif
 
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
 namespace beagle {
 namespace cpu {
 
 
 BeagleCPUAVXPlugin::BeagleCPUAVXPlugin() :
-Plugin("CPU-AVX", "CPU-AVX")
+Plugin("CPU-" BEAGLE_CPU_AVX_PLUGIN_VARIANT, "CPU-" BEAGLE_CPU_AVX_PLUGIN_VARIANT)
 {
 	BeagleResource resource;
         resource.name = (char*) "CPU";
@@ -40,12 +42,9 @@ Plugin("CPU-AVX", "CPU-AVX")
         resource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU;
 	beagleResources.push_back(resource);
 
-	// Optional for plugins: check if the hardware is compatible and only populate
-	// list with compatible factories and resources
-	// TODO Write AVX specific implementation
-  beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<double>());
-
-  beagleFactories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<double>());
+	// The same sources are built for AVX, AVX2/FMA and AVX-512; plugin_init()
+	// only creates the plugin if the processor supports the compiled variant
+	addAVXFactories(beagleFactories);
 }
 
 }	// namespace cpu
@@ -158,10 +157,81 @@ bool check_sse2(){
 #endif
 #endif
 
+/*
+ * This file is compiled without the plugin's instruction set flags, so the checks
+ * below run on any processor; they are static so that no copy compiled with those
+ * flags is linked in their place.
+ */
+static void avxCpuid(unsigned int leaf,
+                     unsigned int subleaf,
+                     unsigned int* regs) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned int) r[i];
+#else
+    __asm__ __volatile__ ("cpuid" :
+                          "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3]) :
+                          "a" (leaf), "c" (subleaf));
+#endif
+}
+
+static unsigned long long avxXgetbv() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((unsigned long long) edx << 32) | eax;
+#endif
+}
+
+/*
+ * Returns true if the processor supports the instruction set the plugin is built
+ * for (see BEAGLE_CPU_AVX_LEVEL), and the OS saves the vector registers.
+ */
+static bool CPUSupportsAVX() {
+    unsigned int regs[4];
+
+    avxCpuid(0, 0, regs);
+    const unsigned int maxLeaf = regs[0];
+
+    avxCpuid(1, 0, regs);
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx     = (regs[2] & (1u << 28)) != 0;
+    const bool fma     = (regs[2] & (1u << 12)) != 0;
+    if (!osxsave || !avx)
+        return false;
+
+    const unsigned long long xcr0 = avxXgetbv();
+    if ((xcr0 & 0x06) != 0x06) // SSE and AVX register state
+        return false;
+
+#if BEAGLE_CPU_AVX_LEVEL >= 2
+    if (maxLeaf < 7 || !fma)
+        return false;
+    avxCpuid(7, 0, regs);
+    if (!(regs[1] & (1u << 5))) // AVX2
+        return false;
+#endif
+
+#if BEAGLE_CPU_AVX_LEVEL >= 3
+    if ((xcr0 & 0xe0) != 0xe0) // opmask and 512-bit register state
+        return false;
+    const unsigned int avx512 = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31); // F, DQ, BW, VL
+    if ((regs[1] & avx512) != avx512)
+        return false;
+#endif
+
+    (void) maxLeaf;
+    (void) fma;
+    return true;
+}
 
 void* plugin_init(void){
-	if(!check_sse2()){
-		return NULL;	// no SSE no plugin?! 
+	if(!check_sse2() || !CPUSupportsAVX()){
+		return NULL;	// processor lacks the instructions this plugin was built for
 	}
 	return new beagle::cpu::BeagleCPUAVXPlugin();
 }
@@ -15,9 +15,30 @@
 #include "libhmsbeagle/platform.h"
 #include "libhmsbeagle/plugin/Plugin.h"
 
+#include <list>
+
+/*
+ * Instruction set a plugin is built for, set by the build for both of its parts:
+ * 1 for AVX, 2 for AVX2/FMA and 3 for AVX-512
+ */
+#if BEAGLE_CPU_AVX_LEVEL == 3
+#	define BEAGLE_CPU_AVX_PLUGIN_VARIANT	"AVX512"
+#elif BEAGLE_CPU_AVX_LEVEL == 2
+#	define BEAGLE_CPU_AVX_PLUGIN_VARIANT	"AVX2"
+#else
+#	define BEAGLE_CPU_AVX_PLUGIN_VARIANT	"AVX"
+#endif
+
 namespace beagle {
 namespace cpu {
 
+/*
+ * Adds the factories of the AVX implementations. Defined with the kernels, which are
+ * compiled for the plugin's instruction set, so it may only be called once the
+ * processor is known to support it.
+ */
+void addAVXFactories(std::list<beagle::BeagleImplFactory*>& factories);
+
 class BEAGLE_DLLEXPORT BeagleCPUAVXPlugin : public beagle::plugin::Plugin
 {
 public:
@@ -0,0 +1,291 @@
+/*
+ *  BeagleCPUBufferArena.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUBufferArena__
+#define __BeagleCPUBufferArena__
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define BEAGLE_CPU_ARENA_CACHE_LINE 64
+#define BEAGLE_CPU_ARENA_PAGE_SIZE  4096
+#define BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define BEAGLE_CPU_ARENA_HUGE_PAGE_MIN_SIZE (16 * BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE)
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * One contiguous block of memory holding the buffers of an instance.
+ *
+ * The arena is made of regions of equally sized slots, e.g. one slot per partials
+ * buffer. Slots start on a cache line and their stride is kept off multiples of
+ * the page size, so that the same offset in different buffers does not map to the
+ * same cache set. The block is reserved but not written: pages are backed when a
+ * buffer is first written, and releasing a slot gives its pages back.
+ *
+ * Blocks of at least BEAGLE_CPU_ARENA_HUGE_PAGE_MIN_SIZE are advised to use transparent
+ * huge pages, so that a partly used huge page wastes little of the block; smaller blocks
+ * use normal pages. Huge pages from the hugetlbfs pool are only tried on request, as they
+ * are taken from pages the administrator reserved for other uses.
+ */
+class BeagleCPUBufferArena {
+public:
+    enum Backing {
+        NONE = 0,
+        HEAP,        // one aligned allocation; pages are not given back
+        PAGES,       // anonymous mapping
+        HUGE_PAGES,  // anonymous mapping with transparent huge pages
+        HUGETLB      // mapping from the hugetlbfs pool
+    };
+
+    BeagleCPUBufferArena() : base(NULL), heapBlock(NULL), size(0), regionsEnd(0), backing(NONE),
+                             discardable(true) {}
+
+    ~BeagleCPUBufferArena();
+
+    // Adds a region of slotCount slots of slotSize bytes and returns its index;
+    // only before map()
+    int addRegion(size_t slotSize,
+                  int slotCount);
+
+    // Reserves the block for all regions, from the hugetlbfs pool first if useHugeTLB;
+    // returns false if it cannot be allocated
+    bool map(bool useHugeTLB);
+
+    // Gives the block back and reserves it again as map() does; only while no slot is
+    // in use
+    bool remap(bool useHugeTLB);
+
+    // Whether map() can take the block from the hugetlbfs pool on this system
+    static bool supportsHugeTLB();
+
+    // Returns slot preferredSlot of the region if it is free, otherwise any free
+    // slot of the region, or NULL if all are in use
+    void* allocate(int region,
+                   int preferredSlot);
+
+    // Frees the slot at buffer; returns false if buffer is not a slot of this arena
+    bool release(void* buffer);
+
+    bool contains(const void* buffer) const {
+        return base != NULL && (const char*) buffer >= base && (const char*) buffer < base + size;
+    }
+
+    Backing getBacking() const { return backing; }
+
+    size_t getSize() const { return size; }
+
+private:
+    struct Region {
+        size_t offset;
+        size_t slotSize;
+        size_t stride;
+        int slotCount;
+        std::vector<char> inUse;
+    };
+
+    void unmap();
+
+    void discardPages(char* begin,
+                      size_t length);
+
+    std::vector<Region> regions;
+    char* base;
+    void* heapBlock;
+    size_t size;       // of the block once reserved
+    size_t regionsEnd; // end of the last region
+    Backing backing;
+    bool discardable; // false once the system refused to give pages back
+};
+
+inline BeagleCPUBufferArena::~BeagleCPUBufferArena() {
+    unmap();
+}
+
+inline void BeagleCPUBufferArena::unmap() {
+#if defined(__linux__) || defined(__APPLE__)
+    if (backing == PAGES || backing == HUGE_PAGES || backing == HUGETLB)
+        munmap(base, size);
+#endif
+    if (backing == HEAP)
+        free(heapBlock);
+    base = NULL;
+    heapBlock = NULL;
+    size = 0;
+    backing = NONE;
+    discardable = true;
+}
+
+inline int BeagleCPUBufferArena::addRegion(size_t slotSize,
+                                           int slotCount) {
+    Region region;
+    region.slotSize = slotSize;
+    region.slotCount = slotCount;
+    region.inUse.assign(slotCount, 0);
+
+    // Buffers a whole number of pages apart would contend for the same cache sets
+    region.stride = ((slotSize + BEAGLE_CPU_ARENA_CACHE_LINE - 1) / BEAGLE_CPU_ARENA_CACHE_LINE) *
+                    BEAGLE_CPU_ARENA_CACHE_LINE;
+    if (region.stride % BEAGLE_CPU_ARENA_PAGE_SIZE == 0)
+        region.stride += BEAGLE_CPU_ARENA_CACHE_LINE;
+
+    // Regions start on a page
+    region.offset = ((regionsEnd + BEAGLE_CPU_ARENA_PAGE_SIZE - 1) / BEAGLE_CPU_ARENA_PAGE_SIZE) *
+                    BEAGLE_CPU_ARENA_PAGE_SIZE;
+    regionsEnd = region.offset + region.stride * slotCount;
+
+    regions.push_back(region);
+    return (int) regions.size() - 1;
+}
+
+inline bool BeagleCPUBufferArena::map(bool useHugeTLB) {
+    if (regionsEnd == 0)
+        return false;
+
+#if defined(__linux__) || defined(__APPLE__)
+    const size_t pageSize = ((regionsEnd + BEAGLE_CPU_ARENA_PAGE_SIZE - 1) / BEAGLE_CPU_ARENA_PAGE_SIZE) *
+                            BEAGLE_CPU_ARENA_PAGE_SIZE;
+    const size_t hugeSize = ((regionsEnd + BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE - 1) / BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE) *
+                            BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE;
+    void* block = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    // Fails unless enough huge pages are reserved; without MAP_NORESERVE, so that a
+    // short pool cannot fault (SIGBUS) when a buffer is first written
+    if (useHugeTLB) {
+        block = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (block != MAP_FAILED) {
+            base = (char*) block;
+            size = hugeSize;
+            backing = HUGETLB;
+            return true;
+        }
+    }
+#endif
+    const bool hugePages = (regionsEnd >= BEAGLE_CPU_ARENA_HUGE_PAGE_MIN_SIZE);
+    const size_t mapSize = (hugePages ? hugeSize : pageSize);
+    block = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block != MAP_FAILED) {
+        base = (char*) block;
+        size = mapSize;
+        backing = PAGES;
+#if defined(MADV_HUGEPAGE)
+        if (hugePages && madvise(base, size, MADV_HUGEPAGE) == 0)
+            backing = HUGE_PAGES;
+#endif
+        return true;
+    }
+#endif
+
+    heapBlock = malloc(regionsEnd + BEAGLE_CPU_ARENA_PAGE_SIZE);
+    if (heapBlock == NULL)
+        return false;
+    size_t address = (size_t) heapBlock;
+    base = (char*) (((address + BEAGLE_CPU_ARENA_PAGE_SIZE - 1) / BEAGLE_CPU_ARENA_PAGE_SIZE) *
+                    BEAGLE_CPU_ARENA_PAGE_SIZE);
+    size = regionsEnd;
+    backing = HEAP;
+    return true;
+}
+
+inline bool BeagleCPUBufferArena::remap(bool useHugeTLB) {
+    for (size_t r = 0; r < regions.size(); r++) {
+        for (int slot = 0; slot < regions[r].slotCount; slot++) {
+            if (regions[r].inUse[slot])
+                return false;
+        }
+    }
+    unmap();
+    return map(useHugeTLB);
+}
+
+inline bool BeagleCPUBufferArena::supportsHugeTLB() {
+#if (defined(__linux__) || defined(__APPLE__)) && defined(MAP_HUGETLB)
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline void* BeagleCPUBufferArena::allocate(int regionIndex,
+                                            int preferredSlot) {
+    if (backing == NONE)
+        return NULL;
+
+    Region& region = regions[regionIndex];
+    int slot = preferredSlot;
+    if (slot < 0 || slot >= region.slotCount || region.inUse[slot]) {
+        for (slot = 0; slot < region.slotCount && region.inUse[slot]; slot++)
+            ;
+        if (slot == region.slotCount)
+            return NULL;
+    }
+    region.inUse[slot] = 1;
+    return base + region.offset + region.stride * slot;
+}
+
+inline bool BeagleCPUBufferArena::release(void* buffer) {
+    if (!contains(buffer))
+        return false;
+
+    size_t offset = (char*) buffer - base;
+    for (size_t r = 0; r < regions.size(); r++) {
+        Region& region = regions[r];
+        if (offset >= region.offset && offset < region.offset + region.stride * region.slotCount) {
+            int slot = (int) ((offset - region.offset) / region.stride);
+            region.inUse[slot] = 0;
+            discardPages((char*) buffer, region.slotSize);
+            break;
+        }
+    }
+    return true;
+}
+
+// Gives back the pages lying entirely inside [begin, begin + length). Where the system
+// refuses (MADV_DONTNEED on hugetlbfs before Linux 5.18), released slots keep their pages
+// and are reused as they are.
+inline void BeagleCPUBufferArena::discardPages(char* begin,
+                                               size_t length) {
+#if defined(__linux__) || defined(__APPLE__)
+    if (backing == HEAP || !discardable)
+        return;
+    const size_t pageSize = (backing == HUGETLB ? BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE : BEAGLE_CPU_ARENA_PAGE_SIZE);
+    size_t first = (((size_t) begin + pageSize - 1) / pageSize) * pageSize;
+    size_t last = (((size_t) begin + length) / pageSize) * pageSize;
+    if (first < last && madvise((void*) first, last - first, MADV_DONTNEED) != 0)
+        discardable = false;
+#endif
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUBufferArena__
@@ -38,11 +38,9 @@
 
 #include <vector>
 #include <thread>
-#include <future>
-#include <queue>
-#include <condition_variable>
-#include <mutex>
-#include <functional>
+
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+#include "libhmsbeagle/CPU/BeagleCPUBufferArena.h"
 
 #define BEAGLE_CPU_GENERIC	REALTYPE, T_PAD, P_PAD
 #define BEAGLE_CPU_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD>
@@ -55,10 +53,16 @@
 #define P_PAD_DEFAULT   0   // No partials padding necessary for non-SSE implementations
 
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT 256 // do not use CPU auto-threading for problems with fewer patterns
+#define BEAGLE_CPU_PAGE_SIZE 4096 // granularity of first-touch placement of partition buffers
+#define BEAGLE_CPU_RESCALE_BLOCK_SIZE 8192 // partials entries (over all categories) computed and rescaled per block
+#define BEAGLE_CPU_CROSS_PRODUCT_BLOCK_PATTERNS 64 // patterns gathered together when accumulating cross products
+#define BEAGLE_CPU_MAX_TIP_STATE_COUNT 255 // larger state spaces keep tips set by setTipStates as partials
 
 namespace beagle {
 namespace cpu {
 
+typedef unsigned char TipState; // compact tip state, kStateCount for missing data
+
 BEAGLE_CPU_TEMPLATE
 class BeagleCPUImpl : public BeagleImpl {
 
@@ -109,8 +113,15 @@ protected:
     //      tipStates field should be switched to vectors of vectors (to make
     //      memory management less error prone
     REALTYPE** gPartials;
-    int** gTipStates;
+    TipState** gTipStates;
     REALTYPE** gScaleBuffers;
+
+    // Packed tip states keep two bits per pattern, 16 patterns per word, and list the
+    // patterns with missing data (including padding) separately
+    bool kPackedTipStates;
+    unsigned int** gPackedTipStates;
+    std::vector<std::vector<int> > gTipMissingPatterns;
+    std::vector<TipState> gTipStatesScratch; // unpacked states, see getTipStates
     
     signed short** gAutoScaleBuffers;
     
@@ -129,30 +140,142 @@ protected:
     REALTYPE* outFirstDerivativesTmp;
     REALTYPE* outSecondDerivativesTmp;
 
+    int* indexMaxScaleTmp; // per pattern, subset holding the largest scale factor
+    REALTYPE* maxScaleFactorTmp;
+
+    // Mixed precision (single precision only): partials and matrices stay in float, but
+    // matrices are computed, partials integrated, cumulative scale factors kept and site
+    // log likelihoods summed in double. Enabling it doubles the scale buffers, which then
+    // hold the low-order part of each factor in their second half.
+    bool kMixedPrecision;
+    bool kScaleBuffersWidened; // scale buffers hold 2 * kPaddedPatternCount, once and for all
+    double* gSiteLikelihoodsTmp; // per pattern, before taking the log; mixed precision only
+    EigenDecomposition<double, T_PAD>* gMixedEigenDecomposition;
+    std::vector<char> gMixedEigenSet; // per decomposition, set since mixed precision was enabled
+    std::vector<double> gMixedMatricesTmp;
+
+    int kRescaleBlockPatterns; // patterns computed and rescaled together while in cache
+    int kTilePatterns; // patterns per tile when running operation lists tile by tile, 0: not tiled
+
     REALTYPE* ones;
     REALTYPE* zeros;
 
-    struct threadData
-    {
-        std::thread t; // The thread object
-        std::queue<std::packaged_task<void()>> jobs; // The job queue
-        std::condition_variable cv; // The condition variable to wait for threads
-        std::mutex m; // Mutex used for avoiding data races
-        bool stop = false; // When set, this flag tells the thread that it should exit
-    };
-
     int kNumThreads;
+    int kRequestedThreadCount;  // 0: size of the shared thread pool
+    int kMinPatternsPerThread;
     bool kThreadingEnabled;
     bool kAutoPartitioningEnabled;
     bool kAutoRootPartitioningEnabled;
 
-    threadData* gThreads;
-    int** gThreadOperations;
-    int* gThreadOpCounts;
+    BeagleCPUThreadPool* gThreadPool;
+    int* gThreadOperations; // operations grouped by task
+    int* gThreadOpOffsets;  // first operation of each task
     int* gAutoPartitionOperations;
     int* gAutoPartitionIndices;
     double* gAutoPartitionOutSumLogLikelihoods;
-    std::shared_future<void>* gFutures;
+
+    // Dependency levels for scheduling independent partials operations concurrently
+    int* gOperationLevels;
+    int* gLevelOperationOffsets;
+    int* gLevelOperations;
+    int* gBufferWriteLevels; // last level writing each partials/scale buffer, per partition
+    int* gBufferReadLevels;  // last level reading each partials/scale buffer, per partition
+    int* gOperationSlots;          // thread of each level-sorted operation, see upPartialsByLevelAsync
+    int* gSlotOperationOffsets;    // first operation of each thread within a level
+    int* gPartitionOperationCounts;
+
+    // A partials operation of an operation plan, with its buffers and kernel looked up
+    struct PlanOperation {
+        int kernel;  // 0: states-states, 1: states-partials, 2: partials-partials
+        int rescale; // BEAGLE_OP_NONE: no scaling, 0: fixed scale factors, 1: recompute scale factors
+        REALTYPE* destPartials;
+        int states1Index; // buffer with compact states, or -1
+        const REALTYPE* partials1;
+        const REALTYPE* matrices1;
+        const REALTYPE* partials2;
+        int states2Index;
+        const REALTYPE* matrices2;
+        REALTYPE* scalingFactors;
+    };
+
+    struct OperationPlan {
+        int eigenIndex;
+        std::vector<int> probabilityIndices;
+        std::vector<int> encodedOperations; // as passed to updatePartials
+        std::vector<PlanOperation> operations;
+        int bufferVersion; // kBufferVersion when operations were decoded
+        int cumulativeScaleIndex;
+        REALTYPE* cumulativeScaleBuffer;
+        int rootBufferIndex;
+        int categoryWeightsIndex;
+        int stateFrequenciesIndex;
+    };
+
+    std::vector<OperationPlan*> gOperationPlans; // NULL for finalized plans
+    int kBufferVersion; // changes whenever a partials, matrix, scale or tip states buffer is (re)allocated or swapped
+
+    // Inputs a partials buffer was last computed from by updatePartials
+    struct OperationInputs {
+        int operation[BEAGLE_OP_COUNT];
+        unsigned long versions[5];     // child1, matrix1, child2, matrix2 and read scale buffer
+        unsigned long partialsVersion; // version written by the operation, 0: none
+        unsigned long scaleVersion;    // version of the written scale buffer, 0: none
+    };
+
+    // Content versions, so that updatePartials can skip operations whose inputs are unchanged
+    bool kSkipUnchangedOperations;
+    unsigned long kVersionClock;
+    std::vector<unsigned long> gPartialsVersions; // per partials or tip states buffer
+    std::vector<unsigned long> gMatrixVersions;
+    std::vector<unsigned long> gScaleVersions;
+    std::vector<OperationInputs> gOperationInputs; // per partials buffer
+    std::vector<int> gChangedOperations;
+
+    // A buffer written since the restore point, with its contents at the restore point
+    struct SnapshotBuffer {
+        int index;
+        REALTYPE* buffer;
+        unsigned long version;
+        OperationInputs inputs; // partials buffers only
+    };
+
+    // Saved buffers of one kind; buffers are swapped, not copied, when fully overwritten
+    struct SnapshotBuffers {
+        std::vector<SnapshotBuffer> saved;
+        std::vector<char> isSaved;
+        std::vector<REALTYPE*> spares; // buffers for reuse by later restore points
+        size_t bufferSize;
+    };
+
+    // Partials, matrix and (unless auto-scaling) scale buffers are slots of the arena;
+    // buffers that do not fit, and snapshot spares, are separate allocations
+    BeagleCPUBufferArena gBufferArena;
+    bool kUseBufferArena;
+    int kArenaPartialsRegion;
+    int kArenaMatricesRegion;
+    int kArenaScaleRegion; // -1 with auto-scaling
+
+    bool kSnapshotActive;
+    SnapshotBuffers gSnapshotPartials;
+    SnapshotBuffers gSnapshotMatrices;
+    SnapshotBuffers gSnapshotScaleBuffers;
+
+    // A pre-order partials operation with its buffers looked up
+    struct PreOperation {
+        REALTYPE* destPartials;
+        const REALTYPE* prePartials;  // pre-order partials of the parent
+        const REALTYPE* preMatrices;  // edge above the parent, NULL at the root's children
+        int statesIndex;              // sibling buffer with compact states, or -1
+        const REALTYPE* partials;     // sibling post-order partials
+        const REALTYPE* matrices;     // edge above the sibling
+        REALTYPE* scalingFactors;     // NULL: no rescaling
+    };
+
+    std::vector<PreOperation> gPreOperations;
+    std::vector<double> gEdgeDerivativeSums; // per pattern partition and edge
+    std::vector<int> gSubsetScaleIndices; // per subset, scale buffer when scaling always
+    std::vector<double> gCrossProductScratch; // per pattern partition: gathered partials and sums
+    std::vector<double> gEdgeProjection; // exponential terms, then per pattern the projected edge
 
 public:
     virtual ~BeagleCPUImpl();
@@ -179,6 +302,7 @@ public:
     //
     // tipIndex the index of the tip
     // inStates the array of states: 0 to stateCount - 1, missing = stateCount
+    // tips of more than BEAGLE_CPU_MAX_TIP_STATE_COUNT states are stored as partials
     int setTipStates(int tipIndex,
                      const int* inStates);
 
@@ -197,6 +321,12 @@ public:
 					int scaleBuffer,
                     double* outPartials);
 
+    int allocatePartials(const int* bufferIndices,
+                         int count);
+
+    int releasePartials(const int* bufferIndices,
+                        int count);
+
     // sets the Eigen decomposition for a given matrix
     //
     // matrixIndex the matrix index to update
@@ -218,6 +348,20 @@ public:
 
     int setPatternPartitions(int partitionCount,
                              const int* inPatternPartitions);
+
+    int setCPUThreadCount(int threadCount);
+
+    int setCPUMinPatternsPerThread(int minPatternCount);
+
+    int setCPUTilePatternCount(int patternCount);
+
+    int setCPUSkipUnchangedOperations(int enabled);
+
+    int setCPUPackedTipStates(int enabled);
+
+    int setCPUBufferArena(int mode);
+
+    int setCPUMixedPrecision(int enabled);
     
     // set the vector of category rates
     //
@@ -282,6 +426,40 @@ public:
     int updatePartialsByPartition(const int* operations,
                                   int operationCount);
 
+    int createOperationPlan(int eigenIndex,
+                            const int* probabilityIndices,
+                            int matrixCount,
+                            const int* operations,
+                            int operationCount,
+                            int cumulativeScalingIndex,
+                            int rootBufferIndex,
+                            int categoryWeightsIndex,
+                            int stateFrequenciesIndex);
+
+    int updateWithOperationPlan(int planIndex,
+                                const double* edgeLengths,
+                                double* outSumLogLikelihood);
+
+    int finalizeOperationPlan(int planIndex);
+
+    // Mark a restore point; buffers written afterwards keep their contents at this point
+    int storeSnapshot();
+
+    // Revert the buffers written since the restore point
+    int restoreSnapshot();
+
+    // Drop the restore point and stop saving buffers
+    int releaseSnapshot();
+
+    // Fill pre-order partials with the state frequencies at the root
+    int setRootPrePartials(const int* bufferIndices,
+                           const int* stateFrequenciesIndices,
+                           int count);
+
+    // Calculate pre-order partials, parents first; see beagleUpdatePrePartials for the layout
+    int updatePrePartials(const int* operations,
+                          int operationCount);
+
     // Block until all calculations that write to the specified partials have completed.
     //
     // This function is optional and only has to be called by clients that "recycle" partials.
@@ -380,6 +558,54 @@ public:
                                                double* outSumFirstDerivative,
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
+
+    // log likelihood and derivative sums of each of count independent edges
+    int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                           const int* childBufferIndices,
+                                           const int* probabilityIndices,
+                                           const int* firstDerivativeIndices,
+                                           const int* secondDerivativeIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           int count,
+                                           double* outLogLikelihoods,
+                                           double* outFirstDerivatives,
+                                           double* outSecondDerivatives);
+
+    // d logL / d t for each edge from its post-order and pre-order partials
+    int calculateEdgeDerivatives(const int* postBufferIndices,
+                                 const int* preBufferIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 int categoryWeightsIndex,
+                                 int count,
+                                 double* outDerivatives);
+
+    // Pre-order times post-order partials per rate category, summed over edges and patterns
+    int calculateCrossProducts(const int* postBufferIndices,
+                               const int* preBufferIndices,
+                               const int* probabilityIndices,
+                               const double* edgeLengths,
+                               int categoryWeightsIndex,
+                               int count,
+                               double* outCrossProducts);
+
+    // Newton-Raphson on one edge length with the partials projected onto the eigenvectors
+    int optimizeEdgeLength(int parentBufferIndex,
+                           int childBufferIndex,
+                           int eigenIndex,
+                           int categoryWeightsIndex,
+                           int stateFrequenciesIndex,
+                           int cumulativeScaleIndex,
+                           double minEdgeLength,
+                           double maxEdgeLength,
+                           double tolerance,
+                           int maxIterations,
+                           double* inOutEdgeLength,
+                           double* outLogLikelihood,
+                           double* outFirstDerivative,
+                           double* outSecondDerivative);
     
     int getSiteLogLikelihoods(double* outLogLikelihoods);
     
@@ -396,7 +622,8 @@ protected:
     virtual int upPartials(bool byPartition,
                            const int* operations,
                            int operationCount,
-                           int cumulativeScalingIndex);
+                           int cumulativeScalingIndex,
+                           int scratchLane);
 
     virtual void autoPartitionPartialsOperations(const int* operations,
                                                  int* partitionOperations,
@@ -406,19 +633,146 @@ protected:
     virtual int upPartialsByPartitionAsync(const int* operations,
                                            int operationCount);
 
+    virtual int computeOperationLevels(const int* operations,
+                                       int operationCount);
+
+    virtual int upPartialsByLevelAsync(const int* operations,
+                                       int operationCount);
+
+    virtual int decodeOperationPlan(OperationPlan* plan);
+
+    virtual void upPlanPartials(const OperationPlan* plan,
+                                int startPattern,
+                                int endPattern);
+
+    virtual void upPrePartials(const PreOperation* operations,
+                               int operationCount,
+                               int startPattern,
+                               int endPattern);
+
+    virtual void calcEdgeDerivativeSums(const int* postBufferIndices,
+                                        const int* preBufferIndices,
+                                        const int* probabilityIndices,
+                                        const int* firstDerivativeIndices,
+                                        const REALTYPE* weights,
+                                        int count,
+                                        double* outSums,
+                                        int startPattern,
+                                        int endPattern);
+
+    virtual void calcCrossProductSums(const int* postBufferIndices,
+                                      const int* preBufferIndices,
+                                      const int* probabilityIndices,
+                                      const double* edgeLengths,
+                                      const REALTYPE* weights,
+                                      int count,
+                                      double* scratch,
+                                      double* outSums,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual double calcProjectedEdgeLogLikelihood(double edgeLength,
+                                                  const REALTYPE* eigenValues,
+                                                  const double* categoryRates,
+                                                  double* outFirstDerivative,
+                                                  double* outSecondDerivative);
+
     virtual int reorderPatternsByPartition();
 
+    bool hasTipStates(int bufferIndex);
+
+    const TipState* getTipStates(int bufferIndex,
+                                 int startPattern,
+                                 int endPattern,
+                                 int slot);
+
+    void allocateTipStatesScratch();
+
+    int packTipStates(int tipIndex,
+                      const int* inStates);
+
+    void unpackTipStates(int tipIndex,
+                         int startPattern,
+                         int endPattern,
+                         TipState* outStates);
+
+    int allocatePartialsBuffer(int bufferIndex);
+
+    void* allocateBuffer(int arenaRegion,
+                         int slot,
+                         size_t size);
+
+    void freeBuffer(void* buffer);
+
+    void moveBuffers(REALTYPE** buffers,
+                     int count,
+                     int arenaRegion,
+                     size_t size);
+
+    void setBuffersInArena(bool useArena);
+
+    void moveSnapshotBuffersToHeap(SnapshotBuffers& snapshot);
+
+    bool widenScaleBuffers(int count);
+
+    int preparePartialsOperations(const int* operations,
+                                  int count,
+                                  int operationSize);
+
+    virtual int removeUnchangedOperations(const int* operations,
+                                          int count,
+                                          int cumulativeScaleIndex,
+                                          int* changedOperations);
+
+    void touchPartials(int bufferIndex);
+
+    void touchMatrices(const int* matrixIndices,
+                       int count);
+
+    void touchScaleBuffer(int scaleIndex);
+
+    void saveSnapshotBuffer(SnapshotBuffers& snapshot,
+                            REALTYPE** buffers,
+                            std::vector<unsigned long>& versions,
+                            int index,
+                            bool keepContents);
+
+    void savePartials(int bufferIndex,
+                      bool keepContents);
+
+    void saveMatrices(const int* matrixIndices,
+                      int count);
+
+    void saveScaleBuffer(int scaleIndex,
+                         bool keepContents);
+
+    void clearSnapshot(bool restore);
+
+    virtual void touchPartitionBuffers();
+
+    virtual int getThreadCountLimit();
+
+    virtual void enableThreading();
+
+    virtual void disableThreading();
+
+    virtual void enableAutoPartitioning();
+
+    virtual void disableAutoPartitioning();
+
+    virtual void resetThreading();
+
     virtual void calcStatesStates(REALTYPE* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const REALTYPE* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const REALTYPE* matrices2,
                                   int startPattern,
                                   int endPattern);
 
 
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
@@ -516,6 +870,32 @@ protected:
                                             int count,
                                             double* outSumLogLikelihood);
     
+    virtual int calcEdgeLogLikelihoodsDerivsMulti(const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* firstDerivativeIndices,
+                                                  const int* secondDerivativeIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* scalingFactorsIndices,
+                                                  int count,
+                                                  double* outSumLogLikelihoods,
+                                                  double* outSumFirstDerivatives,
+                                                  double* outSumSecondDerivatives);
+
+    virtual void calcEdgeLogLikelihoodDerivSums(const int parentBufferIndex,
+                                                const int childBufferIndex,
+                                                const int probabilityIndex,
+                                                const int firstDerivativeIndex,
+                                                const int secondDerivativeIndex,
+                                                const int categoryWeightsIndex,
+                                                const int stateFrequenciesIndex,
+                                                const int scalingFactorsIndex,
+                                                int startPattern,
+                                                int endPattern,
+                                                int scratchLane,
+                                                double* outSums);
+
     virtual int calcEdgeLogLikelihoodsFirstDeriv(const int parentBufferIndex,
                                                   const int childBufferIndex,
                                                   const int probabilityIndex,
@@ -539,16 +919,16 @@ protected:
                                                    double* outSumSecondDerivative);
 
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                              const int *child0States,
+                                              const TipState *child0States,
                                               const REALTYPE *child0TransMat,
-                                              const int *child1States,
+                                              const TipState *child1States,
                                               const REALTYPE *child1TransMat,
                                               const REALTYPE *scaleFactors,
                                               int startPattern,
                                               int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                                const int *child0States,
+                                                const TipState *child0States,
                                                 const REALTYPE *child0TransMat,
                                                 const REALTYPE *child1Partials,
                                                 const REALTYPE *child1TransMat,
@@ -575,13 +955,60 @@ protected:
     virtual void rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
                                  REALTYPE *cumulativeScaleFactors,
-                                 const int  fillWithOnes);
-
-    virtual void rescalePartialsByPartition(REALTYPE *destP,
-                                            REALTYPE *scaleFactors,
-                                            REALTYPE *cumulativeScaleFactors,
-                                            const int fillWithOnes,
-                                            const int partitionIndex);
+                                 int startPattern,
+                                 int endPattern);
+
+    void setPatternScaleFactor(REALTYPE max,
+                               REALTYPE *scaleFactors,
+                               REALTYPE *cumulativeScaleFactors,
+                               int pattern);
+
+    void updateMixedTransitionMatrices(int eigenIndex,
+                                       const int* probabilityIndices,
+                                       const int* firstDerivativeIndices,
+                                       const int* secondDerivativeIndices,
+                                       const double* edgeLengths,
+                                       const double* categoryRates,
+                                       int count);
+
+    void addCumulativeScaleFactor(REALTYPE *cumulativeScaleFactors,
+                                  int pattern,
+                                  double logScaleFactor);
+
+    double sumSiteLogLikelihoods(int startPattern,
+                                 int endPattern,
+                                 int scalingFactorsIndex);
+
+    double getCumulativeScaleFactor(const REALTYPE* cumulativeScaleFactors,
+                                    int pattern);
+
+    void addSubsetSiteLikelihood(const int* scaleIndices,
+                                 int subsetIndex,
+                                 int count,
+                                 int pattern,
+                                 double siteLikelihood);
+
+    double sumSubsetSiteLogLikelihoods(const int* scaleIndices);
+
+    template <typename SUMTYPE>
+    void integrateStatesPartials(REALTYPE *destP,
+                                 const TipState *states1,
+                                 const REALTYPE *matrices1,
+                                 const REALTYPE *partials2,
+                                 const REALTYPE *matrices2,
+                                 const REALTYPE *scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    template <typename SUMTYPE>
+    void integratePartialsPartials(REALTYPE *destP,
+                                   const REALTYPE *partials1,
+                                   const REALTYPE *matrices1,
+                                   const REALTYPE *partials2,
+                                   const REALTYPE *matrices2,
+                                   const REALTYPE *scaleFactors,
+                                   int startPattern,
+                                   int endPattern);
     
     virtual void autoRescalePartials(REALTYPE *destP,
     		                     signed short *scaleFactors);
@@ -590,8 +1017,6 @@ protected:
 
     void* mallocAligned(size_t size);
 
-    void threadWaiting(threadData* tData);
-
 };
 
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -80,6 +80,7 @@
 #include <cassert>
 #include <vector>
 #include <cfloat>
+#include <algorithm>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/CPU/Precision.h"
@@ -139,18 +140,21 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 
     for(unsigned int i=0; i<kMatrixCount; i++) {
         if (gTransitionMatrices[i] != NULL)
-            free(gTransitionMatrices[i]);
+            freeBuffer(gTransitionMatrices[i]);
     }
     free(gTransitionMatrices);
 
     for(unsigned int i=0; i<kBufferCount; i++) {
         if (gPartials[i] != NULL)
-            free(gPartials[i]);
+            freeBuffer(gPartials[i]);
         if (gTipStates[i] != NULL)
             free(gTipStates[i]);
+        if (gPackedTipStates[i] != NULL)
+            free(gPackedTipStates[i]);
     }
     free(gPartials);
     free(gTipStates);
+    free(gPackedTipStates);
     
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
@@ -165,7 +169,7 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     } else {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
             if (gScaleBuffers[i] != NULL)
-                free(gScaleBuffers[i]);
+                freeBuffer(gScaleBuffers[i]);
         }        
     }
     
@@ -191,43 +195,26 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     free(outFirstDerivativesTmp);
     free(outSecondDerivativesTmp);
 
-    free(ones);
-    free(zeros);
+    free(indexMaxScaleTmp);
+    free(maxScaleFactorTmp);
 
-    delete gEigenDecomposition;
+    if (gSiteLikelihoodsTmp != NULL)
+        free(gSiteLikelihoodsTmp);
 
-    if (kThreadingEnabled) {
-        // Send stop signal to all threads and join them...
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            std::unique_lock<std::mutex> l(td->m);
-            td->stop = true;
-            td->cv.notify_one();
-        }
+    free(ones);
+    free(zeros);
 
-        // Join all the threads
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            td->t.join();
-        }
+    for (size_t i = 0; i < gOperationPlans.size(); i++)
+        delete gOperationPlans[i];
 
-        delete[] gThreads;
-        delete[] gFutures;
+    releaseSnapshot();
 
-        for (int i=0; i<kNumThreads; i++) {
-            free(gThreadOperations[i]);
-        }
-        free(gThreadOperations);
-        free(gThreadOpCounts);
-    }
+    delete gEigenDecomposition;
+    if (gMixedEigenDecomposition != NULL)
+        delete gMixedEigenDecomposition;
 
-    if (kAutoPartitioningEnabled) {
-        free(gAutoPartitionOperations);
-        if (kAutoRootPartitioningEnabled) {
-            free(gAutoPartitionIndices);
-            free(gAutoPartitionOutSumLogLikelihoods);
-        }
-    }
+    disableThreading();
+    disableAutoPartitioning();
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -287,6 +274,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     kMatrixSize = (T_PAD + kStateCount) * kStateCount;
 
+    // Scale buffers get room for low-order parts when mixed precision is enabled
     int scaleBufferSize = kPaddedPatternCount;
     
     kFlags = 0;
@@ -357,20 +345,35 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     // assigning kBufferCount to this array so that we can just check if a tipStateBuffer is
     // allocated
-    gTipStates = (int**) malloc(sizeof(int*) * kBufferCount);
+    gTipStates = (TipState**) malloc(sizeof(TipState*) * kBufferCount);
     if (gTipStates == NULL)
         throw std::bad_alloc();
 
+    gPackedTipStates = (unsigned int**) malloc(sizeof(unsigned int*) * kBufferCount);
+    if (gPackedTipStates == NULL)
+        throw std::bad_alloc();
+
     for (int i = 0; i < kBufferCount; i++) {
         gPartials[i] = NULL;
         gTipStates[i] = NULL;
+        gPackedTipStates[i] = NULL;
     }
-
-    for (int i = kTipCount; i < kBufferCount; i++) {
-        gPartials[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-        if (gPartials[i] == NULL)
-            throw std::bad_alloc();
-    }
+    gTipMissingPatterns.resize(kBufferCount);
+    kPackedTipStates = false;
+
+    // Partials buffers are allocated when first written (allocatePartialsBuffer)
+
+    // Slots are only backed by memory once written, so reserving all of them is cheap
+    kArenaPartialsRegion = gBufferArena.addRegion(sizeof(REALTYPE) * kPartialsSize, kBufferCount);
+    kArenaMatricesRegion = gBufferArena.addRegion(sizeof(REALTYPE) * kMatrixSize * kCategoryCount,
+                                                  kMatrixCount);
+    kArenaScaleRegion = -1;
+    if (!(kFlags & BEAGLE_FLAG_SCALING_AUTO))
+        kArenaScaleRegion = gBufferArena.addRegion(sizeof(REALTYPE) * scaleBufferSize,
+                                                   kScaleBufferCount);
+    // Reserved hugetlbfs pages are shared with the rest of the system, so they are
+    // only used on request (setCPUBufferArena)
+    kUseBufferArena = gBufferArena.map(false);
 
     gScaleBuffers = NULL;
 
@@ -381,27 +384,28 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         if (gAutoScaleBuffers == NULL)
             throw std::bad_alloc();        
         for (int i = 0; i < kScaleBufferCount; i++) {
-            gAutoScaleBuffers[i] = (signed short*) malloc(sizeof(signed short) * scaleBufferSize);
+            gAutoScaleBuffers[i] = (signed short*) malloc(sizeof(signed short) * kPaddedPatternCount);
             if (gAutoScaleBuffers[i] == 0L)
                 throw std::bad_alloc();
         }
         gActiveScalingFactors = (int*) malloc(sizeof(int) * kInternalPartialsBufferCount);
         gScaleBuffers = (REALTYPE**) malloc(sizeof(REALTYPE*));
-        gScaleBuffers[0] = (REALTYPE*) malloc(sizeof(REALTYPE) * scaleBufferSize);
+        gScaleBuffers[0] = (REALTYPE*) calloc(scaleBufferSize, sizeof(REALTYPE));
     } else {
         gScaleBuffers = (REALTYPE**) malloc(sizeof(REALTYPE*) * kScaleBufferCount);
         if (gScaleBuffers == NULL)
             throw std::bad_alloc();
         
         for (int i = 0; i < kScaleBufferCount; i++) {
-            gScaleBuffers[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * scaleBufferSize);
+            gScaleBuffers[i] = (REALTYPE*) allocateBuffer(kArenaScaleRegion, i,
+                                                          sizeof(REALTYPE) * scaleBufferSize);
             
             if (gScaleBuffers[i] == 0L)
                 throw std::bad_alloc();
 
             
             if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) {
-                for (int j=0; j < scaleBufferSize; j++) {
+                for (int j=0; j < kPaddedPatternCount; j++) {
                     gScaleBuffers[i][j] = 1.0;
                 }
             }
@@ -413,7 +417,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     if (gTransitionMatrices == NULL)
         throw std::bad_alloc();
     for (int i = 0; i < kMatrixCount; i++) {
-        gTransitionMatrices[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+        gTransitionMatrices[i] = (REALTYPE*) allocateBuffer(kArenaMatricesRegion, i,
+                                                            sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
         if (gTransitionMatrices[i] == 0L)
             throw std::bad_alloc();
     }
@@ -426,6 +431,36 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     outFirstDerivativesTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
     outSecondDerivativesTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
 
+    indexMaxScaleTmp = (int*) malloc(sizeof(int) * kPatternCount);
+    maxScaleFactorTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount);
+
+    kMixedPrecision = false;
+    kScaleBuffersWidened = false;
+    gSiteLikelihoodsTmp = NULL;
+    gMixedEigenDecomposition = NULL;
+
+    kRescaleBlockPatterns = BEAGLE_CPU_RESCALE_BLOCK_SIZE / (kCategoryCount * kPartialsPaddedStateCount);
+    if (kRescaleBlockPatterns < 1)
+        kRescaleBlockPatterns = 1;
+
+    kTilePatterns = 0;
+
+    kBufferVersion = 0;
+
+    kSkipUnchangedOperations = false;
+    kVersionClock = 0;
+    gPartialsVersions.assign(kBufferCount, 0);
+    gMatrixVersions.assign(kMatrixCount, 0);
+    gScaleVersions.assign(kScaleBufferCount, 0);
+
+    kSnapshotActive = false;
+    gSnapshotPartials.isSaved.assign(kBufferCount, 0);
+    gSnapshotPartials.bufferSize = kPartialsSize;
+    gSnapshotMatrices.isSaved.assign(kMatrixCount, 0);
+    gSnapshotMatrices.bufferSize = kMatrixSize * kCategoryCount;
+    gSnapshotScaleBuffers.isSaved.assign(kScaleBufferCount, 0);
+    gSnapshotScaleBuffers.bufferSize = scaleBufferSize;
+
     zeros = (REALTYPE*) malloc(sizeof(REALTYPE) * kPaddedPatternCount);
     ones = (REALTYPE*) malloc(sizeof(REALTYPE) * kPaddedPatternCount);
     for(int i = 0; i < kPaddedPatternCount; i++) {
@@ -433,40 +468,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         ones[i] = 1.0;
     }
 
+    kNumThreads = 1;
+    kRequestedThreadCount = 0;
+    kMinPatternsPerThread = BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT/2;
     kThreadingEnabled = false;
     kAutoPartitioningEnabled = false;
-    if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
-        int hardwareThreads = std::thread::hardware_concurrency();
-        if (kPatternCount >= BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT && hardwareThreads > 1) {
-            int partitionCount = kPatternCount/(BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT/2);
-            if (partitionCount > hardwareThreads/2) {
-                partitionCount = hardwareThreads/2;
-            } 
-
-            int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
-            int partitionSize = kPatternCount/partitionCount;
-            for (int i=0; i<kPatternCount; i++) {
-                int sitePartition = i/partitionSize;
-                if (sitePartition > partitionCount - 1)
-                    sitePartition = partitionCount - 1;
-                patternPartitions[i] = sitePartition;
-            }
-            setPatternPartitions(partitionCount, patternPartitions);
-
-            gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
-
-            if (kPatternCount >= BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT*4) {
-                gAutoPartitionIndices = (int*) malloc(sizeof(int) * partitionCount);
-                for (int i=0; i<partitionCount; i++) {
-                    gAutoPartitionIndices[i] = i;
-                }
-                gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
-                kAutoRootPartitioningEnabled = true;
-            }
+    kAutoRootPartitioningEnabled = false;
 
-            kAutoPartitioningEnabled = true;
-        }
-    }
+    enableAutoPartitioning();
 
     return BEAGLE_SUCCESS;
 }
@@ -499,14 +508,44 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
                                 const int* inStates) {
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    gTipStates[tipIndex] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
-    // TODO: What if this throws a memory full error?
+    if (kStateCount > BEAGLE_CPU_MAX_TIP_STATE_COUNT) {
+        // the states do not fit a TipState, so expand them to partials
+        savePartials(tipIndex, false);
+        if (allocatePartialsBuffer(tipIndex) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        REALTYPE* tipPartials = gPartials[tipIndex];
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPaddedPatternCount; k++) {
+                for (int i = 0; i < kPartialsPaddedStateCount; i++) {
+                    if (k >= kPatternCount || i >= kStateCount)
+                        tipPartials[i] = 0.0;
+                    else
+                        tipPartials[i] = ((inStates[k] >= kStateCount || inStates[k] == i) ? 1.0 : 0.0);
+                }
+                tipPartials += kPartialsPaddedStateCount;
+            }
+        }
+        touchPartials(tipIndex);
+        return BEAGLE_SUCCESS;
+    }
+    if (kPackedTipStates) {
+        int returnCode = packTipStates(tipIndex, inStates);
+        if (returnCode == BEAGLE_SUCCESS)
+            touchPartials(tipIndex);
+        return returnCode;
+    }
+    if (gTipStates[tipIndex] == NULL) {
+        gTipStates[tipIndex] = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+        // TODO: What if this throws a memory full error?
+        kBufferVersion++;
+    }
     for (int j = 0; j < kPatternCount; j++) {
         gTipStates[tipIndex][j] = (inStates[j] < kStateCount ? inStates[j] : kStateCount);
     }
     for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
         gTipStates[tipIndex][j] = kStateCount;
     }
+    touchPartials(tipIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -516,12 +555,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
                                   const double* inPartials) {
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    if(gPartials[tipIndex] == NULL) {
-        gPartials[tipIndex] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-        // TODO: What if this throws a memory full error?
-        if (gPartials[tipIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
-    }
+    savePartials(tipIndex, false);
+    if (allocatePartialsBuffer(tipIndex) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 
     const double* inPartialsOffset;
     REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
@@ -537,6 +573,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
             *tmpRealPartialsOffset++ = 0;
         }
     }
+    touchPartials(tipIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -546,11 +583,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
                                const double* inPartials) {
     if (bufferIndex < 0 || bufferIndex >= kBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    if (gPartials[bufferIndex] == NULL) {
-        gPartials[bufferIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kPartialsSize);
-        if (gPartials[bufferIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
-    }
+    savePartials(bufferIndex, false);
+    if (allocatePartialsBuffer(bufferIndex) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
     
     const double* inPartialsOffset = inPartials;
     REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
@@ -565,6 +600,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
             *tmpRealPartialsOffset++ = 0;
         }
     }
+    touchPartials(bufferIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -578,6 +614,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
     // TODO: Test with and without padding
     if (bufferIndex < 0 || bufferIndex >= kBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (gPartials[bufferIndex] == NULL)
+        return BEAGLE_ERROR_GENERAL;
 
     if (kPatternCount == kPaddedPatternCount) {
         beagleMemCpy(outPartials, gPartials[bufferIndex], kPartialsSize);
@@ -597,6 +635,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
         int index = 0;
         for(int k=0; k<kPatternCount; k++) {
             REALTYPE scaleFactor = exp(cumulativeScaleBuffer[k]);
+            if (kMixedPrecision)
+                scaleFactor = exp((double) cumulativeScaleBuffer[k] +
+                                  (double) cumulativeScaleBuffer[kPaddedPatternCount + k]);
             for(int i=0; i<kStateCount; i++) {
                 outPartials[index] *= scaleFactor;
                 index++;
@@ -608,6 +649,55 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocatePartials(const int* bufferIndices,
+                                                        int count) {
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] < 0 || bufferIndices[i] >= kBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    // With partitions set, pages are placed by the threads that work on them
+    const bool placeByPartition = (kThreadingEnabled && kPartitionsInitialised);
+
+    for (int i = 0; i < count; i++) {
+        if (gPartials[bufferIndices[i]] != NULL)
+            continue;
+        if (allocatePartialsBuffer(bufferIndices[i]) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        if (!placeByPartition)
+            memset(gPartials[bufferIndices[i]], 0, sizeof(REALTYPE) * kPartialsSize);
+    }
+
+    if (placeByPartition)
+        touchPartitionBuffers();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::releasePartials(const int* bufferIndices,
+                                                       int count) {
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] < 0 || bufferIndices[i] >= kBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const int bufferIndex = bufferIndices[i];
+        if (gPartials[bufferIndex] == NULL)
+            continue;
+        // A restore point keeps the contents it saved
+        savePartials(bufferIndex, false);
+        freeBuffer(gPartials[bufferIndex]);
+        gPartials[bufferIndex] = NULL;
+        touchPartials(bufferIndex);
+    }
+    kBufferVersion++;
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
                                          const double* inEigenVectors,
@@ -615,6 +705,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
                                          const double* inEigenValues) {
 
     gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
+    if (gMixedEigenDecomposition != NULL) {
+        gMixedEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors,
+                                                        inEigenValues);
+        gMixedEigenSet[eigenIndex] = 1;
+    }
     return BEAGLE_SUCCESS;
 }
 
@@ -662,20 +757,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
 
     kPartitionCount = partitionCount;
 
+    // Partitions set by the client replace the automatic ones
+    disableAutoPartitioning();
+
     if (!kPartitionsInitialised) {
         gPatternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
         if (gPatternPartitions == NULL)
             throw std::bad_alloc();
-
-        if (kAutoPartitioningEnabled) {
-            free(gAutoPartitionOperations);
-            if (kAutoRootPartitioningEnabled) {
-                free(gAutoPartitionIndices);
-                free(gAutoPartitionOutSumLogLikelihoods);
-                kAutoRootPartitioningEnabled = false;
-            }
-            kAutoPartitioningEnabled = false;
-        }
     }
     if (!kPartitionsInitialised || partitionCount > kMaxPartitionCount) {
         if (kPartitionsInitialised) {
@@ -685,60 +773,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
         if (gPatternPartitionsStartPatterns == NULL)
             throw std::bad_alloc();
 
-        if (kThreadingEnabled) {
-            // Send stop signal to all threads and join them...
-            for (int i = 0; i < kNumThreads; i++) {
-                threadData* td = &gThreads[i];
-                std::unique_lock<std::mutex> l(td->m);
-                td->stop = true;
-                td->cv.notify_one();
-            }
-
-            // Join all the threads
-            for (int i = 0; i < kNumThreads; i++) {
-                threadData* td = &gThreads[i];
-                td->t.join();
-            }
-
-            delete[] gThreads;
-            delete[] gFutures;
-
-            for (int i=0; i<kNumThreads; i++) {
-                free(gThreadOperations[i]);
-            }
-            free(gThreadOperations);
-            free(gThreadOpCounts);
-
-            kThreadingEnabled = false;
-        }
-
-        if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
-            kNumThreads = std::thread::hardware_concurrency();
-            if (kNumThreads > 1 && partitionCount > 1 && kPatternCount >= BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT) {
-                if (partitionCount < kNumThreads)
-                    kNumThreads = partitionCount;
-
-                gThreads = new threadData[kNumThreads];
-                for (int i = 0; i < kNumThreads; i++) {
-                    gThreads[i].t = std::thread(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting, this, &gThreads[i]);
-                }
-
-                gFutures = new std::shared_future<void>[kNumThreads];
-                if (gFutures == NULL)
-                    throw std::bad_alloc();
-
-                gThreadOperations = (int**) malloc(sizeof(int*) * kNumThreads);
-                for (int i=0; i<kNumThreads; i++) {
-                    gThreadOperations[i] = (int*) malloc(sizeof(int) * BEAGLE_PARTITION_OP_COUNT * kBufferCount * partitionCount);
-                }
-
-                gThreadOpCounts = (int*) malloc(sizeof(int) * kNumThreads);
-
-                kThreadingEnabled = true;
-            }
-        }
-
         kMaxPartitionCount = partitionCount;
+
+        disableThreading();
+        enableThreading();
     }
 
     memcpy(gPatternPartitions, inPatternPartitions, sizeof(int) * kPatternCount);
@@ -769,11 +807,402 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
         gPatternPartitionsStartPatterns[currentPartition+1] = kPatternCount;
     }
 
+    if (kThreadingEnabled)
+        touchPartitionBuffers();
+
     kPartitionsInitialised = true;
 
     return returnCode;
 }
 
+/*
+ * Writes one value per memory page of each partition's patterns in the internal
+ * partials and scale buffers, from the thread that later works on that partition.
+ * Under a first-touch page placement policy (the Linux default) pages not yet
+ * written are thereby placed on that thread's NUMA node; pages already placed
+ * are left where they are. Values are rewritten unchanged.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::touchPartitionBuffers() {
+    const size_t pageSize = BEAGLE_CPU_PAGE_SIZE;
+
+    auto touchRange = [&](void* buffer, size_t begin, size_t end) {
+        // Only pages starting in [begin, end), so no page is touched by two partitions
+        char* base = (char*) buffer;
+        size_t firstPage = (((size_t) base + begin + pageSize - 1) / pageSize) * pageSize - (size_t) base;
+        for (size_t offset = firstPage; offset < end; offset += pageSize) {
+            volatile char* byte = base + offset;
+            *byte = *byte;
+        }
+    };
+
+    auto partitionTask = [&](int p) {
+        size_t startPattern = gPatternPartitionsStartPatterns[p];
+        size_t endPattern = gPatternPartitionsStartPatterns[p + 1];
+        if (p == kPartitionCount - 1)
+            endPattern = kPaddedPatternCount;
+
+        size_t patternSize = sizeof(REALTYPE) * kPartialsPaddedStateCount;
+        for (int i = kTipCount; i < kBufferCount; i++) {
+            if (gPartials[i] == NULL)
+                continue;
+            for (int l = 0; l < kCategoryCount; l++) {
+                size_t categoryOffset = (size_t) l * kPaddedPatternCount;
+                touchRange(gPartials[i], (categoryOffset + startPattern) * patternSize,
+                                         (categoryOffset + endPattern) * patternSize);
+            }
+        }
+
+        if (!(kFlags & BEAGLE_FLAG_SCALING_AUTO)) {
+            for (int i = 0; i < kScaleBufferCount; i++)
+                touchRange(gScaleBuffers[i], startPattern * sizeof(REALTYPE), endPattern * sizeof(REALTYPE));
+        }
+    };
+    gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
+    if (threadCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    kRequestedThreadCount = threadCount;
+    resetThreading();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUMinPatternsPerThread(int minPatternCount) {
+    if (minPatternCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    kMinPatternsPerThread = minPatternCount;
+    resetThreading();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUTilePatternCount(int patternCount) {
+    if (patternCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    // Tiles need scale factors that only depend on the patterns of the tile
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    kTilePatterns = patternCount;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUSkipUnchangedOperations(int enabled) {
+    // Operations that rescale without a scale buffer to write cannot be checked
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    kSkipUnchangedOperations = (enabled != 0);
+
+    // Buffers written while skipping was off have no recorded inputs
+    OperationInputs noInputs;
+    memset(&noInputs, 0, sizeof(OperationInputs));
+    gOperationInputs.assign(kSkipUnchangedOperations ? kBufferCount : 0, noInputs);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUPackedTipStates(int enabled) {
+    // Two bits hold a nucleotide and nothing else
+    if (kStateCount != 4)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    const bool packed = (enabled != 0);
+    if (packed == kPackedTipStates)
+        return BEAGLE_SUCCESS;
+
+    // Convert the tips that are already set
+    std::vector<int> states(kPatternCount);
+    for (int tip = 0; tip < kTipCount; tip++) {
+        if (packed && gTipStates[tip] != NULL) {
+            for (int k = 0; k < kPatternCount; k++)
+                states[k] = gTipStates[tip][k];
+            if (packTipStates(tip, &states[0]) != BEAGLE_SUCCESS)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+            free(gTipStates[tip]);
+            gTipStates[tip] = NULL;
+        } else if (!packed && gPackedTipStates[tip] != NULL) {
+            gTipStates[tip] = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+            if (gTipStates[tip] == NULL)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+            unpackTipStates(tip, 0, kPaddedPatternCount, gTipStates[tip]);
+            free(gPackedTipStates[tip]);
+            gPackedTipStates[tip] = NULL;
+            gTipMissingPatterns[tip].clear();
+        }
+    }
+
+    kPackedTipStates = packed;
+    kBufferVersion++;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUBufferArena(int mode) {
+    if (mode < 0 || mode > 2)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (mode == 2 && !BeagleCPUBufferArena::supportsHugeTLB())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    const bool useArena = (mode != 0);
+    const bool useHugeTLB = (mode == 2);
+    if (useArena && gBufferArena.getBacking() != BeagleCPUBufferArena::NONE &&
+        (gBufferArena.getBacking() == BeagleCPUBufferArena::HUGETLB) != useHugeTLB) {
+        // The block is reserved again, so every buffer leaves it first
+        setBuffersInArena(false);
+        moveSnapshotBuffersToHeap(gSnapshotPartials);
+        moveSnapshotBuffersToHeap(gSnapshotMatrices);
+        moveSnapshotBuffersToHeap(gSnapshotScaleBuffers);
+        gBufferArena.remap(useHugeTLB);
+    }
+    if (useArena && gBufferArena.getBacking() == BeagleCPUBufferArena::NONE)
+        return (useHugeTLB ? BEAGLE_ERROR_OUT_OF_MEMORY : BEAGLE_ERROR_NO_IMPLEMENTATION);
+
+    setBuffersInArena(useArena);
+
+    // Not enough huge pages reserved: the buffers are in an arena of normal pages
+    if (useHugeTLB && gBufferArena.getBacking() != BeagleCPUBufferArena::HUGETLB)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setBuffersInArena(bool useArena) {
+    if (useArena == kUseBufferArena)
+        return;
+
+    kUseBufferArena = useArena;
+    moveBuffers(gPartials, kBufferCount, kArenaPartialsRegion, sizeof(REALTYPE) * kPartialsSize);
+    moveBuffers(gTransitionMatrices, kMatrixCount, kArenaMatricesRegion,
+                sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+    // Scale buffers widened for mixed precision no longer fit their slots
+    if (kArenaScaleRegion >= 0 && !kScaleBuffersWidened)
+        moveBuffers(gScaleBuffers, kScaleBufferCount, kArenaScaleRegion,
+                    sizeof(REALTYPE) * kPaddedPatternCount);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUMixedPrecision(int enabled) {
+    if (DOUBLE_PRECISION)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    const bool mixedPrecision = (enabled != 0);
+    if (mixedPrecision == kMixedPrecision)
+        return BEAGLE_SUCCESS;
+
+    if (mixedPrecision) {
+        if (gSiteLikelihoodsTmp == NULL) {
+            gSiteLikelihoodsTmp = (double*) malloc(sizeof(double) * kPatternCount);
+            if (gSiteLikelihoodsTmp == NULL)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+
+        // Matrices are computed in double from decompositions set from now on
+        if (gMixedEigenDecomposition == NULL) {
+            if (kFlags & BEAGLE_FLAG_EIGEN_COMPLEX)
+                gMixedEigenDecomposition = new EigenDecompositionSquare<double, T_PAD>(kEigenDecompCount,
+                        kStateCount, kCategoryCount, kFlags);
+            else
+                gMixedEigenDecomposition = new EigenDecompositionCube<double, T_PAD>(kEigenDecompCount,
+                        kStateCount, kCategoryCount, kFlags);
+            gMixedEigenSet.assign(kEigenDecompCount, 0);
+            gMixedMatricesTmp.resize(3 * kMatrixSize * kCategoryCount);
+        }
+
+        // Cumulative scale factors so far are exact in their high-order part. Any manual
+        // scale buffer can be accumulated into, so all of them are widened.
+        const int cumulativeBufferCount = (kFlags & BEAGLE_FLAG_SCALING_AUTO ? 1 : kScaleBufferCount);
+        if (!kScaleBuffersWidened) {
+            if (!widenScaleBuffers(cumulativeBufferCount))
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+        for (int i = 0; i < cumulativeBufferCount; i++) {
+            if (gScaleBuffers[i] != NULL)
+                memset(gScaleBuffers[i] + kPaddedPatternCount, 0, sizeof(REALTYPE) * kPaddedPatternCount);
+        }
+        for (size_t i = 0; i < gSnapshotScaleBuffers.saved.size(); i++) {
+            if (gSnapshotScaleBuffers.saved[i].buffer != NULL)
+                memset(gSnapshotScaleBuffers.saved[i].buffer + kPaddedPatternCount, 0,
+                       sizeof(REALTYPE) * kPaddedPatternCount);
+        }
+    }
+
+    kMixedPrecision = mixedPrecision;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getThreadCountLimit() {
+    int threadCount = (kRequestedThreadCount > 0 ? kRequestedThreadCount :
+                                                   BeagleCPUThreadPool::getSharedThreadCount());
+    // Every thread gets at least kMinPatternsPerThread patterns
+    if (threadCount > kPatternCount/kMinPatternsPerThread)
+        threadCount = kPatternCount/kMinPatternsPerThread;
+    return threadCount;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::enableThreading() {
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return;
+
+    // Threads are not capped at the partition count: operations that are
+    // independent in the tree are also scheduled concurrently
+    int threadCount = getThreadCountLimit();
+    if (threadCount > 1) {
+        // Worker threads are shared by all instances in the process and
+        // the calling thread works alongside them
+        gThreadPool = BeagleCPUThreadPool::acquireShared();
+        kNumThreads = std::min(threadCount, gThreadPool->getWorkerCount() + 1);
+
+        int maxOperationCount = kBufferCount * kMaxPartitionCount;
+        gThreadOperations = (int*) malloc(sizeof(int) * BEAGLE_PARTITION_OP_COUNT * maxOperationCount);
+        gThreadOpOffsets = (int*) malloc(sizeof(int) * (maxOperationCount + 1));
+        if (gThreadOperations == NULL || gThreadOpOffsets == NULL)
+            throw std::bad_alloc();
+
+        int dependencyBufferCount = (kBufferCount + kScaleBufferCount) * kMaxPartitionCount;
+        gOperationLevels = (int*) malloc(sizeof(int) * maxOperationCount);
+        gLevelOperationOffsets = (int*) malloc(sizeof(int) * (maxOperationCount + 1));
+        gLevelOperations = (int*) malloc(sizeof(int) * maxOperationCount);
+        gBufferWriteLevels = (int*) malloc(sizeof(int) * dependencyBufferCount);
+        gBufferReadLevels = (int*) malloc(sizeof(int) * dependencyBufferCount);
+        gOperationSlots = (int*) malloc(sizeof(int) * maxOperationCount);
+        gSlotOperationOffsets = (int*) malloc(sizeof(int) * (kNumThreads + 1));
+        gPartitionOperationCounts = (int*) malloc(sizeof(int) * kMaxPartitionCount);
+        if (gOperationLevels == NULL || gLevelOperationOffsets == NULL || gLevelOperations == NULL ||
+            gBufferWriteLevels == NULL || gBufferReadLevels == NULL || gOperationSlots == NULL ||
+            gSlotOperationOffsets == NULL || gPartitionOperationCounts == NULL)
+            throw std::bad_alloc();
+        for (int i=0; i<dependencyBufferCount; i++) {
+            gBufferWriteLevels[i] = -1;
+            gBufferReadLevels[i] = -1;
+        }
+
+        if (kPackedTipStates)
+            allocateTipStatesScratch();
+
+        kThreadingEnabled = true;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::disableThreading() {
+    if (kThreadingEnabled) {
+        BeagleCPUThreadPool::releaseShared(gThreadPool);
+
+        free(gThreadOperations);
+        free(gThreadOpOffsets);
+
+        free(gOperationLevels);
+        free(gLevelOperationOffsets);
+        free(gLevelOperations);
+        free(gBufferWriteLevels);
+        free(gBufferReadLevels);
+        free(gOperationSlots);
+        free(gSlotOperationOffsets);
+        free(gPartitionOperationCounts);
+
+        kThreadingEnabled = false;
+    }
+    kNumThreads = 1;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::enableAutoPartitioning() {
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return;
+
+    int threadCount = getThreadCountLimit();
+    if (threadCount > 1) {
+        int partitionCount = kPatternCount/kMinPatternsPerThread;
+        if (partitionCount > threadCount/2) {
+            partitionCount = threadCount/2;
+        }
+
+        int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
+        if (patternPartitions == NULL)
+            throw std::bad_alloc();
+        int partitionSize = kPatternCount/partitionCount;
+        for (int i=0; i<kPatternCount; i++) {
+            int sitePartition = i/partitionSize;
+            if (sitePartition > partitionCount - 1)
+                sitePartition = partitionCount - 1;
+            patternPartitions[i] = sitePartition;
+        }
+        setPatternPartitions(partitionCount, patternPartitions);
+        free(patternPartitions);
+
+        gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
+        if (gAutoPartitionOperations == NULL)
+            throw std::bad_alloc();
+
+        if (kPatternCount >= kMinPatternsPerThread*8) {
+            gAutoPartitionIndices = (int*) malloc(sizeof(int) * partitionCount);
+            gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
+            if (gAutoPartitionIndices == NULL || gAutoPartitionOutSumLogLikelihoods == NULL)
+                throw std::bad_alloc();
+            for (int i=0; i<partitionCount; i++) {
+                gAutoPartitionIndices[i] = i;
+            }
+            kAutoRootPartitioningEnabled = true;
+        }
+
+        kAutoPartitioningEnabled = true;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::disableAutoPartitioning() {
+    if (kAutoPartitioningEnabled) {
+        free(gAutoPartitionOperations);
+        if (kAutoRootPartitioningEnabled) {
+            free(gAutoPartitionIndices);
+            free(gAutoPartitionOutSumLogLikelihoods);
+            kAutoRootPartitioningEnabled = false;
+        }
+        kAutoPartitioningEnabled = false;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetThreading() {
+    disableThreading();
+
+    if (kAutoPartitioningEnabled || !kPartitionsInitialised) {
+        // Automatic partitions are recomputed for the new thread count
+        disableAutoPartitioning();
+        if (kPartitionsInitialised) {
+            free(gPatternPartitions);
+            free(gPatternPartitionsStartPatterns);
+            kPartitionsInitialised = false;
+        }
+        kPartitionCount = 1;
+        kMaxPartitionCount = kPartitionCount;
+        enableAutoPartitioning();
+    } else {
+        enableThreading();
+    }
+}
+
 BEAGLE_CPU_TEMPLATE
     int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
                                                      const double* inStateFrequencies) {
@@ -828,12 +1257,9 @@ if (T_PAD != 0) {
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
     if (kPatternsReordered) {
-        REALTYPE* outLogLikelihoodsOriginalOrder = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount);
         for (int i=0; i < kPatternCount; i++) {
-            outLogLikelihoodsOriginalOrder[i] = outLogLikelihoodsTmp[gPatternsNewOrder[i]];
+            outLogLikelihoods[i] = outLogLikelihoodsTmp[gPatternsNewOrder[i]];
         }
-        beagleMemCpy(outLogLikelihoods, outLogLikelihoodsOriginalOrder, kPatternCount);
-        free(outLogLikelihoodsOriginalOrder);
     } else {
         beagleMemCpy(outLogLikelihoods, outLogLikelihoodsTmp, kPatternCount);
     }
@@ -857,6 +1283,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrix(int matrixIndex,
                                        const double* inMatrix,
                                        double paddedValue) {
 
+    saveMatrices(&matrixIndex, 1);
+
 if (T_PAD != 0) {
     const double* offsetInMatrix = inMatrix;
     REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
@@ -872,6 +1300,7 @@ if (T_PAD != 0) {
     beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
                  kMatrixSize * kCategoryCount);
 }
+    touchMatrices(&matrixIndex, 1);
     return BEAGLE_SUCCESS;
 }
     
@@ -880,6 +1309,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrices(const int* matrixIn
                                                              const double* inMatrices,
                                                              const double* paddedValues,
                                                              int count) {
+    saveMatrices(matrixIndices, count);
     for (int k = 0; k < count; k++) {
         const double* inMatrix = inMatrices + k*kStateCount*kStateCount*kCategoryCount;
         int matrixIndex = matrixIndices[k];
@@ -900,6 +1330,7 @@ if (T_PAD != 0) {
                      kMatrixSize * kCategoryCount);
 }
     }
+    touchMatrices(matrixIndices, count);
     
     return BEAGLE_SUCCESS;
 }
@@ -922,6 +1353,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
 
     int returnCode = BEAGLE_SUCCESS;
 
+    saveMatrices(resultIndices, matrixCount);
+
     for (int u = 0; u < matrixCount; u++) {
 
         if(firstIndices[u] == resultIndices[u] || secondIndices[u] == resultIndices[u]) {
@@ -1006,6 +1439,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
 
     }//END: u loop
 
+    touchMatrices(resultIndices, matrixCount);
+
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrices \n");
 #endif
@@ -1025,8 +1460,23 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
     //     printf("uTM %d %d %f %d\n", eigenIndex, probabilityIndices[i], edgeLengths[i], 0);
     // }
 
-    gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
-                                                  edgeLengths,gCategoryRates[0],gTransitionMatrices,count);
+    saveMatrices(probabilityIndices, count);
+    if (firstDerivativeIndices != NULL)
+        saveMatrices(firstDerivativeIndices, count);
+    if (secondDerivativeIndices != NULL)
+        saveMatrices(secondDerivativeIndices, count);
+
+    if (kMixedPrecision && gMixedEigenSet[eigenIndex])
+        updateMixedTransitionMatrices(eigenIndex, probabilityIndices, firstDerivativeIndices,
+                                      secondDerivativeIndices, edgeLengths, gCategoryRates[0], count);
+    else
+        gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
+                                                      edgeLengths,gCategoryRates[0],gTransitionMatrices,count);
+    touchMatrices(probabilityIndices, count);
+    if (firstDerivativeIndices != NULL)
+        touchMatrices(firstDerivativeIndices, count);
+    if (secondDerivativeIndices != NULL)
+        touchMatrices(secondDerivativeIndices, count);
     return BEAGLE_SUCCESS;
 }
 
@@ -1041,6 +1491,12 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModel
 
     // TODO: move loop to within gEigenDecomposition
 
+    saveMatrices(probabilityIndices, count);
+    if (firstDerivativeIndices != NULL)
+        saveMatrices(firstDerivativeIndices, count);
+    if (secondDerivativeIndices != NULL)
+        saveMatrices(secondDerivativeIndices, count);
+
     for (int i = 0; i < count; i++) {
         // printf("uTMWMM %d %d %f %d\n", eigenIndices[i], probabilityIndices[i], edgeLengths[i], categoryRateIndices[i]);
 
@@ -1053,15 +1509,24 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModel
             secondDeriv = &secondDerivativeIndices[i];
         }
 
-        gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
-                                                      &probabilityIndices[i],
-                                                      firstDeriv,
-                                                      secondDeriv,
-                                                      &edgeLengths[i],
-                                                      gCategoryRates[categoryRateIndices[i]],
-                                                      gTransitionMatrices,
-                                                      1);
+        if (kMixedPrecision && gMixedEigenSet[eigenIndices[i]])
+            updateMixedTransitionMatrices(eigenIndices[i], &probabilityIndices[i], firstDeriv, secondDeriv,
+                                          &edgeLengths[i], gCategoryRates[categoryRateIndices[i]], 1);
+        else
+            gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
+                                                          &probabilityIndices[i],
+                                                          firstDeriv,
+                                                          secondDeriv,
+                                                          &edgeLengths[i],
+                                                          gCategoryRates[categoryRateIndices[i]],
+                                                          gTransitionMatrices,
+                                                          1);
     }
+    touchMatrices(probabilityIndices, count);
+    if (firstDerivativeIndices != NULL)
+        touchMatrices(firstDerivativeIndices, count);
+    if (secondDerivativeIndices != NULL)
+        touchMatrices(secondDerivativeIndices, count);
 
     return BEAGLE_SUCCESS;
 }
@@ -1072,7 +1537,26 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
                                                       int count,
                                                       int cumulativeScaleIndex) {
 
-    int returnCode = BEAGLE_ERROR_GENERAL;
+    int returnCode = preparePartialsOperations(operations, count, BEAGLE_OP_COUNT);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (kSkipUnchangedOperations) {
+        if ((int) gChangedOperations.size() < count * BEAGLE_OP_COUNT)
+            gChangedOperations.resize(count * BEAGLE_OP_COUNT);
+        if (count > 0)
+            count = removeUnchangedOperations(operations, count, cumulativeScaleIndex,
+                                              &gChangedOperations[0]);
+        if (count == 0)
+            return BEAGLE_SUCCESS;
+        operations = &gChangedOperations[0];
+    } else if (kSnapshotActive) {
+        for (int i = 0; i < count; i++) {
+            savePartials(operations[i * BEAGLE_OP_COUNT], false);
+            saveScaleBuffer(operations[i * BEAGLE_OP_COUNT + 1], false);
+        }
+        saveScaleBuffer(cumulativeScaleIndex, true);
+    }
 
     if (kAutoPartitioningEnabled) {
         autoPartitionPartialsOperations(operations,
@@ -1087,7 +1571,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
         returnCode = upPartials(byPartition,
                                 operations,
                                 count,
-                                cumulativeScaleIndex);
+                                cumulativeScaleIndex,
+                                0);
     }
 
     return returnCode;
@@ -1098,7 +1583,20 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
                                                                  int count) {
     
-    int returnCode = BEAGLE_ERROR_GENERAL;
+    int returnCode = preparePartialsOperations(operations, count, BEAGLE_PARTITION_OP_COUNT);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    // Partition operations write part of their buffers, so they are never skipped
+    for (int i = 0; i < count; i++) {
+        const int* op = &operations[i * BEAGLE_PARTITION_OP_COUNT];
+        savePartials(op[0], true);
+        saveScaleBuffer(op[1], true);
+        saveScaleBuffer(op[8], true);
+        touchPartials(op[0]);
+        touchScaleBuffer(op[1]);
+        touchScaleBuffer(op[8]);
+    }
 
     if (kThreadingEnabled) {
         returnCode = upPartialsByPartitionAsync(operations,
@@ -1108,15 +1606,466 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* oper
         returnCode = upPartials(byPartition,
                                 operations,
                                 count,
-                                BEAGLE_OP_NONE);
+                                BEAGLE_OP_NONE,
+                                0);
     }
 
     return returnCode;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoPartitionPartialsOperations(const int* operations,
-                                                                        int* partitionOperations,
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createOperationPlan(int eigenIndex,
+                                                           const int* probabilityIndices,
+                                                           int matrixCount,
+                                                           const int* operations,
+                                                           int operationCount,
+                                                           int cumulativeScalingIndex,
+                                                           int rootBufferIndex,
+                                                           int categoryWeightsIndex,
+                                                           int stateFrequenciesIndex) {
+    // Plans need scale factors that are only written where the operations say so
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (matrixCount < 0 || operationCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (matrixCount > 0 && (eigenIndex < 0 || eigenIndex >= kEigenDecompCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int i = 0; i < matrixCount; i++) {
+        if (probabilityIndices[i] < 0 || probabilityIndices[i] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    if (cumulativeScalingIndex != BEAGLE_OP_NONE &&
+        (cumulativeScalingIndex < 0 || cumulativeScalingIndex >= kScaleBufferCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (rootBufferIndex != BEAGLE_OP_NONE &&
+        (rootBufferIndex < 0 || rootBufferIndex >= kBufferCount ||
+         categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount ||
+         stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    OperationPlan* plan = new OperationPlan;
+    plan->eigenIndex = eigenIndex;
+    plan->probabilityIndices.assign(probabilityIndices, probabilityIndices + matrixCount);
+    plan->encodedOperations.assign(operations, operations + operationCount * BEAGLE_OP_COUNT);
+    plan->cumulativeScaleIndex = cumulativeScalingIndex;
+    plan->rootBufferIndex = rootBufferIndex;
+    plan->categoryWeightsIndex = categoryWeightsIndex;
+    plan->stateFrequenciesIndex = stateFrequenciesIndex;
+
+    int returnCode = decodeOperationPlan(plan);
+    if (returnCode != BEAGLE_SUCCESS) {
+        delete plan;
+        return returnCode;
+    }
+
+    // Reuse the slot of a finalized plan
+    for (size_t i = 0; i < gOperationPlans.size(); i++) {
+        if (gOperationPlans[i] == NULL) {
+            gOperationPlans[i] = plan;
+            return (int) i;
+        }
+    }
+    gOperationPlans.push_back(plan);
+
+    return (int) gOperationPlans.size() - 1;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateWithOperationPlan(int planIndex,
+                                                               const double* edgeLengths,
+                                                               double* outSumLogLikelihood) {
+    if (planIndex < 0 || planIndex >= (int) gOperationPlans.size() || gOperationPlans[planIndex] == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    OperationPlan* plan = gOperationPlans[planIndex];
+
+    if (kSnapshotActive) {
+        for (size_t i = 0; i < plan->encodedOperations.size(); i += BEAGLE_OP_COUNT) {
+            savePartials(plan->encodedOperations[i], false);
+            saveScaleBuffer(plan->encodedOperations[i + 1], false);
+        }
+        saveScaleBuffer(plan->cumulativeScaleIndex, true);
+        if (edgeLengths != NULL && !plan->probabilityIndices.empty())
+            saveMatrices(&plan->probabilityIndices[0], (int) plan->probabilityIndices.size());
+    }
+
+    // Buffers have moved since the plan was decoded
+    if (plan->bufferVersion != kBufferVersion) {
+        int returnCode = decodeOperationPlan(plan);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    if (edgeLengths != NULL && !plan->probabilityIndices.empty())
+        updateTransitionMatrices(plan->eigenIndex, &plan->probabilityIndices[0], NULL, NULL,
+                                 edgeLengths, (int) plan->probabilityIndices.size());
+
+    if (kThreadingEnabled && kAutoPartitioningEnabled) {
+        auto partitionTask = [&](int p) {
+            upPlanPartials(plan,
+                           gPatternPartitionsStartPatterns[p],
+                           gPatternPartitionsStartPatterns[p + 1]);
+        };
+        gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+    } else {
+        upPlanPartials(plan, 0, kPatternCount);
+    }
+
+    for (size_t i = 0; i < plan->encodedOperations.size(); i += BEAGLE_OP_COUNT) {
+        touchPartials(plan->encodedOperations[i]);
+        touchScaleBuffer(plan->encodedOperations[i + 1]);
+    }
+    touchScaleBuffer(plan->cumulativeScaleIndex);
+
+    if (outSumLogLikelihood != NULL && plan->rootBufferIndex != BEAGLE_OP_NONE)
+        return calculateRootLogLikelihoods(&plan->rootBufferIndex, &plan->categoryWeightsIndex,
+                                           &plan->stateFrequenciesIndex, &plan->cumulativeScaleIndex,
+                                           1, outSumLogLikelihood);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::finalizeOperationPlan(int planIndex) {
+    if (planIndex < 0 || planIndex >= (int) gOperationPlans.size() || gOperationPlans[planIndex] == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    delete gOperationPlans[planIndex];
+    gOperationPlans[planIndex] = NULL;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::storeSnapshot() {
+    // Scale buffers are written inside the kernels with these scaling modes
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    clearSnapshot(false);
+    kSnapshotActive = true;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restoreSnapshot() {
+    if (!kSnapshotActive)
+        return BEAGLE_ERROR_GENERAL;
+
+    clearSnapshot(true);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::releaseSnapshot() {
+    clearSnapshot(false);
+    kSnapshotActive = false;
+
+    SnapshotBuffers* snapshots[3] = {&gSnapshotPartials, &gSnapshotMatrices, &gSnapshotScaleBuffers};
+    for (int k = 0; k < 3; k++) {
+        for (size_t i = 0; i < snapshots[k]->spares.size(); i++)
+            freeBuffer(snapshots[k]->spares[i]);
+        snapshots[k]->spares.clear();
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setRootPrePartials(const int* bufferIndices,
+                                                          const int* stateFrequenciesIndices,
+                                                          int count) {
+    if (count < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] < kTipCount || bufferIndices[i] >= kBufferCount ||
+            stateFrequenciesIndices[i] < 0 || stateFrequenciesIndices[i] >= kEigenDecompCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+
+    for (int i = 0; i < count; i++) {
+        savePartials(bufferIndices[i], false);
+        if (allocatePartialsBuffer(bufferIndices[i]) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+        REALTYPE* prePartials = gPartials[bufferIndices[i]];
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[i]];
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPatternCount; k++) {
+                REALTYPE* pre = prePartials + l * categoryStride + k * kPartialsPaddedStateCount;
+                for (int j = 0; j < kStateCount; j++)
+                    pre[j] = freqs[j];
+            }
+        }
+
+        touchPartials(bufferIndices[i]);
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePrePartials(const int* operations,
+                                                         int operationCount) {
+    // Scale factors are only written where the operations say so
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (operationCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int op = 0; op < operationCount; op++) {
+        const int* encoded = &operations[op * BEAGLE_OP_COUNT];
+        const int destIndex = encoded[0];
+        const int writeScalingIndex = encoded[1];
+        const int preIndex = encoded[3];
+        const int preMatIndex = encoded[4];
+        const int siblingIndex = encoded[5];
+        const int siblingMatIndex = encoded[6];
+
+        if (destIndex < kTipCount || destIndex >= kBufferCount ||
+            preIndex < kTipCount || preIndex >= kBufferCount ||
+            siblingIndex < 0 || siblingIndex >= kBufferCount ||
+            (preMatIndex != BEAGLE_OP_NONE && (preMatIndex < 0 || preMatIndex >= kMatrixCount)) ||
+            siblingMatIndex < 0 || siblingMatIndex >= kMatrixCount ||
+            writeScalingIndex >= kScaleBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (allocatePartialsBuffer(destIndex) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        if (gPartials[preIndex] == NULL ||
+            (!hasTipStates(siblingIndex) && gPartials[siblingIndex] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+
+    // Buffers are swapped when saved, so they are looked up afterwards
+    for (int op = 0; op < operationCount; op++) {
+        savePartials(operations[op * BEAGLE_OP_COUNT], false);
+        saveScaleBuffer(operations[op * BEAGLE_OP_COUNT + 1], false);
+    }
+
+    if ((int) gPreOperations.size() < operationCount)
+        gPreOperations.resize(operationCount);
+
+    for (int op = 0; op < operationCount; op++) {
+        const int* encoded = &operations[op * BEAGLE_OP_COUNT];
+        PreOperation& preOp = gPreOperations[op];
+        preOp.destPartials = gPartials[encoded[0]];
+        preOp.scalingFactors = (encoded[1] >= 0 ? gScaleBuffers[encoded[1]] : NULL);
+        preOp.prePartials = gPartials[encoded[3]];
+        preOp.preMatrices = (encoded[4] >= 0 ? gTransitionMatrices[encoded[4]] : NULL);
+        preOp.statesIndex = (hasTipStates(encoded[5]) ? encoded[5] : -1);
+        preOp.partials = gPartials[encoded[5]];
+        preOp.matrices = gTransitionMatrices[encoded[6]];
+    }
+
+    if (operationCount > 0) {
+        if (kThreadingEnabled && kAutoPartitioningEnabled) {
+            auto partitionTask = [&](int p) {
+                upPrePartials(&gPreOperations[0], operationCount,
+                              gPatternPartitionsStartPatterns[p],
+                              gPatternPartitionsStartPatterns[p + 1]);
+            };
+            gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+        } else {
+            upPrePartials(&gPreOperations[0], operationCount, 0, kPatternCount);
+        }
+    }
+
+    for (int op = 0; op < operationCount; op++) {
+        touchPartials(operations[op * BEAGLE_OP_COUNT]);
+        touchScaleBuffer(operations[op * BEAGLE_OP_COUNT + 1]);
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Looks up the buffers, kernel and scaling mode of each encoded operation of a
+ * plan, following the same rules as upPartials for manual scaling.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::decodeOperationPlan(OperationPlan* plan) {
+    const int operationCount = (int) plan->encodedOperations.size() / BEAGLE_OP_COUNT;
+    plan->operations.resize(operationCount);
+
+    for (int op = 0; op < operationCount; op++) {
+        const int* encoded = &plan->encodedOperations[op * BEAGLE_OP_COUNT];
+        const int parIndex = encoded[0];
+        const int writeScalingIndex = encoded[1];
+        const int readScalingIndex = encoded[2];
+        int child1Index = encoded[3];
+        int child1TransMatIndex = encoded[4];
+        int child2Index = encoded[5];
+        int child2TransMatIndex = encoded[6];
+
+        if (parIndex < kTipCount || parIndex >= kBufferCount ||
+            child1Index < 0 || child1Index >= kBufferCount ||
+            child2Index < 0 || child2Index >= kBufferCount ||
+            child1TransMatIndex < 0 || child1TransMatIndex >= kMatrixCount ||
+            child2TransMatIndex < 0 || child2TransMatIndex >= kMatrixCount ||
+            writeScalingIndex >= kScaleBufferCount || readScalingIndex >= kScaleBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (allocatePartialsBuffer(parIndex) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+        // Compact states come first, as in upPartials
+        if (!hasTipStates(child1Index) && hasTipStates(child2Index)) {
+            std::swap(child1Index, child2Index);
+            std::swap(child1TransMatIndex, child2TransMatIndex);
+        }
+        if ((!hasTipStates(child1Index) && gPartials[child1Index] == NULL) ||
+            (!hasTipStates(child2Index) && gPartials[child2Index] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+
+        PlanOperation& planOp = plan->operations[op];
+        planOp.destPartials = gPartials[parIndex];
+        planOp.states1Index = (hasTipStates(child1Index) ? child1Index : -1);
+        planOp.partials1 = gPartials[child1Index];
+        planOp.matrices1 = gTransitionMatrices[child1TransMatIndex];
+        planOp.states2Index = (hasTipStates(child2Index) ? child2Index : -1);
+        planOp.partials2 = gPartials[child2Index];
+        planOp.matrices2 = gTransitionMatrices[child2TransMatIndex];
+        planOp.kernel = (planOp.states1Index < 0 ? 2 : (planOp.states2Index < 0 ? 1 : 0));
+
+        planOp.rescale = BEAGLE_OP_NONE;
+        planOp.scalingFactors = NULL;
+        if (writeScalingIndex >= 0) {
+            planOp.rescale = 1;
+            planOp.scalingFactors = gScaleBuffers[writeScalingIndex];
+        } else if (readScalingIndex >= 0) {
+            planOp.rescale = 0;
+            planOp.scalingFactors = gScaleBuffers[readScalingIndex];
+        }
+    }
+
+    plan->cumulativeScaleBuffer = NULL;
+    if (plan->cumulativeScaleIndex != BEAGLE_OP_NONE)
+        plan->cumulativeScaleBuffer = gScaleBuffers[plan->cumulativeScaleIndex];
+
+    plan->bufferVersion = kBufferVersion;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPlanPartials(const OperationPlan* plan,
+                                                       int startPattern,
+                                                       int endPattern) {
+    const int operationCount = (int) plan->operations.size();
+
+    int tilePatterns = endPattern - startPattern;
+    if (kTilePatterns > 0 && operationCount > 1)
+        tilePatterns = kTilePatterns;
+
+    for (int tileStart = startPattern; tileStart < endPattern; tileStart += tilePatterns) {
+        const int tileEnd = std::min(tileStart + tilePatterns, endPattern);
+
+        for (int op = 0; op < operationCount; op++) {
+            const PlanOperation& planOp = plan->operations[op];
+            const TipState* states1 = (planOp.kernel < 2 ?
+                                       getTipStates(planOp.states1Index, tileStart, tileEnd, 0) : NULL);
+            const TipState* states2 = (planOp.kernel == 0 ?
+                                       getTipStates(planOp.states2Index, tileStart, tileEnd, 1) : NULL);
+
+            if (planOp.rescale == 0) {
+                if (planOp.kernel == 0)
+                    calcStatesStatesFixedScaling(planOp.destPartials, states1, planOp.matrices1,
+                                                 states2, planOp.matrices2, planOp.scalingFactors,
+                                                 tileStart, tileEnd);
+                else if (planOp.kernel == 1)
+                    calcStatesPartialsFixedScaling(planOp.destPartials, states1, planOp.matrices1,
+                                                   planOp.partials2, planOp.matrices2, planOp.scalingFactors,
+                                                   tileStart, tileEnd);
+                else
+                    calcPartialsPartialsFixedScaling(planOp.destPartials, planOp.partials1, planOp.matrices1,
+                                                     planOp.partials2, planOp.matrices2, planOp.scalingFactors,
+                                                     tileStart, tileEnd);
+                continue;
+            }
+
+            const int blockPatterns = (planOp.rescale == 1 ? kRescaleBlockPatterns : tileEnd - tileStart);
+            for (int blockStart = tileStart; blockStart < tileEnd; blockStart += blockPatterns) {
+                const int blockEnd = std::min(blockStart + blockPatterns, tileEnd);
+                if (planOp.kernel == 0)
+                    calcStatesStates(planOp.destPartials, states1, planOp.matrices1,
+                                     states2, planOp.matrices2, blockStart, blockEnd);
+                else if (planOp.kernel == 1)
+                    calcStatesPartials(planOp.destPartials, states1, planOp.matrices1,
+                                       planOp.partials2, planOp.matrices2, blockStart, blockEnd);
+                else
+                    calcPartialsPartials(planOp.destPartials, planOp.partials1, planOp.matrices1,
+                                         planOp.partials2, planOp.matrices2, blockStart, blockEnd);
+                if (planOp.rescale == 1)
+                    rescalePartials(planOp.destPartials, planOp.scalingFactors,
+                                    plan->cumulativeScaleBuffer, blockStart, blockEnd);
+            }
+        }
+    }
+}
+
+/*
+ * Computes pre-order partials for a range of patterns: the parent's pre-order partials
+ * carried down the edge above the parent times the sibling's partials carried up the
+ * edge above the sibling.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(const PreOperation* operations,
+                                                      int operationCount,
+                                                      int startPattern,
+                                                      int endPattern) {
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+
+    for (int op = 0; op < operationCount; op++) {
+        const PreOperation& preOp = operations[op];
+        const TipState* states = (preOp.statesIndex >= 0 ?
+                                  getTipStates(preOp.statesIndex, startPattern, endPattern, 0) : NULL);
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const REALTYPE* preMatrix = (preOp.preMatrices != NULL ? preOp.preMatrices + l * kMatrixSize : NULL);
+            const REALTYPE* matrix = preOp.matrices + l * kMatrixSize;
+
+            for (int k = startPattern; k < endPattern; k++) {
+                const int v = l * categoryStride + k * kPartialsPaddedStateCount;
+                const REALTYPE* pre = preOp.prePartials + v;
+                REALTYPE* dest = preOp.destPartials + v;
+
+                for (int j = 0; j < kStateCount; j++) {
+                    REALTYPE above = pre[j];
+                    if (preMatrix != NULL) {
+                        above = 0;
+                        for (int i = 0; i < kStateCount; i++)
+                            above += pre[i] * preMatrix[i * kTransPaddedStateCount + j];
+                    }
+
+                    const REALTYPE* row = matrix + j * kTransPaddedStateCount;
+                    REALTYPE sibling;
+                    if (states != NULL) {
+                        sibling = row[states[k]];
+                    } else {
+                        const REALTYPE* partials = preOp.partials + v;
+                        sibling = 0;
+                        for (int i = 0; i < kStateCount; i++)
+                            sibling += row[i] * partials[i];
+                    }
+
+                    dest[j] = above * sibling;
+                }
+            }
+        }
+
+        if (preOp.scalingFactors != NULL)
+            rescalePartials(preOp.destPartials, preOp.scalingFactors, NULL, startPattern, endPattern);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoPartitionPartialsOperations(const int* operations,
+                                                                        int* partitionOperations,
                                                                         int count,
                                                                         int cumulativeScaleIndex) {
 
@@ -1138,38 +2087,175 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* operations,
                                                                   int count) {
 
+    // When the pattern split alone cannot occupy all threads, also run
+    // operations that are independent in the tree concurrently
+    if (kPartitionCount < kNumThreads && (kFlags & BEAGLE_FLAG_SCALING_MANUAL))
+        return upPartialsByLevelAsync(operations, count);
+
     int numOps = BEAGLE_PARTITION_OP_COUNT;
 
-    memset(gThreadOpCounts, 0, sizeof(int) * kNumThreads);
+    // Group operations by partition, keeping their order within each partition;
+    // each partition is one task so idle threads can steal whole partitions
+    memset(gThreadOpOffsets, 0, sizeof(int) * (kPartitionCount + 1));
+    for (int i=0; i<count; i++)
+        gThreadOpOffsets[operations[i * numOps + 7] + 1]++;
+    for (int p=0; p<kPartitionCount; p++)
+        gThreadOpOffsets[p + 1] += gThreadOpOffsets[p];
+    for (int i=0; i<count; i++) {
+        int p = operations[i * numOps + 7];
+        memcpy(&gThreadOperations[gThreadOpOffsets[p]*numOps], &operations[i*numOps], sizeof(int) * numOps);
+        gThreadOpOffsets[p]++;
+    }
+    for (int p=kPartitionCount; p>0; p--)
+        gThreadOpOffsets[p] = gThreadOpOffsets[p - 1];
+    gThreadOpOffsets[0] = 0;
+
+    auto partitionTask = [&](int p) {
+        upPartials(true,
+                   (const int*) &gThreadOperations[gThreadOpOffsets[p]*numOps],
+                   gThreadOpOffsets[p + 1] - gThreadOpOffsets[p],
+                   BEAGLE_OP_NONE,
+                   0);
+    };
+    gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Assigns each partials operation to a dependency level such that an operation
+ * only depends on operations in earlier levels. Dependencies are tracked per
+ * partition on the destination, child and scale buffers (read-after-write,
+ * write-after-write and write-after-read). Returns the number of levels.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::computeOperationLevels(const int* operations,
+                                                              int count) {
+
+    int numOps = BEAGLE_PARTITION_OP_COUNT;
+    int dependencyBufferCount = kBufferCount + kScaleBufferCount;
+    int levelCount = 0;
 
     for (int i=0; i<count; i++) {
-        int t = operations[i * numOps + 7] % kNumThreads;
-        for (int j=0; j<numOps; j++) {
-            gThreadOperations[t][gThreadOpCounts[t]*numOps + j] = operations[i*numOps + j];
+        const int* op = &operations[i * numOps];
+        const int offset = op[7] * dependencyBufferCount;
+        const int parIndex = offset + op[0];
+        const int child1Index = offset + op[3];
+        const int child2Index = offset + op[5];
+        const int writeScalingIndex = (op[1] >= 0 ? offset + kBufferCount + op[1] : -1);
+        const int readScalingIndex = (op[2] >= 0 ? offset + kBufferCount + op[2] : -1);
+
+        int level = 0;
+        level = std::max(level, gBufferWriteLevels[child1Index] + 1);
+        level = std::max(level, gBufferWriteLevels[child2Index] + 1);
+        level = std::max(level, gBufferWriteLevels[parIndex] + 1);
+        level = std::max(level, gBufferReadLevels[parIndex] + 1);
+        if (writeScalingIndex >= 0) {
+            level = std::max(level, gBufferWriteLevels[writeScalingIndex] + 1);
+            level = std::max(level, gBufferReadLevels[writeScalingIndex] + 1);
         }
-        gThreadOpCounts[t]++;
+        if (readScalingIndex >= 0)
+            level = std::max(level, gBufferWriteLevels[readScalingIndex] + 1);
+
+        gBufferWriteLevels[parIndex] = level;
+        gBufferReadLevels[child1Index] = std::max(gBufferReadLevels[child1Index], level);
+        gBufferReadLevels[child2Index] = std::max(gBufferReadLevels[child2Index], level);
+        if (writeScalingIndex >= 0)
+            gBufferWriteLevels[writeScalingIndex] = level;
+        if (readScalingIndex >= 0)
+            gBufferReadLevels[readScalingIndex] = std::max(gBufferReadLevels[readScalingIndex], level);
+
+        gOperationLevels[i] = level;
+        if (level + 1 > levelCount)
+            levelCount = level + 1;
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials, this,
-                      true,
-                      (const int*) gThreadOperations[i],
-                      gThreadOpCounts[i],
-                      BEAGLE_OP_NONE));
+    // Reset only the entries touched above
+    for (int i=0; i<count; i++) {
+        const int* op = &operations[i * numOps];
+        const int offset = op[7] * dependencyBufferCount;
+        const int indices[5] = {op[0], op[3], op[5],
+                                (op[1] >= 0 ? kBufferCount + op[1] : -1),
+                                (op[2] >= 0 ? kBufferCount + op[2] : -1)};
+        for (int j=0; j<5; j++) {
+            if (indices[j] >= 0) {
+                gBufferWriteLevels[offset + indices[j]] = -1;
+                gBufferReadLevels[offset + indices[j]] = -1;
+            }
+        }
+    }
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+    // Counting sort of operations by level, stable with respect to the input order
+    memset(gLevelOperationOffsets, 0, sizeof(int) * (levelCount + 1));
+    for (int i=0; i<count; i++)
+        gLevelOperationOffsets[gOperationLevels[i] + 1]++;
+    for (int l=0; l<levelCount; l++)
+        gLevelOperationOffsets[l + 1] += gLevelOperationOffsets[l];
+    for (int i=0; i<count; i++)
+        gLevelOperations[gLevelOperationOffsets[gOperationLevels[i]]++] = i;
+    for (int l=levelCount; l>0; l--)
+        gLevelOperationOffsets[l] = gLevelOperationOffsets[l - 1];
+    gLevelOperationOffsets[0] = 0;
+
+    return levelCount;
+}
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByLevelAsync(const int* operations,
+                                                              int count) {
 
-        gThreads[i].cv.notify_one();
-    }
+    int numOps = BEAGLE_PARTITION_OP_COUNT;
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+    int levelCount = computeOperationLevels(operations, count);
+
+    // Only called with fewer partitions than threads. The operations of partition p
+    // go round-robin to threads p, p + kPartitionCount, ..., so that partition p's
+    // share of every level runs on the thread that first touched its slice of the
+    // buffers (see touchPartitionBuffers) and on threads grouped with it
+    for (int l=0; l<levelCount; l++) {
+        const int levelStart = gLevelOperationOffsets[l];
+        const int levelEnd = gLevelOperationOffsets[l + 1];
+
+        memset(gPartitionOperationCounts, 0, sizeof(int) * kPartitionCount);
+        memset(gSlotOperationOffsets, 0, sizeof(int) * (kNumThreads + 1));
+        for (int i=levelStart; i<levelEnd; i++) {
+            const int p = operations[gLevelOperations[i] * numOps + 7];
+            const int groupSize = (kNumThreads - 1 - p) / kPartitionCount + 1;
+            gOperationSlots[i] = p + kPartitionCount * (gPartitionOperationCounts[p]++ % groupSize);
+            gSlotOperationOffsets[gOperationSlots[i] + 1]++;
+        }
+        for (int t=0; t<kNumThreads; t++)
+            gSlotOperationOffsets[t + 1] += gSlotOperationOffsets[t];
+
+        for (int i=levelStart; i<levelEnd; i++) {
+            int* threadOp = &gThreadOperations[(levelStart + gSlotOperationOffsets[gOperationSlots[i]]++) * numOps];
+            memcpy(threadOp, &operations[gLevelOperations[i] * numOps], sizeof(int) * numOps);
+            // Operations within a level may share a cumulative scale buffer,
+            // so scale factors are accumulated once the level is done
+            threadOp[8] = BEAGLE_OP_NONE;
+        }
+        for (int t=kNumThreads; t>0; t--)
+            gSlotOperationOffsets[t] = gSlotOperationOffsets[t - 1];
+        gSlotOperationOffsets[0] = 0;
+
+        auto threadTask = [&](int t) {
+            const int first = levelStart + gSlotOperationOffsets[t];
+            const int operationCount = gSlotOperationOffsets[t + 1] - gSlotOperationOffsets[t];
+            if (operationCount > 0)
+                upPartials(true,
+                           (const int*) &gThreadOperations[first * numOps],
+                           operationCount,
+                           BEAGLE_OP_NONE,
+                           t);
+        };
+        gThreadPool->parallelFor(kNumThreads, threadTask, kNumThreads, true);
+
+        // A scale buffer written in this level may be written again in a later one
+        for (int i=levelStart; i<levelEnd; i++) {
+            const int* op = &operations[gLevelOperations[i] * numOps];
+            if (op[1] >= 0 && op[8] != BEAGLE_OP_NONE)
+                accumulateScaleFactorsByPartition(&op[1], 1, op[8], op[7]);
+        }
     }
 
     return BEAGLE_SUCCESS;
@@ -1179,188 +2265,203 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                                                   const int* operations,
                                                   int count,
-                                                  int cumulativeScaleIndex) {
+                                                  int cumulativeScaleIndex,
+                                                  int scratchLane) {
 
     REALTYPE* cumulativeScaleBuffer = NULL;
     if (cumulativeScaleIndex != BEAGLE_OP_NONE)
         cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
 
-    for (int op = 0; op < count; op++) {
+    // Tiled traversal: all operations are run over one tile of patterns before
+    // the next, so that partials are still in cache when the parent operation
+    // reads them. Tiles are counted from the start of each operation's partition.
+    int tilePatterns = kPatternCount;
+    if (kTilePatterns > 0 && count > 1)
+        tilePatterns = kTilePatterns;
 
-        int numOps = BEAGLE_OP_COUNT;
-        if (byPartition)
-            numOps = BEAGLE_PARTITION_OP_COUNT;
+    for (int tileStart = 0; tileStart < kPatternCount; tileStart += tilePatterns) {
+        for (int op = 0; op < count; op++) {
 
-        if (DEBUGGING_OUTPUT) {
-            fprintf(stderr, "op[%d] = ", op);
-            for (int j = 0; j < numOps; j++) {
-                std::cerr << operations[op*numOps+j] << " ";
-            }
-            fprintf(stderr, "\n");
-        }
-
-        const int parIndex = operations[op * numOps];
-        const int writeScalingIndex = operations[op * numOps + 1];
-        const int readScalingIndex = operations[op * numOps + 2];
-        const int child1Index = operations[op * numOps + 3];
-        const int child1TransMatIndex = operations[op * numOps + 4];
-        const int child2Index = operations[op * numOps + 5];
-        const int child2TransMatIndex = operations[op * numOps + 6];
-        int currentPartition = 0;
-        if (byPartition) {
-            currentPartition = operations[op * numOps + 7];
-            cumulativeScaleIndex = operations[op * numOps + 8];
-            if (cumulativeScaleIndex != BEAGLE_OP_NONE)
-                cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
-            else
-                cumulativeScaleBuffer = NULL;
-        }
+            int numOps = BEAGLE_OP_COUNT;
+            if (byPartition)
+                numOps = BEAGLE_PARTITION_OP_COUNT;
 
-        const REALTYPE* partials1 = gPartials[child1Index];
-        const REALTYPE* partials2 = gPartials[child2Index];
+            if (DEBUGGING_OUTPUT) {
+                fprintf(stderr, "op[%d] = ", op);
+                for (int j = 0; j < numOps; j++) {
+                    std::cerr << operations[op*numOps+j] << " ";
+                }
+                fprintf(stderr, "\n");
+            }
 
-        const int* tipStates1 = gTipStates[child1Index];
-        const int* tipStates2 = gTipStates[child2Index];
+            const int parIndex = operations[op * numOps];
+            const int writeScalingIndex = operations[op * numOps + 1];
+            const int readScalingIndex = operations[op * numOps + 2];
+            const int child1Index = operations[op * numOps + 3];
+            const int child1TransMatIndex = operations[op * numOps + 4];
+            const int child2Index = operations[op * numOps + 5];
+            const int child2TransMatIndex = operations[op * numOps + 6];
+            int currentPartition = 0;
+            if (byPartition) {
+                currentPartition = operations[op * numOps + 7];
+                cumulativeScaleIndex = operations[op * numOps + 8];
+                if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+                    cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
+                else
+                    cumulativeScaleBuffer = NULL;
+            }
 
-        const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
-        const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
+            const REALTYPE* partials1 = gPartials[child1Index];
+            const REALTYPE* partials2 = gPartials[child2Index];
 
-        REALTYPE* destPartials = gPartials[parIndex];
+            const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
+            const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
 
-        int startPattern = 0;
-        int endPattern = kPatternCount;
-        if (byPartition) {
-            startPattern = gPatternPartitionsStartPatterns[currentPartition];
-            endPattern = gPatternPartitionsStartPatterns[currentPartition + 1];
-        }
+            REALTYPE* destPartials = gPartials[parIndex];
 
-        int rescale = BEAGLE_OP_NONE;
-        REALTYPE* scalingFactors = NULL;
+            int startPattern = 0;
+            int endPattern = kPatternCount;
+            if (byPartition) {
+                startPattern = gPatternPartitionsStartPatterns[currentPartition];
+                endPattern = gPatternPartitionsStartPatterns[currentPartition + 1];
+            }
+
+            startPattern += tileStart;
+            if (tileStart > 0 && startPattern >= endPattern)
+                continue; // the operation's partition has no patterns left
+            endPattern = std::min(startPattern + tilePatterns, endPattern);
+
+            const TipState* tipStates1 = getTipStates(child1Index, startPattern, endPattern, 2 * scratchLane);
+            const TipState* tipStates2 = getTipStates(child2Index, startPattern, endPattern, 2 * scratchLane + 1);
+
+            int rescale = BEAGLE_OP_NONE;
+            REALTYPE* scalingFactors = NULL;
         
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            gActiveScalingFactors[parIndex - kTipCount] = 0;
-            if (tipStates1 == 0 && tipStates2 == 0)
-                rescale = 2;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[parIndex - kTipCount];
-        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
-            if (tipStates1 == 0 && tipStates2 == 0) {
+            if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+                gActiveScalingFactors[parIndex - kTipCount] = 0;
+                if (tipStates1 == 0 && tipStates2 == 0)
+                    rescale = 2;
+            } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+                rescale = 1;
+                scalingFactors = gScaleBuffers[parIndex - kTipCount];
+            } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
+                if (tipStates1 == 0 && tipStates2 == 0) {
+                    rescale = 1;
+                    removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
+                    scalingFactors = gScaleBuffers[writeScalingIndex];
+                }
+            } else if (writeScalingIndex >= 0) {
                 rescale = 1;
-                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
                 scalingFactors = gScaleBuffers[writeScalingIndex];
+            } else if (readScalingIndex >= 0) {
+                rescale = 0;
+                scalingFactors = gScaleBuffers[readScalingIndex];
             }
-        } else if (writeScalingIndex >= 0) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[writeScalingIndex];
-        } else if (readScalingIndex >= 0) {
-            rescale = 0;
-            scalingFactors = gScaleBuffers[readScalingIndex];
-        }
 
-        if (DEBUGGING_OUTPUT) {
-            std::cerr << "Rescale= " << rescale << " writeIndex= " << writeScalingIndex
-                     << " readIndex = " << readScalingIndex << "\n";
-        }
+            if (DEBUGGING_OUTPUT) {
+                std::cerr << "Rescale= " << rescale << " writeIndex= " << writeScalingIndex
+                         << " readIndex = " << readScalingIndex << "\n";
+            }
 
-        if (tipStates1 != NULL) {
-            if (tipStates2 != NULL ) {
-                if (rescale == 0) { // Use fixed scaleFactors
-                    calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
-                                                 matrices2, scalingFactors, startPattern, endPattern);
-                } else {
-                    // First compute without any scaling
-                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
-                                     startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+            // When rescaling, partials are computed in blocks of patterns and each
+            // block is rescaled right away, while it is still in cache
+            const int blockPatterns = (rescale == 1 ? kRescaleBlockPatterns : endPattern - startPattern);
+
+            if (tipStates1 != NULL) {
+                if (tipStates2 != NULL ) {
+                    if (rescale == 0) { // Use fixed scaleFactors
+                        calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
+                                                     matrices2, scalingFactors, startPattern, endPattern);
+                    } else {
+                        // First compute without any scaling
+                        for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+                            const int blockEnd = std::min(blockStart + blockPatterns, endPattern);
+                            calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
+                                             blockStart, blockEnd);
+                            if (rescale == 1) // Recompute scaleFactors
+                                rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                blockStart, blockEnd);
                         }
                     }
-                }
-            } else {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
-                                                   matrices2, scalingFactors, startPattern, endPattern);
                 } else {
-                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                       startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                    if (rescale == 0) {
+                        calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
+                                                       matrices2, scalingFactors, startPattern, endPattern);
+                    } else {
+                        for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+                            const int blockEnd = std::min(blockStart + blockPatterns, endPattern);
+                            calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
+                                               blockStart, blockEnd);
+                            if (rescale == 1) // Recompute scaleFactors
+                                rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                blockStart, blockEnd);
                         }
                     }
                 }
-            }
-        } else {
-            if (tipStates2 != NULL) {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
-                                                   scalingFactors, startPattern, endPattern);
-                } else {
-                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
-                                       startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+            } else {
+                if (tipStates2 != NULL) {
+                    if (rescale == 0) {
+                        calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
+                                                       scalingFactors, startPattern, endPattern);
+                    } else {
+                        for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+                            const int blockEnd = std::min(blockStart + blockPatterns, endPattern);
+                            calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
+                                               blockStart, blockEnd);
+                            if (rescale == 1) // Recompute scaleFactors
+                                rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                blockStart, blockEnd);
                         }
                     }
-                }
-            } else {
-                if (rescale == 2) {
-                    int sIndex = parIndex - kTipCount;
-                    calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
-                                                     &gActiveScalingFactors[sIndex]);
-                    if (gActiveScalingFactors[sIndex])
-                        autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
-
-                } else if (rescale == 0) {
-                    calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
-                                                     matrices2,scalingFactors,startPattern,endPattern);
                 } else {
-                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                         startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                    if (rescale == 2) {
+                        int sIndex = parIndex - kTipCount;
+                        calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
+                                                         &gActiveScalingFactors[sIndex]);
+                        if (gActiveScalingFactors[sIndex])
+                            autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
+
+                    } else if (rescale == 0) {
+                        calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
+                                                         matrices2,scalingFactors,startPattern,endPattern);
+                    } else {
+                        for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+                            const int blockEnd = std::min(blockStart + blockPatterns, endPattern);
+                            calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                                 blockStart, blockEnd);
+                            if (rescale == 1) // Recompute scaleFactors
+                                rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                blockStart, blockEnd);
                         }
                     }
                 }
             }
-        }
         
-        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            int parScalingIndex = parIndex - kTipCount;
-            int child1ScalingIndex = child1Index - kTipCount;
-            int child2ScalingIndex = child2Index - kTipCount;
-            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
-                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
-            } else if (child1ScalingIndex >= 0) {
-                int scalingIndices[1] = {child1ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
-            } else if (child2ScalingIndex >= 0) {
-                int scalingIndices[1] = {child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+            if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+                int parScalingIndex = parIndex - kTipCount;
+                int child1ScalingIndex = child1Index - kTipCount;
+                int child2ScalingIndex = child2Index - kTipCount;
+                if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
+                    int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
+                    accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
+                } else if (child1ScalingIndex >= 0) {
+                    int scalingIndices[1] = {child1ScalingIndex};
+                    accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+                } else if (child2ScalingIndex >= 0) {
+                    int scalingIndices[1] = {child2ScalingIndex};
+                    accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+                }
             }
-        }
         
-        if (DEBUGGING_OUTPUT) {
-            if (scalingFactors != NULL && rescale == 0) {
-                for(int i=0; i<kPatternCount; i++)
-                    fprintf(stderr,"old scaleFactor[%d] = %.5f\n",i,scalingFactors[i]);
+            if (DEBUGGING_OUTPUT) {
+                if (scalingFactors != NULL && rescale == 0) {
+                    for(int i=0; i<kPatternCount; i++)
+                        fprintf(stderr,"old scaleFactor[%d] = %.5f\n",i,scalingFactors[i]);
+                }
+                fprintf(stderr,"Result partials:\n");
+                for(int i = 0; i < kPartialsSize; i++)
+                    fprintf(stderr,"destP[%d] = %.5f\n",i,destPartials[i]);
             }
-            fprintf(stderr,"Result partials:\n");
-            for(int i = 0; i < kPartialsSize; i++)
-                fprintf(stderr,"destP[%d] = %.5f\n",i,destPartials[i]);
         }
     }
 
@@ -1383,6 +2484,11 @@ BEAGLE_CPU_TEMPLATE
                                                              int count,
                                                              double* outSumLogLikelihood) {
 
+    for (int i = 0; i < count; i++) {
+        if (gPartials[bufferIndices[i]] == NULL)
+            return BEAGLE_ERROR_GENERAL;
+    }
+
     if (count == 1) {
         // We treat this as a special case so that we don't have convoluted logic
         //      at the end of the loop over patterns
@@ -1440,6 +2546,11 @@ BEAGLE_CPU_TEMPLATE
 
     int returnCode = BEAGLE_SUCCESS;
 
+    for (int i = 0; i < partitionCount * count; i++) {
+        if (gPartials[bufferIndices[i]] == NULL)
+            return BEAGLE_ERROR_GENERAL;
+    }
+
     if (count == 1) {
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
             returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
@@ -1478,41 +2589,16 @@ BEAGLE_CPU_TEMPLATE
                                                         int partitionCount,
                                                         double* outSumLogLikelihoodByPartition) {
 
-    int partitionsPerThreadFloor = partitionCount / kNumThreads;
-    int partitionsRemainder = partitionCount % kNumThreads;
-    int currentPartitionIndex = 0;
-    for (int i=0; i<kNumThreads; i++) {
-        int partitionCountThread = partitionsPerThreadFloor;
-        if (partitionsRemainder) {
-            partitionCountThread++;
-            partitionsRemainder--;
-        }
-
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
-                      &bufferIndices[currentPartitionIndex], &categoryWeightsIndices[currentPartitionIndex],
-                      &stateFrequenciesIndices[currentPartitionIndex], &cumulativeScaleIndices[currentPartitionIndex],
-                      &partitionIndices[currentPartitionIndex], partitionCountThread,
-                      &outSumLogLikelihoodByPartition[currentPartitionIndex]));
-
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
-
-        currentPartitionIndex += partitionCountThread;
-    }
-
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
-
+    auto partitionTask = [&](int p) {
+        calcRootLogLikelihoodsByPartition(&bufferIndices[p], &categoryWeightsIndices[p],
+                                          &stateFrequenciesIndices[p], &cumulativeScaleIndices[p],
+                                          &partitionIndices[p], 1,
+                                          &outSumLogLikelihoodByPartition[p]);
+    };
+    gThreadPool->parallelFor(partitionCount, partitionTask, kNumThreads);
 }
 
+
 BEAGLE_CPU_TEMPLATE
     void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByAutoPartitionAsync(
                                                         const int* bufferIndices,
@@ -1522,30 +2608,13 @@ BEAGLE_CPU_TEMPLATE
                                                         const int* partitionIndices,
                                                         double* outSumLogLikelihoodByPartition) {
 
-    for (int i=0; i<kNumThreads; i++) {
-
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
-                      bufferIndices, categoryWeightsIndices,
-                      stateFrequenciesIndices, cumulativeScaleIndices,
-                      &partitionIndices[i], 1,
-                      &outSumLogLikelihoodByPartition[i]));
-
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
-
-    }
-
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
-
+    auto partitionTask = [&](int p) {
+        calcRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                          stateFrequenciesIndices, cumulativeScaleIndices,
+                                          &partitionIndices[p], 1,
+                                          &outSumLogLikelihoodByPartition[p]);
+    };
+    gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
 }
 
 
@@ -1565,11 +2634,22 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
     //              a problem, though as we deal with count == 1 in the previous
     //              branch.
 
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
+    int* indexMaxScale = indexMaxScaleTmp;
+    REALTYPE* maxScaleFactor = maxScaleFactorTmp;
 
     int returnCode = BEAGLE_SUCCESS;
 
+    const int* mixedScaleIndices = NULL;
+    if (kMixedPrecision && (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS))) {
+        mixedScaleIndices = scaleBufferIndices;
+        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            gSubsetScaleIndices.resize(count);
+            for (int j = 0; j < count; j++)
+                gSubsetScaleIndices[j] = bufferIndices[j] - kTipCount;
+            mixedScaleIndices = &gSubsetScaleIndices[0];
+        }
+    }
+
     for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
         const int rootPartialIndex = bufferIndices[subsetIndex];
         const REALTYPE* rootPartials = gPartials[rootPartialIndex];
@@ -1604,6 +2684,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
                 u++;
             }
 
+            if (kMixedPrecision) {
+                addSubsetSiteLikelihood(mixedScaleIndices, subsetIndex, count, k, sum);
+                continue;
+            }
+
             // TODO: allow only some subsets to have scale indices
             if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
                 int cumulativeScalingFactorIndex;
@@ -1647,14 +2732,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
         }
     }
 
-    if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSubsetSiteLogLikelihoods(mixedScaleIndices);
+    } else {
+        if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
+            for(int i=0; i<kPatternCount; i++)
+                outLogLikelihoodsTmp[i] += maxScaleFactor[i];
+        }
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
     }
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
@@ -1705,19 +2794,26 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIn
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sum);
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sum;
+        else
+            outLogLikelihoodsTmp[k] = log(sum);
     }
 
-    if (scalingFactorsIndex >= 0) {
-        const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int i=0; i<kPatternCount; i++) {
-            outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex >= 0) {
+            const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int i=0; i<kPatternCount; i++) {
+                outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
+            }
         }
-    }
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
     }
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
@@ -1778,7 +2874,16 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sum);
+            if (kMixedPrecision)
+                gSiteLikelihoodsTmp[k] = sum;
+            else
+                outLogLikelihoodsTmp[k] = log(sum);
+        }
+
+        if (kMixedPrecision) {
+            outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                      scalingFactorsIndex);
+            continue;
         }
 
         if (scalingFactorsIndex >= 0) {
@@ -1805,22 +2910,33 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scaling
         REALTYPE* cumulativeScaleBuffer = gScaleBuffers[0];
         for(int j=0; j<kPatternCount; j++)
             cumulativeScaleBuffer[j] =  0;
+        if (kMixedPrecision)
+            memset(cumulativeScaleBuffer + kPaddedPatternCount, 0, sizeof(REALTYPE) * kPaddedPatternCount);
         for(int i=0; i<count; i++) {
             int sIndex = scalingIndices[i] - kTipCount;
             if (gActiveScalingFactors[sIndex]) {
                 const signed short* scaleBuffer = gAutoScaleBuffers[sIndex];
                 for(int j=0; j<kPatternCount; j++) {
-                    cumulativeScaleBuffer[j] += M_LN2 * scaleBuffer[j];
+                    if (kMixedPrecision)
+                        addCumulativeScaleFactor(cumulativeScaleBuffer, j, M_LN2 * scaleBuffer[j]);
+                    else
+                        cumulativeScaleBuffer[j] += M_LN2 * scaleBuffer[j];
                 }
             }
         }
                 
     } else {
+        saveScaleBuffer(cumulativeScalingIndex, true);
         REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
         for(int i=0; i<count; i++) {
             const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
             for(int j=0; j<kPatternCount; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+                if (kMixedPrecision) {
+                    double logScaleFactor = scaleBuffer[j];
+                    if (!(kFlags & BEAGLE_FLAG_SCALERS_LOG))
+                        logScaleFactor = log(logScaleFactor);
+                    addCumulativeScaleFactor(cumulativeScaleBuffer, j, logScaleFactor);
+                } else if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                     cumulativeScaleBuffer[j] += scaleBuffer[j];
                 else
                     cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
@@ -1850,11 +2966,17 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsByPartition(const i
         int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
         int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
 
+        saveScaleBuffer(cumulativeScalingIndex, true);
         REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
         for(int i=0; i<count; i++) {
             const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
             for(int j=startPattern; j<endPattern; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+                if (kMixedPrecision) {
+                    double logScaleFactor = scaleBuffer[j];
+                    if (!(kFlags & BEAGLE_FLAG_SCALERS_LOG))
+                        logScaleFactor = log(logScaleFactor);
+                    addCumulativeScaleFactor(cumulativeScaleBuffer, j, logScaleFactor);
+                } else if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                     cumulativeScaleBuffer[j] += scaleBuffer[j];
                 else
                     cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
@@ -1870,16 +2992,23 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactors(const int* scalingIndices,
                                             int  count,
                                             int  cumulativeScalingIndex) {
+    saveScaleBuffer(cumulativeScalingIndex, true);
     REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
     for(int i=0; i<count; i++) {
         const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
         for(int j=0; j<kPatternCount; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+            if (kMixedPrecision) {
+                double logScaleFactor = scaleBuffer[j];
+                if (!(kFlags & BEAGLE_FLAG_SCALERS_LOG))
+                    logScaleFactor = log(logScaleFactor);
+                addCumulativeScaleFactor(cumulativeScaleBuffer, j, -logScaleFactor);
+            } else if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                 cumulativeScaleBuffer[j] -= scaleBuffer[j];
             else
                 cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
         }
     }
+    touchScaleBuffer(cumulativeScalingIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -1893,11 +3022,17 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsByPartition(const int*
     int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
     int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
 
+    saveScaleBuffer(cumulativeScalingIndex, true);
     REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
     for(int i=0; i<count; i++) {
         const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
         for(int j=startPattern; j<endPattern; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+            if (kMixedPrecision) {
+                double logScaleFactor = scaleBuffer[j];
+                if (!(kFlags & BEAGLE_FLAG_SCALERS_LOG))
+                    logScaleFactor = log(logScaleFactor);
+                addCumulativeScaleFactor(cumulativeScaleBuffer, j, -logScaleFactor);
+            } else if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                 cumulativeScaleBuffer[j] -= scaleBuffer[j];
             else
                 cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
@@ -1915,8 +3050,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactors(int cumulativeScalingIn
      if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
          memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(signed short) * kPaddedPatternCount);
      } else {           
-         memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(REALTYPE) * kPaddedPatternCount);
+         saveScaleBuffer(cumulativeScalingIndex, false);
+         memset(gScaleBuffers[cumulativeScalingIndex], 0,
+                sizeof(REALTYPE) * kPaddedPatternCount * (kMixedPrecision ? 2 : 1));
      }
+    touchScaleBuffer(cumulativeScalingIndex);
     return BEAGLE_SUCCESS;
 }
 
@@ -1930,9 +3068,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulati
         int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
         int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
 
+        saveScaleBuffer(cumulativeScalingIndex, true);
         REALTYPE* cumulativeBuffer = gScaleBuffers[cumulativeScalingIndex]; 
 
         memset(&cumulativeBuffer[startPattern], 0, sizeof(REALTYPE) * (endPattern - startPattern));
+        if (kMixedPrecision)
+            memset(&cumulativeBuffer[kPaddedPatternCount + startPattern], 0,
+                   sizeof(REALTYPE) * (endPattern - startPattern));
      }
     return BEAGLE_SUCCESS;
 }
@@ -1940,7 +3082,12 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulati
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
                                                         int srcScalingIndex) {
+    saveScaleBuffer(destScalingIndex, true);
     memcpy(gScaleBuffers[destScalingIndex],gScaleBuffers[srcScalingIndex],sizeof(REALTYPE) * kPatternCount);
+    if (kMixedPrecision)
+        memcpy(gScaleBuffers[destScalingIndex] + kPaddedPatternCount,
+               gScaleBuffers[srcScalingIndex] + kPaddedPatternCount, sizeof(REALTYPE) * kPatternCount);
+    touchScaleBuffer(destScalingIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -1967,6 +3114,12 @@ BEAGLE_CPU_TEMPLATE
                                                              double* outSumSecondDerivative) {
     // TODO: implement for count > 1
 
+    for (int i = 0; i < count; i++) {
+        if (gPartials[parentBufferIndices[i]] == NULL ||
+            (!hasTipStates(childBufferIndices[i]) && gPartials[childBufferIndices[i]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+
     if (count == 1) {
         int cumulativeScalingFactorIndex;
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
@@ -2042,6 +3195,40 @@ BEAGLE_CPU_TEMPLATE
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                                          const int* childBufferIndices,
+                                                                          const int* probabilityIndices,
+                                                                          const int* firstDerivativeIndices,
+                                                                          const int* secondDerivativeIndices,
+                                                                          const int* categoryWeightsIndices,
+                                                                          const int* stateFrequenciesIndices,
+                                                                          const int* cumulativeScaleIndices,
+                                                                          int count,
+                                                                          double* outLogLikelihoods,
+                                                                          double* outFirstDerivatives,
+                                                                          double* outSecondDerivatives) {
+    if (firstDerivativeIndices == NULL || outFirstDerivatives == NULL ||
+        (secondDerivativeIndices != NULL && outSecondDerivatives == NULL) ||
+        (kFlags & BEAGLE_FLAG_SCALING_AUTO) || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    for (int i = 0; i < count; i++) {
+        if (parentBufferIndices[i] < kTipCount || parentBufferIndices[i] >= kBufferCount ||
+            childBufferIndices[i] < 0 || childBufferIndices[i] >= kBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (gPartials[parentBufferIndices[i]] == NULL ||
+            (!hasTipStates(childBufferIndices[i]) && gPartials[childBufferIndices[i]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+
+    return calcEdgeLogLikelihoodsDerivsMulti(parentBufferIndices, childBufferIndices, probabilityIndices,
+                                             firstDerivativeIndices, secondDerivativeIndices,
+                                             categoryWeightsIndices, stateFrequenciesIndices,
+                                             cumulativeScaleIndices, count, outLogLikelihoods,
+                                             outFirstDerivatives, outSecondDerivatives);
+}
+
 BEAGLE_CPU_TEMPLATE
     int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
                                                     const int* parentBufferIndices,
@@ -2064,6 +3251,12 @@ BEAGLE_CPU_TEMPLATE
 
     int returnCode = BEAGLE_SUCCESS;
 
+    for (int i = 0; i < partitionCount * count; i++) {
+        if (gPartials[parentBufferIndices[i]] == NULL ||
+            (!hasTipStates(childBufferIndices[i]) && gPartials[childBufferIndices[i]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+
     if (count == 1) {
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
             returnCode =  BEAGLE_ERROR_NO_IMPLEMENTATION;
@@ -2092,116 +3285,529 @@ BEAGLE_CPU_TEMPLATE
                                                   outSumLogLikelihoodByPartition);
             }
 
-            *outSumLogLikelihood = 0.0;
+            *outSumLogLikelihood = 0.0;
+
+            for (int i = 0; i < partitionCount; i++) {
+                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
+            }
+
+            if (*outSumLogLikelihood != *outSumLogLikelihood) {
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+            }
+        }
+    } else {
+        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
+                                                        const int* parentBufferIndices,
+                                                        const int* childBufferIndices,
+                                                        const int* probabilityIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        int partitionCount,
+                                                        double* outSumLogLikelihoodByPartition) {
+
+    auto partitionTask = [&](int p) {
+        calcEdgeLogLikelihoodsByPartition(&parentBufferIndices[p],
+                                          &childBufferIndices[p],
+                                          &probabilityIndices[p],
+                                          &categoryWeightsIndices[p],
+                                          &stateFrequenciesIndices[p],
+                                          &cumulativeScaleIndices[p],
+                                          &partitionIndices[p],
+                                          1,
+                                          &outSumLogLikelihoodByPartition[p]);
+    };
+    gThreadPool->parallelFor(partitionCount, partitionTask, kNumThreads);
+}
+
+
+BEAGLE_CPU_TEMPLATE
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByAutoPartitionAsync(
+                                                        const int* parentBufferIndices,
+                                                        const int* childBufferIndices,
+                                                        const int* probabilityIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        double* outSumLogLikelihoodByPartition) {
+
+    auto partitionTask = [&](int p) {
+        calcEdgeLogLikelihoodsByPartition(parentBufferIndices,
+                                          childBufferIndices,
+                                          probabilityIndices,
+                                          categoryWeightsIndices,
+                                          stateFrequenciesIndices,
+                                          cumulativeScaleIndices,
+                                          &partitionIndices[p],
+                                          1,
+                                          &outSumLogLikelihoodByPartition[p]);
+    };
+    gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeDerivatives(const int* postBufferIndices,
+                                                                const int* preBufferIndices,
+                                                                const int* probabilityIndices,
+                                                                const int* firstDerivativeIndices,
+                                                                int categoryWeightsIndex,
+                                                                int count,
+                                                                double* outDerivatives) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (count < 0 || categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int e = 0; e < count; e++) {
+        if (postBufferIndices[e] < 0 || postBufferIndices[e] >= kBufferCount ||
+            preBufferIndices[e] < kTipCount || preBufferIndices[e] >= kBufferCount ||
+            probabilityIndices[e] < 0 || probabilityIndices[e] >= kMatrixCount ||
+            firstDerivativeIndices[e] < 0 || firstDerivativeIndices[e] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (gPartials[preBufferIndices[e]] == NULL ||
+            (!hasTipStates(postBufferIndices[e]) && gPartials[postBufferIndices[e]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+
+    const REALTYPE* weights = gCategoryWeights[categoryWeightsIndex];
+
+    if (kThreadingEnabled && kAutoPartitioningEnabled && count > 0) {
+        gEdgeDerivativeSums.resize(kPartitionCount * count);
+        auto partitionTask = [&](int p) {
+            calcEdgeDerivativeSums(postBufferIndices, preBufferIndices, probabilityIndices,
+                                   firstDerivativeIndices, weights, count,
+                                   &gEdgeDerivativeSums[p * count],
+                                   gPatternPartitionsStartPatterns[p],
+                                   gPatternPartitionsStartPatterns[p + 1]);
+        };
+        gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+
+        for (int e = 0; e < count; e++) {
+            outDerivatives[e] = 0.0;
+            for (int p = 0; p < kPartitionCount; p++)
+                outDerivatives[e] += gEdgeDerivativeSums[p * count + e];
+        }
+    } else {
+        calcEdgeDerivativeSums(postBufferIndices, preBufferIndices, probabilityIndices,
+                               firstDerivativeIndices, weights, count, outDerivatives,
+                               0, kPatternCount);
+    }
+
+    for (int e = 0; e < count; e++) {
+        if (outDerivatives[e] != outDerivatives[e])
+            return BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Sums the derivatives of the site log likelihoods over a range of patterns for each edge.
+ * Each site derivative is taken relative to the likelihood integrated on the same edge, so
+ * the scale factors of the pre-order and post-order partials cancel out.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeDerivativeSums(const int* postBufferIndices,
+                                                               const int* preBufferIndices,
+                                                               const int* probabilityIndices,
+                                                               const int* firstDerivativeIndices,
+                                                               const REALTYPE* weights,
+                                                               int count,
+                                                               double* outSums,
+                                                               int startPattern,
+                                                               int endPattern) {
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+
+    for (int e = 0; e < count; e++) {
+        const TipState* statesChild = getTipStates(postBufferIndices[e], startPattern, endPattern, 0);
+        const REALTYPE* partialsChild = gPartials[postBufferIndices[e]];
+        const REALTYPE* prePartials = gPartials[preBufferIndices[e]];
+        const REALTYPE* transMatrix = gTransitionMatrices[probabilityIndices[e]];
+        const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndices[e]];
+
+        double sum = 0.0;
+        for (int k = startPattern; k < endPattern; k++) {
+            double siteLikelihood = 0.0;
+            double siteDerivative = 0.0;
+            for (int l = 0; l < kCategoryCount; l++) {
+                const int v = l * categoryStride + k * kPartialsPaddedStateCount;
+                double sumOverJ = 0.0;
+                double sumOverJD1 = 0.0;
+                int w = l * kMatrixSize;
+                for (int j = 0; j < kStateCount; j++) {
+                    double sumOverI = 0.0;
+                    double sumOverID1 = 0.0;
+                    if (statesChild != NULL) {
+                        sumOverI = transMatrix[w + statesChild[k]];
+                        sumOverID1 = firstDerivMatrix[w + statesChild[k]];
+                    } else {
+                        for (int i = 0; i < kStateCount; i++) {
+                            sumOverI += transMatrix[w + i] * partialsChild[v + i];
+                            sumOverID1 += firstDerivMatrix[w + i] * partialsChild[v + i];
+                        }
+                    }
+                    sumOverJ += prePartials[v + j] * sumOverI;
+                    sumOverJD1 += prePartials[v + j] * sumOverID1;
+                    w += kTransPaddedStateCount;
+                }
+                siteLikelihood += weights[l] * sumOverJ;
+                siteDerivative += weights[l] * sumOverJD1;
+            }
+            sum += gPatternWeights[k] * siteDerivative / siteLikelihood;
+        }
+        outSums[e] = sum;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateCrossProducts(const int* postBufferIndices,
+                                                              const int* preBufferIndices,
+                                                              const int* probabilityIndices,
+                                                              const double* edgeLengths,
+                                                              int categoryWeightsIndex,
+                                                              int count,
+                                                              double* outCrossProducts) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-            for (int i = 0; i < partitionCount; i++) {
-                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
-            }
+    if (count < 0 || categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int e = 0; e < count; e++) {
+        if (postBufferIndices[e] < 0 || postBufferIndices[e] >= kBufferCount ||
+            preBufferIndices[e] < kTipCount || preBufferIndices[e] >= kBufferCount ||
+            probabilityIndices[e] < 0 || probabilityIndices[e] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (gPartials[preBufferIndices[e]] == NULL ||
+            (!hasTipStates(postBufferIndices[e]) && gPartials[postBufferIndices[e]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
 
-            if (*outSumLogLikelihood != *outSumLogLikelihood) {
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;
-            }
+    const REALTYPE* weights = gCategoryWeights[categoryWeightsIndex];
+    const int sumsSize = kCategoryCount * kStateCount * kStateCount;
+    const int scratchSize = (2 * kCategoryCount * kStateCount + 1) * BEAGLE_CPU_CROSS_PRODUCT_BLOCK_PATTERNS +
+                            sumsSize;
+
+    if (kThreadingEnabled && kAutoPartitioningEnabled) {
+        if ((int) gCrossProductScratch.size() < kPartitionCount * scratchSize)
+            gCrossProductScratch.resize(kPartitionCount * scratchSize);
+        auto partitionTask = [&](int p) {
+            double* scratch = &gCrossProductScratch[p * scratchSize];
+            calcCrossProductSums(postBufferIndices, preBufferIndices, probabilityIndices,
+                                 edgeLengths, weights, count, scratch + sumsSize, scratch,
+                                 gPatternPartitionsStartPatterns[p],
+                                 gPatternPartitionsStartPatterns[p + 1]);
+        };
+        gThreadPool->parallelFor(kPartitionCount, partitionTask, kNumThreads, true);
+
+        for (int n = 0; n < sumsSize; n++) {
+            outCrossProducts[n] = 0.0;
+            for (int p = 0; p < kPartitionCount; p++)
+                outCrossProducts[n] += gCrossProductScratch[p * scratchSize + n];
         }
     } else {
-        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        if ((int) gCrossProductScratch.size() < scratchSize)
+            gCrossProductScratch.resize(scratchSize);
+        calcCrossProductSums(postBufferIndices, preBufferIndices, probabilityIndices,
+                             edgeLengths, weights, count, &gCrossProductScratch[0],
+                             outCrossProducts, 0, kPatternCount);
     }
 
-    return returnCode;
+    for (int n = 0; n < sumsSize; n++) {
+        if (outCrossProducts[n] != outCrossProducts[n])
+            return BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    return BEAGLE_SUCCESS;
 }
 
+/*
+ * Accumulates the cross products of each edge over a range of patterns. Patterns are
+ * gathered in blocks: the pre-order partials are carried down to the bottom of the edge and
+ * compact states expanded, so that the sums over patterns run over contiguous states.
+ */
 BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
-                                                        const int* parentBufferIndices,
-                                                        const int* childBufferIndices,
-                                                        const int* probabilityIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        int partitionCount,
-                                                        double* outSumLogLikelihoodByPartition) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductSums(const int* postBufferIndices,
+                                                             const int* preBufferIndices,
+                                                             const int* probabilityIndices,
+                                                             const double* edgeLengths,
+                                                             const REALTYPE* weights,
+                                                             int count,
+                                                             double* scratch,
+                                                             double* outSums,
+                                                             int startPattern,
+                                                             int endPattern) {
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+    const int blockPatterns = BEAGLE_CPU_CROSS_PRODUCT_BLOCK_PATTERNS;
+    const int blockStride = blockPatterns * kStateCount;
 
-    int partitionsPerThreadFloor = kPartitionCount / kNumThreads;
-    int partitionsRemainder = kPartitionCount % kNumThreads;
-    int currentPartitionIndex = 0;
-    for (int i=0; i<kNumThreads; i++) {
-        int partitionCountThread = partitionsPerThreadFloor;
-        if (partitionsRemainder) {
-            partitionCountThread++;
-            partitionsRemainder--;
-        }
+    double* preBlock = scratch;                                 // [category][pattern][state]
+    double* postBlock = preBlock + kCategoryCount * blockStride; // [category][pattern][state]
+    double* siteFactors = postBlock + kCategoryCount * blockStride;
 
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
-                      &parentBufferIndices[currentPartitionIndex],
-                      &childBufferIndices[currentPartitionIndex],
-                      &probabilityIndices[currentPartitionIndex],
-                      &categoryWeightsIndices[currentPartitionIndex],
-                      &stateFrequenciesIndices[currentPartitionIndex],
-                      &cumulativeScaleIndices[currentPartitionIndex],
-                      &partitionIndices[currentPartitionIndex],
-                      partitionCountThread,
-                      &outSumLogLikelihoodByPartition[currentPartitionIndex]));
+    memset(outSums, 0, sizeof(double) * kCategoryCount * kStateCount * kStateCount);
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+    for (int e = 0; e < count; e++) {
+        const TipState* statesChild = getTipStates(postBufferIndices[e], startPattern, endPattern, 0);
+        const REALTYPE* partialsChild = gPartials[postBufferIndices[e]];
+        const REALTYPE* prePartials = gPartials[preBufferIndices[e]];
+        const REALTYPE* transMatrix = gTransitionMatrices[probabilityIndices[e]];
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+        for (int blockStart = startPattern; blockStart < endPattern; blockStart += blockPatterns) {
+            const int patternCount = std::min(blockPatterns, endPattern - blockStart);
 
-        gThreads[i].cv.notify_one();
+            for (int k = 0; k < patternCount; k++)
+                siteFactors[k] = 0.0;
 
-        currentPartitionIndex += partitionCountThread;
-    }
+            for (int l = 0; l < kCategoryCount; l++) {
+                const REALTYPE* matrix = transMatrix + l * kMatrixSize;
+                for (int k = 0; k < patternCount; k++) {
+                    const int v = l * categoryStride + (blockStart + k) * kPartialsPaddedStateCount;
+                    double* pre = preBlock + l * blockStride + k * kStateCount;
+                    double* post = postBlock + l * blockStride + k * kStateCount;
+
+                    if (statesChild != NULL) {
+                        const int state = statesChild[blockStart + k];
+                        for (int j = 0; j < kStateCount; j++)
+                            post[j] = (state == j || state >= kStateCount ? 1.0 : 0.0);
+                    } else {
+                        for (int j = 0; j < kStateCount; j++)
+                            post[j] = partialsChild[v + j];
+                    }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+                    double siteLikelihood = 0.0;
+                    for (int i = 0; i < kStateCount; i++) {
+                        double sumOverJ = 0.0;
+                        for (int j = 0; j < kStateCount; j++)
+                            sumOverJ += prePartials[v + j] * matrix[j * kTransPaddedStateCount + i];
+                        pre[i] = sumOverJ;
+                        siteLikelihood += sumOverJ * post[i];
+                    }
+                    siteFactors[k] += weights[l] * siteLikelihood;
+                }
+            }
+
+            for (int k = 0; k < patternCount; k++)
+                siteFactors[k] = edgeLengths[e] * gPatternWeights[blockStart + k] / siteFactors[k];
 
+            for (int l = 0; l < kCategoryCount; l++) {
+                const double* preCategory = preBlock + l * blockStride;
+                const double* postCategory = postBlock + l * blockStride;
+                double* sums = outSums + l * kStateCount * kStateCount;
+                for (int i = 0; i < kStateCount; i++) {
+                    double* __restrict sumsRow = sums + i * kStateCount;
+                    for (int k = 0; k < patternCount; k++) {
+                        const double factor = weights[l] * siteFactors[k] * preCategory[k * kStateCount + i];
+                        const double* __restrict post = postCategory + k * kStateCount;
+                        for (int j = 0; j < kStateCount; j++)
+                            sumsRow[j] += factor * post[j];
+                    }
+                }
+            }
+        }
+    }
 }
 
+
 BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByAutoPartitionAsync(
-                                                        const int* parentBufferIndices,
-                                                        const int* childBufferIndices,
-                                                        const int* probabilityIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        double* outSumLogLikelihoodByPartition) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::optimizeEdgeLength(int parentBufferIndex,
+                                                          int childBufferIndex,
+                                                          int eigenIndex,
+                                                          int categoryWeightsIndex,
+                                                          int stateFrequenciesIndex,
+                                                          int cumulativeScaleIndex,
+                                                          double minEdgeLength,
+                                                          double maxEdgeLength,
+                                                          double tolerance,
+                                                          int maxIterations,
+                                                          double* inOutEdgeLength,
+                                                          double* outLogLikelihood,
+                                                          double* outFirstDerivative,
+                                                          double* outSecondDerivative) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (parentBufferIndex < kTipCount || parentBufferIndex >= kBufferCount ||
+        childBufferIndex < 0 || childBufferIndex >= kBufferCount ||
+        eigenIndex < 0 || eigenIndex >= kEigenDecompCount ||
+        categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount ||
+        stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount ||
+        (cumulativeScaleIndex != BEAGLE_OP_NONE &&
+         (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= kScaleBufferCount)) ||
+        minEdgeLength < 0.0 || maxEdgeLength < minEdgeLength || maxIterations < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    for (int i=0; i<kNumThreads; i++) {
+    // Rates are paired with the decomposition as in updateTransitionMatricesWithMultipleModels
+    const double* categoryRates = (gCategoryRates[eigenIndex] != NULL ? gCategoryRates[eigenIndex] :
+                                   gCategoryRates[0]);
+    if (gPartials[parentBufferIndex] == NULL ||
+        (!hasTipStates(childBufferIndex) && gPartials[childBufferIndex] == NULL) ||
+        categoryRates == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    const REALTYPE* eigenVectors;
+    const REALTYPE* inverseEigenVectors;
+    const REALTYPE* eigenValues;
+    if (!gEigenDecomposition->getEigenSystem(eigenIndex, &eigenVectors, &inverseEigenVectors, &eigenValues))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
-                      parentBufferIndices,
-                      childBufferIndices,
-                      probabilityIndices,
-                      categoryWeightsIndices,
-                      stateFrequenciesIndices,
-                      cumulativeScaleIndices,
-                      &partitionIndices[i],
-                      1,
-                      &outSumLogLikelihoodByPartition[i]));
+    const int termCount = kCategoryCount * kStateCount;
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+    const REALTYPE* partialsParent = gPartials[parentBufferIndex];
+    const TipState* statesChild = getTipStates(childBufferIndex, 0, kPatternCount, 0);
+    const REALTYPE* partialsChild = gPartials[childBufferIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+    gEdgeProjection.resize((3 + kPatternCount) * termCount + 2 * kStateCount);
+    double* projection = &gEdgeProjection[3 * termCount];
+    double* parentProjection = projection + kPatternCount * termCount;
+    double* childProjection = parentProjection + kStateCount;
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+    // Project both ends of the edge once: site likelihoods are then sums over categories and
+    // eigenvalues of projection * exp(eigenValue * rate * t), whatever the edge length
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int k = 0; k < kPatternCount; k++) {
+            const int v = l * categoryStride + k * kPartialsPaddedStateCount;
+            for (int m = 0; m < kStateCount; m++) {
+                parentProjection[m] = 0.0;
+                childProjection[m] = 0.0;
+            }
+            for (int i = 0; i < kStateCount; i++) {
+                const double weightedParent = freqs[i] * partialsParent[v + i];
+                for (int m = 0; m < kStateCount; m++)
+                    parentProjection[m] += weightedParent * eigenVectors[i * kStateCount + m];
+            }
+            if (statesChild != NULL) {
+                const int state = statesChild[k];
+                for (int m = 0; m < kStateCount; m++) {
+                    if (state < kStateCount) {
+                        childProjection[m] = inverseEigenVectors[m * kStateCount + state];
+                    } else {
+                        for (int j = 0; j < kStateCount; j++)
+                            childProjection[m] += inverseEigenVectors[m * kStateCount + j];
+                    }
+                }
+            } else {
+                for (int m = 0; m < kStateCount; m++) {
+                    for (int j = 0; j < kStateCount; j++)
+                        childProjection[m] += inverseEigenVectors[m * kStateCount + j] * partialsChild[v + j];
+                }
+            }
+            double* siteProjection = projection + k * termCount + l * kStateCount;
+            for (int m = 0; m < kStateCount; m++)
+                siteProjection[m] = wt[l] * parentProjection[m] * childProjection[m];
+        }
+    }
 
-        gThreads[i].cv.notify_one();
+    double scaleSum = 0.0;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE) {
+        const REALTYPE* scalingFactors = gScaleBuffers[cumulativeScaleIndex];
+        for (int k = 0; k < kPatternCount; k++)
+            scaleSum += gPatternWeights[k] * getCumulativeScaleFactor(scalingFactors, k);
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+    // Newton-Raphson, falling back on bisection of the bracket around the optimum whenever a
+    // step leaves it or the log likelihood is not concave at the current length
+    double lower = minEdgeLength;
+    double upper = maxEdgeLength;
+    double edgeLength = std::min(std::max(*inOutEdgeLength, lower), upper);
+    double firstDerivative, secondDerivative;
+    double logLikelihood = calcProjectedEdgeLogLikelihood(edgeLength, eigenValues, categoryRates,
+                                                          &firstDerivative, &secondDerivative);
+
+    for (int iteration = 0; iteration < maxIterations; iteration++) {
+        if (firstDerivative > 0.0)
+            lower = edgeLength;
+        else
+            upper = edgeLength;
+
+        double next = 0.5 * (lower + upper);
+        if (secondDerivative < 0.0) {
+            const double newton = edgeLength - firstDerivative / secondDerivative;
+            if (newton > lower && newton < upper)
+                next = newton;
+        }
+
+        const bool converged = (std::abs(next - edgeLength) <= tolerance);
+        edgeLength = next;
+        logLikelihood = calcProjectedEdgeLogLikelihood(edgeLength, eigenValues, categoryRates,
+                                                       &firstDerivative, &secondDerivative);
+        if (converged)
+            break;
     }
 
+    *inOutEdgeLength = edgeLength;
+    *outLogLikelihood = logLikelihood + scaleSum;
+    if (outFirstDerivative != NULL)
+        *outFirstDerivative = firstDerivative;
+    if (outSecondDerivative != NULL)
+        *outSecondDerivative = secondDerivative;
+
+    if (*outLogLikelihood != *outLogLikelihood)
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
 }
 
+/*
+ * Evaluates the log likelihood of an edge and its first two derivatives from the projection
+ * set up by optimizeEdgeLength. Only categoryCount x stateCount exponentials are taken; each
+ * pattern then costs three dot products of that length.
+ */
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcProjectedEdgeLogLikelihood(double edgeLength,
+                                                                         const REALTYPE* eigenValues,
+                                                                         const double* categoryRates,
+                                                                         double* outFirstDerivative,
+                                                                         double* outSecondDerivative) {
+    const int termCount = kCategoryCount * kStateCount;
+    double* expTerms = &gEdgeProjection[0];
+    double* firstTerms = expTerms + termCount;
+    double* secondTerms = firstTerms + termCount;
+    const double* projection = secondTerms + termCount;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int m = 0; m < kStateCount; m++) {
+            const double rate = eigenValues[m] * categoryRates[l];
+            const int n = l * kStateCount + m;
+            expTerms[n] = exp(rate * edgeLength);
+            firstTerms[n] = rate * expTerms[n];
+            secondTerms[n] = rate * firstTerms[n];
+        }
+    }
+
+    double logLikelihood = 0.0;
+    double firstDerivative = 0.0;
+    double secondDerivative = 0.0;
+    for (int k = 0; k < kPatternCount; k++) {
+        const double* siteProjection = projection + k * termCount;
+        double siteLikelihood = 0.0;
+        double siteFirst = 0.0;
+        double siteSecond = 0.0;
+        for (int n = 0; n < termCount; n++) {
+            siteLikelihood += siteProjection[n] * expTerms[n];
+            siteFirst += siteProjection[n] * firstTerms[n];
+            siteSecond += siteProjection[n] * secondTerms[n];
+        }
+        const double ratio = siteFirst / siteLikelihood;
+        logLikelihood += gPatternWeights[k] * log(siteLikelihood);
+        firstDerivative += gPatternWeights[k] * ratio;
+        secondDerivative += gPatternWeights[k] * (siteSecond / siteLikelihood - ratio * ratio);
+    }
+
+    *outFirstDerivative = firstDerivative;
+    *outSecondDerivative = secondDerivative;
+    return logLikelihood;
+}
 
 
 BEAGLE_CPU_TEMPLATE
@@ -2225,9 +3831,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
     memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
 
     
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2299,19 +3905,26 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sumOverI;
+        else
+            outLogLikelihoodsTmp[k] = log(sumOverI);
     }
 
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=0; k < kPatternCount; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
     }
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
@@ -2355,8 +3968,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
         const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
 
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-            const int* statesChild = gTipStates[childIndex];
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+            const TipState* statesChild = getTipStates(childIndex, startPattern, endPattern, 0);
             int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
@@ -2429,9 +4042,17 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
+            if (kMixedPrecision)
+                gSiteLikelihoodsTmp[k] = sumOverI;
+            else
+                outLogLikelihoodsTmp[k] = log(sumOverI);
         }
 
+        if (kMixedPrecision) {
+            outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                      scalingFactorsIndex);
+            continue;
+        }
 
         if (scalingFactorsIndex != BEAGLE_OP_NONE) {
             const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
@@ -2458,10 +4079,12 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
                                                                    int count,
                                                                    double* outSumLogLikelihood) {
 
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
+    int* indexMaxScale = indexMaxScaleTmp;
+    REALTYPE* maxScaleFactor = maxScaleFactorTmp;
     
     int returnCode = BEAGLE_SUCCESS;
+
+    const int* mixedScaleIndices = (scalingFactorsIndices[0] != BEAGLE_OP_NONE ? scalingFactorsIndices : NULL);
     
     for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
         const REALTYPE* partialsParent = gPartials[parentBufferIndices[subsetIndex]];
@@ -2472,9 +4095,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
 
         memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
         
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
             
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);
             int v = 0; // Index for parent partials
             
             for(int l = 0; l < kCategoryCount; l++) {
@@ -2543,6 +4166,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
                 sumOverI += freqs[i] * integrationTmp[u];
                 u++;
             }            
+
+            if (kMixedPrecision) {
+                addSubsetSiteLikelihood(mixedScaleIndices, subsetIndex, count, k, sumOverI);
+                continue;
+            }
             
             if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
                 int cumulativeScalingFactorIndex;
@@ -2584,15 +4212,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
         
     }
     
-    if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
-    
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSubsetSiteLogLikelihoods(mixedScaleIndices);
+    } else {
+        if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
+            for(int i=0; i<kPatternCount; i++)
+                outLogLikelihoodsTmp[i] += maxScaleFactor[i];
+        }
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
     }
     
     if (*outSumLogLikelihood != *outSumLogLikelihood)
@@ -2601,7 +4232,151 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
     return returnCode;
 }
 
-    
+
+/*
+ * Integrates count independent edges, each with its own log likelihood and derivative sums.
+ * Every edge is split into the auto-partitioned pattern ranges and all (edge, range) pairs
+ * run on the thread pool. Pair t runs after pair t - kNumThreads on the same task, so it
+ * can use scratch lane t % kNumThreads.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsDerivsMulti(const int* parentBufferIndices,
+                                                                        const int* childBufferIndices,
+                                                                        const int* probabilityIndices,
+                                                                        const int* firstDerivativeIndices,
+                                                                        const int* secondDerivativeIndices,
+                                                                        const int* categoryWeightsIndices,
+                                                                        const int* stateFrequenciesIndices,
+                                                                        const int* scalingFactorsIndices,
+                                                                        int count,
+                                                                        double* outSumLogLikelihoods,
+                                                                        double* outSumFirstDerivatives,
+                                                                        double* outSumSecondDerivatives) {
+    const int partitionCount = (kThreadingEnabled && kAutoPartitioningEnabled ? kPartitionCount : 1);
+
+    if ((int) gEdgeDerivativeSums.size() < 3 * count * partitionCount)
+        gEdgeDerivativeSums.resize(3 * count * partitionCount);
+
+    auto edgeTask = [&](int t) {
+        const int e = t / partitionCount;
+        const int p = t % partitionCount;
+        calcEdgeLogLikelihoodDerivSums(parentBufferIndices[e], childBufferIndices[e], probabilityIndices[e],
+                                       firstDerivativeIndices[e],
+                                       (secondDerivativeIndices != NULL ? secondDerivativeIndices[e] : BEAGLE_OP_NONE),
+                                       categoryWeightsIndices[e], stateFrequenciesIndices[e],
+                                       scalingFactorsIndices[e],
+                                       (partitionCount > 1 ? gPatternPartitionsStartPatterns[p] : 0),
+                                       (partitionCount > 1 ? gPatternPartitionsStartPatterns[p + 1] : kPatternCount),
+                                       t % kNumThreads, &gEdgeDerivativeSums[3 * t]);
+    };
+
+    if (kThreadingEnabled && count * partitionCount > 1)
+        gThreadPool->parallelFor(count * partitionCount, edgeTask, kNumThreads, true);
+    else
+        for (int t = 0; t < count * partitionCount; t++)
+            edgeTask(t);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    for (int e = 0; e < count; e++) {
+        double sums[3] = {0.0, 0.0, 0.0};
+        for (int p = 0; p < partitionCount; p++) {
+            for (int n = 0; n < 3; n++)
+                sums[n] += gEdgeDerivativeSums[3 * (e * partitionCount + p) + n];
+        }
+        outSumLogLikelihoods[e] = sums[0];
+        outSumFirstDerivatives[e] = sums[1];
+        if (secondDerivativeIndices != NULL)
+            outSumSecondDerivatives[e] = sums[2];
+
+        if (sums[0] != sums[0])
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    return returnCode;
+}
+
+/*
+ * Sums the log likelihood of one edge and its first and, unless secondDerivativeIndex is
+ * BEAGLE_OP_NONE, second derivatives over a range of patterns into outSums[0..2].
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodDerivSums(const int parIndex,
+                                                                      const int childIndex,
+                                                                      const int probIndex,
+                                                                      const int firstDerivativeIndex,
+                                                                      const int secondDerivativeIndex,
+                                                                      const int categoryWeightsIndex,
+                                                                      const int stateFrequenciesIndex,
+                                                                      const int scalingFactorsIndex,
+                                                                      int startPattern,
+                                                                      int endPattern,
+                                                                      int scratchLane,
+                                                                      double* outSums) {
+    assert(parIndex >= kTipCount);
+
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+    const bool secondDerivative = (secondDerivativeIndex != BEAGLE_OP_NONE);
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const TipState* statesChild = (childIndex < kTipCount ?
+                                   getTipStates(childIndex, startPattern, endPattern, 2 * scratchLane) : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
+    const REALTYPE* secondDerivMatrix = (secondDerivative ? gTransitionMatrices[secondDerivativeIndex] : transMatrix);
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const REALTYPE* scalingFactors = (scalingFactorsIndex != BEAGLE_OP_NONE ? gScaleBuffers[scalingFactorsIndex] : NULL);
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double siteLikelihood = 0.0;
+        double siteFirst = 0.0;
+        double siteSecond = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int v = l * categoryStride + k * kPartialsPaddedStateCount;
+            int w = l * kMatrixSize;
+            for (int i = 0; i < kStateCount; i++) {
+                double sumOverJ = 0.0;
+                double sumOverJD1 = 0.0;
+                double sumOverJD2 = 0.0;
+                if (statesChild != NULL) {
+                    sumOverJ = transMatrix[w + statesChild[k]];
+                    sumOverJD1 = firstDerivMatrix[w + statesChild[k]];
+                    sumOverJD2 = secondDerivMatrix[w + statesChild[k]];
+                } else {
+                    for (int j = 0; j < kStateCount; j++) {
+                        sumOverJ += transMatrix[w + j] * partialsChild[v + j];
+                        sumOverJD1 += firstDerivMatrix[w + j] * partialsChild[v + j];
+                        if (secondDerivative)
+                            sumOverJD2 += secondDerivMatrix[w + j] * partialsChild[v + j];
+                    }
+                }
+                const double weightedParent = freqs[i] * partialsParent[v + i] * wt[l];
+                siteLikelihood += sumOverJ * weightedParent;
+                siteFirst += sumOverJD1 * weightedParent;
+                siteSecond += sumOverJD2 * weightedParent;
+                w += kTransPaddedStateCount;
+            }
+        }
+
+        const double ratio = siteFirst / siteLikelihood;
+        sumLogLikelihood += gPatternWeights[k] * (log(siteLikelihood) +
+                                                   (scalingFactors != NULL ?
+                                                    getCumulativeScaleFactor(scalingFactors, k) : 0.0));
+        sumFirstDerivative += gPatternWeights[k] * ratio;
+        sumSecondDerivative += gPatternWeights[k] * (siteSecond / siteLikelihood - ratio * ratio);
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const int parIndex,
                                                                const int childIndex,
@@ -2627,9 +4402,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
     memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
     memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2692,22 +4467,29 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sumOverI;
+        else
+            outLogLikelihoodsTmp[k] = log(sumOverI);
         outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
     }
 
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=0; k < kPatternCount; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++)
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
     }
 
-    *outSumLogLikelihood = 0.0;
     *outSumFirstDerivative = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-
         *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
     }
     
@@ -2746,9 +4528,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
     memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
     memset(secondDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = getTipStates(childIndex, 0, kPatternCount, 0);
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2817,24 +4599,31 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sumOverI;
+        else
+            outLogLikelihoodsTmp[k] = log(sumOverI);
         outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
         outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
     }
 
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=0; k < kPatternCount; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++)
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
     }
 
-    *outSumLogLikelihood = 0.0;
     *outSumFirstDerivative = 0.0;
     *outSumSecondDerivative = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-
         *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
 
         *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
@@ -2855,103 +4644,233 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
 }
 
 /*
- * Re-scales the partial likelihoods such that the largest is one.
+ * Re-scales the partial likelihoods of patterns [startPattern, endPattern) such
+ * that the largest is one.  The maximum is reduced over four independent
+ * accumulators and the reciprocal is applied in unit-stride loops, so that both
+ * passes vectorize for the plugin's instruction set.  No scratch memory is used,
+ * as independent operations on the same patterns may be rescaled concurrently.
+ * The maximum is exact whatever the reduction order and each partial gets the
+ * same single multiply, so results do not depend on the block size; they can
+ * still differ in the last digits between builds whose compiler flags differ
+ * in multiply-add contraction (see --enable-march-native).
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
         REALTYPE* scaleFactors,
         REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
+        int startPattern,
+        int endPattern) {
     if (DEBUGGING_OUTPUT) {
         std::cerr << "destP (before rescale): \n";// << destP << "\n";
         for(int i=0; i<kPartialsSize; i++)
             fprintf(stderr,"destP[%d] = %.5f\n",i,destP[i]);
     }
 
-    // TODO None of the code below has been optimized.
-    for (int k = 0; k < kPatternCount; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE* patternP = destP + k * kPartialsPaddedStateCount;
+
+        REALTYPE maxA = 0, maxB = 0, maxC = 0, maxD = 0;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
+            const REALTYPE* catP = patternP + l * categoryStride;
+            int i = 0;
+            for (; i < stateCountModFour; i += 4) {
+                maxA = (catP[i + 0] > maxA ? catP[i + 0] : maxA);
+                maxB = (catP[i + 1] > maxB ? catP[i + 1] : maxB);
+                maxC = (catP[i + 2] > maxC ? catP[i + 2] : maxC);
+                maxD = (catP[i + 3] > maxD ? catP[i + 3] : maxD);
             }
+            for (; i < kStateCount; i++)
+                maxA = (catP[i] > maxA ? catP[i] : maxA);
         }
-        
+        maxA = (maxB > maxA ? maxB : maxA);
+        maxC = (maxD > maxC ? maxD : maxC);
+        REALTYPE max = (maxC > maxA ? maxC : maxA);
+
         if (max == 0)
-            max = 1.0;
-            
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+            max = REALTYPE(1.0);
+
+        const REALTYPE oneOverMax = REALTYPE(1.0) / max;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            REALTYPE* __restrict catP = patternP + l * categoryStride;
             for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
+                catP[i] *= oneOverMax;
         }
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
+        setPatternScaleFactor(max, scaleFactors, cumulativeScaleFactors, k);
     }
+
     if (DEBUGGING_OUTPUT) {
-        for(int i=0; i<kPatternCount; i++)
+        for(int i=startPattern; i<endPattern; i++)
             fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
     }
 }
-    
-BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(REALTYPE* destP,
-                                                                   REALTYPE* scaleFactors,
-                                                                   REALTYPE* cumulativeScaleFactors,
-                                                                   const int fillWithOnes,
-                                                                   const int partitionIndex) {
 
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+/*
+ * Stores the scale factor of a pattern whose largest partial was max.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternScaleFactor(REALTYPE max,
+                                                              REALTYPE* scaleFactors,
+                                                              REALTYPE* cumulativeScaleFactors,
+                                                              int pattern) {
+    if (kMixedPrecision) {
+        const double logMax = log((double) max);
+        scaleFactors[pattern] = (kFlags & BEAGLE_FLAG_SCALERS_LOG ? (REALTYPE) logMax : max);
+        if( cumulativeScaleFactors != NULL )
+            addCumulativeScaleFactor(cumulativeScaleFactors, pattern, logMax);
+    } else if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+        REALTYPE logMax = log(max);
+        scaleFactors[pattern] = logMax;
+        if( cumulativeScaleFactors != NULL )
+            cumulativeScaleFactors[pattern] += logMax;
+    } else {
+        scaleFactors[pattern] = max;
+        if( cumulativeScaleFactors != NULL )
+            cumulativeScaleFactors[pattern] += log(max);
+    }
+}
 
-    // TODO None of the code below has been optimized.
-    for (int k = startPattern; k < endPattern; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
+/*
+ * Mixed precision: computes transition matrices (and derivatives) one edge at a time in
+ * double and stores them in float.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateMixedTransitionMatrices(int eigenIndex,
+                                                                      const int* probabilityIndices,
+                                                                      const int* firstDerivativeIndices,
+                                                                      const int* secondDerivativeIndices,
+                                                                      const double* edgeLengths,
+                                                                      const double* categoryRates,
+                                                                      int count) {
+    const int matrixSize = kMatrixSize * kCategoryCount;
+    double* mixedMatrices[3];
+    for (int i = 0; i < 3; i++)
+        mixedMatrices[i] = &gMixedMatricesTmp[i * matrixSize];
+    const int mixedIndices[3] = {0, 1, 2};
+
+    for (int u = 0; u < count; u++) {
+        gMixedEigenDecomposition->updateTransitionMatrices(eigenIndex, &mixedIndices[0],
+                (firstDerivativeIndices != NULL ? &mixedIndices[1] : NULL),
+                (secondDerivativeIndices != NULL ? &mixedIndices[2] : NULL),
+                &edgeLengths[u], categoryRates, mixedMatrices, 1);
+
+        REALTYPE* transitionMatrices[3] = {gTransitionMatrices[probabilityIndices[u]], NULL, NULL};
+        if (firstDerivativeIndices != NULL)
+            transitionMatrices[1] = gTransitionMatrices[firstDerivativeIndices[u]];
+        if (secondDerivativeIndices != NULL)
+            transitionMatrices[2] = gTransitionMatrices[secondDerivativeIndices[u]];
+        for (int i = 0; i < 3; i++) {
+            if (transitionMatrices[i] != NULL) {
+                for (int j = 0; j < matrixSize; j++)
+                    transitionMatrices[i][j] = (REALTYPE) mixedMatrices[i][j];
             }
         }
-        
-        if (max == 0)
-            max = 1.0;
-            
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
-        }
+    }
+}
+
+/*
+ * Adds to a cumulative scale factor; in mixed precision the factor is the sum of
+ * its single precision value and of a low-order part kPaddedPatternCount further on.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::addCumulativeScaleFactor(REALTYPE* cumulativeScaleFactors,
+                                                                 int pattern,
+                                                                 double logScaleFactor) {
+    REALTYPE* lowOrderFactors = cumulativeScaleFactors + kPaddedPatternCount;
+    const double sum = (double) cumulativeScaleFactors[pattern] + (double) lowOrderFactors[pattern] +
+                       logScaleFactor;
+    cumulativeScaleFactors[pattern] = (REALTYPE) sum;
+    lowOrderFactors[pattern] = (REALTYPE) (sum - (double) cumulativeScaleFactors[pattern]);
+}
+
+/*
+ * Mixed precision: sums, in double precision, the logs of the site likelihoods in
+ * gSiteLikelihoodsTmp and their cumulative scale factors; the site log likelihoods
+ * are kept in outLogLikelihoodsTmp.
+ */
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods(int startPattern,
+                                                                int endPattern,
+                                                                int scalingFactorsIndex) {
+    const REALTYPE* cumulativeScaleFactors = NULL;
+    if (scalingFactorsIndex >= 0)
+        cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
+
+    double sumLogLikelihood = 0.0;
+    for (int k = startPattern; k < endPattern; k++) {
+        double siteLogLikelihood = log(gSiteLikelihoodsTmp[k]);
+        if (cumulativeScaleFactors != NULL)
+            siteLogLikelihood += (double) cumulativeScaleFactors[k] +
+                                 (double) cumulativeScaleFactors[kPaddedPatternCount + k];
+        outLogLikelihoodsTmp[k] = (REALTYPE) siteLogLikelihood;
+        sumLogLikelihood += siteLogLikelihood * gPatternWeights[k];
+    }
+
+    return sumLogLikelihood;
+}
+
+// Cumulative scale factor of a pattern, with its low-order part under mixed precision
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getCumulativeScaleFactor(const REALTYPE* cumulativeScaleFactors,
+                                                                   int pattern) {
+    double scaleFactor = cumulativeScaleFactors[pattern];
+    if (kMixedPrecision)
+        scaleFactor += (double) cumulativeScaleFactors[kPaddedPatternCount + pattern];
+    return scaleFactor;
+}
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
+/*
+ * Mixed precision: adds the likelihood of a pattern in one of count subsets into
+ * gSiteLikelihoodsTmp, in double precision. With scaleIndices (one cumulative scale
+ * buffer per subset), likelihoods are taken relative to the largest scale factor of
+ * the pattern, whose subset the first subset records in indexMaxScaleTmp.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::addSubsetSiteLikelihood(const int* scaleIndices,
+                                                                int subsetIndex,
+                                                                int count,
+                                                                int pattern,
+                                                                double siteLikelihood) {
+    if (scaleIndices != NULL) {
+        if (subsetIndex == 0) {
+            indexMaxScaleTmp[pattern] = 0;
+            for (int j = 1; j < count; j++) {
+                if (getCumulativeScaleFactor(gScaleBuffers[scaleIndices[j]], pattern) >
+                    getCumulativeScaleFactor(gScaleBuffers[scaleIndices[indexMaxScaleTmp[pattern]]], pattern))
+                    indexMaxScaleTmp[pattern] = j;
+            }
         }
+        const int maxIndex = indexMaxScaleTmp[pattern];
+        if (subsetIndex != maxIndex)
+            siteLikelihood *= exp(getCumulativeScaleFactor(gScaleBuffers[scaleIndices[subsetIndex]], pattern) -
+                                  getCumulativeScaleFactor(gScaleBuffers[scaleIndices[maxIndex]], pattern));
+    }
+
+    if (subsetIndex == 0)
+        gSiteLikelihoodsTmp[pattern] = siteLikelihood;
+    else
+        gSiteLikelihoodsTmp[pattern] += siteLikelihood;
+}
+
+/*
+ * Mixed precision: sums the logs of the site likelihoods added over all subsets by
+ * addSubsetSiteLikelihood, with the largest scale factor of each pattern.
+ */
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSubsetSiteLogLikelihoods(const int* scaleIndices) {
+    double sumLogLikelihood = 0.0;
+    for (int k = 0; k < kPatternCount; k++) {
+        double siteLogLikelihood = log(gSiteLikelihoodsTmp[k]);
+        if (scaleIndices != NULL)
+            siteLogLikelihood += getCumulativeScaleFactor(gScaleBuffers[scaleIndices[indexMaxScaleTmp[k]]], k);
+        outLogLikelihoodsTmp[k] = (REALTYPE) siteLogLikelihood;
+        sumLogLikelihood += siteLogLikelihood * gPatternWeights[k];
     }
+
+    return sumLogLikelihood;
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -2989,9 +4908,441 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
 // private methods
 
 
+/*
+ * Copies the operations whose destination is out of date into changedOperations
+ * and returns their count. An operation is skipped when its destination was last
+ * written by the same operation, from inputs that have not changed since, and
+ * nothing has overwritten the destination or its scale buffer in between.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeUnchangedOperations(const int* operations,
+                                                                 int count,
+                                                                 int cumulativeScaleIndex,
+                                                                 int* changedOperations) {
+    int changedCount = 0;
+
+    for (int op = 0; op < count; op++) {
+        const int* operation = &operations[op * BEAGLE_OP_COUNT];
+        const int parIndex = operation[0];
+        const int writeScalingIndex = operation[1];
+        const int readScalingIndex = operation[2];
+
+        unsigned long versions[5] = {gPartialsVersions[operation[3]],
+                                     gMatrixVersions[operation[4]],
+                                     gPartialsVersions[operation[5]],
+                                     gMatrixVersions[operation[6]],
+                                     (readScalingIndex >= 0 ? gScaleVersions[readScalingIndex] : 0)};
+
+        OperationInputs& inputs = gOperationInputs[parIndex];
+
+        // New scale factors are accumulated as the operation runs, so it must run
+        bool accumulates = (cumulativeScaleIndex != BEAGLE_OP_NONE && writeScalingIndex >= 0);
+
+        if (!accumulates &&
+            inputs.partialsVersion != 0 &&
+            inputs.partialsVersion == gPartialsVersions[parIndex] &&
+            (writeScalingIndex < 0 || inputs.scaleVersion == gScaleVersions[writeScalingIndex]) &&
+            memcmp(inputs.operation, operation, sizeof(int) * BEAGLE_OP_COUNT) == 0 &&
+            memcmp(inputs.versions, versions, sizeof(versions)) == 0)
+            continue;
+
+        savePartials(parIndex, false);
+        saveScaleBuffer(writeScalingIndex, false);
+        touchPartials(parIndex);
+        touchScaleBuffer(writeScalingIndex);
+
+        memcpy(inputs.operation, operation, sizeof(int) * BEAGLE_OP_COUNT);
+        memcpy(inputs.versions, versions, sizeof(versions));
+        inputs.partialsVersion = gPartialsVersions[parIndex];
+        inputs.scaleVersion = (writeScalingIndex >= 0 ? gScaleVersions[writeScalingIndex] : 0);
+
+        memcpy(&changedOperations[changedCount * BEAGLE_OP_COUNT], operation,
+               sizeof(int) * BEAGLE_OP_COUNT);
+        changedCount++;
+    }
+
+    if (changedCount > 0) {
+        saveScaleBuffer(cumulativeScaleIndex, true);
+        touchScaleBuffer(cumulativeScaleIndex);
+    }
+
+    return changedCount;
+}
+
+/*
+ * Keeps the contents of a buffer at the restore point before its first write
+ * since then. The buffer is swapped for a spare one, so nothing is copied
+ * unless the write only updates part of the buffer (keepContents).
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveSnapshotBuffer(SnapshotBuffers& snapshot,
+                                                           REALTYPE** buffers,
+                                                           std::vector<unsigned long>& versions,
+                                                           int index,
+                                                           bool keepContents) {
+    if (!kSnapshotActive || index < 0 || snapshot.isSaved[index] || buffers[index] == NULL)
+        return;
+
+    REALTYPE* buffer;
+    if (snapshot.spares.empty()) {
+        buffer = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * snapshot.bufferSize);
+        if (buffer == NULL)
+            throw std::bad_alloc();
+    } else {
+        buffer = snapshot.spares.back();
+        snapshot.spares.pop_back();
+    }
+    if (keepContents)
+        memcpy(buffer, buffers[index], sizeof(REALTYPE) * snapshot.bufferSize);
+
+    SnapshotBuffer saved;
+    saved.index = index;
+    saved.buffer = buffers[index];
+    saved.version = versions[index];
+    if (&snapshot == &gSnapshotPartials && index < (int) gOperationInputs.size())
+        saved.inputs = gOperationInputs[index];
+    else
+        memset(&saved.inputs, 0, sizeof(OperationInputs));
+    snapshot.saved.push_back(saved);
+    snapshot.isSaved[index] = 1;
+
+    buffers[index] = buffer;
+    kBufferVersion++;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::savePartials(int bufferIndex,
+                                                     bool keepContents) {
+    saveSnapshotBuffer(gSnapshotPartials, gPartials, gPartialsVersions, bufferIndex, keepContents);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveMatrices(const int* matrixIndices,
+                                                     int count) {
+    if (kSnapshotActive) {
+        for (int i = 0; i < count; i++)
+            saveSnapshotBuffer(gSnapshotMatrices, gTransitionMatrices, gMatrixVersions,
+                               matrixIndices[i], false);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveScaleBuffer(int scaleIndex,
+                                                        bool keepContents) {
+    if (scaleIndex < kScaleBufferCount)
+        saveSnapshotBuffer(gSnapshotScaleBuffers, gScaleBuffers, gScaleVersions, scaleIndex,
+                           keepContents);
+}
+
+/*
+ * Ends the current restore point. When restoring, the saved buffers (and their
+ * versions) are put back; otherwise they are kept as spares.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearSnapshot(bool restore) {
+    SnapshotBuffers* snapshots[3] = {&gSnapshotPartials, &gSnapshotMatrices, &gSnapshotScaleBuffers};
+    REALTYPE** buffers[3] = {gPartials, gTransitionMatrices, gScaleBuffers};
+    std::vector<unsigned long>* versions[3] = {&gPartialsVersions, &gMatrixVersions, &gScaleVersions};
+
+    for (int k = 0; k < 3; k++) {
+        SnapshotBuffers& snapshot = *snapshots[k];
+        for (size_t i = 0; i < snapshot.saved.size(); i++) {
+            const SnapshotBuffer& saved = snapshot.saved[i];
+            if (restore) {
+                if (buffers[k][saved.index] != NULL) // not released since
+                    snapshot.spares.push_back(buffers[k][saved.index]);
+                buffers[k][saved.index] = saved.buffer;
+                (*versions[k])[saved.index] = saved.version;
+                if (k == 0 && saved.index < (int) gOperationInputs.size())
+                    gOperationInputs[saved.index] = saved.inputs;
+            } else {
+                snapshot.spares.push_back(saved.buffer);
+            }
+            snapshot.isSaved[saved.index] = 0;
+        }
+        snapshot.saved.clear();
+    }
+
+    if (restore)
+        kBufferVersion++;
+}
+
+// Version bumps are only needed while operations may be skipped, since enabling
+// skipping forgets all recorded operation inputs
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::touchPartials(int bufferIndex) {
+    if (kSkipUnchangedOperations)
+        gPartialsVersions[bufferIndex] = ++kVersionClock;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::touchMatrices(const int* matrixIndices,
+                                                      int count) {
+    if (kSkipUnchangedOperations) {
+        for (int i = 0; i < count; i++)
+            gMatrixVersions[matrixIndices[i]] = ++kVersionClock;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::touchScaleBuffer(int scaleIndex) {
+    if (kSkipUnchangedOperations && scaleIndex >= 0 && scaleIndex < (int) gScaleVersions.size())
+        gScaleVersions[scaleIndex] = ++kVersionClock;
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasTipStates(int bufferIndex) {
+    return gTipStates[bufferIndex] != NULL || gPackedTipStates[bufferIndex] != NULL;
+}
+
+/*
+ * Returns the compact states of a buffer, indexed by pattern, or NULL if it has none.
+ * Packed states are unpacked for the patterns in [startPattern, endPattern) into scratch
+ * slot 2 * lane + child. Only that range of the slot is written, so tasks on disjoint
+ * patterns can share a lane; tasks running concurrently on the same patterns (the
+ * by-level scheduler, batched edges) each pass their own lane below kNumThreads.
+ */
+BEAGLE_CPU_TEMPLATE
+const TipState* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTipStates(int bufferIndex,
+                                                                int startPattern,
+                                                                int endPattern,
+                                                                int slot) {
+    if (gTipStates[bufferIndex] != NULL || gPackedTipStates[bufferIndex] == NULL)
+        return gTipStates[bufferIndex];
+
+    assert((size_t) (slot + 1) * kPaddedPatternCount <= gTipStatesScratch.size());
+    TipState* scratch = &gTipStatesScratch[(size_t) slot * kPaddedPatternCount];
+
+    // Kernels running to the last pattern may read the padding
+    if (endPattern >= kPatternCount)
+        endPattern = kPaddedPatternCount;
+    unpackTipStates(bufferIndex, startPattern, endPattern, scratch);
+
+    return scratch;
+}
+
+/*
+ * Sizes the unpacking scratch for two slots per thread lane; called when tip states are
+ * packed and when the thread count changes, so evaluation never allocates it.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocateTipStatesScratch() {
+    const size_t scratchSize = (size_t) 2 * kNumThreads * kPaddedPatternCount;
+    if (gTipStatesScratch.size() < scratchSize)
+        gTipStatesScratch.resize(scratchSize);
+}
+
+/*
+ * Packs 16 patterns into each word, two bits per pattern; patterns with missing
+ * data (and the padding) are stored as state 0 and listed in gTipMissingPatterns.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::packTipStates(int tipIndex,
+                                                     const int* inStates) {
+    const int wordCount = (kPaddedPatternCount + 15) / 16;
+    if (gPackedTipStates[tipIndex] == NULL) {
+        gPackedTipStates[tipIndex] = (unsigned int*) mallocAligned(sizeof(unsigned int) * wordCount);
+        if (gPackedTipStates[tipIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        allocateTipStatesScratch();
+        kBufferVersion++;
+    }
+
+    unsigned int* packed = gPackedTipStates[tipIndex];
+    std::vector<int>& missing = gTipMissingPatterns[tipIndex];
+    memset(packed, 0, sizeof(unsigned int) * wordCount);
+    missing.clear();
+    for (int k = 0; k < kPaddedPatternCount; k++) {
+        if (k >= kPatternCount || inStates[k] >= kStateCount)
+            missing.push_back(k);
+        else
+            packed[k >> 4] |= ((unsigned int) inStates[k] & 3) << ((k & 15) << 1);
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Whole words are unpacked with a fixed-length loop, which the compiler vectorizes;
+ * the missing patterns in range are patched afterwards.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::unpackTipStates(int tipIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        TipState* outStates) {
+    const unsigned int* packed = gPackedTipStates[tipIndex];
+
+    int k = startPattern;
+    for (; k < endPattern && (k & 15) != 0; k++)
+        outStates[k] = (TipState) ((packed[k >> 4] >> ((k & 15) << 1)) & 3);
+    for (; k + 16 <= endPattern; k += 16) {
+        const unsigned int word = packed[k >> 4];
+        TipState* out = outStates + k;
+        for (int j = 0; j < 16; j++)
+            out[j] = (TipState) ((word >> (j << 1)) & 3);
+    }
+    for (; k < endPattern; k++)
+        outStates[k] = (TipState) ((packed[k >> 4] >> ((k & 15) << 1)) & 3);
+
+    const std::vector<int>& missing = gTipMissingPatterns[tipIndex];
+    for (std::vector<int>::const_iterator it = std::lower_bound(missing.begin(), missing.end(), startPattern);
+         it != missing.end() && *it < endPattern; ++it)
+        outStates[*it] = (TipState) kStateCount;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocatePartialsBuffer(int bufferIndex) {
+    if (gPartials[bufferIndex] == NULL) {
+        gPartials[bufferIndex] = (REALTYPE*) allocateBuffer(kArenaPartialsRegion, bufferIndex,
+                                                            sizeof(REALTYPE) * kPartialsSize);
+        if (gPartials[bufferIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        kBufferVersion++;
+    }
+    return BEAGLE_SUCCESS;
+}
+
+// Takes the buffer from its slot of the arena if that is in use and the slot is free,
+// otherwise from any free slot of the region or, failing that, from the heap
+BEAGLE_CPU_TEMPLATE
+void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocateBuffer(int arenaRegion,
+                                                        int slot,
+                                                        size_t size) {
+    if (kUseBufferArena && arenaRegion >= 0) {
+        void* buffer = gBufferArena.allocate(arenaRegion, slot);
+        if (buffer != NULL)
+            return buffer;
+    }
+    return mallocAligned(size);
+}
+
+// Buffers can move between the arena and the heap (e.g. as snapshot spares), so
+// ownership is looked up when they are freed
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::freeBuffer(void* buffer) {
+    if (!gBufferArena.release(buffer))
+        free(buffer);
+}
+
+/*
+ * Gives the first count scale buffers, and those saved at a restore point, room for
+ * the low-order part of each factor after their kPaddedPatternCount high-order parts.
+ * Widened buffers live on the heap, as they no longer fit the arena slots. All new
+ * buffers are allocated before any is replaced, so nothing changes on failure.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::widenScaleBuffers(int count) {
+    const size_t size = sizeof(REALTYPE) * kPaddedPatternCount;
+    std::vector<REALTYPE**> buffers;
+    for (int i = 0; i < count; i++) {
+        if (gScaleBuffers[i] != NULL)
+            buffers.push_back(&gScaleBuffers[i]);
+    }
+    for (size_t i = 0; i < gSnapshotScaleBuffers.saved.size(); i++)
+        buffers.push_back(&gSnapshotScaleBuffers.saved[i].buffer);
+
+    std::vector<REALTYPE*> widened(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        widened[i] = (REALTYPE*) mallocAligned(2 * size);
+        if (widened[i] == NULL) {
+            for (size_t j = 0; j < i; j++)
+                free(widened[j]);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        memcpy(widened[i], *buffers[i], size);
+        memset(widened[i] + kPaddedPatternCount, 0, size);
+        freeBuffer(*buffers[i]);
+        *buffers[i] = widened[i];
+    }
+
+    for (size_t i = 0; i < gSnapshotScaleBuffers.spares.size(); i++)
+        freeBuffer(gSnapshotScaleBuffers.spares[i]);
+    gSnapshotScaleBuffers.spares.clear();
+    gSnapshotScaleBuffers.bufferSize = 2 * kPaddedPatternCount;
+    kScaleBuffersWidened = true;
+    kBufferVersion++;
+
+    return true;
+}
+
+// Copies the buffers saved at a restore point that are slots of the arena to the
+// heap, and frees spares that are slots
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::moveSnapshotBuffersToHeap(SnapshotBuffers& snapshot) {
+    std::vector<REALTYPE*> spares;
+    for (size_t i = 0; i < snapshot.spares.size(); i++) {
+        if (gBufferArena.contains(snapshot.spares[i]))
+            freeBuffer(snapshot.spares[i]);
+        else
+            spares.push_back(snapshot.spares[i]);
+    }
+    snapshot.spares.swap(spares);
+
+    for (size_t i = 0; i < snapshot.saved.size(); i++) {
+        REALTYPE* saved = snapshot.saved[i].buffer;
+        if (!gBufferArena.contains(saved))
+            continue;
+        REALTYPE* buffer = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * snapshot.bufferSize);
+        if (buffer == NULL)
+            throw std::bad_alloc();
+        memcpy(buffer, saved, sizeof(REALTYPE) * snapshot.bufferSize);
+        freeBuffer(saved);
+        snapshot.saved[i].buffer = buffer;
+    }
+}
+
+// Moves the allocated buffers into the arena, or out of it if it is not in use
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::moveBuffers(REALTYPE** buffers,
+                                                    int count,
+                                                    int arenaRegion,
+                                                    size_t size) {
+    for (int i = 0; i < count; i++) {
+        if (buffers[i] == NULL || gBufferArena.contains(buffers[i]) == kUseBufferArena)
+            continue;
+        REALTYPE* buffer = (REALTYPE*) allocateBuffer(arenaRegion, i, size);
+        if (buffer == NULL)
+            throw std::bad_alloc();
+        if (gBufferArena.contains(buffer) != kUseBufferArena) { // arena full
+            free(buffer);
+            continue;
+        }
+        memcpy(buffer, buffers[i], size);
+        freeBuffer(buffers[i]);
+        buffers[i] = buffer;
+    }
+    kBufferVersion++;
+}
+
+/*
+ * Allocates the destination buffers of a list of partials operations and checks
+ * that every child has been written, either earlier or by a preceding operation.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::preparePartialsOperations(const int* operations,
+                                                                 int count,
+                                                                 int operationSize) {
+    for (int op = 0; op < count; op++) {
+        const int* operation = &operations[op * operationSize];
+        if (allocatePartialsBuffer(operation[0]) != BEAGLE_SUCCESS)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        if ((!hasTipStates(operation[3]) && gPartials[operation[3]] == NULL) ||
+            (!hasTipStates(operation[5]) && gPartials[operation[5]] == NULL))
+            return BEAGLE_ERROR_GENERAL;
+    }
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
     
+    // Saved buffers would be restored in the old pattern order
+    releaseSnapshot();
+
     if (!kPatternsReordered) {
         gPatternsNewOrder = (int*) malloc(kPatternCount * sizeof(int));
     } else {
@@ -3035,24 +5386,33 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
     gPatternWeights = sortedPatternWeights;
 
     REALTYPE* sortedPartials = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-    int* sortedTips = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+    TipState* sortedTips = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+
+    std::vector<int> sortedStates(kPaddedPatternCount);
 
     for (int tip=0; tip < kTipCount; tip++) {
-        if (gTipStates[tip] == NULL) {
+        if (gPackedTipStates[tip] != NULL) {
+            unpackTipStates(tip, 0, kPatternCount, sortedTips);
+            for (int i=0; i < kPatternCount; i++)
+                sortedStates[gPatternsNewOrder[i]] = sortedTips[i];
+            packTipStates(tip, &sortedStates[0]);
+        } else if (gTipStates[tip] == NULL) {
+            // Tips not set yet have no buffer to reorder
+            if (gPartials[tip] == NULL)
+                continue;
             REALTYPE* unsortedPartials = gPartials[tip];
             for (int l=0; l < kCategoryCount; l++) {
                 for (int i=0; i < kPatternCount; i++) {
                     for (int j=0; j < kStateCount; j++) {
-                        int sortIndex = l*kStateCount*kPatternCount + gPatternsNewOrder[i]*kStateCount + j;
-                        int pIndex = l*kStateCount*kPatternCount + i*kStateCount + j;
+                        int sortIndex = l*kPartialsPaddedStateCount*kPatternCount + gPatternsNewOrder[i]*kPartialsPaddedStateCount + j;
+                        int pIndex = l*kPartialsPaddedStateCount*kPatternCount + i*kPartialsPaddedStateCount + j;
                         sortedPartials[sortIndex] = unsortedPartials[pIndex];
                     }
                 }
             }
-            gPartials[tip] = sortedPartials;
-            sortedPartials = unsortedPartials;
+            memcpy(unsortedPartials, sortedPartials, sizeof(REALTYPE) * kPartialsSize);
         } else {
-            int* unsortedTips = gTipStates[tip];
+            TipState* unsortedTips = gTipStates[tip];
             for (int i=0; i < kPatternCount; i++) {
                 int sortIndex = gPatternsNewOrder[i];
                 int pIndex = i;
@@ -3065,6 +5425,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
 
     free(sortedPartials);
     free(sortedTips);
+    kBufferVersion++;
+    for (int i = 0; i < kBufferCount; i++)
+        touchPartials(i);
 
     kPatternsReordered = true;
 
@@ -3077,9 +5440,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                                         const int* states1,
+                                                         const TipState* states1,
                                                          const REALTYPE* matrices1,
-                                                         const int* states2,
+                                                         const TipState* states2,
                                                          const REALTYPE* matrices2,
                                                          int startPattern,
                                                          int endPattern) {
@@ -3108,9 +5471,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                                                     const int* child1States,
+                                                                     const TipState* child1States,
                                                                      const REALTYPE* child1TransMat,
-                                                                     const int* child2States,
+                                                                     const TipState* child2States,
                                                                      const REALTYPE* child2TransMat,
                                                                      const REALTYPE* scaleFactors,
                                                                      int startPattern,
@@ -3141,65 +5504,52 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* d
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                                           const int* states1,
+                                                           const TipState* states1,
                                                            const REALTYPE* matrices1,
                                                            const REALTYPE* partials2,
                                                            const REALTYPE* matrices2,
                                                            int startPattern,
                                                            int endPattern) {
-
-    int matrixIncr = kStateCount;
-
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
-
-
-    int stateCountModFour = (kStateCount / 4) * 4;
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
-            int w = l * kMatrixSize;
-            int state1 = states1[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-                REALTYPE sumA = 0.0;
-                REALTYPE sumB = 0.0;                
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
-                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
-                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
-                }
-                for (; j < kStateCount; j++) {
-                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
-                }               
-                
-                w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB);
-            }
-            destPtr += P_PAD;
-            partials2Ptr += kPartialsPaddedStateCount;
-        }
-    }
+    if (kMixedPrecision)
+        integrateStatesPartials<double>(destP, states1, matrices1, partials2, matrices2, NULL,
+                                        startPattern, endPattern);
+    else
+        integrateStatesPartials<REALTYPE>(destP, states1, matrices1, partials2, matrices2, NULL,
+                                          startPattern, endPattern);
 }
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                                       const int* states1,
+                                                                       const TipState* states1,
                                                                        const REALTYPE* matrices1,
                                                                        const REALTYPE* partials2,
                                                                        const REALTYPE* matrices2,
                                                                        const REALTYPE* scaleFactors,
                                                                        int startPattern,
                                                                        int endPattern) {
+    if (kMixedPrecision)
+        integrateStatesPartials<double>(destP, states1, matrices1, partials2, matrices2, scaleFactors,
+                                        startPattern, endPattern);
+    else
+        integrateStatesPartials<REALTYPE>(destP, states1, matrices1, partials2, matrices2, scaleFactors,
+                                          startPattern, endPattern);
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials,
+ * dividing by scaleFactors unless NULL. Products are summed in SUMTYPE, which is double in
+ * mixed precision.
+ */
+BEAGLE_CPU_TEMPLATE
+template <typename SUMTYPE>
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateStatesPartials(REALTYPE* destP,
+                                                                const TipState* states1,
+                                                                const REALTYPE* matrices1,
+                                                                const REALTYPE* partials2,
+                                                                const REALTYPE* matrices2,
+                                                                const REALTYPE* scaleFactors,
+                                                                int startPattern,
+                                                                int endPattern) {
 
     int matrixIncr = kStateCount;
 
@@ -3217,31 +5567,33 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE*
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             int state1 = states1[k];
-            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+            SUMTYPE oneOverScaleFactor = 1.0;
+            if (scaleFactors != NULL)
+                oneOverScaleFactor = SUMTYPE(1.0) / scaleFactors[k];
             for (int i = 0; i < kStateCount; i++) {
                 const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-                REALTYPE sumA = 0.0;
-                REALTYPE sumB = 0.0;                
+                SUMTYPE tmp = matrices1[w + state1];
+                SUMTYPE sumA = 0.0;
+                SUMTYPE sumB = 0.0;
                 int j = 0;
                 for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
-                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
-                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
+                    sumA += (SUMTYPE) matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+                    sumB += (SUMTYPE) matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                    sumA += (SUMTYPE) matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+                    sumB += (SUMTYPE) matrices2Ptr[j + 3] * partials2Ptr[j + 3];
                 }
                 for (; j < kStateCount; j++) {
-                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
-                }               
-                
+                    sumA += (SUMTYPE) matrices2Ptr[j] * partials2Ptr[j];
+                }
+
                 w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB) * oneOverScaleFactor;
+
+                *(destPtr++) = (REALTYPE) (tmp * (sumA + sumB) * oneOverScaleFactor);
             }
             destPtr += P_PAD;
             partials2Ptr += kPartialsPaddedStateCount;
         }
-    }                                            
+    }
 }
 
 /*
@@ -3255,54 +5607,12 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
                                                              const REALTYPE* matrices2,
                                                              int startPattern,
                                                              int endPattern) {
-    int matrixIncr = kStateCount;
-
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
-
-    int stateCountModFour = (kStateCount / 4) * 4;
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials1Ptr = &partials1[v];
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
-
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-                REALTYPE sum1B = 0.0, sum2B = 0.0;
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-                    
-                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-
-                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-                    
-                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
-                }               
-                
-                for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
-                }
-
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
-            }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
-        }
-    }
+    if (kMixedPrecision)
+        integratePartialsPartials<double>(destP, partials1, matrices1, partials2, matrices2, NULL,
+                                          startPattern, endPattern);
+    else
+        integratePartialsPartials<REALTYPE>(destP, partials1, matrices1, partials2, matrices2, NULL,
+                                            startPattern, endPattern);
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -3314,6 +5624,27 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
                                                                          const REALTYPE* scaleFactors,
                                                                          int startPattern,
                                                                          int endPattern) {
+    if (kMixedPrecision)
+        integratePartialsPartials<double>(destP, partials1, matrices1, partials2, matrices2,
+                                          scaleFactors, startPattern, endPattern);
+    else
+        integratePartialsPartials<REALTYPE>(destP, partials1, matrices1, partials2, matrices2,
+                                            scaleFactors, startPattern, endPattern);
+}
+
+/*
+ * As integrateStatesPartials, when both children have partials.
+ */
+BEAGLE_CPU_TEMPLATE
+template <typename SUMTYPE>
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integratePartialsPartials(REALTYPE* destP,
+                                                                  const REALTYPE* partials1,
+                                                                  const REALTYPE* matrices1,
+                                                                  const REALTYPE* partials2,
+                                                                  const REALTYPE* matrices2,
+                                                                  const REALTYPE* scaleFactors,
+                                                                  int startPattern,
+                                                                  int endPattern) {
 
     int matrixIncr = kStateCount;
 
@@ -3321,7 +5652,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
     matrixIncr += T_PAD;
 
     int stateCountModFour = (kStateCount / 4) * 4;
-    
+
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
         int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
@@ -3330,33 +5661,35 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
         const REALTYPE* partials2Ptr = &partials2[v];
         REALTYPE* destPtr = &destP[v];
         for (int k = startPattern; k < endPattern; k++) {
-            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+            SUMTYPE oneOverScaleFactor = 1.0;
+            if (scaleFactors != NULL)
+                oneOverScaleFactor = SUMTYPE(1.0) / scaleFactors[k];
             for (int i = 0; i < kStateCount; i++) {
                 const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
                 const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-                REALTYPE sum1B = 0.0, sum2B = 0.0;
+                SUMTYPE sum1A = 0.0, sum2A = 0.0;
+                SUMTYPE sum1B = 0.0, sum2B = 0.0;
                 int j = 0;
                 for (; j < stateCountModFour; j += 4) {
-                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-                    
-                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                    sum1A += (SUMTYPE) matrices1Ptr[j + 0] * partials1Ptr[j + 0];
+                    sum2A += (SUMTYPE) matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+
+                    sum1B += (SUMTYPE) matrices1Ptr[j + 1] * partials1Ptr[j + 1];
+                    sum2B += (SUMTYPE) matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+
+                    sum1A += (SUMTYPE) matrices1Ptr[j + 2] * partials1Ptr[j + 2];
+                    sum2A += (SUMTYPE) matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+
+                    sum1B += (SUMTYPE) matrices1Ptr[j + 3] * partials1Ptr[j + 3];
+                    sum2B += (SUMTYPE) matrices2Ptr[j + 3] * partials2Ptr[j + 3];
+                }
 
-                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-                    
-                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
-                }               
-                
                 for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
+                    sum1A += (SUMTYPE) matrices1Ptr[j] * partials1Ptr[j];
+                    sum2A += (SUMTYPE) matrices2Ptr[j] * partials2Ptr[j];
                 }
 
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
+                *(destPtr++) = (REALTYPE) ((sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor);
             }
             destPtr += P_PAD;
             partials1Ptr += kPartialsPaddedStateCount;
@@ -3444,33 +5777,6 @@ void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
     return ptr;
 }
 
-BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting(threadData* tData)
-{
-    std::unique_lock<std::mutex> l(tData->m, std::defer_lock);
-    while (true)
-    {
-        l.lock();
-
-        // Wait until the queue won't be empty or stop is signaled
-        tData->cv.wait(l, [tData] () {
-            return (tData->stop || !tData->jobs.empty()); 
-            });
-
-        // Stop was signaled, let's exit the thread
-        if (tData->stop) { return; }
-
-        // Pop one task from the queue...
-        std::packaged_task<void()> j = std::move(tData->jobs.front());
-        tData->jobs.pop();
-
-        l.unlock();
-
-        // Execute the task!
-        j();
-    }
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 // BeagleCPUImplFactory public methods
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -62,9 +62,9 @@ inline const char* getBeagleCPUSSEName<float>(){ return "CPU-SSE-Single"; };
 
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                                               const int* states_q,
+                                                               const TipState* states_q,
                                                                const double* matrices_q,
-                                                               const int* states_r,
+                                                               const TipState* states_r,
                                                                const double* matrices_r,
                                                                int startPattern,
                                                                int endPattern) {
@@ -81,9 +81,9 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
 
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const TipState* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const TipState* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -117,7 +117,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                                                 const int* states_q,
+                                                                 const TipState* states_q,
                                                                  const double* matrices_q,
                                                                  const double* partials_r,
                                                                  const double* matrices_r,
@@ -136,7 +136,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(double* destP,
 //
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const TipState* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -224,8 +224,8 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartials(double* __res
     int stateCountMinusOne = kPartialsPaddedStateCount - 1;
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
+    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
+    	int v = l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount;
@@ -310,7 +310,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsFixedScaling(d
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
     	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
+    	int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             const V_Real scalar = VEC_SPLAT(scaleFactors[k]);
@@ -424,7 +424,7 @@ return BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcEdgeLogLikelihoods(
 //
 //    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 //
-//        const int* statesChild = gTipStates[childIndex];
+//        const TipState* statesChild = gTipStates[childIndex];
 //
 //		int w = 0;
 //		V_Real *vcl_r = (V_Real *)cl_r;
@@ -524,6 +524,400 @@ return BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcEdgeLogLikelihoods(
 //    return returnCode;
 //}
 
+///////////////////////////////////////////////////////////////////////////////
+// Single-precision specialization
+//
+// Transition matrix rows and partials are padded to a multiple of four states,
+// so every row and every pattern starts on a 16-byte boundary.  Four rows are
+// integrated at once and their sums end up in the four lanes of one vector.
+
+/*
+ * Returns the dot products of rows [row, row + 3] of a transition matrix with a
+ * vector of partials.  Rows past lastRow repeat lastRow, and lanes of the final
+ * block that lie beyond the state count are masked out of the sums.
+ */
+inline V_Float sseFloatDotRows(const float* __restrict matrix,
+                               int rowStride,
+                               int row,
+                               int lastRow,
+                               const float* __restrict partials,
+                               int stateCountModFour,
+                               bool hasTail,
+                               V_Float tailMask) {
+    const float* m0 = matrix + row * rowStride;
+    const float* m1 = matrix + (row + 1 < lastRow ? row + 1 : lastRow) * rowStride;
+    const float* m2 = matrix + (row + 2 < lastRow ? row + 2 : lastRow) * rowStride;
+    const float* m3 = matrix + (row + 3 < lastRow ? row + 3 : lastRow) * rowStride;
+
+    V_Float sum0 = VEC_F_SETZERO();
+    V_Float sum1 = VEC_F_SETZERO();
+    V_Float sum2 = VEC_F_SETZERO();
+    V_Float sum3 = VEC_F_SETZERO();
+
+    int j = 0;
+    for (; j < stateCountModFour; j += FLOATS_PER_VEC) {
+        const V_Float p = VEC_F_LOAD(partials + j);
+        sum0 = VEC_F_MADD(VEC_F_LOAD(m0 + j), p, sum0);
+        sum1 = VEC_F_MADD(VEC_F_LOAD(m1 + j), p, sum1);
+        sum2 = VEC_F_MADD(VEC_F_LOAD(m2 + j), p, sum2);
+        sum3 = VEC_F_MADD(VEC_F_LOAD(m3 + j), p, sum3);
+    }
+    if (hasTail) { // padding entries are not initialized, so mask the products
+        const V_Float p = VEC_F_LOAD(partials + j);
+        sum0 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m0 + j), p), tailMask), sum0);
+        sum1 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m1 + j), p), tailMask), sum1);
+        sum2 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m2 + j), p), tailMask), sum2);
+        sum3 = VEC_F_ADD(VEC_F_AND(VEC_F_MULT(VEC_F_LOAD(m3 + j), p), tailMask), sum3);
+    }
+
+    _MM_TRANSPOSE4_PS(sum0, sum1, sum2, sum3);
+    return VEC_F_ADD(VEC_F_ADD(sum0, sum1), VEC_F_ADD(sum2, sum3));
+}
+
+/*
+ * As sseFloatDotRows, but the products are summed in double precision, for mixed
+ * precision.  The sums of rows row and row + 1 are returned in sum01, those of
+ * rows row + 2 and row + 3 in sum23.
+ */
+inline void sseFloatDotRowsDouble(const float* __restrict matrix,
+                                  int rowStride,
+                                  int row,
+                                  int lastRow,
+                                  const float* __restrict partials,
+                                  int stateCountModFour,
+                                  bool hasTail,
+                                  V_Float tailMask,
+                                  V_Real* sum01,
+                                  V_Real* sum23) {
+    const float* m0 = matrix + row * rowStride;
+    const float* m1 = matrix + (row + 1 < lastRow ? row + 1 : lastRow) * rowStride;
+    const float* m2 = matrix + (row + 2 < lastRow ? row + 2 : lastRow) * rowStride;
+    const float* m3 = matrix + (row + 3 < lastRow ? row + 3 : lastRow) * rowStride;
+
+    V_Real sum0 = VEC_SETZERO();
+    V_Real sum1 = VEC_SETZERO();
+    V_Real sum2 = VEC_SETZERO();
+    V_Real sum3 = VEC_SETZERO();
+
+    int j = 0;
+    for (; j < stateCountModFour; j += FLOATS_PER_VEC) {
+        const V_Float p = VEC_F_LOAD(partials + j);
+        const V_Real pLow = VEC_F_TO_D_LOW(p);
+        const V_Real pHigh = VEC_F_TO_D_HIGH(p);
+        V_Float m = VEC_F_LOAD(m0 + j);
+        sum0 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum0));
+        m = VEC_F_LOAD(m1 + j);
+        sum1 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum1));
+        m = VEC_F_LOAD(m2 + j);
+        sum2 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum2));
+        m = VEC_F_LOAD(m3 + j);
+        sum3 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum3));
+    }
+    if (hasTail) { // padding entries are not initialized, so mask both factors
+        const V_Float p = VEC_F_AND(VEC_F_LOAD(partials + j), tailMask);
+        const V_Real pLow = VEC_F_TO_D_LOW(p);
+        const V_Real pHigh = VEC_F_TO_D_HIGH(p);
+        V_Float m = VEC_F_AND(VEC_F_LOAD(m0 + j), tailMask);
+        sum0 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum0));
+        m = VEC_F_AND(VEC_F_LOAD(m1 + j), tailMask);
+        sum1 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum1));
+        m = VEC_F_AND(VEC_F_LOAD(m2 + j), tailMask);
+        sum2 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum2));
+        m = VEC_F_AND(VEC_F_LOAD(m3 + j), tailMask);
+        sum3 = VEC_MADD(VEC_F_TO_D_HIGH(m), pHigh, VEC_MADD(VEC_F_TO_D_LOW(m), pLow, sum3));
+    }
+
+    *sum01 = VEC_ADD(_mm_unpacklo_pd(sum0, sum1), _mm_unpackhi_pd(sum0, sum1));
+    *sum23 = VEC_ADD(_mm_unpacklo_pd(sum2, sum3), _mm_unpackhi_pd(sum2, sum3));
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesStates(float* destP,
+                                                              const TipState* states_q,
+                                                              const float* matrices_q,
+                                                              const TipState* states_r,
+                                                              const float* matrices_r,
+                                                              int startPattern,
+                                                              int endPattern) {
+
+	BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesStates(destP,
+                                                          states_q,
+                                                          matrices_q,
+                                                          states_r,
+                                                          matrices_r,
+                                                          startPattern,
+                                                          endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartials(float* destP,
+                                                                const TipState* states_q,
+                                                                const float* matrices_q,
+                                                                const float* partials_r,
+                                                                const float* matrices_r,
+                                                                int startPattern,
+                                                                int endPattern) {
+    sumStatesPartials(destP, states_q, matrices_q, partials_r, matrices_r, NULL,
+                      startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
+                                                                            const TipState* states_q,
+                                                                            const float* matrices_q,
+                                                                            const float* partials_r,
+                                                                            const float* matrices_r,
+                                                                            const float* scaleFactors,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    sumStatesPartials(destP, states_q, matrices_q, partials_r, matrices_r, scaleFactors,
+                      startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::sumStatesPartials(float* destP,
+                                                               const TipState* states_q,
+                                                               const float* matrices_q,
+                                                               const float* partials_r,
+                                                               const float* matrices_r,
+                                                               const float* scaleFactors,
+                                                               int startPattern,
+                                                               int endPattern) {
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* mq = matrices_q + l*kMatrixSize;
+        const float* mr = matrices_r + l*kMatrixSize;
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state_q = states_q[k];
+            if (kMixedPrecision) {
+                const V_Real scale = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+                for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                    V_Real sum01, sum23;
+                    sseFloatDotRowsDouble(mr, rowStride, i, lastRow, partials_r + v,
+                                          stateCountModFour, hasTail, tailMask, &sum01, &sum23);
+                    const V_Real m_q01 = VEC_SET(
+                            mq[(i + 1 < lastRow ? i + 1 : lastRow) * rowStride + state_q],
+                            mq[i * rowStride + state_q]);
+                    const V_Real m_q23 = VEC_SET(
+                            mq[(i + 3 < lastRow ? i + 3 : lastRow) * rowStride + state_q],
+                            mq[(i + 2 < lastRow ? i + 2 : lastRow) * rowStride + state_q]);
+                    VEC_F_STORE(destP + v + i, VEC_D_TO_F(VEC_MULT(VEC_MULT(m_q01, sum01), scale),
+                                                          VEC_MULT(VEC_MULT(m_q23, sum23), scale)));
+                }
+                v += kPartialsPaddedStateCount;
+                continue;
+            }
+            const V_Float scale = VEC_F_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum_r = sseFloatDotRows(mr, rowStride, i, lastRow, partials_r + v,
+                                                      stateCountModFour, hasTail, tailMask);
+                const V_Float m_q = VEC_F_SET(
+                        mq[(i + 3 < lastRow ? i + 3 : lastRow) * rowStride + state_q],
+                        mq[(i + 2 < lastRow ? i + 2 : lastRow) * rowStride + state_q],
+                        mq[(i + 1 < lastRow ? i + 1 : lastRow) * rowStride + state_q],
+                        mq[i * rowStride + state_q]);
+                VEC_F_STORE(destP + v + i, VEC_F_MULT(VEC_F_MULT(m_q, sum_r), scale));
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                                                  const float* __restrict partials1,
+                                                                  const float* __restrict matrices1,
+                                                                  const float* __restrict partials2,
+                                                                  const float* __restrict matrices2,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    sumPartialsPartials(destP, partials1, matrices1, partials2, matrices2, NULL,
+                        startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                                              const float* __restrict partials1,
+                                                                              const float* __restrict matrices1,
+                                                                              const float* __restrict partials2,
+                                                                              const float* __restrict matrices2,
+                                                                              const float* __restrict scaleFactors,
+                                                                              int startPattern,
+                                                                              int endPattern) {
+    sumPartialsPartials(destP, partials1, matrices1, partials2, matrices2, scaleFactors,
+                        startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::sumPartialsPartials(float* __restrict destP,
+                                                                 const float* __restrict partials1,
+                                                                 const float* __restrict matrices1,
+                                                                 const float* __restrict partials2,
+                                                                 const float* __restrict matrices2,
+                                                                 const float* __restrict scaleFactors,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* m1 = matrices1 + l*kMatrixSize;
+        const float* m2 = matrices2 + l*kMatrixSize;
+        for (int k = startPattern; k < endPattern; k++) {
+            if (kMixedPrecision) {
+                const V_Real scale = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+                for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                    V_Real sum1_01, sum1_23, sum2_01, sum2_23;
+                    sseFloatDotRowsDouble(m1, rowStride, i, lastRow, partials1 + v,
+                                          stateCountModFour, hasTail, tailMask, &sum1_01, &sum1_23);
+                    sseFloatDotRowsDouble(m2, rowStride, i, lastRow, partials2 + v,
+                                          stateCountModFour, hasTail, tailMask, &sum2_01, &sum2_23);
+                    VEC_F_STORE(destP + v + i, VEC_D_TO_F(VEC_MULT(VEC_MULT(sum1_01, sum2_01), scale),
+                                                          VEC_MULT(VEC_MULT(sum1_23, sum2_23), scale)));
+                }
+                v += kPartialsPaddedStateCount;
+                continue;
+            }
+            const V_Float scale = VEC_F_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum1 = sseFloatDotRows(m1, rowStride, i, lastRow, partials1 + v,
+                                                     stateCountModFour, hasTail, tailMask);
+                const V_Float sum2 = sseFloatDotRows(m2, rowStride, i, lastRow, partials2 + v,
+                                                     stateCountModFour, hasTail, tailMask);
+                // lanes past the state count land in the partials padding
+                VEC_F_STORE(destP + v + i, VEC_F_MULT(VEC_F_MULT(sum1, sum2), scale));
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
+                                                                             const float* partials_q,
+                                                                             const float* matrices_q,
+                                                                             const float* partials_r,
+                                                                             const float* matrices_r,
+                                                                             int* activateScaling) {
+    BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsAutoScaling(destP,
+                                                                         partials_q,
+                                                                         matrices_q,
+                                                                         partials_r,
+                                                                         matrices_r,
+                                                                         activateScaling);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                   const int childIndex,
+                                                                   const int probIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) // Integrate against a state at the child
+        return BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcEdgeLogLikelihoods(parIndex,
+                                                                           childIndex,
+                                                                           probIndex,
+                                                                           categoryWeightsIndex,
+                                                                           stateFrequenciesIndex,
+                                                                           scalingFactorsIndex,
+                                                                           outSumLogLikelihood);
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const float* partialsParent = gPartials[parIndex];
+    const float* partialsChild = gPartials[childIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    const int rowStride = kStateCount + T_PAD;
+    const int lastRow = kStateCount - 1;
+    const int stateCountModFour = (kStateCount / 4) * 4;
+    const bool hasTail = (stateCountModFour != kStateCount);
+    const V_Float tailMask = VEC_F_TAIL_MASK(kStateCount - stateCountModFour);
+
+    ALIGN16 float sums[FLOATS_PER_VEC];
+
+    int v = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = 0;
+        const float* m = transMatrix + l*kMatrixSize;
+        const V_Float weight = VEC_F_SPLAT(wt[l]);
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                const V_Float sum = sseFloatDotRows(m, rowStride, i, lastRow, partialsChild + v,
+                                                    stateCountModFour, hasTail, tailMask);
+                VEC_F_STORE(sums, VEC_F_MULT(VEC_F_MULT(sum, VEC_F_LOAD(partialsParent + v + i)),
+                                             weight));
+                const int laneCount = (kStateCount - i < FLOATS_PER_VEC ?
+                                       kStateCount - i : FLOATS_PER_VEC);
+                for (int j = 0; j < laneCount; j++)
+                    integrationTmp[u + j] += sums[j];
+                u += laneCount;
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        float sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            u++;
+        }
+
+        if (kMixedPrecision)
+            gSiteLikelihoodsTmp[k] = sumOverI;
+        else
+            outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+    if (kMixedPrecision) {
+        *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
+    } else {
+        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+            const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+            for(int k=0; k < kPatternCount; k++)
+                outLogLikelihoodsTmp[k] += scalingFactors[k];
+        }
+
+        *outSumLogLikelihood = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
 BEAGLE_CPU_SSE_TEMPLATE
 int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -561,6 +955,42 @@ const long BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getFlags() {
 ///////////////////////////////////////////////////////////////////////////////
 // BeagleImplFactory public methods
 
+BEAGLE_CPU_TEMPLATE
+BeagleImpl* createBeagleCPUSSEImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags) {
+    BeagleCPUSSEImpl<BEAGLE_CPU_GENERIC>* impl = new BeagleCPUSSEImpl<BEAGLE_CPU_GENERIC>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 BeagleImpl* BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
                                              int partialsBufferCount,
@@ -581,50 +1011,51 @@ BeagleImpl* BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int
         return NULL;
     
 	if (stateCount & 1) { // is odd
-        BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_ODD, P_PAD_SSE_ODD>* impl =
-        new BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_ODD, P_PAD_SSE_ODD>();
-        
-        
-        try {
-            if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
-                                     patternCount, eigenBufferCount, matrixBufferCount,
-                                     categoryCount,scaleBufferCount, resourceNumber, 
-                                     pluginResourceNumber, 
-                                     preferenceFlags, requirementFlags) == 0)
-                return impl;
-        }
-        catch(...) {
-            if (DEBUGGING_OUTPUT)
-                std::cerr << "exception in initialize\n";
-            delete impl;
-            throw;
-        }
-        
-        delete impl;        
+        return createBeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_ODD, P_PAD_SSE_ODD>(
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount,
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags);
 	} else {
-        BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_EVEN, P_PAD_SSE_EVEN>* impl =
-                new BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_EVEN, P_PAD_SSE_EVEN>();
+        return createBeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_EVEN, P_PAD_SSE_EVEN>(
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount,
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags);
+    }
+}
 
+template <>
+BeagleImpl* BeagleCPUSSEImplFactory<float>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
 
-        try {
-            if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
-                                     patternCount, eigenBufferCount, matrixBufferCount,
-                                     categoryCount,scaleBufferCount, resourceNumber,
-                                     pluginResourceNumber, 
-                                     preferenceFlags, requirementFlags) == 0)
-                return impl;
-        }
-        catch(...) {
-            if (DEBUGGING_OUTPUT)
-                std::cerr << "exception in initialize\n";
-            delete impl;
-            throw;
-        }
+    if (!CPUSupportsSSE())
+        return NULL;
 
-        delete impl;
+#define CREATE_SSE_FLOAT_IMPL(MOD) \
+        createBeagleCPUSSEImpl<float, T_PAD_SSE_FLOAT_##MOD, P_PAD_SSE_FLOAT_##MOD>( \
+                tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount, \
+                eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount, \
+                resourceNumber, pluginResourceNumber, preferenceFlags, requirementFlags)
+
+    switch (stateCount & 3) { // pad rows to a multiple of four states
+        case 0:  return CREATE_SSE_FLOAT_IMPL(0);
+        case 1:  return CREATE_SSE_FLOAT_IMPL(1);
+        case 2:  return CREATE_SSE_FLOAT_IMPL(2);
+        default: return CREATE_SSE_FLOAT_IMPL(3);
     }
-    
-    return NULL;
+
+#undef CREATE_SSE_FLOAT_IMPL
 }
 
 BEAGLE_CPU_FACTORY_TEMPLATE
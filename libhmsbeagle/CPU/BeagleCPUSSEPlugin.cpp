@@ -44,9 +44,9 @@ Plugin("CPU-SSE", "CPU-SSE")
 	// list with compatible factories and resources
 
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<double>());
-//	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>()); // TODO Not yet written
+	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<double>()); // TODO In process of writing (disabled until it works for all input)
-//	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<float>()); // TODO Not yet written
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<float>());
 }
 
 }	// namespace cpu
@@ -0,0 +1,495 @@
+/*
+ *  BeagleCPUThreadPool.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUThreadPool__
+#define __BeagleCPUThreadPool__
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "libhmsbeagle/BeagleCPUThreadPoolState.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Work-stealing pool of worker threads.
+ *
+ * Each worker owns a task deque; a worker whose deque is empty steals from
+ * the others. A batch of tasks is run with run()/parallelFor(), which blocks
+ * until the whole batch is done and lets the calling thread execute tasks
+ * while it waits. Dispatching a batch does not allocate: a task is a
+ * (batch, index) pair and the batch lives on the caller's stack.
+ *
+ * A queue entry is a contiguous range of task indices from one batch. Taking
+ * a task moves the entry behind any other entries in that queue, so batches
+ * submitted concurrently (e.g. by different instances) are served
+ * round-robin rather than one after the other.
+ *
+ * All CPU instances in a process share one pool, see acquireShared(). The
+ * pool and its settings are kept in libhmsbeagle (getCPUThreadPoolState()),
+ * so that every CPU plugin finds the same pool.
+ */
+class BeagleCPUThreadPool {
+public:
+    typedef void (*TaskFunction)(void* context, int taskIndex);
+
+    explicit BeagleCPUThreadPool(int workerCount);
+
+    ~BeagleCPUThreadPool();
+
+    int getWorkerCount() const { return kWorkerCount; }
+
+    // Calls function(context, i) for i in [0, taskCount) and returns when all calls are done;
+    // with stablePlacement, task 0 runs on the calling thread and task i > 0 is queued to
+    // worker (i - 1) % getWorkerCount() on every call, so data first touched by task i stays
+    // local to its thread unless another worker steals the task. The calling thread then
+    // does not help with queued tasks, so stable batches must not be run from inside a task.
+    void run(TaskFunction function,
+             void* context,
+             int taskCount,
+             bool stablePlacement = false);
+
+    // Calls function(i) for i in [0, taskCount) and returns when all calls are done;
+    // at most maxThreads threads (if > 0) work on the calls at any time. With stablePlacement
+    // and more tasks than threads, task i is placed like task i % maxThreads of run()
+    template <typename F>
+    void parallelFor(int taskCount,
+                     F& function,
+                     int maxThreads = 0,
+                     bool stablePlacement = false) {
+        if (maxThreads <= 0 || taskCount <= maxThreads) {
+            run(&invokeTask<F>, &function, taskCount, stablePlacement);
+        } else if (stablePlacement) {
+            // maxThreads tasks, task t calling indices t, t + maxThreads, ...
+            CappedLoop<F> loop(function, taskCount, maxThreads);
+            run(&invokeStridedLoop<F>, &loop, maxThreads, true);
+        } else {
+            // maxThreads tasks that each keep claiming the next index
+            CappedLoop<F> loop(function, taskCount, maxThreads);
+            run(&invokeCappedLoop<F>, &loop, maxThreads);
+        }
+    }
+
+    // Returns the process-wide pool, creating it if needed; pair with releaseShared()
+    static BeagleCPUThreadPool* acquireShared();
+
+    static void releaseShared(BeagleCPUThreadPool* pool);
+
+    // Number of threads working on a batch (pool workers plus the calling thread)
+    // for pools created from now on; defaults to the number of hardware threads
+    static int getSharedThreadCount();
+
+private:
+    struct Batch {
+        TaskFunction function;
+        void* context;
+        int remaining; // guarded by m
+        std::mutex m;
+        std::condition_variable cv;
+    };
+
+    struct Task {
+        Batch* batch;
+        int begin;
+        int end;
+    };
+
+    template <typename F>
+    struct CappedLoop {
+        F& function;
+        int count;
+        int stride;
+        std::atomic<int> next;
+
+        CappedLoop(F& f, int n, int s) : function(f), count(n), stride(s), next(0) {}
+    };
+
+    struct WorkerQueue {
+        std::mutex m;
+        std::vector<Task> tasks; // ring buffer
+        int head;
+        int count;
+    };
+
+    template <typename F>
+    static void invokeTask(void* function, int taskIndex) {
+        (*static_cast<F*>(function))(taskIndex);
+    }
+
+    template <typename F>
+    static void invokeCappedLoop(void* context, int) {
+        CappedLoop<F>* loop = static_cast<CappedLoop<F>*>(context);
+        int i;
+        while ((i = loop->next.fetch_add(1)) < loop->count)
+            loop->function(i);
+    }
+
+    template <typename F>
+    static void invokeStridedLoop(void* context, int taskIndex) {
+        CappedLoop<F>* loop = static_cast<CappedLoop<F>*>(context);
+        for (int i = taskIndex; i < loop->count; i += loop->stride)
+            loop->function(i);
+    }
+
+    static bool pinThread(std::thread& thread,
+                          int cpuIndex);
+
+    // Pins the workers round-robin to the shared state's CPUs; called with the
+    // shared state locked
+    static void repinWorkers(void* pool);
+
+    void workerLoop(int workerIndex);
+
+    void pushTask(int queueIndex,
+                  const Task& task);
+
+    bool popTask(int queueIndex,
+                 Task& task);
+
+    bool takeTask(int firstQueue,
+                  Task& task);
+
+    void executeTask(const Task& task);
+
+    int kWorkerCount;
+    int kSharedUsers; // guarded by the shared state mutex
+
+    WorkerQueue* gQueues;
+    std::thread* gWorkers;
+
+    std::atomic<int> kPendingTasks;
+    std::atomic<unsigned int> kNextQueue;
+    bool kStop;
+    std::mutex gSleepMutex;
+    std::condition_variable gSleepCondition;
+};
+
+inline BeagleCPUThreadPool::BeagleCPUThreadPool(int workerCount) :
+    kWorkerCount(workerCount > 0 ? workerCount : 0),
+    kSharedUsers(0),
+    kPendingTasks(0),
+    kNextQueue(0),
+    kStop(false) {
+
+    gQueues = new WorkerQueue[kWorkerCount];
+    for (int i = 0; i < kWorkerCount; i++) {
+        gQueues[i].tasks.resize(64);
+        gQueues[i].head = 0;
+        gQueues[i].count = 0;
+    }
+
+    gWorkers = new std::thread[kWorkerCount];
+    for (int i = 0; i < kWorkerCount; i++) {
+        gWorkers[i] = std::thread(&BeagleCPUThreadPool::workerLoop, this, i);
+    }
+
+    // Only constructed by acquireShared(), with the shared state locked
+    if (!getCPUThreadPoolState().cpuIndices.empty())
+        repinWorkers(this);
+}
+
+inline BeagleCPUThreadPool::~BeagleCPUThreadPool() {
+    {
+        std::unique_lock<std::mutex> l(gSleepMutex);
+        kStop = true;
+    }
+    gSleepCondition.notify_all();
+
+    for (int i = 0; i < kWorkerCount; i++) {
+        gWorkers[i].join();
+    }
+
+    delete[] gWorkers;
+    delete[] gQueues;
+}
+
+inline void BeagleCPUThreadPool::run(TaskFunction function,
+                                     void* context,
+                                     int taskCount,
+                                     bool stablePlacement) {
+    if (taskCount <= 0)
+        return;
+
+    if (kWorkerCount == 0 || taskCount == 1) {
+        for (int i = 0; i < taskCount; i++)
+            function(context, i);
+        return;
+    }
+
+    Batch batch;
+    batch.function = function;
+    batch.context = context;
+    batch.remaining = taskCount;
+
+    // The calling thread keeps the first task. With stable placement every other
+    // task is queued to its own worker, otherwise the rest are split into one
+    // contiguous range per queue
+    unsigned int firstQueue = 0;
+    if (stablePlacement) {
+        for (int i = 1; i < taskCount; i++) {
+            Task task = {&batch, i, i + 1};
+            pushTask((i - 1) % kWorkerCount, task);
+        }
+    } else {
+        firstQueue = kNextQueue.fetch_add(1, std::memory_order_relaxed);
+        int queuedCount = taskCount - 1;
+        int rangeCount = (queuedCount < kWorkerCount ? queuedCount : kWorkerCount);
+        int begin = 1;
+        for (int i = 0; i < rangeCount; i++) {
+            int end = begin + queuedCount / rangeCount + (i < queuedCount % rangeCount ? 1 : 0);
+            Task task = {&batch, begin, end};
+            pushTask((firstQueue + i) % kWorkerCount, task);
+            begin = end;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> l(gSleepMutex);
+        kPendingTasks.fetch_add(taskCount - 1);
+    }
+    if (taskCount - 1 >= kWorkerCount) {
+        gSleepCondition.notify_all();
+    } else {
+        for (int i = 1; i < taskCount; i++)
+            gSleepCondition.notify_one();
+    }
+
+    Task first = {&batch, 0, 1};
+    executeTask(first);
+
+    // Help with queued work until this batch is complete; tasks placed on
+    // workers are left to them
+    Task task;
+    while (!stablePlacement && takeTask(firstQueue % kWorkerCount, task)) {
+        executeTask(task);
+        std::unique_lock<std::mutex> l(batch.m);
+        if (batch.remaining == 0)
+            return;
+    }
+
+    std::unique_lock<std::mutex> l(batch.m);
+    while (batch.remaining > 0)
+        batch.cv.wait(l);
+}
+
+inline void BeagleCPUThreadPool::executeTask(const Task& task) {
+    Batch* batch = task.batch;
+    batch->function(batch->context, task.begin);
+
+    // The batch may be destroyed by its owner as soon as the mutex is released
+    std::unique_lock<std::mutex> l(batch->m);
+    if (--batch->remaining == 0)
+        batch->cv.notify_all();
+}
+
+inline void BeagleCPUThreadPool::workerLoop(int workerIndex) {
+    Task task;
+    for (;;) {
+        if (takeTask(workerIndex, task)) {
+            executeTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(gSleepMutex);
+        while (kPendingTasks.load() <= 0 && !kStop)
+            gSleepCondition.wait(l);
+        if (kStop && kPendingTasks.load() <= 0)
+            return;
+    }
+}
+
+inline void BeagleCPUThreadPool::pushTask(int queueIndex,
+                                          const Task& task) {
+    WorkerQueue& queue = gQueues[queueIndex];
+    std::unique_lock<std::mutex> l(queue.m);
+
+    int capacity = (int) queue.tasks.size();
+    if (queue.count == capacity) {
+        // Unroll the ring buffer into a larger one; only happens while the pool warms up
+        std::vector<Task> tasks(capacity * 2);
+        for (int i = 0; i < queue.count; i++)
+            tasks[i] = queue.tasks[(queue.head + i) % capacity];
+        queue.tasks.swap(tasks);
+        queue.head = 0;
+        capacity *= 2;
+    }
+
+    queue.tasks[(queue.head + queue.count) % capacity] = task;
+    queue.count++;
+}
+
+/*
+ * Takes the first task index of the entry at the head of the queue; the rest
+ * of that entry's range goes to the back of the queue.
+ */
+
+inline bool BeagleCPUThreadPool::popTask(int queueIndex,
+                                         Task& task) {
+    WorkerQueue& queue = gQueues[queueIndex];
+    std::unique_lock<std::mutex> l(queue.m);
+
+    if (queue.count == 0)
+        return false;
+
+    const int capacity = (int) queue.tasks.size();
+    Task front = queue.tasks[queue.head];
+    task.batch = front.batch;
+    task.begin = front.begin;
+    task.end = front.begin + 1;
+
+    front.begin++;
+    queue.head = (queue.head + 1) % capacity;
+    if (front.begin == front.end) {
+        queue.count--;
+    } else {
+        queue.tasks[(queue.head + queue.count - 1) % capacity] = front;
+    }
+    return true;
+}
+
+/*
+ * Takes a task from the queue at firstQueue (a worker's own queue) or, when it
+ * is empty, steals one from the next non-empty queue.
+ */
+inline bool BeagleCPUThreadPool::takeTask(int firstQueue,
+                                          Task& task) {
+    for (int i = 0; i < kWorkerCount; i++) {
+        if (popTask((firstQueue + i) % kWorkerCount, task)) {
+            kPendingTasks.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline BeagleCPUThreadPool* BeagleCPUThreadPool::acquireShared() {
+    CPUThreadPoolState& state = getCPUThreadPoolState();
+    std::unique_lock<std::mutex> l(state.m);
+
+    if (state.pool == NULL) {
+        int threadCount = state.threadCount;
+        if (threadCount <= 0)
+            threadCount = std::thread::hardware_concurrency();
+        if (threadCount <= 0)
+            threadCount = 1;
+        state.pool = new BeagleCPUThreadPool(threadCount - 1);
+        state.poolThreadCount = threadCount;
+        CPUThreadPoolState::LivePool livePool = {state.pool, &BeagleCPUThreadPool::repinWorkers};
+        state.livePools.push_back(livePool);
+    }
+    BeagleCPUThreadPool* pool = static_cast<BeagleCPUThreadPool*>(state.pool);
+    pool->kSharedUsers++;
+    return pool;
+}
+
+inline void BeagleCPUThreadPool::releaseShared(BeagleCPUThreadPool* pool) {
+    CPUThreadPoolState& state = getCPUThreadPoolState();
+    std::unique_lock<std::mutex> l(state.m);
+
+    if (--pool->kSharedUsers == 0) {
+        if (state.pool == pool)
+            state.pool = NULL;
+        for (size_t i = 0; i < state.livePools.size(); i++) {
+            if (state.livePools[i].pool == pool) {
+                state.livePools.erase(state.livePools.begin() + i);
+                break;
+            }
+        }
+        l.unlock();
+        delete pool;
+    }
+}
+
+inline int BeagleCPUThreadPool::getSharedThreadCount() {
+    CPUThreadPoolState& state = getCPUThreadPoolState();
+    std::unique_lock<std::mutex> l(state.m);
+
+    int threadCount = state.threadCount;
+    if (threadCount <= 0)
+        threadCount = std::thread::hardware_concurrency();
+    return (threadCount > 0 ? threadCount : 1);
+}
+
+inline void BeagleCPUThreadPool::repinWorkers(void* pool) {
+    BeagleCPUThreadPool* threadPool = static_cast<BeagleCPUThreadPool*>(pool);
+    const std::vector<int>& cpuIndices = getCPUThreadPoolState().cpuIndices;
+    for (int i = 0; i < threadPool->kWorkerCount; i++)
+        pinThread(threadPool->gWorkers[i], cpuIndices[i % cpuIndices.size()]);
+}
+
+inline bool BeagleCPUThreadPool::pinThread(std::thread& thread,
+                                           int cpuIndex) {
+    if (cpuIndex < 0)
+        return false;
+#if defined(__linux__)
+    if (cpuIndex >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpuIndex, &cpuSet);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet) == 0;
+#elif defined(_WIN32)
+    // Logical CPUs are numbered across processor groups of up to 64 processors each
+    WORD groupCount = GetActiveProcessorGroupCount();
+    DWORD first = 0;
+    for (WORD group = 0; group < groupCount; group++) {
+        DWORD groupSize = GetActiveProcessorCount(group);
+        if ((DWORD) cpuIndex < first + groupSize) {
+            DWORD bit = (DWORD) cpuIndex - first;
+            if (bit >= sizeof(KAFFINITY) * 8)
+                return false;
+            GROUP_AFFINITY affinity;
+            ZeroMemory(&affinity, sizeof(affinity));
+            affinity.Group = group;
+            affinity.Mask = ((KAFFINITY) 1) << bit;
+            return SetThreadGroupAffinity((HANDLE) thread.native_handle(), &affinity, NULL) != 0;
+        }
+        first += groupSize;
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUThreadPool__
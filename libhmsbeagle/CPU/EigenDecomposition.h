@@ -76,6 +76,16 @@ public:
                                  REALTYPE** transitionMatrices,
                                  int count) = 0;
 
+    // gets the eigenvectors (row-major, one column per eigenvalue), the inverse eigenvectors
+    // (row-major, one row per eigenvalue) and the eigenvalues for a decomposition. Returns
+    // false if the decomposition is not kept in this form or has complex eigenvalues.
+    virtual bool getEigenSystem(int /*eigenIndex*/,
+                                const REALTYPE** /*outEigenVectors*/,
+                                const REALTYPE** /*outInverseEigenVectors*/,
+                                const REALTYPE** /*outEigenValues*/) {
+        return false;
+    }
+
 };
 
 }
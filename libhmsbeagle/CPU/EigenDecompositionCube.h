@@ -27,6 +27,8 @@ class EigenDecompositionCube : public EigenDecomposition<BEAGLE_CPU_EIGEN_GENERI
 
 protected:
     REALTYPE** gCMatrices;
+    REALTYPE** gEMatrices; // kStateCount^2 flattened array
+    REALTYPE** gIMatrices; // kStateCount^2 flattened array, one row per eigenvalue
 
 public:
 	EigenDecompositionCube(int decompositionCount, 
@@ -49,6 +51,11 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual bool getEigenSystem(int eigenIndex,
+                                const REALTYPE** outEigenVectors,
+                                const REALTYPE** outInverseEigenVectors,
+                                const REALTYPE** outEigenValues);
 	
 };
 
@@ -36,11 +36,27 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::EigenDecompositionCube(int dec
     if (gCMatrices == NULL)
     	throw std::bad_alloc();
     
+    gEMatrices = (REALTYPE**) malloc(sizeof(REALTYPE*) * kEigenDecompCount);
+    if (gEMatrices == NULL)
+    	throw std::bad_alloc();
+
+    gIMatrices = (REALTYPE**) malloc(sizeof(REALTYPE*) * kEigenDecompCount);
+    if (gIMatrices == NULL)
+    	throw std::bad_alloc();
+
     for (int i = 0; i < kEigenDecompCount; i++) {    	
     	gCMatrices[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount * kStateCount * kStateCount);
     	if (gCMatrices[i] == NULL)
     		throw std::bad_alloc();
     
+    	gEMatrices[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount * kStateCount);
+    	if (gEMatrices[i] == NULL)
+    		throw std::bad_alloc();
+
+    	gIMatrices[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount * kStateCount);
+    	if (gIMatrices[i] == NULL)
+    		throw std::bad_alloc();
+
     	gEigenValues[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
     	if (gEigenValues[i] == NULL)
     		throw std::bad_alloc();
@@ -56,9 +72,13 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionCube() {
 	
 	for(int i=0; i<kEigenDecompCount; i++) {
 		free(gCMatrices[i]);
+		free(gEMatrices[i]);
+		free(gIMatrices[i]);
 		free(gEigenValues[i]);
 	}
 	free(gCMatrices);
+	free(gEMatrices);
+	free(gIMatrices);
 	free(gEigenValues);
 	free(matrixTmp);
 	free(firstDerivTmp);
@@ -81,6 +101,8 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int
                             * inInverseEigenVectors[(k * kStateCount) + j];
                     l++;
                 }
+                gEMatrices[eigenIndex][(i * kStateCount) + j] = inEigenVectors[(i * kStateCount) + j];
+                gIMatrices[eigenIndex][(i * kStateCount) + j] = inInverseEigenVectors[(i * kStateCount) + j];
             }
         }
     } else {
@@ -93,6 +115,8 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int
                     * inInverseEigenVectors[k + (j*kStateCount)];
                     l++;
                 }
+                gEMatrices[eigenIndex][(i * kStateCount) + j] = inEigenVectors[(i * kStateCount) + j];
+                gIMatrices[eigenIndex][(i * kStateCount) + j] = inInverseEigenVectors[i + (j * kStateCount)];
             }
         }
     }
@@ -252,6 +276,17 @@ if (T_PAD != 0) {
 	}
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::getEigenSystem(int eigenIndex,
+                                                                     const REALTYPE** outEigenVectors,
+                                                                     const REALTYPE** outInverseEigenVectors,
+                                                                     const REALTYPE** outEigenValues) {
+    *outEigenVectors = gEMatrices[eigenIndex];
+    *outInverseEigenVectors = gIMatrices[eigenIndex];
+    *outEigenValues = gEigenValues[eigenIndex];
+    return true;
+}
+
 } // cpu
 } // beagle
 
@@ -50,6 +50,11 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual bool getEigenSystem(int eigenIndex,
+                                const REALTYPE** outEigenVectors,
+                                const REALTYPE** outInverseEigenVectors,
+                                const REALTYPE** outEigenValues);
 };
 
 }
@@ -185,6 +185,24 @@ if (T_PAD != 0) {
     }
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::getEigenSystem(int eigenIndex,
+                                                                       const REALTYPE** outEigenVectors,
+                                                                       const REALTYPE** outInverseEigenVectors,
+                                                                       const REALTYPE** outEigenValues) {
+    if (isComplex) {
+        const REALTYPE* EvalImag = gEigenValues[eigenIndex] + kStateCount;
+        for (int i = 0; i < kStateCount; i++) {
+            if (EvalImag[i] != 0)
+                return false;
+        }
+    }
+    *outEigenVectors = gEMatrices[eigenIndex];
+    *outInverseEigenVectors = gIMatrices[eigenIndex];
+    *outEigenValues = gEigenValues[eigenIndex];
+    return true;
+}
+
 }
 }
 
@@ -56,6 +56,7 @@ typedef double VecEl_t;
 #	define VEC_STORE(a, b)		_mm_store_pd((a), (b))
 #   define VEC_STORE_SCALAR(a, b) _mm_store_sd((a), (b))
 #	define VEC_MULT(a, b)		_mm_mul_pd((a), (b))
+#	define VEC_MAX(a, b)		_mm_max_pd((a), (b))
 #	define VEC_DIV(a, b)		_mm_div_pd((a), (b))
 #	define VEC_MADD(a, b, c)	_mm_add_pd(_mm_mul_pd((a), (b)), (c))
 #	define VEC_SPLAT(a)			_mm_set1_pd(a)
@@ -81,21 +82,46 @@ typedef union 			/* for copying individual elements to and from vector floats */
 	}
 	VecUnion;
 
-#ifdef __GNUC__
-    #define cpuid(func,ax,bx,cx,dx)\
-            __asm__ __volatile__ ("cpuid":\
-            "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func));
-#endif
-
-#ifdef _WIN32
+/* Single-precision vectors, used by the float specializations */
+typedef __m128	V_Float;
+#	define FLOATS_PER_VEC			4	/* number of elements per vector */
+#	define VEC_F_LOAD(a)			_mm_load_ps(a)
+#	define VEC_F_STORE(a, b)		_mm_store_ps((a), (b))
+#	define VEC_F_MULT(a, b)		_mm_mul_ps((a), (b))
+#	define VEC_F_MAX(a, b)		_mm_max_ps((a), (b))
+#	define VEC_F_MADD(a, b, c)	_mm_add_ps(_mm_mul_ps((a), (b)), (c))
+#	define VEC_F_ADD(a, b)		_mm_add_ps(a, b)
+#	define VEC_F_AND(a, b)		_mm_and_ps(a, b)
+#	define VEC_F_SPLAT(a)			_mm_set1_ps(a)
+#	define VEC_F_SETZERO()		_mm_setzero_ps()
+#	define VEC_F_SET(a, b, c, d)	_mm_set_ps((a), (b), (c), (d))
+#	define VEC_F_TAIL_MASK(n)		_mm_castsi128_ps(_mm_set_epi32(0, (n) > 2 ? -1 : 0, (n) > 1 ? -1 : 0, (n) > 0 ? -1 : 0))
+#	define VEC_F_TO_D_LOW(a)		_mm_cvtps_pd(a)							/* lanes 0 and 1 */
+#	define VEC_F_TO_D_HIGH(a)		_mm_cvtps_pd(_mm_movehl_ps((a), (a)))	/* lanes 2 and 3 */
+#	define VEC_D_TO_F(lo, hi)		_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi))
 
+#ifdef _MSC_VER
+#include <intrin.h>
 #endif
 
-int CPUSupportsSSE() {
-    //int a,b,c,d;
-    //cpuid(0,a,b,c,d);
-    //fprintf(stderr,"a = %d\nb = %d\nc = %d\nd = %d\n",a,b,c,d);
+/*
+ * Returns 1 if the processor supports SSE2, the instruction set the SSE code is
+ * compiled for.
+ */
+inline int CPUSupportsSSE() {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] & (1 << 26)) != 0;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    unsigned int eax, ebx, ecx, edx;
+    __asm__ __volatile__ ("cpuid" :
+                          "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) :
+                          "a" (1), "c" (0));
+    return (edx & (1u << 26)) != 0;
+#else
     return 1;
+#endif
 }
 
 #endif // __SSEDefinitions__
@@ -238,6 +238,12 @@ public:
     int getPartials(int bufferIndex,
 				    int scaleIndex,
                     double* outPartials);
+
+    int allocatePartials(const int* bufferIndices,
+                         int count);
+
+    int releasePartials(const int* bufferIndices,
+                        int count);
         
     int setEigenDecomposition(int eigenIndex,
                               const double* inEigenVectors,
@@ -254,6 +260,20 @@ public:
 
     int setPatternPartitions(int partitionCount,
                              const int* inPatternPartitions);
+
+    int setCPUThreadCount(int threadCount);
+
+    int setCPUMinPatternsPerThread(int minPatternCount);
+
+    int setCPUTilePatternCount(int patternCount);
+
+    int setCPUSkipUnchangedOperations(int enabled);
+
+    int setCPUPackedTipStates(int enabled);
+
+    int setCPUBufferArena(int mode);
+
+    int setCPUMixedPrecision(int enabled);
     
     int setCategoryRates(const double* inCategoryRates);
 
@@ -302,6 +322,35 @@ public:
 
     int updatePartialsByPartition(const int* operations,
                                   int operationCount);
+
+    int createOperationPlan(int eigenIndex,
+                            const int* probabilityIndices,
+                            int matrixCount,
+                            const int* operations,
+                            int operationCount,
+                            int cumulativeScalingIndex,
+                            int rootBufferIndex,
+                            int categoryWeightsIndex,
+                            int stateFrequenciesIndex);
+
+    int updateWithOperationPlan(int planIndex,
+                                const double* edgeLengths,
+                                double* outSumLogLikelihood);
+
+    int finalizeOperationPlan(int planIndex);
+
+    int storeSnapshot();
+
+    int restoreSnapshot();
+
+    int releaseSnapshot();
+
+    int setRootPrePartials(const int* bufferIndices,
+                           const int* stateFrequenciesIndices,
+                           int count);
+
+    int updatePrePartials(const int* operations,
+                          int operationCount);
     
     int waitForPartials(const int* destinationPartials,
                         int destinationPartialsCount);
@@ -382,6 +431,50 @@ public:
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
 
+    int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                           const int* childBufferIndices,
+                                           const int* probabilityIndices,
+                                           const int* firstDerivativeIndices,
+                                           const int* secondDerivativeIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           int count,
+                                           double* outLogLikelihoods,
+                                           double* outFirstDerivatives,
+                                           double* outSecondDerivatives);
+
+    int calculateEdgeDerivatives(const int* postBufferIndices,
+                                 const int* preBufferIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 int categoryWeightsIndex,
+                                 int count,
+                                 double* outDerivatives);
+
+    int calculateCrossProducts(const int* postBufferIndices,
+                               const int* preBufferIndices,
+                               const int* probabilityIndices,
+                               const double* edgeLengths,
+                               int categoryWeightsIndex,
+                               int count,
+                               double* outCrossProducts);
+
+    int optimizeEdgeLength(int parentBufferIndex,
+                           int childBufferIndex,
+                           int eigenIndex,
+                           int categoryWeightsIndex,
+                           int stateFrequenciesIndex,
+                           int cumulativeScaleIndex,
+                           double minEdgeLength,
+                           double maxEdgeLength,
+                           double tolerance,
+                           int maxIterations,
+                           double* inOutEdgeLength,
+                           double* outLogLikelihood,
+                           double* outFirstDerivative,
+                           double* outSecondDerivative);
+
     int getSiteLogLikelihoods(double* outLogLikelihoods);
     
     int getSiteDerivatives(double* outFirstDerivatives,
@@ -975,6 +975,18 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getPartials(int bufferIndex,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::allocatePartials(const int* bufferIndices,
+                                                        int count) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::releasePartials(const int* bufferIndices,
+                                                       int count) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setEigenDecomposition(int eigenIndex,
                                          const double* inEigenVectors,
@@ -1392,6 +1404,41 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPatternPartitions(int partitionCount,
     return returnCode;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUThreadCount(int threadCount) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUMinPatternsPerThread(int minPatternCount) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUTilePatternCount(int patternCount) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUSkipUnchangedOperations(int enabled) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUPackedTipStates(int enabled) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUBufferArena(int mode) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUMixedPrecision(int enabled) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::reorderPatternsByPartition() {    
 #ifdef BEAGLE_DEBUG_FLOW
@@ -1922,6 +1969,59 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updatePartialsByPartition(const int* oper
     return returnCode;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::createOperationPlan(int eigenIndex,
+                                                           const int* probabilityIndices,
+                                                           int matrixCount,
+                                                           const int* operations,
+                                                           int operationCount,
+                                                           int cumulativeScalingIndex,
+                                                           int rootBufferIndex,
+                                                           int categoryWeightsIndex,
+                                                           int stateFrequenciesIndex) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updateWithOperationPlan(int planIndex,
+                                                               const double* edgeLengths,
+                                                               double* outSumLogLikelihood) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::finalizeOperationPlan(int planIndex) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::storeSnapshot() {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::restoreSnapshot() {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::releaseSnapshot() {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setRootPrePartials(const int* bufferIndices,
+                                                          const int* stateFrequenciesIndices,
+                                                          int count) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updatePrePartials(const int* operations,
+                                                         int operationCount) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
@@ -3564,6 +3664,63 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
 }
 
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                                          const int* childBufferIndices,
+                                                                          const int* probabilityIndices,
+                                                                          const int* firstDerivativeIndices,
+                                                                          const int* secondDerivativeIndices,
+                                                                          const int* categoryWeightsIndices,
+                                                                          const int* stateFrequenciesIndices,
+                                                                          const int* cumulativeScaleIndices,
+                                                                          int count,
+                                                                          double* outLogLikelihoods,
+                                                                          double* outFirstDerivatives,
+                                                                          double* outSecondDerivatives) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeDerivatives(const int* postBufferIndices,
+                                                                const int* preBufferIndices,
+                                                                const int* probabilityIndices,
+                                                                const int* firstDerivativeIndices,
+                                                                int categoryWeightsIndex,
+                                                                int count,
+                                                                double* outDerivatives) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateCrossProducts(const int* postBufferIndices,
+                                                              const int* preBufferIndices,
+                                                              const int* probabilityIndices,
+                                                              const double* edgeLengths,
+                                                              int categoryWeightsIndex,
+                                                              int count,
+                                                              double* outCrossProducts) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::optimizeEdgeLength(int parentBufferIndex,
+                                                          int childBufferIndex,
+                                                          int eigenIndex,
+                                                          int categoryWeightsIndex,
+                                                          int stateFrequenciesIndex,
+                                                          int cumulativeScaleIndex,
+                                                          double minEdgeLength,
+                                                          double maxEdgeLength,
+                                                          double tolerance,
+                                                          int maxIterations,
+                                                          double* inOutEdgeLength,
+                                                          double* outLogLikelihood,
+                                                          double* outFirstDerivative,
+                                                          double* outSecondDerivative) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
 
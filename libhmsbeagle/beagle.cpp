@@ -37,6 +37,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <exception>    // for exception, bad_exception
 #include <stdexcept>    // for std exception hierarchy
 #include <list>
@@ -48,6 +49,7 @@
 #include "libhmsbeagle/BeagleImpl.h"
 
 #include "libhmsbeagle/plugin/Plugin.h"
+#include "libhmsbeagle/BeagleCPUThreadPoolState.h"
 
 #define BEAGLE_VERSION  PACKAGE_VERSION
 #define BEAGLE_CITATION "Using BEAGLE library v" PACKAGE_VERSION " for accelerated, parallel likelihood evaluation\n\
@@ -82,6 +84,35 @@ double debugGetTime() {
 //@CHANGED make this a std::vector<BeagleImpl *> and use at to reference.
 std::vector<beagle::BeagleImpl*> *instances = NULL;
 
+// Scratch of buildTreeOperations, one per instance (same index as instances). It is
+// reserved for all buffers of the instance when the instance is created, so that
+// repeated beagleUpdateTree calls do not allocate.
+struct TreeBuilderScratch {
+    std::vector<int> children, postOrder, stack, levels, next;
+    std::vector<char> expanded, dirtyEdge, recompute;
+    std::vector<BeagleOperation> operations;
+    std::vector<int> levelOffsets, matrixIndices, scaleIndices;
+    std::vector<double> matrixEdgeLengths;
+
+    void reserve(int nodeCount) {
+        children.reserve(2 * nodeCount);
+        postOrder.reserve(nodeCount);
+        stack.reserve(nodeCount + 1);
+        levels.reserve(nodeCount);
+        next.reserve(nodeCount);
+        expanded.reserve(nodeCount);
+        dirtyEdge.reserve(nodeCount);
+        recompute.reserve(nodeCount);
+        operations.reserve(nodeCount);
+        levelOffsets.reserve(nodeCount + 1);
+        matrixIndices.reserve(nodeCount);
+        scaleIndices.reserve(nodeCount);
+        matrixEdgeLengths.reserve(nodeCount);
+    }
+};
+
+std::vector<TreeBuilderScratch*> *treeBuilders = NULL;
+
 /// returns an initialized instance or NULL if the index refers to an invalid instance
 namespace beagle {
 BeagleImpl* getBeagleInstance(int instanceIndex);
@@ -153,6 +184,17 @@ void beagleLoadPlugins(void) {
 		plugins->push_back(sseplug);
 	}catch(beagle::plugin::SharedLibraryException sle){}
 	
+	// Widest AVX variant first, so it is preferred among equally scored factories
+	try{
+		beagle::plugin::Plugin* avx512plug = pm.findPlugin("hmsbeagle-cpu-avx512");
+		plugins->push_back(avx512plug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
+	try{
+		beagle::plugin::Plugin* avx2plug = pm.findPlugin("hmsbeagle-cpu-avx2");
+		plugins->push_back(avx2plug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
 	try{
 		beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
 		plugins->push_back(avxplug);
@@ -217,6 +259,11 @@ void beagle_library_finalize(void) {
 	if (instances && loaded) {
 		delete instances;
 	}
+	if (treeBuilders && loaded) {
+		for (size_t i = 0; i < treeBuilders->size(); i++)
+			delete (*treeBuilders)[i];
+		delete treeBuilders;
+	}
 	loaded = 0;
 }
 
@@ -302,6 +349,38 @@ BeagleResourceList* beagleGetResourceList() {
     return rsrcList;
 }
 
+int beagleSetCPUThreadPoolSize(int threadCount) {
+    if (threadCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::setCPUThreadPoolThreadCount(threadCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+int beagleSetCPUThreadAffinity(const int* cpuIndices,
+                               int cpuCount) {
+    if (cpuCount < 0 || (cpuCount > 0 && cpuIndices == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int i = 0; i < cpuCount; i++) {
+        if (cpuIndices[i] < 0)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    if (!beagle::setCPUThreadPoolAffinity(cpuIndices, cpuCount))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    return BEAGLE_SUCCESS;
+}
+
+int beagleSetCPUThreadNUMANode(int node) {
+    std::vector<int> cpuIndices;
+    if (node < 0 || !beagle::getNUMANodeCPUs(node, cpuIndices))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    return beagleSetCPUThreadAffinity(&cpuIndices[0], (int) cpuIndices.size());
+}
+
 int scoreFlags(long flags1, long flags2) {
     int score = 0;
     int trait = 1;
@@ -332,6 +411,8 @@ int beagleCreateInstance(int tipCount,
     try {
         if (instances == NULL)
             instances = new std::vector<beagle::BeagleImpl*>;
+        if (treeBuilders == NULL)
+            treeBuilders = new std::vector<TreeBuilderScratch*>;
 
         if (rsrcList == NULL)
             beagleGetResourceList();
@@ -462,8 +543,12 @@ int beagleCreateInstance(int tipCount,
         delete possibleResourceImplementations;
         
         if (bestBeagle != NULL) {
+            TreeBuilderScratch* treeBuilder = new TreeBuilderScratch;
+            treeBuilder->reserve(tipCount + partialsBufferCount);
+
             int instance = instances->size();
             instances->push_back(bestBeagle);
+            treeBuilders->push_back(treeBuilder);
             
             int returnValue = bestBeagle->getInstanceDetails(returnInfo);
             if (returnValue == BEAGLE_SUCCESS) {
@@ -500,6 +585,8 @@ int beagleFinalizeInstance(int instance) {
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         delete beagleInstance;
         (*instances)[instance] = NULL;
+        delete (*treeBuilders)[instance];
+        (*treeBuilders)[instance] = NULL;
         return BEAGLE_SUCCESS;
     }
     catch (std::bad_alloc &) {
@@ -603,6 +690,48 @@ int beagleGetPartials(int instance, int bufferIndex, int scaleIndex, double* out
     }
 }
 
+int beagleAllocatePartials(int instance, const int* bufferIndices, int count) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->allocatePartials(bufferIndices, count);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleReleasePartials(int instance, const int* bufferIndices, int count) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->releasePartials(bufferIndices, count);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleSetEigenDecomposition(int instance,
                           int eigenIndex,
                           const double* inEigenVectors,
@@ -676,6 +805,105 @@ int beagleSetPatternPartitions(int instance,
     return returnValue;
 }
 
+int beagleSetCPUThreadCount(int instance,
+                            int threadCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUThreadCount(threadCount);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetCPUMinPatternsPerThread(int instance,
+                                     int minPatternCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUMinPatternsPerThread(minPatternCount);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetCPUTilePatternCount(int instance,
+                                 int patternCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUTilePatternCount(patternCount);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetCPUPackedTipStates(int instance,
+                                int enabled) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUPackedTipStates(enabled);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetCPUBufferArena(int instance,
+                            int mode) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUBufferArena(mode);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUMixedPrecision(int instance,
+                               int enabled) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUMixedPrecision(enabled);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUSkipUnchangedOperations(int instance,
+                                        int enabled) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUSkipUnchangedOperations(enabled);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleSetCategoryRates(int instance,
                      const double* inCategoryRates) {
     DEBUG_START_TIME();
@@ -879,6 +1107,330 @@ int beagleUpdatePartialsByPartition(const int instance,
     return returnValue;
 }
 
+int beagleCreateOperationPlan(int instance,
+                              int eigenIndex,
+                              const int* probabilityIndices,
+                              int matrixCount,
+                              const BeagleOperation* operations,
+                              int operationCount,
+                              int cumulativeScaleIndex,
+                              int rootBufferIndex,
+                              int categoryWeightsIndex,
+                              int stateFrequenciesIndex) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->createOperationPlan(eigenIndex, probabilityIndices, matrixCount,
+                                                         (const int*)operations, operationCount,
+                                                         cumulativeScaleIndex, rootBufferIndex,
+                                                         categoryWeightsIndex, stateFrequenciesIndex);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleUpdateWithOperationPlan(int instance,
+                                  int plan,
+                                  const double* edgeLengths,
+                                  double* outSumLogLikelihood) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->updateWithOperationPlan(plan, edgeLengths, outSumLogLikelihood);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleFinalizeOperationPlan(int instance,
+                                int plan) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->finalizeOperationPlan(plan);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleStoreSnapshot(int instance) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->storeSnapshot();
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleRestoreSnapshot(int instance) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->restoreSnapshot();
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleReleaseSnapshot(int instance) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->releaseSnapshot();
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+// Builds the level-ordered partials operations and the transition matrices to update for a
+// rooted binary tree given as a parent array, into scratch.operations, scratch.levelOffsets
+// and scratch.matrixIndices
+int buildTreeOperations(const int* parentIndices,
+                        int nodeCount,
+                        int tipCount,
+                        const int* dirtyNodes,
+                        int dirtyCount,
+                        bool scaling,
+                        TreeBuilderScratch& scratch) {
+    if (parentIndices == NULL || tipCount < 2 || nodeCount < tipCount || dirtyCount < 0 ||
+        (dirtyNodes == NULL && dirtyCount > 0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    std::vector<int>& children = scratch.children;
+    std::vector<int>& postOrder = scratch.postOrder;
+    std::vector<int>& stack = scratch.stack;
+    std::vector<int>& levels = scratch.levels;
+    std::vector<int>& next = scratch.next;
+    std::vector<char>& expanded = scratch.expanded;
+    std::vector<char>& dirtyEdge = scratch.dirtyEdge;
+    std::vector<char>& recompute = scratch.recompute;
+    std::vector<BeagleOperation>& operations = scratch.operations;
+    std::vector<int>& levelOffsets = scratch.levelOffsets;
+    std::vector<int>& matrixIndices = scratch.matrixIndices;
+
+    children.assign(2 * nodeCount, -1);
+    int root = -1;
+    for (int i = 0; i < nodeCount; i++) {
+        int parent = parentIndices[i];
+        if (parent < -1 || parent >= nodeCount || parent == i)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (parent == -1) {
+            if (root != -1)
+                return BEAGLE_ERROR_GENERAL;
+            root = i;
+        } else if (parent < tipCount) {
+            return BEAGLE_ERROR_GENERAL;
+        } else if (children[2 * parent] == -1) {
+            children[2 * parent] = i;
+        } else if (children[2 * parent + 1] == -1) {
+            children[2 * parent + 1] = i;
+        } else {
+            return BEAGLE_ERROR_GENERAL;
+        }
+    }
+    if (root < tipCount)
+        return BEAGLE_ERROR_GENERAL;
+    for (int i = tipCount; i < nodeCount; i++) {
+        if (children[2 * i + 1] == -1)
+            return BEAGLE_ERROR_GENERAL;
+    }
+
+    // Post-order traversal from the root; nodes left unvisited lie on a cycle
+    postOrder.clear();
+    stack.assign(1, root);
+    expanded.assign(nodeCount, 0);
+    while (!stack.empty()) {
+        int node = stack.back();
+        if (node < tipCount || expanded[node]) {
+            stack.pop_back();
+            postOrder.push_back(node);
+        } else {
+            expanded[node] = 1;
+            stack.push_back(children[2 * node + 1]);
+            stack.push_back(children[2 * node]);
+        }
+    }
+    if ((int) postOrder.size() != nodeCount)
+        return BEAGLE_ERROR_GENERAL;
+
+    dirtyEdge.assign(nodeCount, 0);
+    recompute.assign(nodeCount, 0);
+    for (int i = 0; i < (dirtyNodes == NULL ? nodeCount : dirtyCount); i++) {
+        int node = (dirtyNodes == NULL ? i : dirtyNodes[i]);
+        if (node < 0 || node >= nodeCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (node != root)
+            dirtyEdge[node] = 1;
+        for (int n = (node < tipCount ? parentIndices[node] : node);
+             n != -1 && !recompute[n]; n = parentIndices[n])
+            recompute[n] = 1;
+    }
+
+    matrixIndices.clear();
+    for (int i = 0; i < nodeCount; i++) {
+        if (dirtyEdge[i])
+            matrixIndices.push_back(i);
+    }
+
+    // A recomputed node sits one level above its highest recomputed child
+    levels.assign(nodeCount, -1);
+    int levelCount = 0;
+    for (int i = 0; i < nodeCount; i++) {
+        int node = postOrder[i];
+        if (recompute[node]) {
+            levels[node] = std::max(levels[children[2 * node]],
+                                    levels[children[2 * node + 1]]) + 1;
+            levelCount = std::max(levelCount, levels[node] + 1);
+        }
+    }
+
+    // Counting sort by level, stable with respect to the post-order
+    levelOffsets.assign(levelCount + 1, 0);
+    for (int i = 0; i < nodeCount; i++) {
+        if (levels[i] >= 0)
+            levelOffsets[levels[i] + 1]++;
+    }
+    for (int l = 0; l < levelCount; l++)
+        levelOffsets[l + 1] += levelOffsets[l];
+    operations.resize(levelOffsets[levelCount]);
+    next.assign(levelOffsets.begin(), levelOffsets.end() - 1);
+    for (int i = 0; i < nodeCount; i++) {
+        int node = postOrder[i];
+        if (levels[node] >= 0) {
+            BeagleOperation& op = operations[next[levels[node]]++];
+            op.destinationPartials = node;
+            op.destinationScaleWrite = (scaling ? node - tipCount : BEAGLE_OP_NONE);
+            op.destinationScaleRead = BEAGLE_OP_NONE;
+            op.child1Partials = children[2 * node];
+            op.child1TransitionMatrix = children[2 * node];
+            op.child2Partials = children[2 * node + 1];
+            op.child2TransitionMatrix = children[2 * node + 1];
+        }
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+int beagleGetTreeOperations(const int* parentIndices,
+                            int nodeCount,
+                            int tipCount,
+                            const int* dirtyNodes,
+                            int dirtyCount,
+                            int scaling,
+                            BeagleOperation* outOperations,
+                            int* outOperationCount,
+                            int* outLevelOffsets,
+                            int* outLevelCount,
+                            int* outMatrixIndices,
+                            int* outMatrixCount) {
+    if (outOperations == NULL || outOperationCount == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    TreeBuilderScratch scratch;
+    int returnValue = buildTreeOperations(parentIndices, nodeCount, tipCount, dirtyNodes,
+                                          dirtyCount, (scaling != 0), scratch);
+    if (returnValue != BEAGLE_SUCCESS)
+        return returnValue;
+
+    const std::vector<BeagleOperation>& operations = scratch.operations;
+    const std::vector<int>& levelOffsets = scratch.levelOffsets;
+    const std::vector<int>& matrixIndices = scratch.matrixIndices;
+
+    std::copy(operations.begin(), operations.end(), outOperations);
+    *outOperationCount = (int) operations.size();
+    if (outLevelOffsets != NULL)
+        std::copy(levelOffsets.begin(), levelOffsets.end(), outLevelOffsets);
+    if (outLevelCount != NULL)
+        *outLevelCount = (int) levelOffsets.size() - 1;
+    if (outMatrixIndices != NULL)
+        std::copy(matrixIndices.begin(), matrixIndices.end(), outMatrixIndices);
+    if (outMatrixCount != NULL)
+        *outMatrixCount = (int) matrixIndices.size();
+    return BEAGLE_SUCCESS;
+}
+
+int beagleUpdateTree(int instance,
+                     int eigenIndex,
+                     const int* parentIndices,
+                     const double* edgeLengths,
+                     int nodeCount,
+                     int tipCount,
+                     const int* dirtyNodes,
+                     int dirtyCount,
+                     int cumulativeScaleIndex) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    if (edgeLengths == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    bool scaling = (cumulativeScaleIndex != BEAGLE_OP_NONE);
+    TreeBuilderScratch& scratch = *(*treeBuilders)[instance];
+    const std::vector<BeagleOperation>& operations = scratch.operations;
+    const std::vector<int>& matrixIndices = scratch.matrixIndices;
+    std::vector<int>& scaleIndices = scratch.scaleIndices;
+    std::vector<double>& matrixEdgeLengths = scratch.matrixEdgeLengths;
+    int returnValue = buildTreeOperations(parentIndices, nodeCount, tipCount, dirtyNodes,
+                                          dirtyCount, scaling, scratch);
+
+    if (returnValue == BEAGLE_SUCCESS && !matrixIndices.empty()) {
+        matrixEdgeLengths.resize(matrixIndices.size());
+        for (size_t i = 0; i < matrixIndices.size(); i++)
+            matrixEdgeLengths[i] = edgeLengths[matrixIndices[i]];
+        returnValue = beagleInstance->updateTransitionMatrices(eigenIndex, &matrixIndices[0],
+                                                               NULL, NULL, &matrixEdgeLengths[0],
+                                                               (int) matrixIndices.size());
+    }
+
+    if (returnValue == BEAGLE_SUCCESS && scaling) {
+        if (dirtyNodes == NULL) {
+            returnValue = beagleInstance->resetScaleFactors(cumulativeScaleIndex);
+        } else if (!operations.empty()) {
+            scaleIndices.resize(operations.size());
+            for (size_t i = 0; i < operations.size(); i++)
+                scaleIndices[i] = operations[i].destinationScaleWrite;
+            returnValue = beagleInstance->removeScaleFactors(&scaleIndices[0],
+                                                             (int) scaleIndices.size(),
+                                                             cumulativeScaleIndex);
+        }
+    }
+
+    if (returnValue == BEAGLE_SUCCESS && !operations.empty())
+        returnValue = beagleInstance->updatePartials((const int*) &operations[0],
+                                                     (int) operations.size(),
+                                                     (scaling ? cumulativeScaleIndex :
+                                                                BEAGLE_OP_NONE));
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetRootPrePartials(int instance,
+                             const int* bufferIndices,
+                             const int* stateFrequenciesIndices,
+                             int count) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setRootPrePartials(bufferIndices, stateFrequenciesIndices,
+                                                         count);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleUpdatePrePartials(int instance,
+                            const BeagleOperation* operations,
+                            int operationCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->updatePrePartials((const int*) operations, operationCount);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleWaitForPartials(const int instance,
                     const int* destinationPartials,
                     int destinationPartialsCount) {
@@ -1260,6 +1812,110 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
 //    }
 }
 
+int beagleCalculateEdgeLogLikelihoodsPerEdge(int instance,
+                                            const int* parentBufferIndices,
+                                            const int* childBufferIndices,
+                                            const int* probabilityIndices,
+                                            const int* firstDerivativeIndices,
+                                            const int* secondDerivativeIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* cumulativeScaleIndices,
+                                            int count,
+                                            double* outLogLikelihoods,
+                                            double* outFirstDerivatives,
+                                            double* outSecondDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateEdgeLogLikelihoodsPerEdge(parentBufferIndices,
+                                                                         childBufferIndices,
+                                                                         probabilityIndices,
+                                                                         firstDerivativeIndices,
+                                                                         secondDerivativeIndices,
+                                                                         categoryWeightsIndices,
+                                                                         stateFrequenciesIndices,
+                                                                         cumulativeScaleIndices,
+                                                                         count,
+                                                                         outLogLikelihoods,
+                                                                         outFirstDerivatives,
+                                                                         outSecondDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleCalculateEdgeDerivatives(int instance,
+                                   const int* postBufferIndices,
+                                   const int* preBufferIndices,
+                                   const int* probabilityIndices,
+                                   const int* firstDerivativeIndices,
+                                   int categoryWeightsIndex,
+                                   int count,
+                                   double* outDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateEdgeDerivatives(postBufferIndices, preBufferIndices,
+                                                               probabilityIndices,
+                                                               firstDerivativeIndices,
+                                                               categoryWeightsIndex, count,
+                                                               outDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleCalculateCrossProducts(int instance,
+                                 const int* postBufferIndices,
+                                 const int* preBufferIndices,
+                                 const int* probabilityIndices,
+                                 const double* edgeLengths,
+                                 int categoryWeightsIndex,
+                                 int count,
+                                 double* outCrossProducts) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateCrossProducts(postBufferIndices, preBufferIndices,
+                                                             probabilityIndices, edgeLengths,
+                                                             categoryWeightsIndex, count,
+                                                             outCrossProducts);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleOptimizeEdgeLength(int instance,
+                             int parentBufferIndex,
+                             int childBufferIndex,
+                             int eigenIndex,
+                             int categoryWeightsIndex,
+                             int stateFrequenciesIndex,
+                             int cumulativeScaleIndex,
+                             double minEdgeLength,
+                             double maxEdgeLength,
+                             double tolerance,
+                             int maxIterations,
+                             double* inOutEdgeLength,
+                             double* outLogLikelihood,
+                             double* outFirstDerivative,
+                             double* outSecondDerivative) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->optimizeEdgeLength(parentBufferIndex, childBufferIndex,
+                                                         eigenIndex, categoryWeightsIndex,
+                                                         stateFrequenciesIndex, cumulativeScaleIndex,
+                                                         minEdgeLength, maxEdgeLength, tolerance,
+                                                         maxIterations, inOutEdgeLength,
+                                                         outLogLikelihood, outFirstDerivative,
+                                                         outSecondDerivative);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleGetSiteLogLikelihoods(int instance,
                                 double* outLogLikelihoods) {
     DEBUG_START_TIME();
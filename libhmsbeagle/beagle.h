@@ -264,6 +264,49 @@ BEAGLE_DLLEXPORT const char* beagleGetCitation(void);
  */
 BEAGLE_DLLEXPORT BeagleResourceList* beagleGetResourceList(void);
 
+/**
+ * @brief Set the size of the CPU thread pool
+ *
+ * All CPU instances in a process that use BEAGLE_FLAG_THREADING_CPP share one pool
+ * of worker threads. This function sets the number of threads working on an instance's
+ * computations, including the calling thread; the default is the number of hardware
+ * threads. Instances already created keep using the previous pool, so this should be
+ * called before creating instances.
+ *
+ * @param threadCount   Number of threads (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadPoolSize(int threadCount);
+
+/**
+ * @brief Pin CPU worker threads to logical CPUs
+ *
+ * This function binds the worker threads of the shared CPU thread pool round-robin to
+ * the given logical CPUs; passing no CPUs removes the binding for threads created later.
+ * The calling thread is not pinned. On Windows, logical CPUs are numbered across processor
+ * groups, in group order. Workers assigned to a CPU that does not exist are not pinned.
+ *
+ * @param cpuIndices    Array containing cpuCount logical CPU indices (input)
+ * @param cpuCount      Number of logical CPUs (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadAffinity(const int* cpuIndices,
+                                                int cpuCount);
+
+/**
+ * @brief Pin CPU worker threads to a NUMA node
+ *
+ * This function binds the worker threads of the shared CPU thread pool to the logical
+ * CPUs of a NUMA node, as with beagleSetCPUThreadAffinity.
+ *
+ * @param node  NUMA node index (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadNUMANode(int node);
+
 /**
  * @brief Create a single instance
  *
@@ -401,6 +444,41 @@ BEAGLE_DLLEXPORT int beagleGetPartials(int instance,
                       int scaleIndex,
                       double* outPartials);
 
+/**
+ * @brief Allocate partials buffers ahead of their first write
+ *
+ * CPU instances allocate the memory of a partials buffer when it is first written. This function
+ * allocates the listed buffers right away and fills new ones with zeros, so that their pages are
+ * faulted in before timing-sensitive computation. The contents of buffers already allocated are
+ * left unchanged.
+ *
+ * @param instance      Instance number (input)
+ * @param bufferIndices List of indices of partialsBuffers to allocate (input)
+ * @param count         Number of partialsBuffers to allocate (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleAllocatePartials(int instance,
+                                            const int* bufferIndices,
+                                            int count);
+
+/**
+ * @brief Release the memory of partials buffers
+ *
+ * This function frees the memory of the listed partials buffers on CPU instances. The contents of a
+ * released buffer are lost; it is allocated again when next written, and reading it before then is
+ * an error.
+ *
+ * @param instance      Instance number (input)
+ * @param bufferIndices List of indices of partialsBuffers to release (input)
+ * @param count         Number of partialsBuffers to release (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleReleasePartials(int instance,
+                                           const int* bufferIndices,
+                                           int count);
+
 /**
  * @brief Set an eigen-decomposition buffer
  *
@@ -508,6 +586,142 @@ BEAGLE_DLLEXPORT int beagleSetPatternPartitions(int instance,
                                                 int partitionCount,
                                                 const int* inPatternPartitions);
 
+/**
+ * @brief Set the number of CPU threads for an instance
+ *
+ * This function sets the maximum number of threads, including the calling thread, that
+ * work on an instance created with BEAGLE_FLAG_THREADING_CPP. The count is limited by the
+ * size of the shared thread pool (see beagleSetCPUThreadPoolSize) and by the minimum
+ * number of patterns per thread. Automatic pattern partitions are recomputed.
+ *
+ * @param instance      Instance number (input)
+ * @param threadCount   Number of threads (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadCount(int instance,
+                                             int threadCount);
+
+/**
+ * @brief Set the minimum number of patterns per CPU thread for an instance
+ *
+ * This function sets the smallest number of patterns given to each thread of an instance
+ * created with BEAGLE_FLAG_THREADING_CPP; instances with fewer than twice this many
+ * patterns are not threaded. The default is 128. Automatic pattern partitions are
+ * recomputed.
+ *
+ * @param instance          Instance number (input)
+ * @param minPatternCount   Minimum number of patterns per thread (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUMinPatternsPerThread(int instance,
+                                                      int minPatternCount);
+
+/**
+ * @brief Set the number of patterns per tile for CPU partials updates
+ *
+ * This function makes beagleUpdatePartials and beagleUpdatePartialsByPartition run the
+ * whole list of operations over one block of patternCount patterns before moving on to
+ * the next block, so that child partials are still in cache when their parent is
+ * computed. Results do not change. Zero, the default, computes each operation over all
+ * patterns in turn. Not available with BEAGLE_FLAG_SCALING_AUTO, BEAGLE_FLAG_SCALING_ALWAYS
+ * or BEAGLE_FLAG_SCALING_DYNAMIC.
+ *
+ * @param instance      Instance number (input)
+ * @param patternCount  Number of patterns per tile, or 0 (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUTilePatternCount(int instance,
+                                                  int patternCount);
+
+/**
+ * @brief Skip CPU partials operations whose inputs have not changed
+ *
+ * This function makes the library record, for each partials buffer, the operation that last
+ * computed it and the versions of its inputs. Setting tip data, partials, transition matrices
+ * or scale factors gives those buffers new versions. beagleUpdatePartials then skips every
+ * operation that would recompute a buffer from the same inputs, so after a change to a single
+ * edge only the operations on the path to the root are computed. Results do not change.
+ *
+ * Operations that write scale factors are always computed when a cumulative scale index is
+ * passed to beagleUpdatePartials. Operations of beagleUpdatePartialsByPartition are never
+ * skipped. Not available with BEAGLE_FLAG_SCALING_AUTO, BEAGLE_FLAG_SCALING_ALWAYS or
+ * BEAGLE_FLAG_SCALING_DYNAMIC.
+ *
+ * @param instance  Instance number (input)
+ * @param enabled   Non-zero to skip unchanged operations, zero (the default) to compute all
+ *                   operations (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUSkipUnchangedOperations(int instance,
+                                                         int enabled);
+
+/**
+ * @brief Store compact tip states two bits per pattern
+ *
+ * This function makes a 4-state CPU instance keep the states set by beagleSetTipStates in two
+ * bits per pattern, with the patterns that have missing data listed separately. Tip states
+ * then take a quarter of their usual memory. Kernels decode the patterns they work on as
+ * they go. Results do not change. Tips that were already set are converted. Only available
+ * for instances with 4 states.
+ *
+ * @param instance  Instance number (input)
+ * @param enabled   Non-zero to pack tip states, zero (the default) to store one byte per
+ *                   pattern (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUPackedTipStates(int instance,
+                                                 int enabled);
+
+/**
+ * @brief Keep buffers in a single memory arena
+ *
+ * By default a CPU instance takes its partials, transition matrix and scale buffers from one
+ * contiguous block of memory. Large blocks are advised to use transparent huge pages, so that
+ * fewer TLB entries cover the working set. Mode 2 takes the block from the hugetlbfs pool
+ * instead; those pages are reserved by the administrator and shared with the rest of the
+ * system, so this is never the default. If too few huge pages are reserved the buffers stay
+ * in an arena of normal pages and BEAGLE_ERROR_OUT_OF_MEMORY is returned. Pages of the block
+ * are only backed once a buffer is written. This function moves the buffers between the
+ * arena and separate heap allocations, e.g. to compare the two. Results do not change.
+ *
+ * @param instance  Instance number (input)
+ * @param mode      0 for separate allocations, 1 (the default) for the arena, 2 for the arena
+ *                   from the hugetlbfs pool (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUBufferArena(int instance,
+                                             int mode);
+
+/**
+ * @brief Accumulate a single precision instance in double precision
+ *
+ * Partials, transition matrices and scale factors of a single precision CPU instance stay in
+ * single precision, but transition matrices are computed, matrix-partials products summed,
+ * cumulative scale factors kept and site log likelihoods summed in double precision. Root
+ * and edge log likelihoods then come close to those of a double precision instance, at close
+ * to single precision speed. This includes log likelihoods summed over several subsets or
+ * with derivatives. Matrices are only computed in double precision from eigen decompositions
+ * set after mixed precision is enabled. Enabling it widens every scale buffer to hold the
+ * low-order parts of cumulative scale factors, which doubles the memory of scale buffers;
+ * they hold one value per pattern, against stateCount * categoryCount for partials buffers.
+ * Not available for 4-state instances, whose kernels have no double-accumulating variants,
+ * or for double precision instances.
+ *
+ * @param instance  Instance number (input)
+ * @param enabled   Non-zero to accumulate in double precision, zero (the default) for
+ *                   single precision throughout (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUMixedPrecision(int instance,
+                                                int enabled);
+
 /**
  * @brief Set partitions by pattern weight
  *
@@ -728,6 +942,255 @@ BEAGLE_DLLEXPORT int beagleUpdatePartialsByPartition(const int instance,
                                                      const BeagleOperationByPartition* operations,
                                                      int operationCount);
 
+/**
+ * @brief Create an operation plan
+ *
+ * This function decodes a list of partials operations, together with optional transition
+ * matrix updates and root integration, into a plan that can be run many times with
+ * beagleUpdateWithOperationPlan. Running a plan gives the same results as calling
+ * beagleUpdateTransitionMatrices, beagleUpdatePartials and beagleCalculateRootLogLikelihoods
+ * in turn, but buffers and kernels are looked up only once, when the plan is created.
+ *
+ * Tip data must be set before the plan is created, and a plan must be created again if a
+ * tip changes between compact states and partials. Plans are not available with
+ * BEAGLE_FLAG_SCALING_AUTO, BEAGLE_FLAG_SCALING_ALWAYS or BEAGLE_FLAG_SCALING_DYNAMIC.
+ *
+ * @param instance                  Instance number (input)
+ * @param eigenIndex                Index of eigen-decomposition buffer for matrix updates (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param matrixCount               Length of probabilityIndices, 0 for no matrix updates (input)
+ * @param operations                BeagleOperation list specifying operations (input)
+ * @param operationCount            Number of operations (input)
+ * @param cumulativeScaleIndex      Index number of scaleBuffer to store accumulated factors, also
+ *                                   used for root integration (input)
+ * @param rootBufferIndex           Index of root partials buffer, BEAGLE_OP_NONE for no root
+ *                                   integration (input)
+ * @param categoryWeightsIndex      Index of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndex     Index of state frequencies for each partialsBuffer (input)
+ *
+ * @return plan index (>= 0) or error code (< 0)
+ */
+BEAGLE_DLLEXPORT int beagleCreateOperationPlan(int instance,
+                                               int eigenIndex,
+                                               const int* probabilityIndices,
+                                               int matrixCount,
+                                               const BeagleOperation* operations,
+                                               int operationCount,
+                                               int cumulativeScaleIndex,
+                                               int rootBufferIndex,
+                                               int categoryWeightsIndex,
+                                               int stateFrequenciesIndex);
+
+/**
+ * @brief Run an operation plan
+ *
+ * This function updates the transition matrices of the plan for the given edge lengths,
+ * then calculates its partials operations and integrates the root partials.
+ *
+ * @param instance              Instance number (input)
+ * @param plan                  Plan index (input)
+ * @param edgeLengths           List of edge lengths, one per matrix of the plan, or NULL to keep
+ *                               the current matrices (input)
+ * @param outSumLogLikelihood   Pointer to destination for resulting log likelihood, or NULL to
+ *                               skip root integration (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateWithOperationPlan(int instance,
+                                                   int plan,
+                                                   const double* edgeLengths,
+                                                   double* outSumLogLikelihood);
+
+/**
+ * @brief Finalize an operation plan
+ *
+ * This function releases a plan created with beagleCreateOperationPlan. Plans are also
+ * released with their instance.
+ *
+ * @param instance  Instance number (input)
+ * @param plan      Plan index (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleFinalizeOperationPlan(int instance,
+                                                 int plan);
+
+/**
+ * @brief Store a restore point
+ *
+ * This function marks the current contents of all partials, transition matrix and scale
+ * buffers (including cumulative scale buffers) as a restore point, for instance before an
+ * MCMC proposal. A buffer written afterwards keeps its contents at the restore point in a
+ * spare buffer, which is swapped in rather than copied when the whole buffer is overwritten.
+ * Storing a new restore point discards the previous one, as on acceptance of a proposal.
+ * Compact tip states are not saved, and setting pattern partitions releases the restore
+ * point. Not available with BEAGLE_FLAG_SCALING_AUTO, BEAGLE_FLAG_SCALING_ALWAYS or
+ * BEAGLE_FLAG_SCALING_DYNAMIC.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleStoreSnapshot(int instance);
+
+/**
+ * @brief Revert to the restore point
+ *
+ * This function reverts every buffer written since beagleStoreSnapshot to its contents at
+ * that point, for instance on rejection of an MCMC proposal. The restore point is kept, so
+ * the instance can be reverted to it again.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRestoreSnapshot(int instance);
+
+/**
+ * @brief Release the restore point
+ *
+ * This function keeps the current buffer contents, stops saving buffers on writes and frees
+ * the memory held for restore points.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleReleaseSnapshot(int instance);
+
+/**
+ * @brief Build the operations for a tree given as a parent array
+ *
+ * This function builds the minimal set of transition matrix updates and partials operations
+ * needed to bring a rooted binary tree up to date after the nodes in dirtyNodes have changed.
+ * Node i of the tree uses partials buffer i, the transition matrix for the edge above node i
+ * is matrix i and, when scaling is requested, internal node i writes scale buffer
+ * i - tipCount. Nodes 0 to tipCount-1 are the tips and the root has parent -1.
+ *
+ * A dirty node has the matrix of the edge above it updated and the partials of all its
+ * internal ancestors (and its own, if internal) recalculated. Operations are returned grouped
+ * by level: the operations of a level only read partials written by lower levels, so they
+ * are independent of each other and may be computed in any order or concurrently. Passing
+ * the whole list to beagleUpdatePartials computes the tree in a valid order.
+ *
+ * @param parentIndices         Parent node index of each node, -1 for the root (input)
+ * @param nodeCount             Number of nodes in the tree (input)
+ * @param tipCount              Number of tips in the tree (input)
+ * @param dirtyNodes            List of changed nodes, or NULL for all nodes (input)
+ * @param dirtyCount            Number of changed nodes (input)
+ * @param scaling               Non-zero to write scale factors for each operation (input)
+ * @param outOperations         Destination for nodeCount-tipCount operations at most (output)
+ * @param outOperationCount     Pointer to destination for number of operations (output)
+ * @param outLevelOffsets       Destination for the start of each level in outOperations,
+ *                               followed by the operation count, or NULL (output)
+ * @param outLevelCount         Pointer to destination for number of levels, or NULL (output)
+ * @param outMatrixIndices      Destination for indices of transition matrices to update,
+ *                               nodeCount-1 at most, or NULL (output)
+ * @param outMatrixCount        Pointer to destination for number of matrices, or NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGetTreeOperations(const int* parentIndices,
+                                             int nodeCount,
+                                             int tipCount,
+                                             const int* dirtyNodes,
+                                             int dirtyCount,
+                                             int scaling,
+                                             BeagleOperation* outOperations,
+                                             int* outOperationCount,
+                                             int* outLevelOffsets,
+                                             int* outLevelCount,
+                                             int* outMatrixIndices,
+                                             int* outMatrixCount);
+
+/**
+ * @brief Update a tree given as a parent array
+ *
+ * This function builds the operations for a tree as beagleGetTreeOperations does and
+ * computes them: the transition matrices of the dirty edges are updated and the partials of
+ * the dirty nodes and their ancestors are recalculated.
+ *
+ * If cumulativeScaleIndex is not BEAGLE_OP_NONE, each recalculated node writes scale buffer
+ * (node - tipCount) and the cumulative scale buffer is kept up to date: it is reset when
+ * dirtyNodes is NULL, otherwise the old factors of the recalculated nodes are removed
+ * before their new factors are accumulated.
+ *
+ * @param instance              Instance number (input)
+ * @param eigenIndex            Index of eigen-decomposition buffer (input)
+ * @param parentIndices         Parent node index of each node, -1 for the root (input)
+ * @param edgeLengths           Length of the edge above each node, indexed by node (input)
+ * @param nodeCount             Number of nodes in the tree (input)
+ * @param tipCount              Number of tips in the tree (input)
+ * @param dirtyNodes            List of changed nodes, or NULL for all nodes (input)
+ * @param dirtyCount            Number of changed nodes (input)
+ * @param cumulativeScaleIndex  Index number of scaleBuffer to store accumulated factors (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTree(int instance,
+                                      int eigenIndex,
+                                      const int* parentIndices,
+                                      const double* edgeLengths,
+                                      int nodeCount,
+                                      int tipCount,
+                                      const int* dirtyNodes,
+                                      int dirtyCount,
+                                      int cumulativeScaleIndex);
+
+/**
+ * @brief Set the pre-order partials at the root
+ *
+ * This function fills each pre-order partials buffer in bufferIndices with the state
+ * frequencies in the matching entry of stateFrequenciesIndices, for every pattern and rate
+ * category. These are the pre-order partials of the root for beagleUpdatePrePartials.
+ *
+ * @param instance                  Instance number (input)
+ * @param bufferIndices             List of indices of pre-order partialsBuffers (input)
+ * @param stateFrequenciesIndices   List of state frequencies for each buffer (input)
+ * @param count                     Number of buffers (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetRootPrePartials(int instance,
+                                              const int* bufferIndices,
+                                              const int* stateFrequenciesIndices,
+                                              int count);
+
+/**
+ * @brief Calculate or queue for calculation pre-order partials using a list of operations
+ *
+ * Pre-order partials hold the likelihood of the data outside the subtree of a node. The
+ * pre-order partials of a node are taken at the top of the edge above it: for node c with
+ * parent p and sibling s,
+ *
+ *     pre(c)[j] = (sum_i pre(p)[i] P_p[i][j]) * (sum_k P_s[j][k] post(s)[k])
+ *
+ * where post(s) are the post-order partials of s computed by beagleUpdatePartials and P_p,
+ * P_s the transition matrices of the edges above p and s. At the root's children, P_p is
+ * the identity. The likelihood of each pattern is then sum_j pre(c)[j] (P_c post(c))[j] on
+ * every edge, which beagleCalculateEdgeDerivatives differentiates.
+ *
+ * Each operation reuses the BeagleOperation fields as follows: destinationPartials is the
+ * pre-order partials buffer of c, child1Partials and child1TransitionMatrix are the pre-order
+ * partials of p and the matrix of the edge above p (BEAGLE_OP_NONE at the root's children),
+ * child2Partials and child2TransitionMatrix are the post-order partials of s (a partials or
+ * compact tip buffer) and the matrix of the edge above s. If destinationScaleWrite is not
+ * BEAGLE_OP_NONE, the pre-order partials are rescaled and the factors written there;
+ * destinationScaleRead is ignored. Operations are computed in order, so a parent must come
+ * before its children. Not available with BEAGLE_FLAG_SCALING_AUTO,
+ * BEAGLE_FLAG_SCALING_ALWAYS or BEAGLE_FLAG_SCALING_DYNAMIC.
+ *
+ * @param instance          Instance number (input)
+ * @param operations        BeagleOperation list specifying pre-order operations (input)
+ * @param operationCount    Number of operations (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdatePrePartials(int instance,
+                                             const BeagleOperation* operations,
+                                             int operationCount);
+
 /**
  * @brief Block until all calculations that write to the specified partials have completed.
  *
@@ -979,6 +1442,48 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoods(int instance,
                                       double* outSumFirstDerivative,
                                       double* outSumSecondDerivative);
 
+/**
+ * @brief Calculate log likelihoods and derivatives along each of several edges
+ *
+ * This function integrates count independent edges, each between a parent and a child
+ * partialsBuffer, and returns the log likelihood and derivative sums of every edge
+ * separately: those of edge i are written to element i of the output arrays. All edges are
+ * computed in one pass over the thread pool. Second derivatives are optional, first
+ * derivatives are not. Auto and always scaling are not supported.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndices       List of indices of parent partialsBuffers (input)
+ * @param childBufferIndices        List of indices of child partialsBuffers (input)
+ * @param probabilityIndices        List indices of transition probability matrices for each
+ *                                   edge (input)
+ * @param firstDerivativeIndices    List indices of first derivative matrices (input)
+ * @param secondDerivativeIndices   List indices of second derivative matrices, or NULL (input)
+ * @param categoryWeightsIndices    List of weights to apply to each edge (input)
+ * @param stateFrequenciesIndices   List of state frequencies for each edge (input)
+ * @param cumulativeScaleIndices    List of scaleBuffers containing accumulated factors to apply to
+ *                                   each edge, or BEAGLE_OP_NONE (input)
+ * @param count                     Number of edges (input)
+ * @param outLogLikelihoods         Pointer to destination for the count log likelihoods (output)
+ * @param outFirstDerivatives       Pointer to destination for the count first derivatives (output)
+ * @param outSecondDerivatives      Pointer to destination for the count second derivatives, or
+ *                                   NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsPerEdge(int instance,
+                                                             const int* parentBufferIndices,
+                                                             const int* childBufferIndices,
+                                                             const int* probabilityIndices,
+                                                             const int* firstDerivativeIndices,
+                                                             const int* secondDerivativeIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count,
+                                                             double* outLogLikelihoods,
+                                                             double* outFirstDerivatives,
+                                                             double* outSecondDerivatives);
+
 /**
  * @brief Calculate multiple site log likelihoods and derivatives along an edge with 
  *         per partition buffers
@@ -1034,6 +1539,141 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsByPartition(
                                                     double* outSumSecondDerivativeByPartition,
                                                     double* outSumSecondDerivative);
 
+/**
+ * @brief Calculate the first derivative of the log likelihood for a list of edges
+ *
+ * This function returns, for each edge, the derivative of the log likelihood with respect
+ * to the length of that edge, summed over patterns with the pattern weights. Each edge is
+ * given by the post-order partials at its bottom, the pre-order partials computed for it by
+ * beagleUpdatePrePartials, its transition matrix and the first derivative matrix of it,
+ * as computed by beagleUpdateTransitionMatrices. Each edge costs one pass over its partials,
+ * so the gradient over all edges of a tree takes linear time.
+ *
+ * The derivative of each pattern is taken relative to the likelihood integrated on the same
+ * edge, so scale factors of the post-order and pre-order partials cancel out and no
+ * cumulative scale buffer is needed.
+ *
+ * @param instance                  Instance number (input)
+ * @param postBufferIndices         List of indices of post-order partials or compact tip
+ *                                   buffers at the bottom of each edge (input)
+ * @param preBufferIndices          List of indices of pre-order partialsBuffers for each
+ *                                   edge (input)
+ * @param probabilityIndices        List of indices of transition probability matrices for
+ *                                   each edge (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices for each
+ *                                   edge (input)
+ * @param categoryWeightsIndex      Index of weights to apply to the rate categories (input)
+ * @param count                     Number of edges (input)
+ * @param outDerivatives            Destination for count resulting first derivatives (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeDerivatives(int instance,
+                                                    const int* postBufferIndices,
+                                                    const int* preBufferIndices,
+                                                    const int* probabilityIndices,
+                                                    const int* firstDerivativeIndices,
+                                                    int categoryWeightsIndex,
+                                                    int count,
+                                                    double* outDerivatives);
+
+/**
+ * @brief Calculate cross products of pre-order and post-order partials over a list of edges
+ *
+ * This function accumulates, for each rate category c, the stateCount x stateCount matrix
+ *
+ *     out[c][i][j] = sum_e t_e sum_k w_k W_c pre(e,c,k)[i] post(e,c,k)[j] / L(e,k)
+ *
+ * over the edges e and patterns k, where t_e is the edge length, w_k the pattern weight, W_c
+ * the category weight, post the post-order partials at the bottom of the edge, pre the
+ * pre-order partials computed by beagleUpdatePrePartials carried down the edge and L(e,k)
+ * the likelihood of pattern k integrated on the edge. Scale factors cancel out as in
+ * beagleCalculateEdgeDerivatives.
+ *
+ * For a parameter theta of the rate matrix Q, sum_c r_c sum_ij out[c][i][j] dQ[i][j]/dtheta
+ * with category rates r_c approximates d logL / d theta from a single pass over the tree. It
+ * is exact when dQ/dtheta commutes with Q, as for the overall rate.
+ *
+ * @param instance                  Instance number (input)
+ * @param postBufferIndices         List of indices of post-order partials or compact tip
+ *                                   buffers at the bottom of each edge (input)
+ * @param preBufferIndices          List of indices of pre-order partialsBuffers for each
+ *                                   edge (input)
+ * @param probabilityIndices        List of indices of transition probability matrices for
+ *                                   each edge (input)
+ * @param edgeLengths               List of edge lengths (input)
+ * @param categoryWeightsIndex      Index of weights to apply to the rate categories (input)
+ * @param count                     Number of edges (input)
+ * @param outCrossProducts          Destination for categoryCount x stateCount x stateCount
+ *                                   resulting sums (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateCrossProducts(int instance,
+                                                  const int* postBufferIndices,
+                                                  const int* preBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const double* edgeLengths,
+                                                  int categoryWeightsIndex,
+                                                  int count,
+                                                  double* outCrossProducts);
+
+/**
+ * @brief Optimize the length of one edge by Newton-Raphson
+ *
+ * This function maximizes the log likelihood integrated on the edge between a parent and a
+ * child buffer over the length of that edge, as beagleCalculateEdgeLogLikelihoods would
+ * compute it from transition matrices updated with the category rates of index eigenIndex
+ * (beagleSetCategoryRatesWithIndex), or those set by beagleSetCategoryRates if that index was
+ * never set. The partials at both ends are projected once onto the eigenvectors
+ * of the eigen decomposition; each iteration then takes categoryCount x stateCount
+ * exponentials and one pass over patterns of the same length, instead of updating transition
+ * matrices and integrating stateCount x stateCount terms per pattern. Newton steps that leave
+ * the bracket around the optimum, or are taken where the log likelihood is not concave, are
+ * replaced by bisection. No transition matrix is written: call beagleUpdateTransitionMatrices
+ * with the returned edge length to use it.
+ *
+ * The decomposition must have real eigenvalues. Scale factors do not depend on the edge
+ * length and are only added to the returned log likelihood.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndex         Index of parent partialsBuffer (input)
+ * @param childBufferIndex          Index of child partialsBuffer or compact tip buffer (input)
+ * @param eigenIndex                Index of eigen-decomposition buffer (input)
+ * @param categoryWeightsIndex      Index of weights to apply to the rate categories (input)
+ * @param stateFrequenciesIndex     Index of state frequencies (input)
+ * @param cumulativeScaleIndex      Index of scaleBuffer containing accumulated factors to
+ *                                   apply, or BEAGLE_OP_NONE (input)
+ * @param minEdgeLength             Smallest edge length to consider (input)
+ * @param maxEdgeLength             Largest edge length to consider (input)
+ * @param tolerance                 Stop once a step changes the edge length by at most this
+ *                                   much (input)
+ * @param maxIterations             Maximum number of iterations (input)
+ * @param inOutEdgeLength           Starting edge length, replaced by the optimum (input/output)
+ * @param outLogLikelihood          Destination for the log likelihood at the optimum (output)
+ * @param outFirstDerivative        Destination for the first derivative at the optimum, or
+ *                                   NULL (output)
+ * @param outSecondDerivative       Destination for the second derivative at the optimum, or
+ *                                   NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleOptimizeEdgeLength(int instance,
+                                              int parentBufferIndex,
+                                              int childBufferIndex,
+                                              int eigenIndex,
+                                              int categoryWeightsIndex,
+                                              int stateFrequenciesIndex,
+                                              int cumulativeScaleIndex,
+                                              double minEdgeLength,
+                                              double maxEdgeLength,
+                                              double tolerance,
+                                              int maxIterations,
+                                              double* inOutEdgeLength,
+                                              double* outLogLikelihood,
+                                              double* outFirstDerivative,
+                                              double* outSecondDerivative);
+
 /**
  * @brief Get site log likelihoods for last beagleCalculateRootLogLikelihoods or
  *         beagleCalculateEdgeLogLikelihoods call